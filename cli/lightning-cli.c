@@ -6,9 +6,11 @@
 #include <ccan/asort/asort.h>
 #include <ccan/err/err.h>
 #include <ccan/json_escape/json_escape.h>
+#include <ccan/mem/mem.h>
 #include <ccan/opt/opt.h>
 #include <ccan/read_write_all/read_write_all.h>
 #include <ccan/str/str.h>
+#include <ccan/tal/grab_file/grab_file.h>
 #include <ccan/tal/str/str.h>
 #include <common/configdir.h>
 #include <common/json.h>
@@ -270,6 +272,119 @@ static void add_input(char **cmd, const char *input,
 		tal_append_fmt(cmd, ", ");
 }
 
+/* Turns a command and its params into a JSON-RPC request. */
+static char *request(const tal_t *ctx, const char *idstr,
+		     const char *method, char **params, size_t num_params,
+		     enum input input)
+{
+	char *cmd = tal_fmt(ctx,
+		      "{ \"jsonrpc\" : \"2.0\", \"method\" : \"%s\", \"id\" : \"%s\", \"params\" :",
+		      json_escape(ctx, method)->s, idstr);
+
+	if (input == DEFAULT_INPUT) {
+		/* Hacky autodetect; only matters if more than single arg */
+		if (num_params > 0 && strchr(params[0], '='))
+			input = KEYWORDS;
+		else
+			input = ORDERED;
+	}
+
+	if (input == KEYWORDS) {
+		tal_append_fmt(&cmd, "{ ");
+		for (size_t i = 0; i < num_params; i++) {
+			const char *eq = strchr(params[i], '=');
+
+			if (!eq)
+				err(ERROR_USAGE, "Expected key=value in '%s'",
+				    params[i]);
+
+			tal_append_fmt(&cmd, "\"%.*s\" : ",
+				       (int)(eq - params[i]), params[i]);
+
+			add_input(&cmd, eq + 1, i, num_params);
+		}
+		tal_append_fmt(&cmd, "} }");
+	} else {
+		tal_append_fmt(&cmd, "[ ");
+		for (size_t i = 0; i < num_params; i++)
+			add_input(&cmd, params[i], i, num_params);
+		tal_append_fmt(&cmd, "] }");
+	}
+	return cmd;
+}
+
+/* Splits a line of --batch input into words at whitespace, except inside
+ * a "string", [array] or {object}, so JSON params can contain spaces. */
+static char **split_words(const tal_t *ctx, const char *line)
+{
+	char **words = tal_arr(ctx, char *, 0);
+	const char *start = NULL;
+	bool quoted = false;
+	size_t depth = 0;
+
+	for (const char *p = line;; p++) {
+		if (*p == '\0' || (cisspace(*p) && !quoted && depth == 0)) {
+			if (start)
+				tal_arr_expand(&words,
+					       tal_strndup(words, start,
+							   p - start));
+			start = NULL;
+			if (*p == '\0')
+				return words;
+			continue;
+		}
+
+		if (!start)
+			start = p;
+		if (quoted) {
+			if (*p == '\\' && p[1])
+				p++;
+			else if (*p == '"')
+				quoted = false;
+		} else if (*p == '"')
+			quoted = true;
+		else if (*p == '[' || *p == '{')
+			depth++;
+		else if ((*p == ']' || *p == '}') && depth)
+			depth--;
+	}
+}
+
+/* --batch: each line of input is a command and its params, and they're all
+ * sent in one JSON-RPC batch request. */
+static char *batch_request(const tal_t *ctx, const char *idstr,
+			   enum input input, size_t *num)
+{
+	char *in = grab_fd(ctx, STDIN_FILENO), **lines, *cmd;
+
+	if (!in)
+		err(ERROR_USAGE, "Reading standard input");
+
+	lines = tal_strsplit(in, in, "\n", STR_NO_EMPTY);
+	cmd = tal_strdup(ctx, "[ ");
+	*num = 0;
+	for (size_t i = 0; lines[i]; i++) {
+		char **words = split_words(lines, lines[i]);
+
+		if (tal_count(words) == 0)
+			continue;
+		if (*num)
+			tal_append_fmt(&cmd, ", ");
+		tal_append_fmt(&cmd, "%s",
+			       request(lines,
+				       tal_fmt(lines, "%s-%zu", idstr, *num),
+				       words[0], words + 1,
+				       tal_count(words) - 1, input));
+		(*num)++;
+	}
+	tal_free(in);
+
+	if (*num == 0)
+		errx(ERROR_USAGE, "No commands on standard input");
+	tal_append_fmt(&cmd, " ]");
+	return cmd;
+}
+
 static void
 try_exec_man (const char *page, char *relative_to) {
 	int status;
@@ -438,12 +553,124 @@ static enum format choose_format(const char *resp,
 	return format;
 }
 
+/* Prints the result or the error: returns false if it's an error. */
+static bool print_response(char *resp,
+			   const jsmntok_t *result,
+			   const jsmntok_t *error,
+			   enum format format)
+{
+	if (!error || json_tok_is_null(resp, error)) {
+		switch (format) {
+		case HELPLIST:
+			human_help(resp, result);
+			break;
+		case HUMAN:
+			human_readable(resp, result, '\n');
+			break;
+		case JSON:
+			print_json(resp, result, "");
+			printf("\n");
+			break;
+		case RAW:
+			printf("%.*s\n",
+			       json_tok_full_len(result),
+			       json_tok_full(resp, result));
+			break;
+		default:
+			abort();
+		}
+		return true;
+	}
+
+	if (format == RAW)
+		printf("%.*s\n",
+		       json_tok_full_len(error), json_tok_full(resp, error));
+	else {
+		print_json(resp, error, "");
+		printf("\n");
+	}
+	return false;
+}
+
+/* Is this the id we gave the n'th command in a batch? */
+static bool batch_id(const char *resp, const jsmntok_t *id,
+		     const char *idstr, size_t num, size_t *n)
+{
+	size_t len = strlen(idstr);
+	char *end;
+
+	if (id->type != JSMN_STRING
+	    || id->end - id->start < len + 2
+	    || !memeq(resp + id->start, len, idstr, len)
+	    || resp[id->start + len] != '-'
+	    || !cisdigit(resp[id->start + len + 1]))
+		return false;
+
+	*n = strtoul(resp + id->start + len + 1, &end, 10);
+	return end == resp + id->end && *n < num;
+}
+
+/* The responses to a batch come back in the order they completed: print
+ * them in the order of the commands.  Returns false if any failed. */
+static bool print_batch(const tal_t *ctx,
+			char *resp, const jsmntok_t *toks,
+			const char *idstr, size_t num, enum format format)
+{
+	const jsmntok_t **replies, *t;
+	size_t i, n;
+	bool ok = true;
+
+	/* If it didn't like the batch as a whole, we get a single error. */
+	if (toks->type == JSMN_OBJECT) {
+		const jsmntok_t *error = json_get_member(resp, toks, "error");
+		if (!error)
+			errx(ERROR_TALKING_TO_LIGHTNINGD,
+			     "Non-array response '%s'", resp);
+		return print_response(resp, NULL, error, format);
+	}
+
+	if (toks->type != JSMN_ARRAY)
+		errx(ERROR_TALKING_TO_LIGHTNINGD,
+		     "Non-array response '%s'", resp);
+
+	replies = tal_arrz(ctx, const jsmntok_t *, num);
+	json_for_each_arr(i, t, toks) {
+		const jsmntok_t *id = json_get_member(resp, t, "id");
+
+		if (!id)
+			errx(ERROR_TALKING_TO_LIGHTNINGD,
+			     "Missing 'id' in response '%s'", resp);
+		if (!batch_id(resp, id, idstr, num, &n) || replies[n])
+			errx(ERROR_TALKING_TO_LIGHTNINGD,
+			     "Incorrect 'id' in response: %.*s",
+			     json_tok_full_len(id), json_tok_full(resp, id));
+		replies[n] = t;
+	}
+
+	for (n = 0; n < num; n++) {
+		const jsmntok_t *result, *error;
+
+		if (!replies[n])
+			errx(ERROR_TALKING_TO_LIGHTNINGD,
+			     "No response to command %zu in '%s'", n + 1, resp);
+		result = json_get_member(resp, replies[n], "result");
+		error = json_get_member(resp, replies[n], "error");
+		if (!error && !result)
+			errx(ERROR_TALKING_TO_LIGHTNINGD,
+			     "Either 'result' or 'error' must be returned in response '%s'", resp);
+		if (!print_response(resp, result, error, format))
+			ok = false;
+	}
+	return ok;
+}
+
 int main(int argc, char *argv[])
 {
 	setup_locale();
 
-	int fd, i;
-	size_t off;
+	int fd;
+	size_t off, num_batch;
+	bool batch = false, ok;
 	const char *method;
 	char *cmd, *resp, *idstr;
 	struct sockaddr_un addr;
@@ -484,6 +711,9 @@ int main(int argc, char *argv[])
 			   "Use format key=value for <params>");
 	opt_register_noarg("-o|--order", opt_set_ordered, &input,
 			   "Use params in order for <params>");
+	opt_register_noarg("-b|--batch", opt_set_bool, &batch,
+			   "Read one <command> [<params>...] per line from"
+			   " standard input, and send them all at once");
 
 	opt_register_version();
 
@@ -491,7 +721,14 @@ int main(int argc, char *argv[])
 	opt_parse(&argc, argv, opt_log_stderr_exit);
 
 	method = argv[1];
-	if (!method) {
+	if (batch) {
+		if (method)
+			errx(ERROR_USAGE,
+			     "With --batch, commands come from standard input");
+		/* Hints (like help's) are per-command: just use JSON. */
+		if (format == DEFAULT_FORMAT)
+			format = JSON;
+	} else if (!method) {
 		char *usage = opt_usage(argv[0], NULL);
 		printf("%s\n", usage);
 		tal_free(usage);
@@ -501,7 +738,8 @@ int main(int argc, char *argv[])
 
 	/* Launch a manpage if we have a help command with an argument. We do
 	 * not need to have lightningd running in this case. */
-	if (streq(method, "help") && format == DEFAULT_FORMAT && argc >= 3) {
+	if (!batch && streq(method, "help") && format == DEFAULT_FORMAT
+	    && argc >= 3) {
 		command = argv[2];
 		char *page = tal_fmt(ctx, "lightning-%s", command);
 
@@ -530,39 +768,10 @@ int main(int argc, char *argv[])
 		    "Connecting to '%s'", rpc_filename);
 
 	idstr = tal_fmt(ctx, "lightning-cli-%i", getpid());
-	cmd = tal_fmt(ctx,
-		      "{ \"jsonrpc\" : \"2.0\", \"method\" : \"%s\", \"id\" : \"%s\", \"params\" :",
-		      json_escape(ctx, method)->s, idstr);
-
-	if (input == DEFAULT_INPUT) {
-		/* Hacky autodetect; only matters if more than single arg */
-		if (argc > 2 && strchr(argv[2], '='))
-			input = KEYWORDS;
-		else
-			input = ORDERED;
-	}
-
-	if (input == KEYWORDS) {
-		tal_append_fmt(&cmd, "{ ");
-		for (i = 2; i < argc; i++) {
-			const char *eq = strchr(argv[i], '=');
-
-			if (!eq)
-				err(ERROR_USAGE, "Expected key=value in '%s'",
-				    argv[i]);
-
-			tal_append_fmt(&cmd, "\"%.*s\" : ",
-				       (int)(eq - argv[i]), argv[i]);
-
-			add_input(&cmd, eq + 1, i, argc);
-		}
-		tal_append_fmt(&cmd, "} }");
-	} else {
-		tal_append_fmt(&cmd, "[ ");
-		for (i = 2; i < argc; i++)
-			add_input(&cmd, argv[i], i, argc);
-		tal_append_fmt(&cmd, "] }");
-	}
+	if (batch)
+		cmd = batch_request(ctx, idstr, input, &num_batch);
+	else
+		cmd = request(ctx, idstr, method, argv + 2, argc - 2, input);
 
 	if (!write_all(fd, cmd, strlen(cmd)))
 		err(ERROR_TALKING_TO_LIGHTNINGD, "Writing command");
@@ -611,6 +820,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (batch) {
+		ok = print_batch(ctx, resp, toks, idstr, num_batch, format);
+		goto out;
+	}
+
 	if (toks->type != JSMN_OBJECT)
 		errx(ERROR_TALKING_TO_LIGHTNINGD,
 		     "Non-object response '%s'", resp);
@@ -631,43 +845,12 @@ int main(int argc, char *argv[])
 		     "Incorrect 'id' in response: %.*s",
 		     json_tok_full_len(id), json_tok_full(resp, id));
 
-	if (!error || json_tok_is_null(resp, error)) {
-		switch (format) {
-		case HELPLIST:
-			human_help(resp, result);
-			break;
-		case HUMAN:
-			human_readable(resp, result, '\n');
-			break;
-		case JSON:
-			print_json(resp, result, "");
-			printf("\n");
-			break;
-		case RAW:
-			printf("%.*s\n",
-			       json_tok_full_len(result),
-			       json_tok_full(resp, result));
-			break;
-		default:
-			abort();
-		}
-		tal_free(lightning_dir);
-		tal_free(rpc_filename);
-		tal_free(ctx);
-		opt_free_table();
-		return 0;
-	}
+	ok = print_response(resp, result, error, format);
 
-	if (format == RAW)
-		printf("%.*s\n",
-		       json_tok_full_len(error), json_tok_full(resp, error));
-	else {
-		print_json(resp, error, "");
-		printf("\n");
-	}
+out:
 	tal_free(lightning_dir);
 	tal_free(rpc_filename);
 	tal_free(ctx);
 	opt_free_table();
-	return 1;
+	return ok ? 0 : 1;
 }
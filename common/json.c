@@ -5,6 +5,7 @@
 #include <ccan/build_assert/build_assert.h>
 #include <ccan/mem/mem.h>
 #include <ccan/str/hex/hex.h>
+#include <ccan/str/str.h>
 #include <ccan/tal/str/str.h>
 #include <common/utils.h>
 #include <errno.h>
@@ -256,6 +257,144 @@ again:
 	return toks;
 }
 
+/* jsmn can resume, but every call ends by looking back over all the tokens
+ * so far, so feeding it a large value as it trickles in is quadratic.
+ * Instead we find where each value ends (which only means tracking strings
+ * and nesting), and tokenize each once it's all there. */
+struct json_incremental {
+	/* We're finished with input before consumed, and have looked
+	 * through it as far as scanned. */
+	size_t consumed, scanned;
+	/* Have we started on a value (at consumed)?  If so, how deeply
+	 * nested, and are we in a string (just after a backslash)? */
+	bool in_value, in_string, escaped;
+	int depth;
+	bool invalid;
+};
+
+struct json_incremental *new_json_incremental(const tal_t *ctx)
+{
+	struct json_incremental *ji = tal(ctx, struct json_incremental);
+
+	ji->consumed = ji->scanned = 0;
+	ji->in_value = false;
+	ji->invalid = false;
+	return ji;
+}
+
+/* Returns true if input[ji->scanned] is the end of a value: ji->scanned is
+ * then just past it. */
+static bool json_value_ends(struct json_incremental *ji, char c)
+{
+	if (!ji->in_value) {
+		if (cisspace(c)) {
+			ji->consumed = ji->scanned + 1;
+			return false;
+		}
+		ji->in_value = true;
+		ji->in_string = ji->escaped = false;
+		ji->depth = 0;
+	}
+
+	if (ji->in_string) {
+		if (ji->escaped)
+			ji->escaped = false;
+		else if (c == '\\')
+			ji->escaped = true;
+		else if (c == '"') {
+			ji->in_string = false;
+			if (ji->depth == 0)
+				goto end;
+		}
+		return false;
+	}
+
+	switch (c) {
+	case '"':
+		ji->in_string = true;
+		return false;
+	case '{':
+	case '[':
+		ji->depth++;
+		return false;
+	case '}':
+	case ']':
+		if (ji->depth > 0) {
+			if (--ji->depth == 0)
+				goto end;
+			return false;
+		}
+		break;
+	case ',':
+		break;
+	default:
+		if (!cisspace(c))
+			return false;
+	}
+
+	/* Anything else at top level ends a primitive (and isn't part of
+	 * it); if it's not after one, jsmn will complain. */
+	if (ji->depth == 0) {
+		ji->in_value = false;
+		if (ji->scanned == ji->consumed)
+			ji->scanned++;
+		return true;
+	}
+	return false;
+
+end:
+	ji->in_value = false;
+	ji->scanned++;
+	return true;
+}
+
+jsmntok_t *json_parse_incremental(const tal_t *ctx,
+				  struct json_incremental *ji,
+				  const char *input, size_t len, bool *valid)
+{
+	jsmntok_t *toks;
+
+	while (!ji->invalid && ji->scanned < len) {
+		size_t start = ji->consumed;
+		bool ok;
+
+		if (!json_value_ends(ji, input[ji->scanned])) {
+			ji->scanned++;
+			continue;
+		}
+
+		toks = json_parse_input(ctx, input + start,
+					ji->scanned - start, &ok);
+		if (!toks) {
+			ji->invalid = true;
+			break;
+		}
+
+		/* Its offsets are from start: make them from input. */
+		for (size_t i = 0; i < tal_count(toks) - 1; i++) {
+			toks[i].start += start;
+			toks[i].end += start;
+		}
+		ji->consumed = ji->scanned;
+		*valid = true;
+		return toks;
+	}
+
+	*valid = !ji->invalid;
+	return NULL;
+}
+
+size_t json_incremental_consumed(const struct json_incremental *ji)
+{
+	return ji->consumed;
+}
+
+void json_incremental_discard(struct json_incremental *ji)
+{
+	ji->scanned -= ji->consumed;
+	ji->consumed = 0;
+}
+
 const char *jsmntype_to_string(jsmntype_t t)
 {
 	switch (t) {
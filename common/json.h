@@ -65,6 +65,23 @@ const jsmntok_t *json_get_arr(const jsmntok_t tok[], size_t index);
 jsmntok_t *json_parse_input(const tal_t *ctx,
 			    const char *input, int len, bool *valid);
 
+/* For a series of JSON values arriving in a buffer, which we want to
+ * tokenize once each, rather than every time more arrives. */
+struct json_incremental *new_json_incremental(const tal_t *ctx);
+
+/* input[0..len) is what was there last time, plus any more: returns the
+ * tokens of the next complete value (as json_parse_input would), or NULL
+ * if there isn't one yet (*valid false if there never will be). */
+jsmntok_t *json_parse_incremental(const tal_t *ctx,
+				  struct json_incremental *ji,
+				  const char *input, size_t len, bool *valid);
+
+/* How many bytes at the start of input we're finished with. */
+size_t json_incremental_consumed(const struct json_incremental *ji);
+
+/* The caller has removed those consumed bytes from the start of input. */
+void json_incremental_discard(struct json_incremental *ji);
+
 /* Convert a jsmntype_t enum to a human readable string. */
 const char *jsmntype_to_string(jsmntype_t t);
 
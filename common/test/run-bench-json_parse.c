@@ -0,0 +1,165 @@
+/* How long does it take to tokenize JSON-RPC requests as they arrive?
+ * Compares what read_json used to do (reparse the whole buffer each time
+ * more arrives, and move it down after each request) with
+ * json_parse_incremental. */
+#include "../json.c"
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <wire/wire.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_fail */
+const void *fromwire_fail(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
+{ fprintf(stderr, "fromwire_fail called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+/* One big request, like a sendpay with a long route. */
+static char *big_request(const tal_t *ctx, size_t bytes)
+{
+	char *req = tal_strdup(ctx, "{\"jsonrpc\":\"2.0\",\"id\":1,"
+			       "\"method\":\"sendpay\",\"params\":"
+			       "{\"route\":[");
+
+	for (size_t i = 0; tal_count(req) < bytes; i++)
+		tal_append_fmt(&req, "%s{\"id\":\"02%064zu\","
+			       "\"channel\":\"%zux1x0\","
+			       "\"msatoshi\":%zu,\"delay\":%zu}",
+			       i ? "," : "", i, i, 1000000 + i, 9 + i);
+	tal_append_fmt(&req, "],\"payment_hash\":\"%064u\"}}\n", 0);
+	return req;
+}
+
+/* Lots of small requests, as a script might pipeline them. */
+static char *many_requests(const tal_t *ctx, size_t num)
+{
+	char *reqs = tal_strdup(ctx, "");
+
+	for (size_t i = 0; i < num; i++)
+		tal_append_fmt(&reqs, "{\"jsonrpc\":\"2.0\",\"id\":%zu,"
+			       "\"method\":\"listpeers\",\"params\":"
+			       "{\"id\":\"02%064zu\"}}\n", i, i);
+	return reqs;
+}
+
+/* What read_json did: every time a chunk arrives, tokenize the whole
+ * buffer, and move it down after each request. */
+static size_t parse_rescan(const char *input, size_t chunk)
+{
+	size_t len = strlen(input), off = 0, used = 0, num = 0;
+	char *buf = tal_arr(tmpctx, char, 64);
+	jsmntok_t *toks;
+	bool valid;
+
+	while (off < len) {
+		size_t n = len - off < chunk ? len - off : chunk;
+
+		if (used + n > tal_count(buf))
+			tal_resize(&buf, (used + n) * 2);
+		memcpy(buf + used, input + off, n);
+		used += n;
+		off += n;
+
+		while ((toks = json_parse_input(buf, buf, used, &valid))
+		       != NULL) {
+			num++;
+			memmove(buf, buf + toks[0].end, used - toks[0].end);
+			used -= toks[0].end;
+			tal_free(toks);
+		}
+		if (!valid)
+			errx(1, "Invalid input");
+	}
+	return num;
+}
+
+/* What read_json does now. */
+static size_t parse_incremental(const char *input, size_t chunk)
+{
+	size_t len = strlen(input), off = 0, used = 0, num = 0;
+	struct json_incremental *ji = new_json_incremental(tmpctx);
+	char *buf = tal_arr(tmpctx, char, 64);
+	jsmntok_t *toks;
+	bool valid;
+
+	while (off < len) {
+		size_t n = len - off < chunk ? len - off : chunk, consumed;
+
+		if (used + n > tal_count(buf))
+			tal_resize(&buf, (used + n) * 2);
+		memcpy(buf + used, input + off, n);
+		used += n;
+		off += n;
+
+		while ((toks = json_parse_incremental(buf, ji, buf, used,
+						      &valid)) != NULL) {
+			num++;
+			tal_free(toks);
+		}
+		if (!valid)
+			errx(1, "Invalid input");
+
+		consumed = json_incremental_consumed(ji);
+		memmove(buf, buf + consumed, used - consumed);
+		used -= consumed;
+		json_incremental_discard(ji);
+	}
+	return num;
+}
+
+static u64 time_parse(size_t (*parse)(const char *, size_t),
+		      const char *input, size_t chunk, size_t expect)
+{
+	struct timemono start = time_mono();
+	size_t num = parse(input, chunk);
+
+	if (num != expect)
+		errx(1, "Parsed %zu requests, not %zu", num, expect);
+	clean_tmpctx();
+	return time_to_msec(timemono_between(time_mono(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	unsigned int big_bytes = 100000, num_small = 1000, chunk = 65536;
+	char *big, *small;
+
+	setup_tmpctx();
+	opt_register_arg("--big-bytes", opt_set_uintval, opt_show_uintval,
+			 &big_bytes, "Size of one big request");
+	opt_register_arg("--requests", opt_set_uintval, opt_show_uintval,
+			 &num_small, "Number of pipelined small requests");
+	opt_register_arg("--chunk", opt_set_uintval, opt_show_uintval,
+			 &chunk, "Bytes arriving at once");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc != 1)
+		opt_usage_exit_fail("No arguments expected");
+	if (chunk == 0)
+		errx(1, "Chunk must be non-zero");
+
+	big = big_request(NULL, big_bytes);
+	small = many_requests(NULL, num_small);
+
+	/* One name=value per line, so scripts can track them. */
+	printf("big_bytes=%zu\n", strlen(big));
+	printf("big_rescan_msec=%"PRIu64"\n",
+	       time_parse(parse_rescan, big, chunk, 1));
+	printf("big_incremental_msec=%"PRIu64"\n",
+	       time_parse(parse_incremental, big, chunk, 1));
+	printf("pipelined_bytes=%zu\n", strlen(small));
+	printf("pipelined_rescan_msec=%"PRIu64"\n",
+	       time_parse(parse_rescan, small, chunk, num_small));
+	printf("pipelined_incremental_msec=%"PRIu64"\n",
+	       time_parse(parse_incremental, small, chunk, num_small));
+
+	tal_free(big);
+	tal_free(small);
+	opt_free_table();
+	tal_free(tmpctx);
+	return 0;
+}
@@ -190,6 +190,98 @@ static void test_json_delve(void)
 	assert(json_tok_streq(buf, t, "lightning-rpc"));
 }
 
+/* Feed in input a few bytes at a time, as read_json does, and check we get
+ * the same values json_parse_input would. */
+static void test_json_parse_incremental_chunks(const char *input, size_t chunk,
+					       size_t num_values)
+{
+	struct json_incremental *ji = new_json_incremental(tmpctx);
+	char *buf = tal_arr(tmpctx, char, strlen(input));
+	size_t used = 0, off = 0, found = 0;
+	jsmntok_t *toks;
+	bool valid;
+
+	while (off < strlen(input)) {
+		size_t n = strlen(input) - off, consumed;
+		if (n > chunk)
+			n = chunk;
+		memcpy(buf + used, input + off, n);
+		used += n;
+		off += n;
+
+		while ((toks = json_parse_incremental(tmpctx, ji, buf, used,
+						      &valid)) != NULL) {
+			const jsmntok_t *expect;
+			size_t len = json_next(toks) - toks;
+			/* A string token starts after its opening quote. */
+			size_t start = toks[0].start
+				- (toks[0].type == JSMN_STRING);
+			bool ok;
+
+			expect = json_parse_input(tmpctx, buf + start,
+						  used - start, &ok);
+			assert(ok && expect);
+			assert(json_next(expect) - expect == len);
+			for (size_t i = 0; i < len; i++) {
+				assert(toks[i].type == expect[i].type);
+				assert(toks[i].size == expect[i].size);
+				assert(toks[i].end - toks[i].start
+				       == expect[i].end - expect[i].start);
+			}
+			/* It's always referenceable. */
+			assert(toks[len].type == -1);
+			found++;
+		}
+		assert(valid);
+
+		/* Throw away what we've finished with. */
+		consumed = json_incremental_consumed(ji);
+		assert(consumed <= used);
+		memmove(buf, buf + consumed, used - consumed);
+		used -= consumed;
+		json_incremental_discard(ji);
+	}
+	assert(found == num_values);
+	/* Even the trailing whitespace. */
+	assert(used == 0);
+}
+
+static void test_json_parse_incremental(void)
+{
+	const char *input = " {\"id\": 1, \"method\": \"getinfo\", \"params\": []}\n"
+		"{\"id\":\"x\\\"y\",\"method\":\"pay\",\"params\":{\"route\":[{\"a\":true,\"b\":12345},[null,-1.5]]}}"
+		"  [1,2,\"three\"] \"str\" \n\n";
+	struct json_incremental *ji;
+	jsmntok_t *toks;
+	bool valid;
+	const char *buf;
+	unsigned int num;
+
+	for (size_t chunk = 1; chunk < strlen(input) + 1; chunk++)
+		test_json_parse_incremental_chunks(input, chunk, 4);
+
+	/* A number isn't finished until something follows it. */
+	ji = new_json_incremental(tmpctx);
+	buf = "[12";
+	assert(!json_parse_incremental(tmpctx, ji, buf, strlen(buf), &valid));
+	assert(valid);
+	buf = "[123]";
+	toks = json_parse_incremental(tmpctx, ji, buf, strlen(buf), &valid);
+	assert(toks && valid);
+	assert(toks[0].size == 1);
+	assert(json_to_number(buf, &toks[1], &num) && num == 123);
+	assert(json_incremental_consumed(ji) == strlen(buf));
+
+	/* What came before garbage is still fine. */
+	ji = new_json_incremental(tmpctx);
+	buf = "{\"a\":1} }";
+	toks = json_parse_incremental(tmpctx, ji, buf, strlen(buf), &valid);
+	assert(toks && valid);
+	assert(toks[0].type == JSMN_OBJECT);
+	assert(!json_parse_incremental(tmpctx, ji, buf, strlen(buf), &valid));
+	assert(!valid);
+}
+
 int main(void)
 {
 	setup_locale();
@@ -198,6 +290,7 @@ int main(void)
 	test_json_tok_size();
 	test_json_tok_bitcoin_amount();
 	test_json_delve();
+	test_json_parse_incremental();
 	assert(!taken_any());
 	take_cleanup();
 	tal_free(tmpctx);
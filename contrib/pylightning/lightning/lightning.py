@@ -608,6 +608,55 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("getroute", payload)
 
+    def getroutes(self, node_id, msatoshi, riskfactor, cltv=9, fromid=None, fuzzpercent=None, exclude=[], maxhops=20, maxroutes=3):
+        """
+        Like getroute, but show up to {maxroutes} routes, cheapest first:
+        each avoids the channels used by those before it.
+        """
+        payload = {
+            "id": node_id,
+            "msatoshi": msatoshi,
+            "riskfactor": riskfactor,
+            "cltv": cltv,
+            "fromid": fromid,
+            "fuzzpercent": fuzzpercent,
+            "exclude": exclude,
+            "maxhops": maxhops,
+            "maxroutes": maxroutes
+        }
+        return self.call("getroutes", payload)
+
+    def getroutetree(self, msatoshi, riskfactor, cltv=9, ids=None, maxhops=20):
+        """
+        Show what the cheapest routes from this node cost to deliver
+        {msatoshi} to each of {ids} (or every node we can reach), using
+        {riskfactor}, optional {cltv} (default 9) and {maxhops}.
+        """
+        payload = {
+            "msatoshi": msatoshi,
+            "riskfactor": riskfactor,
+            "cltv": cltv,
+            "ids": ids,
+            "maxhops": maxhops
+        }
+        return self.call("getroutetree", payload)
+
+    def getroutestats(self):
+        """
+        Show how busy gossipd's route-finding threads are.
+        """
+        return self.call("getroutestats")
+
+    def getrpcstats(self, command=None):
+        """
+        Show call counts, errors and latencies of JSON-RPC commands, or
+        just {command} if supplied.
+        """
+        payload = {
+            "command": command,
+        }
+        return self.call("getrpcstats", payload)
+
     def help(self, command=None):
         """
         Show available commands, or just {command} if supplied.
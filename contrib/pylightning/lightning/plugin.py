@@ -37,6 +37,7 @@ class Method(object):
         self.mtype = mtype
         self.category = category
         self.background = False
+        self.observer = False
         self.desc = desc
         self.long_desc = long_desc
 
@@ -257,8 +258,12 @@ class Plugin(object):
             return f
         return decorator
 
-    def add_hook(self, name, func, background=False):
+    def add_hook(self, name, func, background=False, observer=False):
         """Register a hook that is called synchronously by lightningd on events
+
+        An observer (only allowed for hooks which several plugins can
+        register for, like `htlc_accepted`) sees each call, but its result
+        is ignored, and lightningd doesn't wait for it.
         """
         if name in self.methods:
             raise ValueError(
@@ -279,15 +284,16 @@ class Plugin(object):
 
         method = Method(name, func, MethodType.HOOK)
         method.background = background
+        method.observer = observer
         self.methods[name] = method
 
-    def hook(self, method_name):
+    def hook(self, method_name, observer=False):
         """Decorator to add a plugin hook to the dispatch table.
 
         Internally uses add_hook.
         """
         def decorator(f):
-            self.add_hook(method_name, f, background=False)
+            self.add_hook(method_name, f, background=False, observer=observer)
             return f
         return decorator
 
@@ -482,7 +488,10 @@ class Plugin(object):
                 continue
 
             if method.mtype == MethodType.HOOK:
-                hooks.append(method.name)
+                if method.observer:
+                    hooks.append({'name': method.name, 'observer': True})
+                else:
+                    hooks.append(method.name)
                 continue
 
             doc = inspect.getdoc(method.func)
@@ -14,7 +14,10 @@
 #include <gossipd/gen_gossip_peerd_wire.h>
 #include <gossipd/gen_gossip_store.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <wire/gen_peer_wire.h>
@@ -48,6 +51,9 @@ struct gossip_store {
 	/* Disable compaction if we encounter an error during a prior
 	 * compaction */
 	bool disable_compaction;
+
+	/* Non-NULL while we're compacting. */
+	struct compaction *compaction;
 };
 
 static void gossip_store_destroy(struct gossip_store *gs)
@@ -173,6 +179,7 @@ struct gossip_store *gossip_store_new(struct routing_state *rstate,
 			      strerror(errno));
 	gs->rstate = rstate;
 	gs->disable_compaction = false;
+	gs->compaction = NULL;
 	gs->len = sizeof(gs->version);
 	gs->peers = peers;
 
@@ -301,117 +308,123 @@ static void destroy_offmap(struct offmap *offmap)
 	offmap_clear(offmap);
 }
 
-/**
- * Rewrite the on-disk gossip store, compacting it along the way
- *
- * Creates a new file, writes all the updates from the `broadcast_state`, and
- * then atomically swaps the files.
- */
-bool gossip_store_compact(struct gossip_store *gs)
-{
-	size_t count = 0, deleted = 0;
+/*~ Rewriting a large store takes a while, so we do it a slice at a time,
+ * letting gossipd get on with other things in between.  Meanwhile the old
+ * store is still the real one: we keep appending to it, and peers keep
+ * reading it.  We copy those new records too, and anything deleted after
+ * we copied it gets deleted in the new store as well; once we've caught up
+ * with the end, we swap the new one into place. */
+struct compaction {
+	/* The new store. */
 	int fd;
-	u64 off, len = sizeof(gs->version), idx;
+	/* How far through the old store we are, and the new store's length */
+	u64 from, len;
+	/* Records in the new store (including deleted, as ever), how many of
+	 * those we've deleted since, and how many deleted records in the old
+	 * store we skipped. */
+	size_t count, deleted, skipped;
+	/* Where each record we copied went. */
 	struct offmap *offmap;
-	struct gossip_hdr hdr;
-	struct offmap_iter oit;
-	struct node_map_iter nit;
-	struct offset_map *omap;
+};
+
+static void destroy_compaction(struct compaction *c)
+{
+	close(c->fd);
+	unlink(GOSSIP_STORE_TEMP_FILENAME);
+}
+
+static void abandon_compaction(struct gossip_store *gs)
+{
+	status_trace("Encountered an error while compacting, disabling "
+		     "future compactions.");
+	gs->compaction = tal_free(gs->compaction);
+	gs->disable_compaction = true;
+}
+
+bool gossip_store_compact_start(struct gossip_store *gs)
+{
+	struct compaction *c;
+	int fd;
 
 	if (gs->disable_compaction)
 		return false;
+	if (gs->compaction)
+		return true;
 
 	status_trace(
 	    "Compacting gossip_store with %zu entries, %zu of which are stale",
 	    gs->count, gs->deleted);
 
 	fd = open(GOSSIP_STORE_TEMP_FILENAME, O_RDWR|O_TRUNC|O_CREAT, 0600);
-
 	if (fd < 0) {
 		status_broken(
 		    "Could not open file for gossip_store compaction");
-		goto disable;
+		gs->disable_compaction = true;
+		return false;
 	}
 
+	c = gs->compaction = tal(gs, struct compaction);
+	c->fd = fd;
+	tal_add_destructor(c, destroy_compaction);
+
 	if (write(fd, &gs->version, sizeof(gs->version))
 	    != sizeof(gs->version)) {
 		status_broken("Writing version to store: %s", strerror(errno));
-		goto unlink_disable;
+		abandon_compaction(gs);
+		return false;
 	}
 
-	/* Walk old file, copy everything and remember new offsets. */
-	offmap = tal(tmpctx, struct offmap);
-	offmap_init_sized(offmap, gs->count);
-	tal_add_destructor(offmap, destroy_offmap);
-
-	/* Start by writing all channel announcements and updates. */
-	off = 1;
-	while (pread(gs->fd, &hdr, sizeof(hdr), off) == sizeof(hdr)) {
-		u32 msglen, wlen;
-		int msgtype;
-
-		msglen = (be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT);
-		if (be32_to_cpu(hdr.len) & GOSSIP_STORE_LEN_DELETED_BIT) {
-			off += sizeof(hdr) + msglen;
-			deleted++;
-			continue;
-		}
-
-		count++;
-		wlen = transfer_store_msg(gs->fd, off, fd, len, &msgtype);
-		if (wlen == 0)
-			goto unlink_disable;
+	c->from = c->len = sizeof(gs->version);
+	c->count = c->deleted = c->skipped = 0;
+	c->offmap = tal(c, struct offmap);
+	offmap_init_sized(c->offmap, gs->count - gs->deleted);
+	tal_add_destructor(c->offmap, destroy_offmap);
+	return true;
+}
 
-		/* We track location of all these message types. */
-		if (msgtype == WIRE_GOSSIPD_LOCAL_ADD_CHANNEL
-		    || msgtype == WIRE_GOSSIP_STORE_PRIVATE_UPDATE
-		    || msgtype == WIRE_CHANNEL_ANNOUNCEMENT
-		    || msgtype == WIRE_CHANNEL_UPDATE
-		    || msgtype == WIRE_NODE_ANNOUNCEMENT) {
-			omap = tal(offmap, struct offset_map);
-			omap->from = off;
-			omap->to = len;
-			offmap_add(offmap, omap);
-		}
-		len += wlen;
-		off += wlen;
-	}
+/* All copied: point everything at the new store and swap it in. */
+static void finish_compaction(struct gossip_store *gs)
+{
+	struct compaction *c = gs->compaction;
+	struct offmap_iter oit;
+	struct node_map_iter nit;
+	struct offset_map *omap;
+	u64 idx, shrink;
 
-	/* OK, now we've written file successfully, we can move broadcasts. */
 	/* Remap node announcements. */
 	for (struct node *n = node_map_first(gs->rstate->nodes, &nit);
 	     n;
 	     n = node_map_next(gs->rstate->nodes, &nit)) {
-		move_broadcast(offmap, &n->bcast, "node_announce");
+		move_broadcast(c->offmap, &n->bcast, "node_announce");
 	}
 
 	/* Remap channel announcements and updates */
-	for (struct chan *c = uintmap_first(&gs->rstate->chanmap, &idx);
-	     c;
-	     c = uintmap_after(&gs->rstate->chanmap, &idx)) {
-		move_broadcast(offmap, &c->bcast, "channel_announce");
-		move_broadcast(offmap, &c->half[0].bcast, "channel_update");
-		move_broadcast(offmap, &c->half[1].bcast, "channel_update");
+	for (struct chan *chan = uintmap_first(&gs->rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&gs->rstate->chanmap, &idx)) {
+		move_broadcast(c->offmap, &chan->bcast, "channel_announce");
+		move_broadcast(c->offmap, &chan->half[0].bcast, "channel_update");
+		move_broadcast(c->offmap, &chan->half[1].bcast, "channel_update");
 	}
 
 	/* That should be everything. */
-	omap = offmap_first(offmap, &oit);
+	omap = offmap_first(c->offmap, &oit);
 	if (omap)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "gossip_store: Entry at %zu->%zu not updated?",
 			      omap->from, omap->to);
 
-	if (count != gs->count - gs->deleted)
+	if (c->count - c->deleted != gs->count - gs->deleted)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "gossip_store: Expected %zu msgs in new"
 			      " gossip store, got %zu",
-			      gs->count - gs->deleted, count);
+			      gs->count - gs->deleted, c->count - c->deleted);
 
-	if (deleted != gs->deleted)
+	if (c->skipped + c->deleted != gs->deleted)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "gossip_store: Expected %zu deleted msgs in old"
 			      " gossip store, got %zu",
-			      gs->deleted, deleted);
+			      gs->deleted, c->skipped + c->deleted);
 
 	if (rename(GOSSIP_STORE_TEMP_FILENAME, GOSSIP_STORE_FILENAME) == -1)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
@@ -421,26 +434,137 @@ bool gossip_store_compact(struct gossip_store *gs)
 
 	status_trace(
 	    "Compaction completed: dropped %zu messages, new count %zu, len %"PRIu64,
-	    deleted, count, len);
-	gs->count = count;
-	gs->deleted = 0;
-	off = gs->len - len;
-	gs->len = len;
+	    c->skipped, c->count, c->len);
+	gs->count = c->count;
+	gs->deleted = c->deleted;
+	shrink = gs->len - c->len;
+	gs->len = c->len;
 	close(gs->fd);
-	gs->fd = fd;
+	gs->fd = c->fd;
 
-	update_peers_broadcast_index(gs->peers, off);
-	return true;
+	/* It's in place now: don't close or unlink it! */
+	tal_del_destructor(c, destroy_compaction);
+	gs->compaction = tal_free(c);
 
-unlink_disable:
-	unlink(GOSSIP_STORE_TEMP_FILENAME);
-disable:
-	status_trace("Encountered an error while compacting, disabling "
-		     "future compactions.");
-	gs->disable_compaction = true;
+	update_peers_broadcast_index(gs->peers, shrink);
+}
+
+bool gossip_store_compact_step(struct gossip_store *gs, size_t max_bytes,
+			       bool *ok)
+{
+	struct compaction *c = gs->compaction;
+	struct gossip_hdr hdr;
+	u64 stop;
+
+	if (!c) {
+		*ok = false;
+		return false;
+	}
+
+	stop = c->from + max_bytes;
+	while (c->from < gs->len && c->from < stop) {
+		u32 msglen, wlen;
+		int msgtype;
+		struct offset_map *omap;
+
+		if (pread(gs->fd, &hdr, sizeof(hdr), c->from) != sizeof(hdr)) {
+			status_broken("Failed reading header from gossip store"
+				      " @%"PRIu64": %s",
+				      c->from, strerror(errno));
+			abandon_compaction(gs);
+			*ok = false;
+			return false;
+		}
+
+		msglen = (be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT);
+		if (be32_to_cpu(hdr.len) & GOSSIP_STORE_LEN_DELETED_BIT) {
+			c->from += sizeof(hdr) + msglen;
+			c->skipped++;
+			continue;
+		}
+
+		c->count++;
+		wlen = transfer_store_msg(gs->fd, c->from, c->fd, c->len,
+					  &msgtype);
+		if (wlen == 0) {
+			abandon_compaction(gs);
+			*ok = false;
+			return false;
+		}
+
+		/* We track location of all these message types. */
+		if (msgtype == WIRE_GOSSIPD_LOCAL_ADD_CHANNEL
+		    || msgtype == WIRE_GOSSIP_STORE_PRIVATE_UPDATE
+		    || msgtype == WIRE_CHANNEL_ANNOUNCEMENT
+		    || msgtype == WIRE_CHANNEL_UPDATE
+		    || msgtype == WIRE_NODE_ANNOUNCEMENT) {
+			omap = tal(c->offmap, struct offset_map);
+			omap->from = c->from;
+			omap->to = c->len;
+			offmap_add(c->offmap, omap);
+		}
+		c->len += wlen;
+		c->from += wlen;
+	}
+
+	/* More to do? */
+	if (c->from < gs->len)
+		return true;
+
+	finish_compaction(gs);
+	*ok = true;
 	return false;
 }
 
+/* Sets the deleted bit on the record at @index: returns the index of the
+ * following record. */
+static u64 mark_deleted(int fd, u64 index)
+{
+	beint32_t belen;
+
+	if (pread(fd, &belen, sizeof(belen), index) != sizeof(belen))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Failed reading len to delete @%"PRIu64": %s",
+			      index, strerror(errno));
+
+	assert((be32_to_cpu(belen) & GOSSIP_STORE_LEN_DELETED_BIT) == 0);
+	belen |= cpu_to_be32(GOSSIP_STORE_LEN_DELETED_BIT);
+	if (pwrite(fd, &belen, sizeof(belen), index) != sizeof(belen))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Failed writing len to delete @%"PRIu64": %s",
+			      index, strerror(errno));
+
+	return index + sizeof(struct gossip_hdr)
+		+ (be32_to_cpu(belen) & ~GOSSIP_STORE_LEN_DELETED_BIT);
+}
+
+/* If we've already copied the record at @index into the new store, delete
+ * it there too (along with its amount, for a channel_announcement). */
+static void compaction_delete(struct compaction *c, u64 index, int type)
+{
+	struct offset_map *omap;
+	u64 next;
+
+	if (index >= c->from)
+		return;
+
+	omap = offmap_get(c->offmap, index);
+	if (!omap)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "gossip_store: deleting uncopied %"PRIu64
+			      " during compaction", index);
+	next = mark_deleted(c->fd, omap->to);
+	c->deleted++;
+	offmap_del(c->offmap, omap);
+	tal_free(omap);
+
+	/* The amount follows it in both stores; we may not have got to it. */
+	if (type == WIRE_CHANNEL_ANNOUNCEMENT && next < c->len) {
+		mark_deleted(c->fd, next);
+		c->deleted++;
+	}
+}
+
 u64 gossip_store_add(struct gossip_store *gs, const u8 *gossip_msg,
 		     u32 timestamp,
 		     const u8 *addendum)
@@ -478,8 +602,6 @@ u64 gossip_store_add_private_update(struct gossip_store *gs, const u8 *update)
 /* Returns index of following entry. */
 static u32 delete_by_index(struct gossip_store *gs, u32 index, int type)
 {
-	beint32_t belen;
-
 	/* Should never get here during loading! */
 	assert(gs->writable);
 
@@ -488,21 +610,8 @@ static u32 delete_by_index(struct gossip_store *gs, u32 index, int type)
 	assert(fromwire_peektype(msg) == type);
 #endif
 
-	if (pread(gs->fd, &belen, sizeof(belen), index) != sizeof(belen))
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Failed reading len to delete @%u: %s",
-			      index, strerror(errno));
-
-	assert((be32_to_cpu(belen) & GOSSIP_STORE_LEN_DELETED_BIT) == 0);
-	belen |= cpu_to_be32(GOSSIP_STORE_LEN_DELETED_BIT);
-	if (pwrite(gs->fd, &belen, sizeof(belen), index) != sizeof(belen))
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Failed writing len to delete @%u: %s",
-			      index, strerror(errno));
 	gs->deleted++;
-
-	return index + sizeof(struct gossip_hdr)
-		+ (be32_to_cpu(belen) & ~GOSSIP_STORE_LEN_DELETED_BIT);
+	return mark_deleted(gs->fd, index);
 }
 
 void gossip_store_delete(struct gossip_store *gs,
@@ -515,6 +624,8 @@ void gossip_store_delete(struct gossip_store *gs,
 		return;
 
 	next_index = delete_by_index(gs, bcast->index, type);
+	if (gs->compaction)
+		compaction_delete(gs->compaction, bcast->index, type);
 
 	/* Reset index. */
 	bcast->index = 0;
@@ -592,10 +703,169 @@ int gossip_store_readonly_fd(struct gossip_store *gs)
 	return fd;
 }
 
+/*~ Loading the store is the bulk of gossipd's startup time on a large
+ * network, so we map the whole file rather than reading each record,
+ * and check the checksums on all our cores before we start adding things
+ * to the routing state (which has to happen in order, and on this
+ * thread). */
+#define GOSSIP_STORE_LOAD_MAX_THREADS 8
+/* Below this, starting threads isn't worth it. */
+#define GOSSIP_STORE_LOAD_MIN_PARALLEL (1024 * 1024)
+
+/* The store, in memory. */
+struct store_map {
+	const u8 *p;
+	u64 len;
+	/* If we couldn't mmap it, we read it into p instead. */
+	bool mapped;
+};
+
+static bool map_store(int fd, struct store_map *map)
+{
+	struct stat st;
+	void *p;
+
+	if (fstat(fd, &st) != 0)
+		return false;
+	map->len = st.st_size;
+	/* Can't map an empty file, and don't need to. */
+	if (map->len == 0) {
+		map->p = NULL;
+		map->mapped = false;
+		return true;
+	}
+
+	p = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED) {
+		/* We read it once, from front to back. */
+		madvise(p, map->len, MADV_SEQUENTIAL);
+		map->p = p;
+		map->mapped = true;
+		return true;
+	}
+
+	status_unusual("gossip_store: mmap failed (%s), reading instead",
+		       strerror(errno));
+	/* Not tmpctx: we clean that as we go. */
+	map->p = tal_arr(NULL, u8, map->len);
+	map->mapped = false;
+	if (pread(fd, (u8 *)map->p, map->len, 0) != map->len)
+		return false;
+	return true;
+}
+
+static void unmap_store(struct store_map *map)
+{
+	if (map->mapped)
+		munmap((void *)map->p, map->len);
+	else
+		tal_free(map->p);
+}
+
+/* Header of the record at @off, if the whole header is there. */
+static bool store_hdr(const struct store_map *map, u64 off,
+		      struct gossip_hdr *hdr)
+{
+	if (off > map->len || map->len - off < sizeof(*hdr))
+		return false;
+	memcpy(hdr, map->p + off, sizeof(*hdr));
+	return true;
+}
+
+static u32 store_msglen(const struct gossip_hdr *hdr)
+{
+	return be32_to_cpu(hdr->len) & ~GOSSIP_STORE_LEN_DELETED_BIT;
+}
+
+/* The records in [start, end), checked by one thread. */
+struct crc_chunk {
+	const struct store_map *map;
+	u64 start, end;
+	/* The first one which fails its checksum, or end. */
+	u64 bad;
+};
+
+/* This runs on other threads: no allocation or logging! */
+static void *check_crcs(void *arg)
+{
+	struct crc_chunk *chunk = arg;
+	const struct store_map *map = chunk->map;
+	struct gossip_hdr hdr;
+	u64 off;
+
+	for (off = chunk->start; off < chunk->end;
+	     off += sizeof(hdr) + store_msglen(&hdr)) {
+		store_hdr(map, off, &hdr);
+		if (be32_to_cpu(hdr.crc)
+		    != crc32c(be32_to_cpu(hdr.timestamp),
+			      map->p + off + sizeof(hdr),
+			      store_msglen(&hdr)))
+			break;
+	}
+	chunk->bad = off;
+	return NULL;
+}
+
+/* Find where the whole records end (*end), and the first which fails its
+ * checksum (or *end if none do). */
+static u64 first_bad_crc(const struct store_map *map, u64 start, u64 *end)
+{
+	struct crc_chunk chunks[GOSSIP_STORE_LOAD_MAX_THREADS];
+	pthread_t threads[GOSSIP_STORE_LOAD_MAX_THREADS];
+	bool started[GOSSIP_STORE_LOAD_MAX_THREADS];
+	size_t num_chunks = 1;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	struct gossip_hdr hdr;
+	u64 off, chunk_len;
+
+	if (map->len >= GOSSIP_STORE_LOAD_MIN_PARALLEL && cores > 1)
+		num_chunks = cores < GOSSIP_STORE_LOAD_MAX_THREADS
+			? cores : GOSSIP_STORE_LOAD_MAX_THREADS;
+
+	/* Headers are cheap: split where records start, by size. */
+	chunk_len = (map->len - start) / num_chunks + 1;
+	chunks[0].start = start;
+	num_chunks = 1;
+	for (off = start; store_hdr(map, off, &hdr); ) {
+		u64 next = off + sizeof(hdr) + store_msglen(&hdr);
+		/* Truncated? */
+		if (next > map->len)
+			break;
+		if (off - chunks[num_chunks-1].start >= chunk_len
+		    && num_chunks < ARRAY_SIZE(chunks)) {
+			chunks[num_chunks-1].end = off;
+			chunks[num_chunks++].start = off;
+		}
+		off = next;
+	}
+	chunks[num_chunks-1].end = *end = off;
+
+	for (size_t i = 0; i < num_chunks; i++) {
+		chunks[i].map = map;
+		/* The first one is ours; if we can't start a thread, we
+		 * do that one too. */
+		started[i] = (i != 0
+			      && pthread_create(&threads[i], NULL,
+						check_crcs, &chunks[i]) == 0);
+	}
+	for (size_t i = 0; i < num_chunks; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			check_crcs(&chunks[i]);
+	}
+
+	for (size_t i = 0; i < num_chunks; i++) {
+		if (chunks[i].bad != chunks[i].end)
+			return chunks[i].bad;
+	}
+	return *end;
+}
+
 bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 {
 	struct gossip_hdr hdr;
-	u32 msglen, checksum;
+	u32 msglen;
 	u8 *msg;
 	struct amount_sat satoshis;
 	const char *bad;
@@ -605,19 +875,27 @@ bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 	bool contents_ok;
 	u32 last_timestamp = 0;
 	u64 chan_ann_off = 0; /* Spurious gcc-9 (Ubuntu 9-20190402-1ubuntu1) 9.0.1 20190402 (experimental) warning */
+	struct store_map map;
+	u64 end, bad_crc;
 
 	gs->writable = false;
-	while (pread(gs->fd, &hdr, sizeof(hdr), gs->len) == sizeof(hdr)) {
-		msglen = be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT;
-		checksum = be32_to_cpu(hdr.crc);
-		msg = tal_arr(tmpctx, u8, msglen);
+	if (!map_store(gs->fd, &map))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "gossip_store: can't read: %s", strerror(errno));
+	bad_crc = first_bad_crc(&map, gs->len, &end);
+
+	while (store_hdr(&map, gs->len, &hdr)) {
+		msglen = store_msglen(&hdr);
 
-		if (pread(gs->fd, msg, msglen, gs->len+sizeof(hdr)) != msglen) {
+		if (gs->len == end) {
 			bad = "gossip_store: truncated file?";
 			goto corrupt;
 		}
 
-		if (checksum != crc32c(be32_to_cpu(hdr.timestamp), msg, msglen)) {
+		if (gs->len == bad_crc) {
+			msg = tal_dup_arr(tmpctx, u8,
+					  map.p + gs->len + sizeof(hdr),
+					  msglen, 0);
 			bad = "Checksum verification failed";
 			goto badmsg;
 		}
@@ -630,6 +908,9 @@ bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 			goto next;
 		}
 
+		/* The routing code wants its own (tal) copy. */
+		msg = tal_dup_arr(tmpctx, u8, map.p + gs->len + sizeof(hdr),
+				  msglen, 0);
 		switch (fromwire_peektype(msg)) {
 		case WIRE_GOSSIP_STORE_CHANNEL_AMOUNT:
 			if (!fromwire_gossip_store_channel_amount(msg,
@@ -733,6 +1014,7 @@ corrupt:
 	gs->len = 1;
 	contents_ok = false;
 out:
+	unmap_store(&map);
 	gs->writable = true;
 	status_trace("total store load time: %"PRIu64" msec",
 		     time_to_msec(time_between(time_now(), start)));
@@ -67,8 +67,27 @@ const u8 *gossip_store_get_private_update(const tal_t *ctx,
 					  struct gossip_store *gs,
 					  u64 offset);
 
-/* Exposed for dev-compact-gossip-store to force compaction. */
-bool gossip_store_compact(struct gossip_store *gs);
+/**
+ * Start rewriting the store without its deleted records.
+ * @gs: the gossip store.
+ *
+ * Call gossip_store_compact_step() until it's done.  Returns false if we
+ * can't compact (true if we already are).
+ */
+bool gossip_store_compact_start(struct gossip_store *gs);
+
+/**
+ * Copy some more of the store being compacted.
+ * @gs: the gossip store.
+ * @max_bytes: roughly how much of the old store to get through.
+ * @ok: set when it's finished: true if it worked.
+ *
+ * Returns true if there's more to do.  Once it's caught up with the end
+ * of the store, the new one is swapped into place and peers are told
+ * (via update_peers_broadcast_index()).
+ */
+bool gossip_store_compact_step(struct gossip_store *gs, size_t max_bytes,
+			       bool *ok);
 
 /**
  * Get a readonly fd for the gossip_store.
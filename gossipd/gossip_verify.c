@@ -0,0 +1,364 @@
+/*~ When we first join the network, peers send us every channel_announcement,
+ * channel_update and node_announcement they know: hundreds of thousands of
+ * them.  Almost all the time it takes to digest them goes on checking their
+ * signatures, which is something we can do without touching the routing
+ * state at all.
+ *
+ * So peer gossip comes through here: we gather it into batches, check the
+ * signatures in a batch on one of our threads, then hand the messages back
+ * to the io_loop in exactly the order they arrived, to be handled as if
+ * they'd just come in.  The handlers skip the signature check if we've done
+ * it (and done it against the right key); anything we couldn't check in
+ * advance, they check as they always did. */
+#include "gossip_verify.h"
+#include <bitcoin/pubkey.h>
+#include <bitcoin/shadouble.h>
+#include <bitcoin/signature.h>
+#include <ccan/intmap/intmap.h>
+#include <ccan/io/io.h>
+#include <ccan/list/list.h>
+#include <common/utils.h>
+#include <gossipd/route_pool.h>
+#include <gossipd/routing.h>
+#include <wire/gen_peer_wire.h>
+
+/* Most messages we hand a thread at once. */
+#define GOSSIP_VERIFY_BATCH 128
+
+struct verify_item {
+	struct gossip_checked checked;
+	size_t len;
+
+	/* The signatures cover msg from offset onwards. */
+	size_t offset;
+	/* The worker checks num_sigs signatures (if 0, there's nothing to do):
+	 * the first num_nodes are by node[], the rest by key[]. */
+	size_t num_sigs, num_nodes;
+	secp256k1_ecdsa_signature sig[4];
+	struct node_id node[2];
+	struct pubkey key[2];
+
+	/* For a channel_announcement, its entry in gv->announced (if any). */
+	struct short_channel_id scid;
+	struct node_id *announced;
+};
+
+struct verify_batch {
+	/* In gv->batches, in the order they must be applied. */
+	struct list_node list;
+	struct gossip_verify *gv;
+	struct verify_item *items;
+	/* tal_count(items), for the thread (tal isn't thread-safe). */
+	size_t num_items;
+	/* Set on the io_loop, once the thread is done with it. */
+	bool done;
+};
+
+struct gossip_verify {
+	struct routing_state *rstate;
+	struct route_pool *pool;
+	void (*apply)(const struct gossip_checked *, void *arg);
+	void *arg;
+
+	/* Batches handed to threads, oldest first. */
+	struct list_head batches;
+	size_t in_flight, max_in_flight;
+
+	/* Batch we're adding to (not handed to a thread yet), if any. */
+	struct verify_batch *filling;
+
+	/* Node ids of channel_announcements we're holding, so we can check
+	 * channel_updates which arrive right behind them. */
+	UINTMAP(struct node_id *) announced;
+
+	/* Once pending reaches max_pending, peers should stop sending more
+	 * until we've caught up: see gossip_verify_full. */
+	size_t pending, max_pending;
+	u64 checked, unchecked;
+};
+
+/* This runs in a worker thread: it mustn't allocate, log or touch gv. */
+static bool check_item(const struct verify_item *item)
+{
+	struct sha256_double hash;
+	struct pubkey key;
+
+	sha256_double(&hash, item->checked.msg + item->offset,
+		      item->len - item->offset);
+	for (size_t i = 0; i < item->num_sigs; i++) {
+		if (i < item->num_nodes) {
+			/* Invalid node_ids are caught here. */
+			if (!pubkey_from_node_id(&key, &item->node[i]))
+				return false;
+		} else
+			key = item->key[i - item->num_nodes];
+		if (!check_signed_hash(&hash, &item->sig[i], &key))
+			return false;
+	}
+	return true;
+}
+
+static void check_batch(struct verify_batch *batch)
+{
+	for (size_t i = 0; i < batch->num_items; i++) {
+		struct verify_item *item = &batch->items[i];
+		item->checked.ok = item->num_sigs && check_item(item);
+	}
+}
+
+static void apply_batch(struct gossip_verify *gv, struct verify_batch *batch)
+{
+	for (size_t i = 0; i < tal_count(batch->items); i++) {
+		struct verify_item *item = &batch->items[i];
+
+		/* Once it's handled, the routing state knows the signers. */
+		if (item->announced
+		    && uintmap_get(&gv->announced, item->scid.u64)
+		       == item->announced)
+			uintmap_del(&gv->announced, item->scid.u64);
+
+		if (item->num_sigs)
+			gv->checked++;
+		else
+			gv->unchecked++;
+		gv->pending--;
+		gv->apply(&item->checked, gv->arg);
+	}
+
+	/* Wait until we're half empty, so peers don't wake for every batch. */
+	if (gv->pending <= gv->max_pending / 2)
+		io_wake(gv);
+}
+
+static void dispatch(struct gossip_verify *gv);
+
+static void batch_checked(struct verify_batch *batch)
+{
+	struct gossip_verify *gv = batch->gv;
+
+	batch->done = true;
+	gv->in_flight--;
+
+	/* A batch which finishes early waits for those before it. */
+	while ((batch = list_top(&gv->batches, struct verify_batch, list))
+	       && batch->done) {
+		list_del_from(&gv->batches, &batch->list);
+		apply_batch(gv, batch);
+		tal_free(batch);
+	}
+
+	/* Whatever piled up while we were busy can go now. */
+	if (gv->filling && gv->in_flight < gv->max_in_flight)
+		dispatch(gv);
+}
+
+static void dispatch(struct gossip_verify *gv)
+{
+	struct verify_batch *batch = gv->filling;
+
+	gv->filling = NULL;
+	batch->num_items = tal_count(batch->items);
+	list_add_tail(&gv->batches, &batch->list);
+	gv->in_flight++;
+	/* With no threads, this checks and applies it immediately. */
+	route_pool_background(gv->pool, check_batch, batch_checked, batch);
+}
+
+static void prepare_channel_announcement(struct gossip_verify *gv,
+					 struct verify_item *item)
+{
+	u8 *features;
+	struct bitcoin_blkid chain_hash;
+	struct chan *chan;
+
+	/* If it's malformed, handle_channel_announcement will say so. */
+	if (!fromwire_channel_announcement(tmpctx, item->checked.msg,
+					   &item->sig[0], &item->sig[1],
+					   &item->sig[2], &item->sig[3],
+					   &features, &chain_hash, &item->scid,
+					   &item->node[0], &item->node[1],
+					   &item->key[0], &item->key[1]))
+		return;
+
+	/* We'll ignore this anyway: don't waste time on it.  This is common
+	 * while we're catching up, as several peers send us the same ones. */
+	chan = get_channel(gv->rstate, &item->scid);
+	if (chan && is_chan_public(chan))
+		return;
+
+	/* 2 byte msg type + 256 byte signatures */
+	item->offset = 258;
+	item->num_sigs = 4;
+	item->num_nodes = 2;
+
+	item->announced = tal_dup_arr(gv->filling, struct node_id,
+				      item->node, 2, 0);
+	if (!uintmap_add(&gv->announced, item->scid.u64, item->announced))
+		item->announced = tal_free(item->announced);
+}
+
+static void prepare_channel_update(struct gossip_verify *gv,
+				   struct verify_item *item)
+{
+	struct bitcoin_blkid chain_hash;
+	struct short_channel_id scid;
+	u32 timestamp;
+	u8 message_flags, channel_flags;
+	u16 expiry;
+	struct amount_msat htlc_minimum;
+	u32 fee_base_msat, fee_proportional_millionths;
+	const struct node_id *signer;
+	int direction;
+
+	if (!fromwire_channel_update(item->checked.msg, &item->sig[0],
+				     &chain_hash, &scid,
+				     &timestamp, &message_flags,
+				     &channel_flags, &expiry,
+				     &htlc_minimum, &fee_base_msat,
+				     &fee_proportional_millionths))
+		return;
+	direction = channel_flags & 0x1;
+
+	/* If the channel_announcement isn't handled yet, it may be waiting
+	 * just ahead of this. */
+	signer = channel_update_signer(gv->rstate, &scid, direction);
+	if (!signer) {
+		const struct node_id *ids = uintmap_get(&gv->announced,
+							scid.u64);
+		if (!ids)
+			return;
+		signer = &ids[direction];
+	}
+
+	item->checked.signer = item->node[0] = *signer;
+	/* 2 byte msg type + 64 byte signature */
+	item->offset = 66;
+	item->num_sigs = item->num_nodes = 1;
+}
+
+static void prepare_node_announcement(struct gossip_verify *gv,
+				      struct verify_item *item)
+{
+	u8 *features, *addresses;
+	u32 timestamp;
+	u8 rgb_color[3];
+	u8 alias[32];
+
+	if (!fromwire_node_announcement(tmpctx, item->checked.msg,
+					&item->sig[0], &features, &timestamp,
+					&item->node[0], rgb_color, alias,
+					&addresses))
+		return;
+
+	/* 2 byte msg type + 64 byte signature */
+	item->offset = 66;
+	item->num_sigs = item->num_nodes = 1;
+}
+
+void gossip_verify_add(struct gossip_verify *gv, const u8 *msg, void *source)
+{
+	struct verify_item item;
+
+	if (!gv->filling) {
+		gv->filling = tal(gv, struct verify_batch);
+		gv->filling->gv = gv;
+		gv->filling->items = tal_arr(gv->filling, struct verify_item, 0);
+		gv->filling->done = false;
+	}
+
+	item.checked.msg = tal_dup_arr(gv->filling, u8, msg, tal_count(msg), 0);
+	item.checked.source = source;
+	item.checked.ok = false;
+	item.len = tal_count(msg);
+	item.num_sigs = item.num_nodes = 0;
+	item.announced = NULL;
+
+	switch (fromwire_peektype(msg)) {
+	case WIRE_CHANNEL_ANNOUNCEMENT:
+		prepare_channel_announcement(gv, &item);
+		break;
+	case WIRE_CHANNEL_UPDATE:
+		prepare_channel_update(gv, &item);
+		break;
+	case WIRE_NODE_ANNOUNCEMENT:
+		prepare_node_announcement(gv, &item);
+		break;
+	}
+
+	tal_arr_expand(&gv->filling->items, item);
+	gv->pending++;
+
+	/* If a thread would otherwise sit idle, don't wait for more. */
+	if (tal_count(gv->filling->items) == GOSSIP_VERIFY_BATCH
+	    || gv->in_flight < gv->max_in_flight)
+		dispatch(gv);
+}
+
+bool gossip_verify_full(const struct gossip_verify *gv)
+{
+	return gv->pending >= gv->max_pending;
+}
+
+static void forget_source(struct verify_batch *batch, const void *source)
+{
+	for (size_t i = 0; i < tal_count(batch->items); i++) {
+		if (batch->items[i].checked.source == source)
+			batch->items[i].checked.source = NULL;
+	}
+}
+
+void gossip_verify_forget(struct gossip_verify *gv, const void *source)
+{
+	struct verify_batch *batch;
+
+	/* The threads never look at the source, so this is safe. */
+	list_for_each(&gv->batches, batch, list)
+		forget_source(batch, source);
+	if (gv->filling)
+		forget_source(gv->filling, source);
+}
+
+void gossip_verify_get_stats(const struct gossip_verify *gv,
+			     struct gossip_verify_stats *stats)
+{
+	stats->pending = gv->pending;
+	stats->batches = gv->in_flight;
+	stats->checked = gv->checked;
+	stats->unchecked = gv->unchecked;
+}
+
+static void destroy_gossip_verify(struct gossip_verify *gv)
+{
+	uintmap_clear(&gv->announced);
+}
+
+struct gossip_verify *new_gossip_verify_(const tal_t *ctx,
+					 struct routing_state *rstate,
+					 struct route_pool *pool,
+					 void (*apply)(const struct gossip_checked *,
+						       void *arg),
+					 void *arg)
+{
+	struct gossip_verify *gv = tal(ctx, struct gossip_verify);
+	struct route_pool_stats stats;
+
+	gv->rstate = rstate;
+	gv->pool = pool;
+	gv->apply = apply;
+	gv->arg = arg;
+	list_head_init(&gv->batches);
+	gv->in_flight = 0;
+	gv->filling = NULL;
+	uintmap_init(&gv->announced);
+	gv->pending = 0;
+	gv->checked = gv->unchecked = 0;
+
+	/* Keep every thread busy while the io_loop applies what's done. */
+	route_pool_get_stats(pool, &stats);
+	gv->max_in_flight = stats.threads ? stats.threads * 2 : 1;
+	/* That's four batches a thread: two being checked, two waiting. */
+	gv->max_pending = GOSSIP_VERIFY_BATCH * gv->max_in_flight * 2;
+
+	tal_add_destructor(gv, destroy_gossip_verify);
+	return gv;
+}
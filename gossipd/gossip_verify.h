@@ -0,0 +1,84 @@
+#ifndef LIGHTNING_GOSSIPD_GOSSIP_VERIFY_H
+#define LIGHTNING_GOSSIPD_GOSSIP_VERIFY_H
+#include "config.h"
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+#include <common/node_id.h>
+
+struct route_pool;
+struct routing_state;
+
+/* A gossip message, once we've checked its signatures (or tried to). */
+struct gossip_checked {
+	const u8 *msg;
+	/* Whoever handed it to gossip_verify_add (NULL if forgotten). */
+	void *source;
+	/* Did its signatures check out?  If not, the handler checks again:
+	 * either we couldn't tell who should have signed it, or it's bad and
+	 * the handler will say why. */
+	bool ok;
+	/* For a channel_update, who we checked it was signed by. */
+	struct node_id signer;
+};
+
+struct gossip_verify_stats {
+	/* Messages waiting to be checked, or to be applied. */
+	u32 pending;
+	/* Batches handed to the threads and not yet applied. */
+	u32 batches;
+	/* Messages whose signatures we checked off the io_loop. */
+	u64 checked;
+	/* Messages we couldn't check in advance (the handler did). */
+	u64 unchecked;
+};
+
+/**
+ * new_gossip_verify - check gossip signatures on other threads.
+ * @ctx: context to allocate from: usually @pool, so its threads are stopped
+ *	 before we're freed.
+ * @rstate: routing state, to find who should have signed channel_updates.
+ * @pool: the threads to check signatures on.
+ * @apply: called from the io_loop for each message, in the order added.
+ * @arg: argument for @apply.
+ */
+#define new_gossip_verify(ctx, rstate, pool, apply, arg)		\
+	new_gossip_verify_((ctx), (rstate), (pool),			\
+			   typesafe_cb_preargs(void, void *, (apply), (arg), \
+					       const struct gossip_checked *), \
+			   (arg))
+
+struct gossip_verify *new_gossip_verify_(const tal_t *ctx,
+					 struct routing_state *rstate,
+					 struct route_pool *pool,
+					 void (*apply)(const struct gossip_checked *,
+						       void *arg),
+					 void *arg);
+
+/**
+ * gossip_verify_add - queue a channel_announcement, channel_update or
+ * node_announcement.
+ * @gv: the gossip_verify.
+ * @msg: the message (we take a copy).
+ * @source: handed back to apply().
+ *
+ * With no threads in the pool, it's applied before this returns.
+ */
+void gossip_verify_add(struct gossip_verify *gv, const u8 *msg, void *source);
+
+/**
+ * gossip_verify_full - should sources stop adding for now?
+ * @gv: the gossip_verify.
+ *
+ * Nothing stops gossip_verify_add() queueing more, but peers can send gossip
+ * far faster than we can check it.  Once this is true, stop reading and
+ * io_wait() on @gv: it's woken once we've caught up.
+ */
+bool gossip_verify_full(const struct gossip_verify *gv);
+
+/* @source has gone away: its messages are applied with a NULL source. */
+void gossip_verify_forget(struct gossip_verify *gv, const void *source);
+
+void gossip_verify_get_stats(const struct gossip_verify *gv,
+			     struct gossip_verify_stats *stats);
+#endif /* LIGHTNING_GOSSIPD_GOSSIP_VERIFY_H */
@@ -53,6 +53,9 @@
 #include <gossipd/broadcast.h>
 #include <gossipd/gen_gossip_peerd_wire.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <gossipd/gossip_verify.h>
+#include <gossipd/route_cache.h>
+#include <gossipd/route_pool.h>
 #include <gossipd/routing.h>
 #include <hsmd/gen_hsm_wire.h>
 #include <inttypes.h>
@@ -148,6 +151,19 @@ struct daemon {
 
 	/* Channels we've heard about, but don't know. */
 	struct short_channel_id *unknown_scids;
+
+	/* Threads to answer getroute requests. */
+	struct route_pool *route_pool;
+	/* Nodes looked at answering them. */
+	u64 route_settled;
+
+	/* Threads to check signatures on gossip from peers. */
+	struct route_pool *verify_pool;
+	struct gossip_verify *gossip_verify;
+
+	/* How many dev-compact-gossip-store requests are waiting for the
+	 * compaction to finish. */
+	size_t compact_waiting;
 };
 
 /*~ How gossipy do we ask a peer to be? */
@@ -245,6 +261,9 @@ static void destroy_peer(struct peer *peer)
 	/* Remove it from the peers list */
 	list_del_from(&peer->daemon->peers, &peer->list);
 
+	/* Its gossip still gets applied, but it won't hear about errors. */
+	gossip_verify_forget(peer->daemon->gossip_verify, peer);
+
 	/* If we have a channel with this peer, disable it. */
 	node = get_node(peer->daemon->rstate, &peer->id);
 	if (node)
@@ -514,7 +533,7 @@ static void send_node_announcement(struct daemon *daemon)
 
 	/* This injects it into the routing code in routing.c; it should not
 	 * reject it! */
-	err = handle_node_announcement(daemon->rstate, take(nannounce));
+	err = handle_node_announcement(daemon->rstate, take(nannounce), false);
 	if (err)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "rejected own node announcement: %s",
@@ -739,8 +758,9 @@ static void query_unknown_channel(struct daemon *daemon,
  * message, and puts the announcemnt on an internal 'pending'
  * queue.  We'll send a request to lightningd to look it up, and continue
  * processing in `handle_txout_reply`. */
-static const u8 *handle_channel_announcement_msg(struct peer *peer,
-						 const u8 *msg)
+static const u8 *handle_channel_announcement_msg(struct daemon *daemon,
+						 const u8 *msg,
+						 bool sigs_checked)
 {
 	const struct short_channel_id *scid;
 	const u8 *err;
@@ -748,27 +768,32 @@ static const u8 *handle_channel_announcement_msg(struct peer *peer,
 	/* If it's OK, tells us the short_channel_id to lookup; it notes
 	 * if this is the unknown channel the peer was looking for (in
 	 * which case, it frees and NULLs that ptr) */
-	err = handle_channel_announcement(peer->daemon->rstate, msg, &scid);
+	err = handle_channel_announcement(daemon->rstate, msg, sigs_checked,
+					  &scid);
 	if (err)
 		return err;
 	else if (scid)
-		daemon_conn_send(peer->daemon->master,
+		daemon_conn_send(daemon->master,
 				 take(towire_gossip_get_txout(NULL, scid)));
 	return NULL;
 }
 
-static u8 *handle_channel_update_msg(struct peer *peer, const u8 *msg)
+/* peer is NULL if it went away while we were checking the signature. */
+static u8 *handle_channel_update_msg(struct daemon *daemon,
+				     struct peer *peer,
+				     const u8 *msg,
+				     const struct node_id *checked_signer)
 {
 	struct short_channel_id unknown_scid;
 	/* Hand the channel_update to the routing code */
 	u8 *err;
 
 	unknown_scid.u64 = 0;
-	err = handle_channel_update(peer->daemon->rstate, msg, "subdaemon",
-				    &unknown_scid);
+	err = handle_channel_update(daemon->rstate, msg, "subdaemon",
+				    checked_signer, &unknown_scid);
 	if (err) {
-		if (unknown_scid.u64 != 0)
-			query_unknown_channel(peer->daemon, peer, &unknown_scid);
+		if (unknown_scid.u64 != 0 && peer)
+			query_unknown_channel(daemon, peer, &unknown_scid);
 		return err;
 	}
 
@@ -777,10 +802,42 @@ static u8 *handle_channel_update_msg(struct peer *peer, const u8 *msg)
 	 * routing until you have both anyway.  For this reason, we might have
 	 * just sent out our own channel_announce, so we check if it's time to
 	 * send a node_announcement too. */
-	maybe_send_own_node_announce(peer->daemon);
+	maybe_send_own_node_announce(daemon);
 	return NULL;
 }
 
+/*~ Signatures take most of the time spent digesting gossip, so
+ * gossip_verify.c checks them on other threads, then hands the messages
+ * back to us here in the order they arrived. */
+static void apply_peer_gossip(const struct gossip_checked *gc,
+			      struct daemon *daemon)
+{
+	struct peer *peer = gc->source;
+	const u8 *err;
+
+	switch (fromwire_peektype(gc->msg)) {
+	case WIRE_CHANNEL_ANNOUNCEMENT:
+		err = handle_channel_announcement_msg(daemon, gc->msg, gc->ok);
+		break;
+	case WIRE_CHANNEL_UPDATE:
+		err = handle_channel_update_msg(daemon, peer, gc->msg,
+						gc->ok ? &gc->signer : NULL);
+		break;
+	case WIRE_NODE_ANNOUNCEMENT:
+		err = handle_node_announcement(daemon->rstate, gc->msg, gc->ok);
+		break;
+	default:
+		abort();
+	}
+
+	if (!err)
+		return;
+	if (peer)
+		queue_peer_msg(peer, take(err));
+	else
+		tal_free(err);
+}
+
 /*~ The peer can ask about an array of short channel ids: we don't assemble the
  * reply immediately but process them one at a time in dump_gossip which is
  * called when there's nothing more important to send. */
@@ -1019,6 +1076,20 @@ static size_t tlv_len(const tal_t *msg)
 	return 1 + bigsize_len(tal_count(msg)) + tal_count(msg);
 }
 
+/* BOLT #7:
+ *
+ * 1. type: 264 (`reply_channel_range`) (`gossip_queries`)
+ * 2. data:
+ *   * [`chain_hash`:`chain_hash`]
+ *   * [`u32`:`first_blocknum`]
+ *   * [`u32`:`number_of_blocks`]
+ *   * [`byte`:`complete`]
+ *   * [`u16`:`len`]
+ *   * [`len*byte`:`encoded_short_ids`]
+ */
+#define REPLY_CHANNEL_RANGE_OVERHEAD (32 + 4 + 4 + 1 + 2)
+#define MAX_ENCODED_BYTES (65535 - 2 - REPLY_CHANNEL_RANGE_OVERHEAD)
+
 /*~ When we need to send an array of channels, it might go over our 64k packet
  * size.  If it doesn't, we recurse, splitting in two, etc.  Each message
  * indicates what blocks it contains, so the recipient knows when we're
@@ -1038,20 +1109,7 @@ static bool queue_channel_ranges(struct peer *peer,
 	struct tlv_reply_channel_range_tlvs_checksums_tlv *csums;
 	struct short_channel_id scid;
 	bool scid_ok;
-
-	/* BOLT #7:
-	 *
-	 * 1. type: 264 (`reply_channel_range`) (`gossip_queries`)
-	 * 2. data:
-	 *   * [`chain_hash`:`chain_hash`]
-	 *   * [`u32`:`first_blocknum`]
-	 *   * [`u32`:`number_of_blocks`]
-	 *   * [`byte`:`complete`]
-	 *   * [`u16`:`len`]
-	 *   * [`len*byte`:`encoded_short_ids`]
-	 */
-	const size_t reply_overhead = 32 + 4 + 4 + 1 + 2;
-	const size_t max_encoded_bytes = 65535 - 2 - reply_overhead;
+	const size_t max_encoded_bytes = MAX_ENCODED_BYTES;
 	size_t extension_bytes;
 
 	if (query_option_flags & QUERY_ADD_TIMESTAMPS) {
@@ -1160,6 +1218,287 @@ wont_fit:
 					tail_blocks, query_option_flags);
 }
 
+/*~ Encoding all that (and compressing it) takes a while on a large network,
+ * and when we start up, every peer asks us for the same thing.  So we keep
+ * what we'd send for each run of blocks in rstate->channel_ranges (routing.c
+ * forgets it when a channel in that run changes), and most replies are just
+ * a matter of sending it again. */
+
+/* Set *scid to just before the first channel @r could contain. */
+static bool channel_range_start(const struct channel_range *r,
+				struct short_channel_id *scid)
+{
+	/* Avoid underflow: we don't use block 0 anyway */
+	if (!mk_short_channel_id(scid,
+				 r->first_blocknum ? r->first_blocknum : 1,
+				 0, 0))
+		return false;
+	scid->u64--;
+	return true;
+}
+
+/* Fill in whichever encodings of @r we want and don't have. */
+static void encode_channel_range(struct routing_state *rstate,
+				 struct channel_range *r,
+				 enum query_option_flags query_option_flags)
+{
+	u8 *encoded_scids;
+	struct tlv_reply_channel_range_tlvs_timestamps_tlv *tstamps;
+	struct tlv_reply_channel_range_tlvs_checksums_tlv *csums;
+	struct short_channel_id scid;
+	struct chan *chan;
+
+	if (!r->encoded_scids) {
+		encoded_scids = encoding_start(tmpctx);
+		r->num_chans = 0;
+	} else
+		encoded_scids = NULL;
+
+	if ((query_option_flags & QUERY_ADD_TIMESTAMPS) && !r->timestamps) {
+		tstamps = tal(rstate,
+			      struct tlv_reply_channel_range_tlvs_timestamps_tlv);
+		tstamps->encoded_timestamps = encoding_start(tstamps);
+	} else
+		tstamps = NULL;
+
+	if ((query_option_flags & QUERY_ADD_CHECKSUMS) && !r->checksums) {
+		csums = tal(rstate,
+			    struct tlv_reply_channel_range_tlvs_checksums_tlv);
+		csums->checksums
+			= tal_arr(csums, struct channel_update_checksums, 0);
+	} else
+		csums = NULL;
+
+	if (!encoded_scids && !tstamps && !csums)
+		return;
+
+	/* No channel has a block this high. */
+	if (!channel_range_start(r, &scid))
+		goto done;
+
+	while ((chan = uintmap_after(&rstate->chanmap, &scid.u64)) != NULL) {
+		struct channel_update_timestamps ts;
+		struct channel_update_checksums cs;
+		u32 blocknum = short_channel_id_blocknum(&scid);
+		if (blocknum > r->last_blocknum)
+			break;
+
+		if (encoded_scids) {
+			encoding_add_short_channel_id(&encoded_scids, &scid);
+			if (r->num_chans++ == 0)
+				r->first_chan_block = blocknum;
+			r->last_chan_block = blocknum;
+		}
+
+		if (!tstamps && !csums)
+			continue;
+
+		get_checksum_and_timestamp(rstate, chan, 0,
+					   &ts.timestamp_node_id_1,
+					   &cs.checksum_node_id_1);
+		get_checksum_and_timestamp(rstate, chan, 1,
+					   &ts.timestamp_node_id_2,
+					   &cs.checksum_node_id_2);
+		if (csums)
+			tal_arr_expand(&csums->checksums, cs);
+		if (tstamps)
+			encoding_add_timestamps(&tstamps->encoded_timestamps,
+						&ts);
+	}
+
+done:
+	/* Whether they fit is up to replies_needed() */
+	if (encoded_scids) {
+		encoding_end_prepend_type(&encoded_scids, MAX_ENCODED_BYTES);
+		r->encoded_scids = tal_steal(rstate, encoded_scids);
+	}
+	if (tstamps) {
+		encoding_end_external_type(&tstamps->encoded_timestamps,
+					   &tstamps->encoding_type,
+					   MAX_ENCODED_BYTES);
+		r->timestamps = tstamps;
+	}
+	if (csums)
+		r->checksums = csums;
+}
+
+/* How many replies it would take to send @r (roughly: pieces of it will
+ * compress differently). */
+static size_t replies_needed(const struct channel_range *r,
+			     enum query_option_flags query_option_flags)
+{
+	size_t bytes = tal_count(r->encoded_scids), replies;
+
+	if (query_option_flags & QUERY_ADD_CHECKSUMS)
+		bytes += tlv_len(r->checksums->checksums);
+	if (query_option_flags & QUERY_ADD_TIMESTAMPS)
+		bytes += 1 + tlv_len(r->timestamps->encoded_timestamps);
+
+	if (bytes <= MAX_ENCODED_BYTES)
+		replies = 1;
+	else
+		replies = bytes / MAX_ENCODED_BYTES + 1;
+
+#if DEVELOPER
+	if (tal_count(r->encoded_scids) > max_encoding_bytes) {
+		size_t dev_replies
+			= tal_count(r->encoded_scids) / (max_encoding_bytes + 1)
+			+ 1;
+		if (dev_replies > replies)
+			replies = dev_replies;
+	}
+#endif
+	return replies;
+}
+
+/* Would a reply with @num_chans fit, even if none of it compressed? */
+static bool fits_uncompressed(size_t num_chans,
+			      enum query_option_flags query_option_flags)
+{
+	size_t scid_bytes = 1 + num_chans * 8, bytes = scid_bytes;
+
+	/* These are what tlv_len() would say. */
+	if (query_option_flags & QUERY_ADD_CHECKSUMS)
+		bytes += 1 + bigsize_len(num_chans) + num_chans;
+	if (query_option_flags & QUERY_ADD_TIMESTAMPS)
+		bytes += 1 + 1 + bigsize_len(num_chans * 8) + num_chans * 8;
+
+#if DEVELOPER
+	if (scid_bytes > max_encoding_bytes)
+		return false;
+#endif
+	return bytes <= MAX_ENCODED_BYTES;
+}
+
+/* Split rstate->channel_ranges[idx] into about @pieces ranges with a
+ * similar number of channels in each.  False if they're all in one block,
+ * so it can't be split at all. */
+static bool split_channel_range_evenly(struct routing_state *rstate,
+				       size_t idx, size_t pieces)
+{
+	const struct channel_range *r = &rstate->channel_ranges[idx];
+	u32 *splits = tal_arr(tmpctx, u32, 0);
+	struct short_channel_id scid;
+	size_t n = 0, num_chans = r->num_chans;
+
+	assert(r->encoded_scids);
+	if (!num_chans || r->first_chan_block == r->last_chan_block)
+		return false;
+
+	/* We split at the block of every num_chans/pieces'th channel, unless
+	 * that's the block we split at last (or the first block). */
+	if (!channel_range_start(r, &scid))
+		return false;
+	while (uintmap_after(&rstate->chanmap, &scid.u64)
+	       && n < num_chans) {
+		u32 blocknum = short_channel_id_blocknum(&scid);
+		u32 prev = tal_count(splits) ? splits[tal_count(splits) - 1]
+			: r->first_chan_block;
+
+		if (n++ < num_chans * (tal_count(splits) + 1) / pieces)
+			continue;
+		if (blocknum > prev)
+			tal_arr_expand(&splits, blocknum);
+		if (tal_count(splits) == pieces - 1)
+			break;
+	}
+
+	status_debug("Splitting channel range %u-%u into %zu",
+		     r->first_blocknum, r->last_blocknum,
+		     tal_count(splits) + 1);
+
+	/* Splitting from the end keeps idx the one before the split. */
+	for (size_t i = tal_count(splits); i > 0; i--)
+		split_channel_range(rstate, idx, splits[i-1]);
+	return tal_count(splits) != 0;
+}
+
+/* Send what we have for blocks first_blocknum to first_blocknum plus
+ * number_of_blocks minus one, as queue_channel_ranges would, but using the
+ * encodings in rstate->channel_ranges (and filling in any we're missing). */
+static bool queue_cached_channel_ranges(struct peer *peer,
+					u32 first_blocknum,
+					u32 number_of_blocks,
+					u32 tail_blocks,
+					enum query_option_flags query_option_flags)
+{
+	struct routing_state *rstate = peer->daemon->rstate;
+	u32 last_blocknum;
+	size_t idx;
+
+	/* There's nothing to cache for an empty reply, and if they've asked
+	 * for blocks past 4 billion, we do what we always have. */
+	if (number_of_blocks == 0
+	    || (u64)first_blocknum + number_of_blocks - 1 > UINT32_MAX)
+		return queue_channel_ranges(peer, first_blocknum,
+					    number_of_blocks, tail_blocks,
+					    query_option_flags);
+
+	last_blocknum = first_blocknum + number_of_blocks - 1;
+	idx = channel_range_idx(rstate, first_blocknum);
+	for (;;) {
+		struct channel_range *r = &rstate->channel_ranges[idx];
+		u32 start, end, extra;
+		size_t replies;
+
+		encode_channel_range(rstate, r, query_option_flags);
+		replies = replies_needed(r, query_option_flags);
+		if (replies > 1) {
+			if (!split_channel_range_evenly(rstate, idx, replies)) {
+				status_broken("Could not fit scids for"
+					      " single block %u",
+					      r->first_chan_block);
+				return false;
+			}
+			continue;
+		}
+
+		/* As channels close, ranges get smaller: if this one and
+		 * the next could never need more than one reply between
+		 * them, join them. */
+		if (idx + 1 < tal_count(rstate->channel_ranges)
+		    && r->last_blocknum < last_blocknum) {
+			struct channel_range *next
+				= &rstate->channel_ranges[idx + 1];
+			encode_channel_range(rstate, next, query_option_flags);
+			if (fits_uncompressed(r->num_chans + next->num_chans,
+					      query_option_flags)) {
+				merge_channel_ranges(rstate, idx);
+				continue;
+			}
+		}
+
+		start = r->first_blocknum < first_blocknum
+			? first_blocknum : r->first_blocknum;
+		end = r->last_blocknum > last_blocknum
+			? last_blocknum : r->last_blocknum;
+		extra = (end == last_blocknum) ? tail_blocks : 0;
+
+		/* If they only asked for some of its channels, we encode
+		 * those as we always did. */
+		if (r->num_chans
+		    && (r->first_chan_block < start
+			|| r->last_chan_block > end)) {
+			if (!queue_channel_ranges(peer, start, end - start + 1,
+						  extra, query_option_flags))
+				return false;
+		} else
+			reply_channel_range(peer, start,
+					    end - start + 1 + extra,
+					    r->encoded_scids,
+					    query_option_flags
+					    & QUERY_ADD_TIMESTAMPS
+					    ? r->timestamps : NULL,
+					    query_option_flags
+					    & QUERY_ADD_CHECKSUMS
+					    ? r->checksums : NULL);
+
+		if (end == last_blocknum)
+			return true;
+		idx++;
+	}
+}
+
 /*~ The peer can ask for all channels is a series of blocks.  We reply with one
  * or more messages containing the short_channel_ids. */
 static u8 *handle_query_channel_range(struct peer *peer, const u8 *msg)
@@ -1222,8 +1561,9 @@ static u8 *handle_query_channel_range(struct peer *peer, const u8 *msg)
 	} else
 		tail_blocks = 0;
 
-	if (!queue_channel_ranges(peer, first_blocknum, number_of_blocks,
-				  tail_blocks, query_option_flags))
+	if (!queue_cached_channel_ranges(peer, first_blocknum,
+					 number_of_blocks, tail_blocks,
+					 query_option_flags))
 		return towire_errorfmt(peer, NULL,
 				       "Invalid query_channel_range %u+%u",
 				       first_blocknum, number_of_blocks + tail_blocks);
@@ -1720,7 +2060,8 @@ static void update_local_channel(struct daemon *daemon,
 	/* We feed it into routing.c like any other channel_update; it may
 	 * discard it (eg. non-public channel), but it should not complain
 	 * about it being invalid! */
-	msg = handle_channel_update(daemon->rstate, take(update), caller, NULL);
+	msg = handle_channel_update(daemon->rstate, take(update), caller, NULL,
+				    NULL);
 	if (msg)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "%s: rejected local channel update %s: %s",
@@ -1938,6 +2279,13 @@ static bool handle_local_channel_update(struct peer *peer, const u8 *msg)
 	return true;
 }
 
+/* gossip_verify has caught up: go back to reading from this peer. */
+static struct io_plan *peer_gossip_resume(struct io_conn *conn,
+					  struct peer *peer)
+{
+	return daemon_conn_read_next(conn, peer->dc);
+}
+
 /*~ This is where the per-peer daemons send us messages.  It's either forwarded
  * gossip, or a request for information.  We deliberately use non-overlapping
  * message types so we can distinguish them. */
@@ -1951,14 +2299,15 @@ static struct io_plan *peer_msg_in(struct io_conn *conn,
 	/* These are messages relayed from peer */
 	switch ((enum wire_type)fromwire_peektype(msg)) {
 	case WIRE_CHANNEL_ANNOUNCEMENT:
-		err = handle_channel_announcement_msg(peer, msg);
-		goto handled_relay;
 	case WIRE_CHANNEL_UPDATE:
-		err = handle_channel_update_msg(peer, msg);
-		goto handled_relay;
 	case WIRE_NODE_ANNOUNCEMENT:
-		err = handle_node_announcement(peer->daemon->rstate, msg);
-		goto handled_relay;
+		/* We'll get it back in apply_peer_gossip (maybe already). */
+		gossip_verify_add(peer->daemon->gossip_verify, msg, peer);
+		/* Don't read any more until the threads catch up. */
+		if (gossip_verify_full(peer->daemon->gossip_verify))
+			return io_wait(conn, peer->daemon->gossip_verify,
+				       peer_gossip_resume, peer);
+		goto done;
 	case WIRE_QUERY_CHANNEL_RANGE:
 		err = handle_query_channel_range(peer, msg);
 		goto handled_relay;
@@ -2408,12 +2757,20 @@ static void gossip_not_missing(struct daemon *daemon)
 	}
 }
 
+/* If we're caching routes, we remember this many (a route is a few hundred
+ * bytes, so this is tiny next to the network itself). */
+#define ROUTE_CACHE_MAX_ENTRIES 1000
+
 /*~ Parse init message from lightningd: starts the daemon properly. */
 static struct io_plan *gossip_init(struct io_conn *conn,
 				   struct daemon *daemon,
 				   const u8 *msg)
 {
 	u32 update_channel_interval;
+	u32 getroute_threads;
+	u16 getroute_landmarks;
+	u32 getroute_cache_secs;
+	u32 gossip_verify_threads;
 	u32 *dev_gossip_time;
 
 	if (!fromwire_gossipctl_init(daemon, msg,
@@ -2425,6 +2782,10 @@ static struct io_plan *gossip_init(struct io_conn *conn,
 				      * (unless --dev-channel-update-interval) */
 				     &update_channel_interval,
 				     &daemon->announcable,
+				     &getroute_threads,
+				     &getroute_landmarks,
+				     &getroute_cache_secs,
+				     &gossip_verify_threads,
 				     &dev_gossip_time)) {
 		master_badmsg(WIRE_GOSSIPCTL_INIT, msg);
 	}
@@ -2437,6 +2798,22 @@ static struct io_plan *gossip_init(struct io_conn *conn,
 					   &daemon->peers,
 					   dev_gossip_time);
 
+	daemon->rstate->num_landmarks = getroute_landmarks;
+	if (getroute_cache_secs)
+		daemon->rstate->route_cache
+			= new_route_cache(daemon->rstate,
+					  ROUTE_CACHE_MAX_ENTRIES,
+					  getroute_cache_secs);
+	daemon->route_pool = new_route_pool(daemon, getroute_threads);
+	daemon->route_settled = 0;
+
+	/* The pool owns it, so the threads stop before it's freed. */
+	daemon->verify_pool = new_route_pool(daemon, gossip_verify_threads);
+	daemon->gossip_verify = new_gossip_verify(daemon->verify_pool,
+						  daemon->rstate,
+						  daemon->verify_pool,
+						  apply_peer_gossip, daemon);
+
 	/* Load stored gossip messages */
 	if (!gossip_store_load(daemon->rstate, daemon->rstate->gs))
 		gossip_missing(daemon);
@@ -2456,6 +2833,64 @@ static struct io_plan *gossip_init(struct io_conn *conn,
 	return daemon_conn_read_next(conn, daemon->master);
 }
 
+/*~ Route queries are answered by route_pool.c, possibly on another thread;
+ * we get called back here (in the same order they were asked) once done. */
+static void getroute_answered(struct route_query *rq, struct daemon *daemon)
+{
+	const u8 *out;
+
+	/* routing.c did all the hard work; hops can be NULL. */
+	out = towire_gossip_getroute_reply(NULL,
+					   route_query_hops(tmpctx, rq, 0));
+	daemon_conn_send(daemon->master, take(out));
+	daemon->route_settled += route_query_settled(rq);
+	route_query_cache(rq);
+	tal_free(rq);
+}
+
+/*~ routing.c works out when channels have come or gone enough that it
+ * needs a new snapshot of the network, and (if we're told to use them) when
+ * it needs new landmarks; both take long enough that we do them in a route
+ * thread, like queries. */
+static void refresh_routing(struct daemon *daemon)
+{
+	struct graph_refresh *graph;
+	struct landmarks_refresh *landmarks;
+
+	graph = routing_graph_refresh(daemon->rstate);
+	if (graph)
+		route_pool_background(daemon->route_pool,
+				      graph_refresh_run,
+				      graph_refresh_done, graph);
+
+	landmarks = routing_landmarks_refresh(daemon->rstate);
+	if (landmarks)
+		route_pool_background(daemon->route_pool,
+				      landmarks_refresh_run,
+				      landmarks_refresh_done, landmarks);
+}
+
+static struct route_query *new_daemon_route_query(struct daemon *daemon,
+						  const struct node_id *source,
+						  const struct node_id *destination,
+						  struct amount_msat msat,
+						  u64 riskfactor_by_million,
+						  u32 final_cltv,
+						  double fuzz,
+						  const struct short_channel_id_dir *excluded,
+						  u32 max_hops,
+						  size_t max_routes)
+{
+	refresh_routing(daemon);
+
+	/* This takes a reference to the current network snapshot, so later
+	 * gossip doesn't change the answer under the thread's feet. */
+	return new_route_query(daemon, daemon->rstate, source, destination,
+			       msat, riskfactor_by_million / 1000000.0,
+			       final_cltv, fuzz, pseudorand_u64(), excluded,
+			       max_hops, max_routes);
+}
+
 /*~ lightningd can ask for a route between nodes. */
 static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 				    const u8 *msg)
@@ -2465,10 +2900,9 @@ static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 	u32 final_cltv;
 	u64 riskfactor_by_million;
 	u32 max_hops;
-	u8 *out;
-	struct route_hop *hops;
 	double fuzz;
 	struct short_channel_id_dir *excluded;
+	struct route_query *rq;
 
 	/* To choose between variations, we need to know how much we're
 	 * sending (eliminates too-small channels, and also effects the fees
@@ -2495,24 +2929,163 @@ static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 		     type_to_string(tmpctx, struct node_id, &destination),
 		     type_to_string(tmpctx, struct amount_msat, &msat));
 
-	/* routing.c does all the hard work; can return NULL. */
-	hops = get_route(tmpctx, daemon->rstate, source, &destination,
-			 msat, riskfactor_by_million / 1000000.0, final_cltv,
-			 fuzz, pseudorand_u64(), excluded, max_hops);
+	rq = new_daemon_route_query(daemon, source, &destination, msat,
+				    riskfactor_by_million, final_cltv, fuzz,
+				    excluded, max_hops, 1);
+	route_pool_add(daemon->route_pool, rq, getroute_answered, daemon);
+	return daemon_conn_read_next(conn, daemon->master);
+}
 
-	out = towire_gossip_getroute_reply(NULL, hops);
-	daemon_conn_send(daemon->master, take(out));
+static void getroutes_answered(struct route_query *rq, struct daemon *daemon)
+{
+	size_t num_routes = route_query_num_routes(rq);
+	u16 *route_lens = tal_arr(tmpctx, u16, num_routes);
+	struct route_hop *hops = tal_arr(tmpctx, struct route_hop, 0);
+
+	/* The wire can't do arrays of arrays, so we flatten them. */
+	for (size_t i = 0; i < num_routes; i++) {
+		struct route_hop *route = route_query_hops(tmpctx, rq, i);
+		size_t n = tal_count(hops);
+
+		route_lens[i] = tal_count(route);
+		tal_resize(&hops, n + tal_count(route));
+		memcpy(hops + n, route, tal_bytelen(route));
+	}
+
+	daemon_conn_send(daemon->master,
+			 take(towire_gossip_getroutes_reply(NULL, route_lens,
+							    hops)));
+	daemon->route_settled += route_query_settled(rq);
+	route_query_cache(rq);
+	tal_free(rq);
+}
+
+/*~ A payer who's going to retry anyway may as well ask for a few routes at
+ * once: we find them in one go, rather than being asked again after each
+ * failure. */
+static struct io_plan *getroutes_req(struct io_conn *conn,
+				     struct daemon *daemon,
+				     const u8 *msg)
+{
+	struct node_id *source, destination;
+	struct amount_msat msat;
+	u32 final_cltv;
+	u64 riskfactor_by_million;
+	u32 max_hops;
+	u16 max_routes;
+	double fuzz;
+	struct short_channel_id_dir *excluded;
+	struct route_query *rq;
+
+	if (!fromwire_gossip_getroutes_request(msg, msg,
+					       &source, &destination,
+					       &msat, &riskfactor_by_million,
+					       &final_cltv, &fuzz,
+					       &excluded,
+					       &max_hops, &max_routes))
+		master_badmsg(WIRE_GOSSIP_GETROUTES_REQUEST, msg);
+
+	status_trace("Trying to find %u routes from %s to %s for %s",
+		     max_routes,
+		     source
+		     ? type_to_string(tmpctx, struct node_id, source) : "(me)",
+		     type_to_string(tmpctx, struct node_id, &destination),
+		     type_to_string(tmpctx, struct amount_msat, &msat));
+
+	rq = new_daemon_route_query(daemon, source, &destination, msat,
+				    riskfactor_by_million, final_cltv, fuzz,
+				    excluded, max_hops, max_routes);
+	route_pool_add(daemon->route_pool, rq, getroutes_answered, daemon);
+	return daemon_conn_read_next(conn, daemon->master);
+}
+
+static void getroutetree_answered(struct route_query *rq,
+				  struct daemon *daemon)
+{
+	daemon_conn_send(daemon->master,
+			 take(towire_gossip_getroutetree_reply(NULL,
+				route_query_costs(tmpctx, rq))));
+	daemon->route_settled += route_query_settled(rq);
+	tal_free(rq);
+}
+
+/*~ Someone who wants to know what it costs to pay lots of nodes (eg. to
+ * decide where to open channels) would otherwise ask for a route to each
+ * in turn: a whole search each time.  One search from us finds them all. */
+static struct io_plan *getroutetree_req(struct io_conn *conn,
+					struct daemon *daemon,
+					const u8 *msg)
+{
+	struct amount_msat msat;
+	u64 riskfactor_by_million;
+	u32 final_cltv, max_hops;
+	struct node_id *destinations;
+	struct route_query *rq;
+
+	if (!fromwire_gossip_getroutetree_request(msg, msg, &msat,
+						  &riskfactor_by_million,
+						  &final_cltv,
+						  &destinations,
+						  &max_hops))
+		master_badmsg(WIRE_GOSSIP_GETROUTETREE_REQUEST, msg);
+
+	status_trace("Pricing routes to %s for %s",
+		     tal_count(destinations)
+		     ? tal_fmt(tmpctx, "%zu nodes", tal_count(destinations))
+		     : "every node",
+		     type_to_string(tmpctx, struct amount_msat, &msat));
+
+	refresh_routing(daemon);
+	rq = new_route_tree_query(daemon, daemon->rstate, msat,
+				  riskfactor_by_million / 1000000.0,
+				  final_cltv,
+				  tal_count(destinations) ? destinations : NULL,
+				  max_hops);
+	route_pool_add(daemon->route_pool, rq, getroutetree_answered, daemon);
+	return daemon_conn_read_next(conn, daemon->master);
+}
+
+/*~ How busy are the route threads? */
+static struct io_plan *getroutestats_req(struct io_conn *conn,
+					 struct daemon *daemon,
+					 const u8 *msg)
+{
+	struct route_pool_stats stats;
+	struct route_cache_stats cache;
+
+	if (!fromwire_gossip_getroutestats_request(msg))
+		master_badmsg(WIRE_GOSSIP_GETROUTESTATS_REQUEST, msg);
+
+	route_pool_get_stats(daemon->route_pool, &stats);
+	routing_route_cache_stats(daemon->rstate, &cache);
+	daemon_conn_send(daemon->master,
+			 take(towire_gossip_getroutestats_reply(NULL,
+								stats.threads,
+								stats.queued,
+								stats.running,
+								stats.max_queued,
+								stats.answered,
+								daemon->route_settled,
+								routing_landmarks_in_use(daemon->rstate),
+								cache.hits,
+								cache.misses,
+								cache.invalidated,
+								cache.entries)));
 	return daemon_conn_read_next(conn, daemon->master);
 }
 
 /*~ When someone asks lightningd to `listchannels`, gossipd does the work:
- * marshalling the channel information for all channels into an array of
- * gossip_getchannels_entry, which lightningd converts to JSON.  Each channel
- * is represented by two half_chan; one in each direction.
+ * marshalling the channel information for all channels into a series of
+ * gossip_getchannels_entry, which lightningd converts to JSON as it reads
+ * them.  Each channel is represented by two half_chan; one in each
+ * direction.
+ *
+ * Since there are a great many channels, and most don't change from minute
+ * to minute, they can ask for only those which changed after a given
+ * rstate->generation (and which were removed since then).
  */
-static struct gossip_halfchannel_entry *hc_entry(const tal_t *ctx,
-						 const struct chan *chan,
-						 int idx)
+static bool hc_entry(const struct chan *chan, int idx,
+		     struct gossip_halfchannel_entry *e)
 {
 	/* Our 'struct chan' contains two nodes: they are in pubkey_cmp order
 	 * (ie. chan->nodes[0] is the lesser pubkey) and this is the same as
@@ -2521,13 +3094,11 @@ static struct gossip_halfchannel_entry *hc_entry(const tal_t *ctx,
 	 * The halfchans are arranged so that half[0] src == nodes[0], and we
 	 * use that here. */
 	const struct half_chan *c = &chan->half[idx];
-	struct gossip_halfchannel_entry *e;
 
 	/* If we've never seen a channel_update for this direction... */
 	if (!is_halfchan_defined(c))
-		return NULL;
+		return false;
 
-	e = tal(ctx, struct gossip_halfchannel_entry);
 	e->channel_flags = c->channel_flags;
 	e->message_flags = c->message_flags;
 	e->last_update_timestamp = c->bcast.timestamp;
@@ -2537,37 +3108,54 @@ static struct gossip_halfchannel_entry *hc_entry(const tal_t *ctx,
 	e->min = c->htlc_minimum;
 	e->max = c->htlc_maximum;
 
-	return e;
+	return true;
 }
 
-/*~ Marshal (possibly) both channel directions into entries. */
-static void append_channel(struct routing_state *rstate,
-			   const struct gossip_getchannels_entry ***entries,
+/*~ Marshal (possibly) both channel directions onto entries, if it changed
+ * after generation since. */
+static bool append_channel(struct routing_state *rstate,
+			   u8 **entries,
 			   const struct chan *chan,
-			   const struct node_id *srcfilter)
-{
-	struct gossip_getchannels_entry *e = tal(*entries, struct gossip_getchannels_entry);
-
-	e->node[0] = chan->nodes[0]->id;
-	e->node[1] = chan->nodes[1]->id;
-	e->sat = chan->sat;
-	e->local_disabled = is_chan_local_disabled(rstate, chan);
-	e->public = is_chan_public(chan);
-	e->short_channel_id = chan->scid;
-	if (!srcfilter || node_id_eq(&e->node[0], srcfilter))
-		e->e[0] = hc_entry(*entries, chan, 0);
-	else
-		e->e[0] = NULL;
-	if (!srcfilter || node_id_eq(&e->node[1], srcfilter))
-		e->e[1] = hc_entry(*entries, chan, 1);
-	else
-		e->e[1] = NULL;
+			   const struct node_id *srcfilter,
+			   u64 since)
+{
+	struct gossip_getchannels_entry e;
+	struct gossip_halfchannel_entry halves[2];
+
+	if (chan->generation <= since)
+		return false;
+
+	e.node[0] = chan->nodes[0]->id;
+	e.node[1] = chan->nodes[1]->id;
+	e.sat = chan->sat;
+	e.local_disabled = is_chan_local_disabled(rstate, chan);
+	e.public = is_chan_public(chan);
+	e.short_channel_id = chan->scid;
+	for (int i = 0; i < 2; i++) {
+		if ((!srcfilter || node_id_eq(&e.node[i], srcfilter))
+		    && hc_entry(chan, i, &halves[i]))
+			e.e[i] = &halves[i];
+		else
+			e.e[i] = NULL;
+	}
 
 	/* We choose not to tell lightningd about channels with no updates,
 	 * as they're unusable and can't be represented in the listchannels
 	 * JSON output we use anyway. */
-	if (e->e[0] || e->e[1])
-		tal_arr_expand(entries, e);
+	if (!e.e[0] && !e.e[1])
+		return false;
+
+	towire_gossip_getchannels_entry(entries, &e);
+	return true;
+}
+
+/* If they didn't say since, or it's before we started remembering what we
+ * removed, they get everything (and we say so). */
+static u64 changed_since(const struct routing_state *rstate,
+			 const u64 *since, bool *full)
+{
+	*full = !since || *since < rstate->removed_horizon;
+	return *full ? 0 : *since;
 }
 
 /*~ This is where lightningd asks for all channels we know about. */
@@ -2575,33 +3163,36 @@ static struct io_plan *getchannels_req(struct io_conn *conn,
 				       struct daemon *daemon,
 				       const u8 *msg)
 {
-	u8 *out;
-	const struct gossip_getchannels_entry **entries;
+	struct routing_state *rstate = daemon->rstate;
+	u8 *out, *entries = tal_arr(tmpctx, u8, 0);
 	struct chan *chan;
-	struct short_channel_id *scid, *prev;
+	struct short_channel_id *scid, *prev, *removed;
 	struct node_id *source;
-	bool complete = true;
+	u64 *since, after;
+	size_t num_entries = 0;
+	bool complete = true, full;
 
 	/* Note: scid is marked optional in gossip_wire.csv */
 	if (!fromwire_gossip_getchannels_request(msg, msg, &scid, &source,
-						 &prev))
+						 &prev, &since))
 		master_badmsg(WIRE_GOSSIP_GETCHANNELS_REQUEST, msg);
 
-	entries = tal_arr(tmpctx, const struct gossip_getchannels_entry *, 0);
+	after = changed_since(rstate, since, &full);
+
 	/* They can ask about a particular channel by short_channel_id */
 	if (scid) {
-		chan = get_channel(daemon->rstate, scid);
+		chan = get_channel(rstate, scid);
 		if (chan)
-			append_channel(daemon->rstate, &entries, chan, NULL);
+			append_channel(rstate, &entries, chan, NULL, after);
 	} else if (source) {
-		struct node *s = get_node(daemon->rstate, source);
+		struct node *s = get_node(rstate, source);
 		if (s) {
 			struct chan_map_iter i;
 			struct chan *c;
 
 			for (c = first_chan(s, &i); c; c = next_chan(s, &i)) {
-				append_channel(daemon->rstate,
-					       &entries, c, source);
+				append_channel(rstate, &entries, c, source,
+					       after);
 			}
 		}
 	} else {
@@ -2611,87 +3202,109 @@ static struct io_plan *getchannels_req(struct io_conn *conn,
 		 * short channel id, starting with previous if any (there is
 		 * no scid 0). */
 		idx = prev ? prev->u64 : 0;
-		while ((chan = uintmap_after(&daemon->rstate->chanmap, &idx))) {
-			append_channel(daemon->rstate, &entries, chan, NULL);
+		while ((chan = uintmap_after(&rstate->chanmap, &idx))) {
+			if (!append_channel(rstate, &entries, chan, NULL,
+					    after))
+				continue;
 			/* Limit how many we do at once. */
-			if (tal_count(entries) == 4096) {
+			if (++num_entries == 4096) {
 				complete = false;
 				break;
 			}
 		}
 	}
 
-	out = towire_gossip_getchannels_reply(NULL, complete, entries);
+	/* We don't know which node a removed channel was from, so if they
+	 * asked by source, they get all of them. */
+	removed = tal_arr(tmpctx, struct short_channel_id, 0);
+	if (complete && !full) {
+		const struct removed_chan *r = rstate->removed_chans;
+		size_t i = tal_count(r);
+
+		while (i > 0 && r[i-1].generation > after)
+			i--;
+		for (; i < tal_count(r); i++) {
+			if (!scid || short_channel_id_eq(scid, &r[i].scid))
+				tal_arr_expand(&removed, r[i].scid);
+		}
+	}
+
+	out = towire_gossip_getchannels_reply(NULL, complete,
+					      rstate->generation, full,
+					      removed, entries);
 	daemon_conn_send(daemon->master, take(out));
 	return daemon_conn_read_next(conn, daemon->master);
 }
 
 /*~ Similarly, lightningd asks us for all nodes when it gets `listnodes` */
-/* We keep pointers into n, assuming it won't change. */
-static void add_node_entry(const tal_t *ctx,
-			   struct daemon *daemon,
-			   const struct node *n,
-			   struct gossip_getnodes_entry *e)
-{
-	e->nodeid = n->id;
-	if (get_node_announcement(ctx, daemon, n,
-				  e->color, e->alias,
-				  &e->globalfeatures,
-				  &e->addresses)) {
-		e->last_timestamp = n->bcast.timestamp;
+static void append_node(struct daemon *daemon, u8 **entries,
+			const struct node *n)
+{
+	struct gossip_getnodes_entry e;
+
+	e.nodeid = n->id;
+	if (get_node_announcement(tmpctx, daemon, n,
+				  e.color, e.alias,
+				  &e.globalfeatures,
+				  &e.addresses)) {
+		e.last_timestamp = n->bcast.timestamp;
 	} else {
 		/* Timestamp on wire is an unsigned 32 bit: we use a 64-bit
 		 * signed, so -1 means "we never received a
 		 * channel_update". */
-		e->last_timestamp = -1;
+		e.last_timestamp = -1;
 	}
+	towire_gossip_getnodes_entry(entries, &e);
 }
 
 /* Simply routine when they ask for `listnodes` */
 static struct io_plan *getnodes(struct io_conn *conn, struct daemon *daemon,
 				const u8 *msg)
 {
-	u8 *out;
+	struct routing_state *rstate = daemon->rstate;
+	u8 *out, *entries = tal_arr(tmpctx, u8, 0);
 	struct node *n;
-	const struct gossip_getnodes_entry **nodes;
-	struct gossip_getnodes_entry *node_arr;
-	struct node_id *id;
+	struct node_id *id, *removed;
+	u64 *since, after;
+	bool full;
 
-	if (!fromwire_gossip_getnodes_request(tmpctx, msg, &id))
+	if (!fromwire_gossip_getnodes_request(tmpctx, msg, &id, &since))
 		master_badmsg(WIRE_GOSSIP_GETNODES_REQUEST, msg);
 
+	after = changed_since(rstate, since, &full);
+
 	/* Format of reply is the same whether they ask for a specific node
 	 * (0 or one responses) or all nodes (0 or more) */
 	if (id) {
-		n = get_node(daemon->rstate, id);
-		if (n) {
-			node_arr = tal_arr(tmpctx,
-					   struct gossip_getnodes_entry,
-					   1);
-			add_node_entry(node_arr, daemon, n, &node_arr[0]);
-		} else {
-			nodes = NULL;
-			node_arr = NULL;
-		}
+		n = get_node(rstate, id);
+		if (n && n->generation > after)
+			append_node(daemon, &entries, n);
 	} else {
 		struct node_map_iter it;
-		size_t i = 0;
-		node_arr = tal_arr(tmpctx, struct gossip_getnodes_entry,
-				   daemon->rstate->nodes->raw.elems);
-		n = node_map_first(daemon->rstate->nodes, &it);
-		while (n != NULL) {
-			add_node_entry(node_arr, daemon, n, &node_arr[i++]);
-			n = node_map_next(daemon->rstate->nodes, &it);
+
+		for (n = node_map_first(rstate->nodes, &it);
+		     n;
+		     n = node_map_next(rstate->nodes, &it)) {
+			if (n->generation > after)
+				append_node(daemon, &entries, n);
+		}
+	}
+
+	removed = tal_arr(tmpctx, struct node_id, 0);
+	if (!full) {
+		const struct removed_node *r = rstate->removed_nodes;
+		size_t i = tal_count(r);
+
+		while (i > 0 && r[i-1].generation > after)
+			i--;
+		for (; i < tal_count(r); i++) {
+			if (!id || node_id_eq(id, &r[i].id))
+				tal_arr_expand(&removed, r[i].id);
 		}
-		assert(i == daemon->rstate->nodes->raw.elems);
 	}
 
-	/* FIXME: towire wants array of pointers. */
-	nodes = tal_arr(node_arr, const struct gossip_getnodes_entry *,
-			tal_count(node_arr));
-	for (size_t i = 0; i < tal_count(node_arr); i++)
-		nodes[i] = &node_arr[i];
-	out = towire_gossip_getnodes_reply(NULL, nodes);
+	out = towire_gossip_getnodes_reply(NULL, rstate->generation, full,
+					   removed, entries);
 	daemon_conn_send(daemon->master, take(out));
 	return daemon_conn_read_next(conn, daemon->master);
 }
@@ -2753,8 +3366,8 @@ out:
 
 /*~ If a node has no public channels (other than the one to us), it's not
  * a very useful route to tell anyone about. */
-static bool node_has_public_channels(const struct node *peer,
-				     const struct chan *exclude)
+static bool node_has_other_public_channels(const struct node *peer,
+					   const struct chan *exclude)
 {
 	struct chan_map_iter i;
 	struct chan *c;
@@ -2829,7 +3442,7 @@ static struct io_plan *get_incoming_channels(struct io_conn *conn,
 
 			/* If peer doesn't have other public channels,
 			 * no point giving route */
-			if (!node_has_public_channels(other_node(node, c), c))
+			if (!node_has_other_public_channels(other_node(node, c), c))
 				continue;
 
 			if (always_expose(exposeprivate) || is_chan_public(c))
@@ -3022,6 +3635,9 @@ static struct io_plan *dev_gossip_memleak(struct io_conn *conn,
 	struct htable *memtable;
 	bool found_leak;
 
+	/* Don't scan memory while a route thread is scribbling on it. */
+	route_pool_wait_idle(daemon->route_pool);
+	route_pool_wait_idle(daemon->verify_pool);
 	memtable = memleak_enter_allocations(tmpctx, msg, msg);
 
 	/* Now delete daemon and those which it has pointers to. */
@@ -3035,15 +3651,43 @@ static struct io_plan *dev_gossip_memleak(struct io_conn *conn,
 	return daemon_conn_read_next(conn, daemon->master);
 }
 
+/*~ Compacting a large gossip_store takes a while, so we do it a slice at a
+ * time, going back to the io_loop in between: peers keep getting served
+ * (from the old store) meanwhile. */
+#define COMPACT_SLICE_BYTES (1024 * 1024)
+
+static void compact_store_slice(struct daemon *daemon)
+{
+	bool ok;
+
+	if (gossip_store_compact_step(daemon->rstate->gs, COMPACT_SLICE_BYTES,
+				      &ok)) {
+		notleak(new_reltimer(&daemon->timers, daemon,
+				     time_from_msec(0),
+				     compact_store_slice, daemon));
+		return;
+	}
+
+	for (; daemon->compact_waiting; daemon->compact_waiting--)
+		daemon_conn_send(daemon->master,
+				 take(towire_gossip_dev_compact_store_reply(NULL,
+									    ok)));
+}
+
 static struct io_plan *dev_compact_store(struct io_conn *conn,
 					 struct daemon *daemon,
 					 const u8 *msg)
 {
-	bool done = gossip_store_compact(daemon->rstate->gs);
+	if (!gossip_store_compact_start(daemon->rstate->gs)) {
+		daemon_conn_send(daemon->master,
+				 take(towire_gossip_dev_compact_store_reply(NULL,
+									    false)));
+		return daemon_conn_read_next(conn, daemon->master);
+	}
 
-	daemon_conn_send(daemon->master,
-			 take(towire_gossip_dev_compact_store_reply(NULL,
-								    done)));
+	/* If we're already compacting, this one gets the same answer. */
+	if (daemon->compact_waiting++ == 0)
+		compact_store_slice(daemon);
 	return daemon_conn_read_next(conn, daemon->master);
 }
 #endif /* DEVELOPER */
@@ -3278,6 +3922,15 @@ static struct io_plan *recv_req(struct io_conn *conn,
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
 		return getroute_req(conn, daemon, msg);
 
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
+		return getroutes_req(conn, daemon, msg);
+
+	case WIRE_GOSSIP_GETROUTETREE_REQUEST:
+		return getroutetree_req(conn, daemon, msg);
+
+	case WIRE_GOSSIP_GETROUTESTATS_REQUEST:
+		return getroutestats_req(conn, daemon, msg);
+
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 		return getchannels_req(conn, daemon, msg);
 
@@ -3334,6 +3987,9 @@ static struct io_plan *recv_req(struct io_conn *conn,
 	/* We send these, we don't receive them */
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
+	case WIRE_GOSSIP_GETROUTETREE_REPLY:
+	case WIRE_GOSSIP_GETROUTESTATS_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_PING_REPLY:
 	case WIRE_GOSSIP_SCIDS_REPLY:
@@ -3372,6 +4028,7 @@ int main(int argc, char *argv[])
 	list_head_init(&daemon->peers);
 	daemon->unknown_scids = tal_arr(daemon, struct short_channel_id, 0);
 	daemon->gossip_missing = NULL;
+	daemon->compact_waiting = 0;
 
 	/* Note the use of time_mono() here.  That's a monotonic clock, which
 	 * is really useful: it can only be used to measure relative events
@@ -0,0 +1,230 @@
+/*~ A node which pays the same few destinations over and over would find
+ * the same route every time: so we remember them.  The hard part of any
+ * cache is knowing when an answer has gone stale; here the routing state
+ * stamps every channel with the generation it last changed at, and an
+ * answer is only good while none of its channels have changed since it
+ * was found.  This file just does the remembering: routing.c decides. */
+#include "route_cache.h"
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/htable/htable_type.h>
+#include <ccan/ilog/ilog.h>
+#include <common/utils.h>
+#include <stdlib.h>
+
+static const struct route_cache_key *
+entry_key(const struct route_cache_entry *entry)
+{
+	return &entry->key;
+}
+
+static size_t hash_key(const struct route_cache_key *key)
+{
+	/* We're not exposed to untrusted input here: a fixed seed is fine. */
+	static const struct siphash_seed seed;
+	struct siphash24_ctx ctx;
+
+	siphash24_init(&ctx, &seed);
+	siphash24_u8(&ctx, key->from_me);
+	if (!key->from_me)
+		siphash24_update(&ctx, &key->source, sizeof(key->source));
+	siphash24_update(&ctx, &key->destination, sizeof(key->destination));
+	siphash24_u32(&ctx, key->amount_bucket);
+	siphash24_update(&ctx, &key->riskfactor, sizeof(key->riskfactor));
+	siphash24_update(&ctx, &key->fuzz, sizeof(key->fuzz));
+	siphash24_u32(&ctx, key->max_hops);
+	siphash24_u32(&ctx, key->max_routes);
+	for (size_t i = 0; i < tal_count(key->excluded); i++) {
+		siphash24_u64(&ctx, key->excluded[i].scid.u64);
+		siphash24_u8(&ctx, key->excluded[i].dir);
+	}
+	return siphash24_done(&ctx);
+}
+
+static bool excluded_eq(const struct short_channel_id_dir *a,
+			const struct short_channel_id_dir *b)
+{
+	if (tal_count(a) != tal_count(b))
+		return false;
+	for (size_t i = 0; i < tal_count(a); i++) {
+		if (!short_channel_id_eq(&a[i].scid, &b[i].scid)
+		    || a[i].dir != b[i].dir)
+			return false;
+	}
+	return true;
+}
+
+static bool entry_eq(const struct route_cache_entry *entry,
+		     const struct route_cache_key *key)
+{
+	const struct route_cache_key *k = &entry->key;
+
+	if (k->from_me != key->from_me)
+		return false;
+	if (!k->from_me && !node_id_eq(&k->source, &key->source))
+		return false;
+	/* We hash the doubles' bits, so compare those too. */
+	return node_id_eq(&k->destination, &key->destination)
+		&& k->amount_bucket == key->amount_bucket
+		&& memcmp(&k->riskfactor, &key->riskfactor,
+			  sizeof(k->riskfactor)) == 0
+		&& memcmp(&k->fuzz, &key->fuzz, sizeof(k->fuzz)) == 0
+		&& k->max_hops == key->max_hops
+		&& k->max_routes == key->max_routes
+		&& excluded_eq(k->excluded, key->excluded);
+}
+HTABLE_DEFINE_TYPE(struct route_cache_entry,
+		   entry_key, hash_key, entry_eq, route_cache_map);
+
+struct route_cache {
+	struct route_cache_map map;
+	/* Most recently used first. */
+	struct list_head entries;
+	size_t num_entries, max_entries;
+	u32 max_age;
+	u64 hits, misses, invalidated;
+};
+
+u32 route_cache_amount_bucket(struct amount_msat msat)
+{
+	u64 v = msat.millisatoshis; /* Raw: bucketing */
+	int bits = ilog64(v);
+	u32 below;
+
+	/* Tiny amounts are their own bucket. */
+	if (bits <= 3)
+		return v;
+
+	below = (v >> (bits - 3)) & 3;
+	return (bits << 2) | below;
+}
+
+static int excluded_cmp(const void *va, const void *vb)
+{
+	const struct short_channel_id_dir *a = va, *b = vb;
+
+	if (a->scid.u64 != b->scid.u64)
+		return a->scid.u64 < b->scid.u64 ? -1 : 1;
+	return a->dir - b->dir;
+}
+
+struct short_channel_id_dir *
+route_cache_sort_excluded(const tal_t *ctx,
+			  const struct short_channel_id_dir *excluded)
+{
+	struct short_channel_id_dir *sorted;
+
+	sorted = tal_dup_arr(ctx, struct short_channel_id_dir, excluded,
+			     tal_count(excluded), 0);
+	qsort(sorted, tal_count(sorted), sizeof(sorted[0]), excluded_cmp);
+	return sorted;
+}
+
+static void destroy_route_cache(struct route_cache *cache)
+{
+	route_cache_map_clear(&cache->map);
+}
+
+struct route_cache *new_route_cache(const tal_t *ctx, size_t max_entries,
+				    u32 max_age)
+{
+	struct route_cache *cache = tal(ctx, struct route_cache);
+
+	route_cache_map_init(&cache->map);
+	list_head_init(&cache->entries);
+	cache->num_entries = 0;
+	cache->max_entries = max_entries;
+	cache->max_age = max_age;
+	cache->hits = cache->misses = cache->invalidated = 0;
+	tal_add_destructor(cache, destroy_route_cache);
+	return cache;
+}
+
+static void forget_entry(struct route_cache *cache,
+			 struct route_cache_entry *entry)
+{
+	route_cache_map_del(&cache->map, entry);
+	list_del_from(&cache->entries, &entry->list);
+	cache->num_entries--;
+	tal_free(entry);
+}
+
+const struct route_cache_entry *
+route_cache_get_(struct route_cache *cache,
+		 const struct route_cache_key *key,
+		 u64 now,
+		 bool (*valid)(const struct route_cache_entry *entry,
+			       void *arg),
+		 void *arg)
+{
+	struct route_cache_entry *entry;
+
+	entry = route_cache_map_get(&cache->map, key);
+	if (!entry) {
+		cache->misses++;
+		return NULL;
+	}
+
+	if (now > entry->expires) {
+		forget_entry(cache, entry);
+		cache->misses++;
+		return NULL;
+	}
+
+	if (!valid(entry, arg)) {
+		forget_entry(cache, entry);
+		cache->invalidated++;
+		cache->misses++;
+		return NULL;
+	}
+
+	list_del_from(&cache->entries, &entry->list);
+	list_add(&cache->entries, &entry->list);
+	cache->hits++;
+	return entry;
+}
+
+void route_cache_add(struct route_cache *cache,
+		     const struct route_cache_key *key,
+		     u64 generation,
+		     u64 now,
+		     const size_t *route_lens,
+		     const struct short_channel_id_dir *path)
+{
+	struct route_cache_entry *entry;
+
+	if (cache->max_entries == 0)
+		return;
+
+	/* Someone else asked the same thing while we were searching? */
+	entry = route_cache_map_get(&cache->map, key);
+	if (entry)
+		forget_entry(cache, entry);
+	else if (cache->num_entries == cache->max_entries)
+		forget_entry(cache, list_tail(&cache->entries,
+					      struct route_cache_entry, list));
+
+	entry = tal(cache, struct route_cache_entry);
+	entry->key = *key;
+	entry->key.excluded = tal_dup_arr(entry, struct short_channel_id_dir,
+					  key->excluded,
+					  tal_count(key->excluded), 0);
+	entry->generation = generation;
+	entry->expires = now + cache->max_age;
+	entry->route_lens = tal_dup_arr(entry, size_t, route_lens,
+					tal_count(route_lens), 0);
+	entry->path = tal_dup_arr(entry, struct short_channel_id_dir, path,
+				  tal_count(path), 0);
+
+	route_cache_map_add(&cache->map, entry);
+	list_add(&cache->entries, &entry->list);
+	cache->num_entries++;
+}
+
+void route_cache_get_stats(const struct route_cache *cache,
+			   struct route_cache_stats *stats)
+{
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->invalidated = cache->invalidated;
+	stats->entries = cache->num_entries;
+}
@@ -0,0 +1,105 @@
+#ifndef LIGHTNING_GOSSIPD_ROUTE_CACHE_H
+#define LIGHTNING_GOSSIPD_ROUTE_CACHE_H
+#include "config.h"
+#include <bitcoin/short_channel_id.h>
+#include <ccan/list/list.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+#include <common/amount.h>
+#include <common/node_id.h>
+
+/* What a cached route was asked for.  Anything which changes the answer
+ * is in here, except the exact amount and final cltv: those only change
+ * the fees and delays along the route, which we recalculate anyway. */
+struct route_cache_key {
+	/* If from_me, source is ignored. */
+	bool from_me;
+	struct node_id source, destination;
+	/* See route_cache_amount_bucket(). */
+	u32 amount_bucket;
+	double riskfactor;
+	double fuzz;
+	u32 max_hops;
+	u32 max_routes;
+	/* Sorted, so the order they're given in doesn't matter. */
+	struct short_channel_id_dir *excluded;
+};
+
+struct route_cache_entry {
+	/* In route_cache->entries, most recently used first. */
+	struct list_node list;
+	struct route_cache_key key;
+	/* Routing state generation the routes were found at. */
+	u64 generation;
+	/* Seconds since epoch (gossip time) after which we forget it. */
+	u64 expires;
+	/* Route i is route_lens[i] long: they're all flattened into path. */
+	size_t *route_lens;
+	struct short_channel_id_dir *path;
+};
+
+struct route_cache_stats {
+	/* Queries answered from the cache. */
+	u64 hits;
+	/* Queries we had to search for (including invalidated ones). */
+	u64 misses;
+	/* Cached routes thrown away because the network changed. */
+	u64 invalidated;
+	/* Routes cached now. */
+	u32 entries;
+};
+
+/* Amounts within 25% of each other (same most significant bit, and the
+ * same two bits below that) share a bucket. */
+u32 route_cache_amount_bucket(struct amount_msat msat);
+
+/* Sorted copy of @excluded, suitable for route_cache_key. */
+struct short_channel_id_dir *
+route_cache_sort_excluded(const tal_t *ctx,
+			  const struct short_channel_id_dir *excluded);
+
+/**
+ * new_route_cache - a cache of routes found recently.
+ * @ctx: context to allocate from.
+ * @max_entries: most routes to remember (least recently used go first).
+ * @max_age: how many seconds to remember a route for.
+ */
+struct route_cache *new_route_cache(const tal_t *ctx, size_t max_entries,
+				    u32 max_age);
+
+/**
+ * route_cache_get - find a cached answer.
+ * @cache: the cache.
+ * @key: what we're being asked.
+ * @now: seconds since epoch.
+ * @valid: called if we find one: if it returns false, it's stale.
+ * @arg: argument for @valid.
+ *
+ * Returns NULL (and forgets any stale answer) if there isn't a good one.
+ */
+#define route_cache_get(cache, key, now, valid, arg)			\
+	route_cache_get_((cache), (key), (now),				\
+			 typesafe_cb_preargs(bool, void *, (valid), (arg), \
+					     const struct route_cache_entry *), \
+			 (arg))
+
+const struct route_cache_entry *
+route_cache_get_(struct route_cache *cache,
+		 const struct route_cache_key *key,
+		 u64 now,
+		 bool (*valid)(const struct route_cache_entry *entry,
+			       void *arg),
+		 void *arg);
+
+/* Remember an answer (replacing any for the same @key). */
+void route_cache_add(struct route_cache *cache,
+		     const struct route_cache_key *key,
+		     u64 generation,
+		     u64 now,
+		     const size_t *route_lens,
+		     const struct short_channel_id_dir *path);
+
+void route_cache_get_stats(const struct route_cache *cache,
+			   struct route_cache_stats *stats);
+#endif /* LIGHTNING_GOSSIPD_ROUTE_CACHE_H */
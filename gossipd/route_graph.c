@@ -0,0 +1,1408 @@
+#include "route_graph.h"
+#include <assert.h>
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <common/type_to_string.h>
+#include <gossipd/routing.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+#ifndef SUPERVERBOSE
+#define SUPERVERBOSE(...)
+#endif
+
+/* Too big to reach, but don't overflow if added. */
+#define INFINITE AMOUNT_MSAT(0x3FFFFFFFFFFFFFFFULL)
+
+/* For nodes not in the heap (not reached, or visited) */
+#define HEAPIDX_NONE UINT32_MAX
+
+/* For nodes we reached without using an edge (ie. the destination) */
+#define EDGE_NONE UINT32_MAX
+
+/* For searches where we do pay fees on the first hop */
+#define NODE_NONE UINT32_MAX
+
+static int node_id_order(const void *a, const void *b)
+{
+	return node_id_cmp(a, b);
+}
+
+static bool find_node_id(const struct node_id *ids, size_t num,
+			 const struct node_id *id, u32 *idx)
+{
+	size_t lo = 0, hi = num;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		int cmp = node_id_cmp(id, &ids[mid]);
+		if (cmp == 0) {
+			*idx = mid;
+			return true;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return false;
+}
+
+bool route_graph_node_idx(const struct route_graph *graph,
+			  const struct node_id *id, u32 *idx)
+{
+	return find_node_id(graph->ids, tal_count(graph->ids), id, idx);
+}
+
+u32 route_graph_edge_dst(const struct route_graph *graph, u32 edge)
+{
+	size_t lo = 0, hi = route_graph_num_nodes(graph);
+
+	assert(edge < tal_count(graph->edges));
+
+	/* Find the last node whose edges start at or before edge. */
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (graph->edge_start[mid] <= edge)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void fill_edge(struct route_graph_edge *e,
+		      struct routing_state *rstate,
+		      const struct chan *chan, int dir)
+{
+	const struct half_chan *hc = &chan->half[dir];
+
+	e->scid = chan->scid;
+	e->htlc_minimum = hc->htlc_minimum;
+	e->htlc_maximum = hc->htlc_maximum;
+	e->base_fee = hc->base_fee;
+	e->proportional_fee = hc->proportional_fee;
+	e->delay = hc->delay;
+	e->direction = dir;
+	e->routable = is_halfchan_enabled(hc)
+		&& !is_chan_local_disabled(rstate, chan);
+}
+
+struct route_graph *route_graph_new(const tal_t *ctx,
+				    struct routing_state *rstate)
+{
+	struct route_graph *graph = tal(ctx, struct route_graph);
+	struct node_map_iter it;
+	struct node *n;
+	size_t num_nodes = 0, num_edges = 0;
+
+	for (n = node_map_first(rstate->nodes, &it);
+	     n;
+	     n = node_map_next(rstate->nodes, &it)) {
+		struct chan_map_iter i;
+
+		num_nodes++;
+		for (struct chan *c = first_chan(n, &i); c; c = next_chan(n, &i))
+			num_edges++;
+	}
+
+	graph->ids = tal_arr(graph, struct node_id, num_nodes);
+	num_nodes = 0;
+	for (n = node_map_first(rstate->nodes, &it);
+	     n;
+	     n = node_map_next(rstate->nodes, &it))
+		graph->ids[num_nodes++] = n->id;
+	qsort(graph->ids, num_nodes, sizeof(graph->ids[0]), node_id_order);
+
+	graph->edge_start = tal_arr(graph, u32, num_nodes + 1);
+	graph->edges = tal_arr(graph, struct route_graph_edge, num_edges);
+
+	/* Saves a bsearch for the other end of every edge. */
+	for (size_t i = 0; i < num_nodes; i++)
+		get_node(rstate, &graph->ids[i])->graph_idx = i;
+
+	num_edges = 0;
+	for (size_t i = 0; i < num_nodes; i++) {
+		struct chan_map_iter cit;
+		struct chan *c;
+
+		graph->edge_start[i] = num_edges;
+		n = get_node(rstate, &graph->ids[i]);
+		for (c = first_chan(n, &cit); c; c = next_chan(n, &cit)) {
+			struct route_graph_edge *e = &graph->edges[num_edges++];
+			/* We want the half which leads to n */
+			int dir = half_chan_to(n, c);
+
+			fill_edge(e, rstate, c, dir);
+			e->src = c->nodes[dir]->graph_idx;
+		}
+	}
+	graph->edge_start[num_nodes] = num_edges;
+	graph->readers = 0;
+
+	return graph;
+}
+
+bool route_graph_chan_edge(const struct route_graph *graph,
+			   const struct chan *chan, int dir, u32 *edge)
+{
+	u32 dst;
+
+	if (!route_graph_node_idx(graph, &chan->nodes[!dir]->id, &dst))
+		return false;
+
+	for (u32 i = graph->edge_start[dst]; i < graph->edge_start[dst+1]; i++) {
+		if (short_channel_id_eq(&graph->edges[i].scid, &chan->scid)) {
+			*edge = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool route_graph_update_chan(struct route_graph *graph,
+			     struct routing_state *rstate,
+			     const struct chan *chan)
+{
+	bool cheaper = false;
+
+	for (int dir = 0; dir < 2; dir++) {
+		u32 edge, old_base_fee;
+
+		/* It's not there yet if it's waiting to be merged in. */
+		if (!route_graph_chan_edge(graph, chan, dir, &edge))
+			return false;
+		old_base_fee = graph->edges[edge].base_fee;
+		fill_edge(&graph->edges[edge], rstate, chan, dir);
+		if (graph->edges[edge].base_fee < old_base_fee)
+			cheaper = true;
+	}
+	return cheaper;
+}
+
+void route_graph_disable_chan(struct route_graph *graph,
+			      const struct chan *chan)
+{
+	for (int dir = 0; dir < 2; dir++) {
+		u32 edge;
+
+		if (route_graph_chan_edge(graph, chan, dir, &edge))
+			graph->edges[edge].routable = false;
+	}
+}
+
+/* Channels to merge into a graph, and everything the merge writes: it
+ * runs in another thread, so it can't allocate. */
+struct route_graph_merge {
+	const struct route_graph *old;
+	size_t num_old_nodes;
+
+	/* Sorted: the edges of these are left out. */
+	struct short_channel_id *removed;
+	size_t num_removed;
+
+	/* Sorted, unique ids of the nodes of the added channels. */
+	struct node_id *add_ids;
+	size_t num_add_ids;
+	/* Both halves of each added channel: src (and dst) are indices into
+	 * add_ids. */
+	struct route_graph_edge *add_edges;
+	u32 *add_dst;
+	size_t num_add_edges;
+
+	/* The new graph, big enough for everything until we're done. */
+	struct route_graph *graph;
+	size_t num_nodes, num_edges;
+
+	/* Where the old graph's nodes, and add_ids, end up; then, once
+	 * nodes without channels are dropped, where those end up. */
+	u32 *old_map, *add_map, *remap;
+	/* Edges into each node, then where its next edge goes. */
+	u32 *count;
+};
+
+static int scid_order(const void *a, const void *b)
+{
+	const struct short_channel_id *sa = a, *sb = b;
+
+	if (sa->u64 < sb->u64)
+		return -1;
+	return sa->u64 > sb->u64;
+}
+
+struct route_graph_merge *route_graph_merge_new(const tal_t *ctx,
+						struct routing_state *rstate,
+						const struct route_graph *old,
+						const struct short_channel_id *removed,
+						struct chan **added)
+{
+	struct route_graph_merge *m = tal(ctx, struct route_graph_merge);
+	size_t num_added = tal_count(added), max_nodes, max_edges;
+
+	m->old = old;
+	m->num_old_nodes = route_graph_num_nodes(old);
+
+	m->num_removed = tal_count(removed);
+	m->removed = tal_dup_arr(m, struct short_channel_id, removed,
+				 m->num_removed, 0);
+	qsort(m->removed, m->num_removed, sizeof(m->removed[0]), scid_order);
+
+	m->add_ids = tal_arr(m, struct node_id, num_added * 2);
+	for (size_t i = 0; i < num_added; i++) {
+		m->add_ids[i * 2] = added[i]->nodes[0]->id;
+		m->add_ids[i * 2 + 1] = added[i]->nodes[1]->id;
+	}
+	qsort(m->add_ids, num_added * 2, sizeof(m->add_ids[0]),
+	      node_id_order);
+	m->num_add_ids = 0;
+	for (size_t i = 0; i < num_added * 2; i++) {
+		if (m->num_add_ids
+		    && node_id_eq(&m->add_ids[m->num_add_ids - 1],
+				  &m->add_ids[i]))
+			continue;
+		m->add_ids[m->num_add_ids++] = m->add_ids[i];
+	}
+
+	/* The thread can't look at the channels: fill in their edges now. */
+	m->num_add_edges = num_added * 2;
+	m->add_edges = tal_arr(m, struct route_graph_edge, m->num_add_edges);
+	m->add_dst = tal_arr(m, u32, m->num_add_edges);
+	for (size_t i = 0; i < m->num_add_edges; i++) {
+		const struct chan *chan = added[i / 2];
+		int dir = i % 2;
+		struct route_graph_edge *e = &m->add_edges[i];
+
+		fill_edge(e, rstate, chan, dir);
+		if (!find_node_id(m->add_ids, m->num_add_ids,
+				  &chan->nodes[dir]->id, &e->src)
+		    || !find_node_id(m->add_ids, m->num_add_ids,
+				     &chan->nodes[!dir]->id, &m->add_dst[i]))
+			abort();
+	}
+
+	/* None of these are written yet, so they cost little. */
+	max_nodes = m->num_old_nodes + m->num_add_ids;
+	max_edges = tal_count(old->edges) + m->num_add_edges;
+	m->graph = tal(m, struct route_graph);
+	m->graph->ids = tal_arr(m->graph, struct node_id, max_nodes);
+	m->graph->edge_start = tal_arr(m->graph, u32, max_nodes + 1);
+	m->graph->edges = tal_arr(m->graph, struct route_graph_edge, max_edges);
+	m->graph->readers = 0;
+
+	m->old_map = tal_arr(m, u32, m->num_old_nodes);
+	m->add_map = tal_arr(m, u32, m->num_add_ids);
+	m->remap = tal_arr(m, u32, max_nodes);
+	m->count = tal_arr(m, u32, max_nodes);
+	return m;
+}
+
+static bool merge_removed(const struct route_graph_merge *m,
+			  const struct short_channel_id *scid)
+{
+	size_t lo = 0, hi = m->num_removed;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (scid->u64 == m->removed[mid].u64)
+			return true;
+		if (scid->u64 < m->removed[mid].u64)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return false;
+}
+
+void route_graph_merge_run(struct route_graph_merge *m)
+{
+	const struct route_graph *old = m->old;
+	struct route_graph *graph = m->graph;
+	size_t i = 0, j = 0, n = 0;
+
+	/* Both lists of nodes are sorted: merge them. */
+	while (i < m->num_old_nodes || j < m->num_add_ids) {
+		int cmp;
+
+		if (i == m->num_old_nodes)
+			cmp = 1;
+		else if (j == m->num_add_ids)
+			cmp = -1;
+		else
+			cmp = node_id_cmp(&old->ids[i], &m->add_ids[j]);
+
+		if (cmp <= 0) {
+			graph->ids[n] = old->ids[i];
+			m->old_map[i++] = n;
+		} else
+			graph->ids[n] = m->add_ids[j];
+		if (cmp >= 0)
+			m->add_map[j++] = n;
+		m->count[n++] = 0;
+	}
+
+	for (i = 0; i < m->num_old_nodes; i++) {
+		for (u32 e = old->edge_start[i]; e < old->edge_start[i+1]; e++) {
+			if (!merge_removed(m, &old->edges[e].scid))
+				m->count[m->old_map[i]]++;
+		}
+	}
+	for (i = 0; i < m->num_add_edges; i++)
+		m->count[m->add_map[m->add_dst[i]]]++;
+
+	/* A node whose channels all went goes too.  No edge leads from it,
+	 * since both halves of a channel come and go together. */
+	m->num_nodes = 0;
+	for (i = 0; i < n; i++) {
+		if (!m->count[i])
+			continue;
+		graph->ids[m->num_nodes] = graph->ids[i];
+		m->count[m->num_nodes] = m->count[i];
+		m->remap[i] = m->num_nodes++;
+	}
+
+	graph->edge_start[0] = 0;
+	for (i = 0; i < m->num_nodes; i++) {
+		graph->edge_start[i+1] = graph->edge_start[i] + m->count[i];
+		m->count[i] = graph->edge_start[i];
+	}
+	m->num_edges = graph->edge_start[m->num_nodes];
+
+	for (i = 0; i < m->num_old_nodes; i++) {
+		u32 dst = m->remap[m->old_map[i]];
+
+		for (u32 e = old->edge_start[i]; e < old->edge_start[i+1]; e++) {
+			struct route_graph_edge *edge;
+
+			if (merge_removed(m, &old->edges[e].scid))
+				continue;
+			edge = &graph->edges[m->count[dst]++];
+			*edge = old->edges[e];
+			edge->src = m->remap[m->old_map[edge->src]];
+		}
+	}
+	for (i = 0; i < m->num_add_edges; i++) {
+		u32 dst = m->remap[m->add_map[m->add_dst[i]]];
+		struct route_graph_edge *edge = &graph->edges[m->count[dst]++];
+
+		*edge = m->add_edges[i];
+		edge->src = m->remap[m->add_map[edge->src]];
+	}
+}
+
+struct route_graph *route_graph_merge_done(const tal_t *ctx,
+					   struct route_graph_merge *m)
+{
+	struct route_graph *graph = tal_steal(ctx, m->graph);
+
+	tal_resize(&graph->ids, m->num_nodes);
+	tal_resize(&graph->edge_start, m->num_nodes + 1);
+	tal_resize(&graph->edges, m->num_edges);
+	tal_free(m);
+	return graph;
+}
+
+/* Per-node state for a single search: this lives outside the graph, so
+ * the graph itself is never written while routing. */
+struct dijkstra {
+	/* Total to get to here from target. */
+	struct amount_msat total;
+	/* Total risk premium of this route. */
+	struct amount_msat risk;
+	/* Position in unvisited heap, or HEAPIDX_NONE. */
+	u32 heapidx;
+	/* Edge we leave by on the cheapest route to target, or EDGE_NONE. */
+	u32 next_edge;
+};
+
+/* A binary minheap of nodes, keyed by cost.  Each node records its
+ * position (dijkstra.heapidx), so when we find a cheaper way to reach
+ * it we can simply move it up, rather than searching for it.  The array is
+ * sized for every node once at the start, so no allocation happens while
+ * we're relaxing edges. */
+struct unvisited_entry {
+	u64 cost;
+	u32 node;
+};
+
+struct unvisited {
+	size_t num;
+	struct unvisited_entry *heap;
+	struct dijkstra *d;
+	/* If non-NULL, we add a lower bound on the cost of getting from each
+	 * node to the goal (whose landmark distances these are), scaled by
+	 * goal_scale / 2^32. */
+	const struct route_landmarks *landmarks;
+	const u32 *goal;
+	u64 goal_scale;
+	/* Nodes we've taken from the heap, for statistics. */
+	size_t settled;
+};
+
+/* Everything a search writes.  tal isn't thread-safe, so this is all
+ * allocated up-front, and searching itself never allocates. */
+struct route_graph_scratch {
+	struct dijkstra *d;
+	struct unvisited unvisited;
+	/* Route being built, and best acceptable route so far; a route
+	 * can't visit a node twice, so these hold one edge per node. */
+	u32 *route, *best;
+	size_t route_len, best_len;
+	/* Only for route_graph_find_tree: edges out of node i are
+	 * out_edges[out_start[i]] to out_edges[out_start[i+1]-1]. */
+	u32 *out_start, *out_edges;
+};
+
+struct route_graph_scratch *route_graph_scratch_new(const tal_t *ctx,
+						    const struct route_graph *graph)
+{
+	struct route_graph_scratch *s = tal(ctx, struct route_graph_scratch);
+	size_t num_nodes = route_graph_num_nodes(graph);
+
+	s->d = tal_arr(s, struct dijkstra, num_nodes);
+	/* Every node enters the heap at most once. */
+	s->unvisited.heap = tal_arr(s, struct unvisited_entry, num_nodes);
+	s->unvisited.d = s->d;
+	s->unvisited.landmarks = NULL;
+	s->route = tal_arr(s, u32, num_nodes);
+	s->best = tal_arr(s, u32, num_nodes);
+	s->unvisited.settled = 0;
+	s->out_start = s->out_edges = NULL;
+	return s;
+}
+
+struct route_graph_scratch *
+route_graph_tree_scratch_new(const tal_t *ctx, const struct route_graph *graph)
+{
+	struct route_graph_scratch *s = route_graph_scratch_new(ctx, graph);
+
+	s->out_start = tal_arr(s, u32, route_graph_num_nodes(graph) + 1);
+	s->out_edges = tal_arr(s, u32, tal_count(graph->edges));
+	return s;
+}
+
+size_t route_graph_scratch_settled(const struct route_graph_scratch *s)
+{
+	return s->unvisited.settled;
+}
+
+/* Risk of passing through this channel.
+ *
+ * There are two ways this function is used:
+ *
+ * 1. Normally, riskbias = 1.  A tiny bias here in order to prefer
+ *    shorter routes, all things equal.
+ * 2. Trying to find a shorter route, riskbias > 1.  By adding an extra
+ *    cost to every hop, we're trying to bias against overlength routes.
+ */
+static WARN_UNUSED_RESULT bool risk_add_fee(struct amount_msat *risk,
+					    struct amount_msat msat,
+					    u32 delay, double riskfactor,
+					    u64 riskbias)
+{
+	double r;
+
+	/* Won't overflow on add, just lose precision */
+	r = (double)riskbias + riskfactor * delay * msat.millisatoshis + risk->millisatoshis; /* Raw: to double */
+	if (r > UINT64_MAX)
+		return false;
+	risk->millisatoshis = r; /* Raw: from double */
+	return true;
+}
+
+/* Check that we can fit through this channel's indicated
+ * maximum_ and minimum_msat requirements.
+ */
+static bool edge_can_carry(const struct route_graph_edge *e,
+			   struct amount_msat requiredcap)
+{
+	return amount_msat_greater_eq(e->htlc_maximum, requiredcap) &&
+		amount_msat_less_eq(e->htlc_minimum, requiredcap);
+}
+
+/* Theoretically, this could overflow. */
+static bool fuzz_fee(u64 *fee,
+		     const struct short_channel_id *scid,
+		     double fuzz, const struct siphash_seed *base_seed)
+{
+	u64 fuzzed_fee, h;
+ 	double fee_scale;
+
+	if (fuzz == 0.0)
+		return true;
+
+	h = siphash24(base_seed, scid, sizeof(*scid));
+
+	/* Scale fees for this channel */
+	/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
+	 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
+	 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
+	 */
+	fee_scale = 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
+	fuzzed_fee = *fee * fee_scale;
+	if (fee_scale > 1.0 && fuzzed_fee < *fee)
+		return false;
+	*fee = fuzzed_fee;
+	return true;
+}
+
+/* Can we carry this amount across the channel?  If so, returns true and
+ * sets newtotal and newrisk */
+static bool can_reach(const struct route_graph_edge *e,
+		      bool no_charge,
+		      struct amount_msat total,
+		      struct amount_msat risk,
+		      double riskfactor,
+		      u64 riskbias,
+		      double fuzz, const struct siphash_seed *base_seed,
+		      struct amount_msat *newtotal, struct amount_msat *newrisk)
+{
+	/* FIXME: Bias against smaller channels. */
+	struct amount_msat fee;
+
+	if (!amount_msat_fee(&fee, total, e->base_fee, e->proportional_fee))
+		return false;
+
+  	if (!fuzz_fee(&fee.millisatoshis, &e->scid, fuzz, base_seed)) /* Raw: double manipulation */
+		return false;
+
+	if (no_charge) {
+		*newtotal = total;
+
+		/* We still want to consider the "charge", since it's indicative
+		 * of a bias (we discounted one channel for a reason), but we
+		 * don't pay it.  So we count it as additional risk. */
+		if (!amount_msat_add(newrisk, risk, fee))
+			return false;
+	} else {
+		*newrisk = risk;
+
+		if (!amount_msat_add(newtotal, total, fee))
+			return false;
+	}
+
+	/* Skip a channel if it indicated that it won't route the
+	 * requested amount. */
+	if (!edge_can_carry(e, *newtotal))
+		return false;
+
+	if (!risk_add_fee(newrisk, *newtotal, e->delay, riskfactor, riskbias))
+		return false;
+
+	return true;
+}
+
+/* Returns false on overflow (shouldn't happen!) */
+typedef bool WARN_UNUSED_RESULT costfn_t(struct amount_msat *,
+					 struct amount_msat,
+					 struct amount_msat);
+
+static WARN_UNUSED_RESULT bool
+normal_cost_function(struct amount_msat *cost,
+		     struct amount_msat total, struct amount_msat risk)
+{
+	if (amount_msat_add(cost, total, risk))
+		return true;
+
+	SUPERVERBOSE("Can't add cost of node %s + %s",
+		     type_to_string(tmpctx, struct amount_msat, &total),
+		     type_to_string(tmpctx, struct amount_msat, &risk));
+	return false;
+}
+
+static WARN_UNUSED_RESULT bool
+shortest_cost_function(struct amount_msat *cost,
+		       struct amount_msat total, struct amount_msat risk)
+{
+	*cost = risk;
+	return true;
+}
+
+/* Does totala+riska add up to less than totalb+riskb?
+ * Saves sums if you want them.
+ */
+static bool costs_less(struct amount_msat totala,
+		       struct amount_msat riska,
+		       struct amount_msat *costa,
+		       struct amount_msat totalb,
+		       struct amount_msat riskb,
+		       struct amount_msat *costb,
+		       costfn_t *costfn)
+{
+	struct amount_msat suma, sumb;
+
+	if (!costfn(&suma, totala, riska))
+		return false;
+	if (!costfn(&sumb, totalb, riskb))
+		return false;
+
+	if (costa)
+		*costa = suma;
+	if (costb)
+		*costb = sumb;
+	return amount_msat_less(suma, sumb);
+}
+
+static bool is_excluded(const u32 *excluded, u32 edge)
+{
+	size_t lo = 0, hi = tal_count(excluded);
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (excluded[mid] == edge)
+			return true;
+		if (excluded[mid] < edge)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
+static void unvisited_set(struct unvisited *unvisited, size_t idx,
+			  const struct unvisited_entry *e)
+{
+	unvisited->heap[idx] = *e;
+	unvisited->d[e->node].heapidx = idx;
+}
+
+/* Move entry at idx towards the root until its parent is no more costly */
+static void unvisited_sift_up(struct unvisited *unvisited, size_t idx)
+{
+	struct unvisited_entry e = unvisited->heap[idx];
+
+	while (idx > 0) {
+		size_t parent = (idx - 1) / 2;
+		if (unvisited->heap[parent].cost <= e.cost)
+			break;
+		unvisited_set(unvisited, idx, &unvisited->heap[parent]);
+		idx = parent;
+	}
+	unvisited_set(unvisited, idx, &e);
+}
+
+/* Move entry at idx towards the leaves until its children cost more */
+static void unvisited_sift_down(struct unvisited *unvisited, size_t idx)
+{
+	struct unvisited_entry e = unvisited->heap[idx];
+
+	for (;;) {
+		size_t child = idx * 2 + 1;
+		if (child >= unvisited->num)
+			break;
+		if (child + 1 < unvisited->num
+		    && unvisited->heap[child + 1].cost < unvisited->heap[child].cost)
+			child++;
+		if (e.cost <= unvisited->heap[child].cost)
+			break;
+		unvisited_set(unvisited, idx, &unvisited->heap[child]);
+		idx = child;
+	}
+	unvisited_set(unvisited, idx, &e);
+}
+
+/* The most any landmark says it costs to get from node to the goal. */
+static u64 goal_bound(const struct unvisited *unvisited, u32 node)
+{
+	const struct route_landmarks *lm = unvisited->landmarks;
+	const u32 *dist = lm->dist + node * lm->num;
+	u32 best = 0;
+
+	for (size_t l = 0; l < lm->num; l++) {
+		u32 diff;
+
+		/* Another part of the network: tells us nothing. */
+		if (dist[l] == LANDMARK_UNREACHABLE
+		    || unvisited->goal[l] == LANDMARK_UNREACHABLE)
+			continue;
+		if (dist[l] > unvisited->goal[l])
+			diff = dist[l] - unvisited->goal[l];
+		else
+			diff = unvisited->goal[l] - dist[l];
+		if (diff > best)
+			best = diff;
+	}
+	return ((u64)best * unvisited->goal_scale) >> 32;
+}
+
+/* Add node, or lower its cost if it's already there. */
+static void unvisited_add(struct unvisited *unvisited,
+			  u32 node,
+			  struct amount_msat cost)
+{
+	size_t idx = unvisited->d[node].heapidx;
+	u64 key = cost.millisatoshis; /* Raw: heap key */
+
+	/* A* : nodes which are obviously further from the goal wait. */
+	if (unvisited->landmarks)
+		key += goal_bound(unvisited, node);
+
+	if (idx == HEAPIDX_NONE) {
+		assert(unvisited->num < tal_count(unvisited->heap));
+		idx = unvisited->num++;
+		unvisited->heap[idx].node = node;
+	}
+
+	assert(unvisited->heap[idx].node == node);
+	unvisited->heap[idx].cost = key;
+	unvisited_sift_up(unvisited, idx);
+}
+
+/* Remove and return the cheapest node, or NODE_NONE if none left. */
+static u32 unvisited_pop(struct unvisited *unvisited)
+{
+	u32 node;
+
+	if (unvisited->num == 0)
+		return NODE_NONE;
+
+	node = unvisited->heap[0].node;
+	unvisited->d[node].heapidx = HEAPIDX_NONE;
+	if (--unvisited->num != 0) {
+		unvisited_set(unvisited, 0, &unvisited->heap[unvisited->num]);
+		unvisited_sift_down(unvisited, 0);
+	}
+	return node;
+}
+
+/* Nodes we haven't reached yet are unvisited, as are those in the heap. */
+static bool is_unvisited(const struct dijkstra *d)
+{
+	return amount_msat_eq(d->total, INFINITE)
+		|| d->heapidx != HEAPIDX_NONE;
+}
+
+static void update_unvisited_neighbors(const struct route_graph *graph,
+				       u32 cur,
+				       u32 me,
+				       double riskfactor,
+				       u64 riskbias,
+				       double fuzz,
+				       const struct siphash_seed *base_seed,
+				       const u32 *excluded,
+				       struct unvisited *unvisited,
+				       costfn_t *costfn)
+{
+	struct dijkstra *d = unvisited->d;
+
+	/* Consider all neighbors */
+	for (u32 i = graph->edge_start[cur]; i < graph->edge_start[cur+1]; i++) {
+		const struct route_graph_edge *e = &graph->edges[i];
+		struct amount_msat total, risk, cost_after;
+		u32 peer = e->src;
+
+		SUPERVERBOSE("CONSIDERING: %s -> %s (%s/%s)",
+			     type_to_string(tmpctx, struct node_id,
+					    &graph->ids[cur]),
+			     type_to_string(tmpctx, struct node_id,
+					    &graph->ids[peer]),
+			     type_to_string(tmpctx, struct amount_msat,
+					    &d[peer].total),
+			     type_to_string(tmpctx, struct amount_msat,
+					    &d[peer].risk));
+
+		if (!e->routable || is_excluded(excluded, i)) {
+			SUPERVERBOSE("... not routable");
+			continue;
+		}
+
+		if (!is_unvisited(&d[peer])) {
+			SUPERVERBOSE("... already visited");
+			continue;
+		}
+
+		/* We're looking at channels *backwards*, so peer == me
+		 * is the right test here for whether we don't charge fees. */
+		if (!can_reach(e, peer == me,
+			       d[cur].total, d[cur].risk,
+			       riskfactor, riskbias, fuzz, base_seed,
+			       &total, &risk)) {
+			SUPERVERBOSE("... can't reach");
+			continue;
+		}
+
+		/* This effectively adds it to the map if it was infinite */
+		if (costs_less(total, risk, &cost_after,
+			       d[peer].total, d[peer].risk,
+			       NULL,
+			       costfn)) {
+			SUPERVERBOSE("...%s can reach %s"
+				     " total %s risk %s",
+				     type_to_string(tmpctx, struct node_id,
+						    &graph->ids[cur]),
+				     type_to_string(tmpctx, struct node_id,
+						    &graph->ids[peer]),
+				     type_to_string(tmpctx, struct amount_msat,
+						    &total),
+				     type_to_string(tmpctx, struct amount_msat,
+						    &risk));
+			d[peer].total = total;
+			d[peer].risk = risk;
+			d[peer].next_edge = i;
+			unvisited_add(unvisited, peer, cost_after);
+		}
+	}
+}
+
+static void dijkstra(const struct route_graph *graph,
+		     u32 dst,
+		     u32 me,
+		     double riskfactor,
+		     u64 riskbias,
+		     double fuzz, const struct siphash_seed *base_seed,
+		     const u32 *excluded,
+		     struct unvisited *unvisited,
+		     costfn_t *costfn)
+{
+	u32 cur;
+
+	while ((cur = unvisited_pop(unvisited)) != NODE_NONE) {
+		unvisited->settled++;
+		update_unvisited_neighbors(graph, cur, me,
+					   riskfactor, riskbias,
+					   fuzz, base_seed, excluded,
+					   unvisited, costfn);
+		if (cur == dst)
+			return;
+	}
+}
+
+/* Note that we calculated route *backwards*, for fees.  So "from"
+ * here has a high cost, "to" has a cost of exact amount sent.
+ * Fills in s->route. */
+static bool build_route(const struct route_graph *graph,
+			struct route_graph_scratch *s,
+			u32 from, u32 to,
+			struct amount_msat *fee)
+{
+	const struct dijkstra *d = s->d;
+
+	SUPERVERBOSE("Building route from %s (%s) -> %s (%s)",
+		     type_to_string(tmpctx, struct node_id, &graph->ids[from]),
+		     type_to_string(tmpctx, struct amount_msat,
+				    &d[from].total),
+		     type_to_string(tmpctx, struct node_id, &graph->ids[to]),
+		     type_to_string(tmpctx, struct amount_msat,
+				    &d[to].total));
+	/* Never reached? */
+	if (amount_msat_eq(d[from].total, INFINITE))
+		return false;
+
+	/* Each node remembers which edge it used to get closer to "to" */
+	s->route_len = 0;
+	for (u32 i = from; i != to; i = route_graph_edge_dst(graph,
+							       d[i].next_edge)) {
+		assert(d[i].next_edge != EDGE_NONE);
+		assert(s->route_len < tal_count(s->route));
+		s->route[s->route_len++] = d[i].next_edge;
+	}
+
+	/* We don't charge ourselves fees, so skip first hop */
+	if (!amount_msat_sub(fee,
+			     d[route_graph_edge_dst(graph, s->route[0])].total,
+			     d[to].total)) {
+		SUPERVERBOSE("Could not subtract %s - %s for fee",
+			     type_to_string(tmpctx, struct amount_msat,
+					    &d[route_graph_edge_dst(graph,
+								    s->route[0])]
+					    .total),
+			     type_to_string(tmpctx, struct amount_msat,
+					    &d[to].total));
+		return false;
+	}
+
+	return true;
+}
+
+/* Every hop costs at least its base fee (less fuzz), plus one for the
+ * riskbias, so landmarks give us a lower bound on the remaining cost,
+ * which never drops across a hop by more than that hop costs.  A* with such
+ * a bound still settles each node at its cheapest cost, but it heads for
+ * the goal rather than spreading out in every direction.
+ *
+ * This only holds for the normal cost function, with riskbias 1. */
+static void aim_at_goal(struct unvisited *unvisited,
+			const struct route_landmarks *landmarks,
+			u32 goal, double fuzz)
+{
+	/* Total fuzz means any fee could be zero. */
+	if (!landmarks || landmarks->num == 0 || fuzz >= 1.0) {
+		unvisited->landmarks = NULL;
+		return;
+	}
+
+	unvisited->landmarks = landmarks;
+	unvisited->goal = landmarks->dist + goal * landmarks->num;
+	/* Fixed point, so rounding can't make the bound inconsistent; a
+	 * hair less than 1 - fuzz allows for fuzz_fee()'s own rounding. */
+	unvisited->goal_scale = (1.0 - fuzz) * (1.0 - 1e-9) * 4294967296.0;
+}
+
+static struct unvisited *dijkstra_prepare(const struct route_graph *graph,
+					  struct route_graph_scratch *s,
+					  u32 src,
+					  struct amount_msat msat,
+					  costfn_t *costfn,
+					  const struct route_landmarks *landmarks,
+					  u32 goal, double fuzz)
+{
+	struct dijkstra *d = s->d;
+	struct amount_msat cost;
+	size_t num_nodes = route_graph_num_nodes(graph);
+
+	aim_at_goal(&s->unvisited, landmarks, goal, fuzz);
+
+	/* Reset all the information. */
+	for (size_t i = 0; i < num_nodes; i++) {
+		d[i].heapidx = HEAPIDX_NONE;
+		d[i].next_edge = EDGE_NONE;
+		d[i].total = INFINITE;
+		d[i].risk = INFINITE;
+	}
+	s->unvisited.num = 0;
+
+	/* Mark start cost: place in unvisited heap. */
+	d[src].total = msat;
+	d[src].risk = AMOUNT_MSAT(0);
+	/* Adding 0 can never fail */
+	if (!costfn(&cost, d[src].total, d[src].risk))
+		abort();
+	unvisited_add(&s->unvisited, src, cost);
+
+	return &s->unvisited;
+}
+
+/* Keep the route we just built as the best one. */
+static void keep_route(struct route_graph_scratch *s)
+{
+	u32 *tmp = s->best;
+
+	s->best = s->route;
+	s->best_len = s->route_len;
+	s->route = tmp;
+}
+
+/* We need to start biassing against long routes. */
+static bool find_shorter_route(const struct route_graph *graph,
+			       struct route_graph_scratch *s,
+			       u32 src, u32 dst, u32 me,
+			       struct amount_msat msat,
+			       size_t max_hops,
+			       double fuzz, const struct siphash_seed *base_seed,
+			       const u32 *excluded,
+			       struct amount_msat *fee)
+{
+	const struct dijkstra *d = s->d;
+	struct unvisited *unvisited;
+	struct amount_msat long_cost, short_cost, cost_diff;
+	u64 min_bias, max_bias;
+	double riskfactor;
+
+	/* We traverse backwards, so dst has largest total */
+	if (!amount_msat_sub(&long_cost, d[dst].total, d[src].total))
+		goto bad_total;
+
+	/* FIXME: It's hard to juggle both the riskfactor and riskbias here,
+	 * so we set our riskfactor to rougly equate to 1 millisatoshi
+	 * per block delay, which is close enough to zero to not break
+	 * this algorithm, but still provide some bias towards
+	 * low-delay routes. */
+	riskfactor = (double)1.0 / msat.millisatoshis; /* Raw: inversion */
+
+	/* First, figure out if a short route is even possible.
+	 * We set the cost function to ignore total, riskbias 1 and riskfactor
+	 * ~0 so risk simply operates as a simple hop counter. */
+	unvisited = dijkstra_prepare(graph, s, src, msat,
+				     shortest_cost_function, NULL, 0, 0);
+	SUPERVERBOSE("Running shortest path from %s -> %s",
+		     type_to_string(tmpctx, struct node_id, &graph->ids[dst]),
+		     type_to_string(tmpctx, struct node_id, &graph->ids[src]));
+	dijkstra(graph, dst, NODE_NONE, riskfactor, 1, fuzz, base_seed,
+		 excluded, unvisited, shortest_cost_function);
+
+	/* This must succeed, since we found a route before */
+	if (!build_route(graph, s, dst, src, fee))
+		abort();
+	keep_route(s);
+	if (!amount_msat_sub(&short_cost, d[dst].total, d[src].total))
+		goto bad_total;
+
+	/* Still too long?  Oh well. */
+	if (s->best_len > max_hops) {
+		SUPERVERBOSE("Minimal possible route %s->%s is %zu",
+			     type_to_string(tmpctx, struct node_id,
+					    &graph->ids[dst]),
+			     type_to_string(tmpctx, struct node_id,
+					    &graph->ids[src]),
+			     s->best_len);
+		return false;
+	}
+
+	/* OK, so it's possible, just more expensive. */
+	min_bias = 0;
+
+	if (!amount_msat_sub(&cost_diff, short_cost, long_cost)) {
+		SUPERVERBOSE("Short cost %s < long cost %s?",
+			     type_to_string(tmpctx, struct amount_msat,
+					    &short_cost),
+			     type_to_string(tmpctx, struct amount_msat,
+					    &long_cost));
+		return false;
+	}
+
+	/* This is a gross overestimate, but it works. */
+	max_bias = cost_diff.millisatoshis; /* Raw: bias calc */
+
+	SUPERVERBOSE("maxbias %"PRIu64" gave rlen %zu",
+		     max_bias, s->best_len);
+
+	/* Now, binary search */
+	while (min_bias < max_bias) {
+		struct amount_msat this_fee;
+		u64 riskbias = (min_bias + max_bias) / 2;
+		bool found;
+
+		unvisited = dijkstra_prepare(graph, s, src, msat,
+					     normal_cost_function, NULL, 0, 0);
+		dijkstra(graph, dst, me, riskfactor, riskbias, fuzz, base_seed,
+			 excluded, unvisited, normal_cost_function);
+
+		found = build_route(graph, s, dst, src, &this_fee);
+
+		SUPERVERBOSE("riskbias %"PRIu64" rlen %zu",
+			     riskbias, found ? s->route_len : 0);
+		/* Too long still?  This is our new min_bias */
+		if (!found || s->route_len > max_hops) {
+			min_bias = riskbias + 1;
+		} else {
+			/* This route is acceptable. */
+			keep_route(s);
+			/* Save this fee in case we exit loop */
+			*fee = this_fee;
+			max_bias = riskbias;
+		}
+	}
+
+	return true;
+
+bad_total:
+	SUPERVERBOSE("dst total %s < src total %s?",
+		     type_to_string(tmpctx, struct amount_msat,
+				    &d[dst].total),
+		     type_to_string(tmpctx, struct amount_msat,
+				    &d[src].total));
+	return false;
+}
+
+const u32 *route_graph_find_route(struct route_graph_scratch *s,
+				  const struct route_graph *graph,
+				  u32 from, u32 to, bool from_is_me,
+				  struct amount_msat msat,
+				  double riskfactor,
+				  double fuzz,
+				  const struct siphash_seed *base_seed,
+				  const u32 *excluded,
+				  const struct route_landmarks *landmarks,
+				  size_t max_hops,
+				  size_t *num_edges,
+				  struct amount_msat *fee)
+{
+	struct unvisited *unvisited;
+	u32 src, dst, me;
+
+	assert(tal_count(s->d) == route_graph_num_nodes(graph));
+
+	/* Note: we map backwards, since we know the amount of satoshi we want
+	 * at the end, and need to derive how much we need to send. */
+	src = to;
+	dst = from;
+	me = from_is_me ? from : NODE_NONE;
+
+	unvisited = dijkstra_prepare(graph, s, src, msat,
+				     normal_cost_function, landmarks, dst, fuzz);
+	dijkstra(graph, dst, me, riskfactor, 1, fuzz, base_seed,
+		 excluded, unvisited, normal_cost_function);
+
+	if (!build_route(graph, s, dst, src, fee))
+		return NULL;
+
+	if (s->route_len > max_hops) {
+		/* This is the far more unlikely case */
+		if (!find_shorter_route(graph, s, src, dst, me, msat,
+					max_hops, fuzz, base_seed, excluded,
+					fee))
+			return NULL;
+	} else
+		keep_route(s);
+
+	*num_edges = s->best_len;
+	return s->best;
+}
+
+/*~ To price routes to every node at once, we search *forwards* from the
+ * payer, so we need the edges out of each node, not into it.  We sort
+ * them out per search (the same counting sort route_graph_new() does
+ * implicitly), rather than making every graph carry both. */
+static void index_out_edges(struct route_graph_scratch *s,
+			    const struct route_graph *graph)
+{
+	size_t num_nodes = route_graph_num_nodes(graph);
+	size_t num_edges = tal_count(graph->edges);
+	/* Not building routes yet, so we can use this to fill slots. */
+	u32 *next = s->route;
+
+	memset(s->out_start, 0, (num_nodes + 1) * sizeof(s->out_start[0]));
+	for (size_t i = 0; i < num_edges; i++)
+		s->out_start[graph->edges[i].src + 1]++;
+	for (size_t i = 0; i < num_nodes; i++) {
+		s->out_start[i + 1] += s->out_start[i];
+		next[i] = s->out_start[i];
+	}
+	for (size_t i = 0; i < num_edges; i++)
+		s->out_edges[next[graph->edges[i].src]++] = i;
+}
+
+void route_graph_find_tree(struct route_graph_scratch *s,
+			   const struct route_graph *graph,
+			   u32 from,
+			   struct amount_msat msat,
+			   double riskfactor)
+{
+	struct unvisited *unvisited;
+	struct dijkstra *d = s->d;
+	u32 cur;
+
+	assert(s->out_start);
+	index_out_edges(s, graph);
+
+	unvisited = dijkstra_prepare(graph, s, from, msat,
+				     normal_cost_function, NULL, 0, 0.0);
+	while ((cur = unvisited_pop(unvisited)) != NODE_NONE) {
+		unvisited->settled++;
+		for (u32 i = s->out_start[cur]; i < s->out_start[cur+1]; i++) {
+			u32 edge = s->out_edges[i];
+			const struct route_graph_edge *e = &graph->edges[edge];
+			u32 peer = route_graph_edge_dst(graph, edge);
+			struct amount_msat total, risk, cost_after;
+
+			if (!e->routable || !is_unvisited(&d[peer]))
+				continue;
+
+			/* Going forwards, we charge the fee on the amount
+			 * plus fees so far, instead of plus fees to come:
+			 * the difference is only the fee on some fees. */
+			if (!can_reach(e, cur == from,
+				       d[cur].total, d[cur].risk,
+				       riskfactor, 1, 0.0, NULL,
+				       &total, &risk))
+				continue;
+
+			if (costs_less(total, risk, &cost_after,
+				       d[peer].total, d[peer].risk, NULL,
+				       normal_cost_function)) {
+				d[peer].total = total;
+				d[peer].risk = risk;
+				/* Forwards, this is the edge we arrive by. */
+				d[peer].next_edge = edge;
+				unvisited_add(unvisited, peer, cost_after);
+			}
+		}
+	}
+}
+
+const u32 *route_graph_tree_route(struct route_graph_scratch *s,
+				  const struct route_graph *graph,
+				  u32 from, u32 to,
+				  size_t *num_edges)
+{
+	const struct dijkstra *d = s->d;
+	size_t len = 0;
+
+	if (to == from || d[to].next_edge == EDGE_NONE)
+		return NULL;
+
+	/* Count the hops, then fill them in from the end. */
+	for (u32 i = to; i != from; i = graph->edges[d[i].next_edge].src)
+		len++;
+
+	s->route_len = len;
+	for (u32 i = to; i != from; i = graph->edges[d[i].next_edge].src)
+		s->route[--len] = d[i].next_edge;
+
+	*num_edges = s->route_len;
+	return s->route;
+}
+
+/* The channel each edge belongs to, so we can pair up its halves. */
+struct landmark_edge {
+	struct short_channel_id scid;
+	u32 edge;
+};
+
+struct route_landmarks_work {
+	struct route_graph_scratch *scratch;
+	struct landmark_edge *by_scid;
+	/* Cheaper base fee of each edge's channel. */
+	u32 *weight;
+};
+
+struct route_landmarks *route_landmarks_new(const tal_t *ctx,
+					    const struct route_graph *graph,
+					    size_t num)
+{
+	struct route_landmarks *lm = tal(ctx, struct route_landmarks);
+	size_t num_edges = tal_count(graph->edges);
+
+	lm->num = num;
+	lm->dist = tal_arr(lm, u32, route_graph_num_nodes(graph) * num);
+	lm->readers = 0;
+	lm->work = tal(lm, struct route_landmarks_work);
+	lm->work->scratch = route_graph_scratch_new(lm->work, graph);
+	lm->work->by_scid = tal_arr(lm->work, struct landmark_edge, num_edges);
+	lm->work->weight = tal_arr(lm->work, u32, num_edges);
+	return lm;
+}
+
+static int landmark_edge_cmp(const void *a, const void *b)
+{
+	const struct landmark_edge *ea = a, *eb = b;
+
+	if (ea->scid.u64 < eb->scid.u64)
+		return -1;
+	return ea->scid.u64 > eb->scid.u64;
+}
+
+/* Both halves of a channel get the cheaper base fee, so distances are the
+ * same in either direction. */
+static void landmark_weights(struct route_landmarks_work *work,
+			     const struct route_graph *graph)
+{
+	size_t num_edges = tal_count(graph->edges);
+
+	for (size_t i = 0; i < num_edges; i++) {
+		work->by_scid[i].scid = graph->edges[i].scid;
+		work->by_scid[i].edge = i;
+	}
+	qsort(work->by_scid, num_edges, sizeof(work->by_scid[0]),
+	      landmark_edge_cmp);
+
+	for (size_t i = 0; i < num_edges; i++) {
+		u32 edge = work->by_scid[i].edge;
+		u32 fee = graph->edges[edge].base_fee;
+
+		if (i + 1 < num_edges
+		    && short_channel_id_eq(&work->by_scid[i+1].scid,
+					   &graph->edges[edge].scid)) {
+			u32 other = work->by_scid[i+1].edge;
+			if (graph->edges[other].base_fee < fee)
+				fee = graph->edges[other].base_fee;
+			work->weight[other] = fee;
+			i++;
+		}
+		work->weight[edge] = fee;
+	}
+}
+
+/* Plain dijkstra from landmark over base fees, ignoring direction: every
+ * channel has an edge into each of its nodes, so we only need to look at
+ * edges into each node.  Leaves distances in work->scratch->d[].total. */
+static void landmark_dijkstra(struct route_landmarks_work *work,
+			      const struct route_graph *graph,
+			      u32 landmark)
+{
+	struct route_graph_scratch *s = work->scratch;
+	struct dijkstra *d = s->d;
+	size_t num_nodes = route_graph_num_nodes(graph);
+	u32 cur;
+
+	for (size_t i = 0; i < num_nodes; i++) {
+		d[i].heapidx = HEAPIDX_NONE;
+		d[i].total = INFINITE;
+	}
+	s->unvisited.num = 0;
+
+	d[landmark].total = AMOUNT_MSAT(0);
+	unvisited_add(&s->unvisited, landmark, d[landmark].total);
+	while ((cur = unvisited_pop(&s->unvisited)) != NODE_NONE) {
+		for (u32 i = graph->edge_start[cur];
+		     i < graph->edge_start[cur+1];
+		     i++) {
+			u32 peer = graph->edges[i].src;
+			struct amount_msat total;
+
+			/* Can't overflow: INFINITE leaves plenty of room. */
+			total.millisatoshis /* Raw: distance */
+				= d[cur].total.millisatoshis /* Raw: distance */
+				+ work->weight[i];
+			if (amount_msat_less(total, d[peer].total)) {
+				d[peer].total = total;
+				unvisited_add(&s->unvisited, peer, total);
+			}
+		}
+	}
+}
+
+/* Saturating is fine: it never makes two distances differ by more. */
+static u32 landmark_dist(struct amount_msat total)
+{
+	if (amount_msat_eq(total, INFINITE))
+		return LANDMARK_UNREACHABLE;
+	if (total.millisatoshis >= LANDMARK_UNREACHABLE) /* Raw: distance */
+		return LANDMARK_UNREACHABLE - 1;
+	return total.millisatoshis; /* Raw: distance */
+}
+
+void route_landmarks_compute(struct route_landmarks *lm,
+			     const struct route_graph *graph)
+{
+	struct route_landmarks_work *work = lm->work;
+	const struct dijkstra *d = work->scratch->d;
+	size_t num_nodes = route_graph_num_nodes(graph);
+	u32 start = 0;
+
+	if (num_nodes == 0)
+		return;
+
+	landmark_weights(work, graph);
+
+	/* The best-connected node is presumably in the main part of the
+	 * network: we want landmarks there. */
+	for (size_t i = 1; i < num_nodes; i++) {
+		if (graph->edge_start[i+1] - graph->edge_start[i]
+		    > graph->edge_start[start+1] - graph->edge_start[start])
+			start = i;
+	}
+	landmark_dijkstra(work, graph, start);
+
+	/* Landmarks work best around the edges, so each one is the
+	 * reachable node furthest from any before (or from start). */
+	for (size_t l = 0; l < lm->num; l++) {
+		u32 landmark = start;
+		u64 furthest = 0;
+
+		for (size_t i = 0; i < num_nodes; i++) {
+			u64 near;
+
+			if (l == 0) {
+				if (amount_msat_eq(d[i].total, INFINITE))
+					continue;
+				near = d[i].total.millisatoshis; /* Raw: distance */
+			} else {
+				const u32 *dist = lm->dist + i * lm->num;
+				if (dist[0] == LANDMARK_UNREACHABLE)
+					continue;
+				near = dist[0];
+				for (size_t j = 1; j < l; j++)
+					if (dist[j] < near)
+						near = dist[j];
+			}
+			if (near > furthest) {
+				furthest = near;
+				landmark = i;
+			}
+		}
+
+		landmark_dijkstra(work, graph, landmark);
+		for (size_t i = 0; i < num_nodes; i++)
+			lm->dist[i * lm->num + l] = landmark_dist(d[i].total);
+	}
+}
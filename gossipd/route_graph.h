@@ -0,0 +1,225 @@
+#ifndef LIGHTNING_GOSSIPD_ROUTE_GRAPH_H
+#define LIGHTNING_GOSSIPD_ROUTE_GRAPH_H
+#include "config.h"
+#include <bitcoin/short_channel_id.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <common/amount.h>
+#include <common/node_id.h>
+
+struct chan;
+struct routing_state;
+struct siphash_seed;
+
+/* One direction of a channel, as routefinding sees it. */
+struct route_graph_edge {
+	struct short_channel_id scid;
+	/* Minimum and maximum number of msatoshi in an HTLC */
+	struct amount_msat htlc_minimum, htlc_maximum;
+	/* millisatoshi. */
+	u32 base_fee;
+	/* millionths */
+	u32 proportional_fee;
+	/* Index of the node which sends across this half-channel. */
+	u32 src;
+	/* cltv_expiry_delta is only 16 bits on the wire. */
+	u16 delay;
+	/* Which half of the channel this is (nodes[direction] is src). */
+	u8 direction;
+	/* Enabled, and not locally disabled. */
+	bool routable;
+};
+
+/* A read-only, compressed-sparse-row snapshot of the network for
+ * routefinding.  Nodes get dense indices (in node_id order), and since
+ * we route backwards from the destination, the edges *into* each node are
+ * kept contiguous.
+ *
+ * Both halves of every channel have an edge, even if unusable, so that a
+ * channel_update only ever has to patch an edge in place.  Adding or
+ * removing channels (and hence nodes) means merging the changes into a new
+ * graph: see route_graph_merge_new(). */
+struct route_graph {
+	/* Sorted, so we can bsearch for a node's index. */
+	struct node_id *ids;
+	/* Edges into node i are edges[edge_start[i]] to edges[edge_start[i+1]-1] */
+	u32 *edge_start;
+	struct route_graph_edge *edges;
+	/* Searches which may still be running on this: if non-zero, it must
+	 * not be altered or freed. */
+	size_t readers;
+};
+
+/* Per-search state: only one search may use this at a time. */
+struct route_graph_scratch;
+
+/* For nodes in a different part of the network from a landmark. */
+#define LANDMARK_UNREACHABLE UINT32_MAX
+
+/* Lower bounds on the cost between nodes, for goal-directed search.
+ *
+ * We pick a few "landmark" nodes, and record the cheapest base fees from
+ * each to every node, ignoring direction (each channel counts as the
+ * cheaper of its halves).  By the triangle inequality, two nodes' distances
+ * from a landmark differ by no more than the base fees between them, so
+ * a search can tell which way its goal lies (the "ALT" flavor of A*).
+ *
+ * These only depend on which channels there are and their base fees: they
+ * stay correct when the graph is patched, unless a base fee goes down. */
+struct route_landmarks {
+	size_t num;
+	/* dist[node * num + l] is node's distance from landmark l,
+	 * saturating at LANDMARK_UNREACHABLE - 1. */
+	u32 *dist;
+	/* Searches which may still be using these: if non-zero, they must
+	 * not be freed. */
+	size_t readers;
+	/* Space for route_landmarks_compute(): free once it's done. */
+	struct route_landmarks_work *work;
+};
+
+/* Build a snapshot of the current network. */
+struct route_graph *route_graph_new(const tal_t *ctx,
+				    struct routing_state *rstate);
+
+/* Channels to add to, or remove from, a graph. */
+struct route_graph_merge;
+
+/**
+ * route_graph_merge_new - prepare a new snapshot from an old one.
+ * @ctx: context to allocate from.
+ * @rstate: routing state, for the added channels' details.
+ * @graph: the old snapshot: it must not be altered or freed until done.
+ * @removed: (tal) array of channels to leave out.
+ * @added: (tal) array of channels to add, which aren't in @graph.
+ *
+ * This only looks at the added channels: the time-consuming part is
+ * route_graph_merge_run().
+ */
+struct route_graph_merge *route_graph_merge_new(const tal_t *ctx,
+						struct routing_state *rstate,
+						const struct route_graph *graph,
+						const struct short_channel_id *removed,
+						struct chan **added);
+
+/* Build the new snapshot.  This doesn't allocate or log, so it can be
+ * called from any thread. */
+void route_graph_merge_run(struct route_graph_merge *merge);
+
+/* Returns the new snapshot, and frees @merge. */
+struct route_graph *route_graph_merge_done(const tal_t *ctx,
+					   struct route_graph_merge *merge);
+
+/* Allocate scratch space for searching this graph.  Searching never
+ * allocates, so it's safe to do from another thread. */
+struct route_graph_scratch *route_graph_scratch_new(const tal_t *ctx,
+						    const struct route_graph *graph);
+
+/* Scratch space for route_graph_find_tree() too. */
+struct route_graph_scratch *
+route_graph_tree_scratch_new(const tal_t *ctx, const struct route_graph *graph);
+
+static inline size_t route_graph_num_nodes(const struct route_graph *graph)
+{
+	return tal_count(graph->ids);
+}
+
+/* Find a node's index: false if it's not in the graph. */
+bool route_graph_node_idx(const struct route_graph *graph,
+			  const struct node_id *id, u32 *idx);
+
+/* Which node does this edge lead to? */
+u32 route_graph_edge_dst(const struct route_graph *graph, u32 edge);
+
+/* Find the edge for chan->half[dir]: false if it's not in the graph. */
+bool route_graph_chan_edge(const struct route_graph *graph,
+			   const struct chan *chan, int dir, u32 *edge);
+
+/* Refresh both edges of chan after a channel_update or local
+ * disable/enable (if it's in the graph).  Returns true if either base fee
+ * went down. */
+bool route_graph_update_chan(struct route_graph *graph,
+			     struct routing_state *rstate,
+			     const struct chan *chan);
+
+/* chan is going away: don't route through it until it's merged out. */
+void route_graph_disable_chan(struct route_graph *graph,
+			      const struct chan *chan);
+
+/* How many nodes have searches using this scratch space settled? */
+size_t route_graph_scratch_settled(const struct route_graph_scratch *s);
+
+/* Allocate @num landmarks for this graph: they're not usable until
+ * route_landmarks_compute() has filled them in. */
+struct route_landmarks *route_landmarks_new(const tal_t *ctx,
+					    const struct route_graph *graph,
+					    size_t num);
+
+/* Choose the landmarks and find their distances.  This takes a while, but
+ * doesn't allocate or log, so it can be called from any thread. */
+void route_landmarks_compute(struct route_landmarks *lm,
+			     const struct route_graph *graph);
+
+/**
+ * route_graph_find_route - cheapest route from @from to @to.
+ * @s: scratch space from route_graph_scratch_new(graph).
+ * @graph: the graph to search.
+ * @from: index of paying node.
+ * @to: index of destination node.
+ * @from_is_me: if true, we don't pay fees on the first hop.
+ * @msat: amount to deliver to @to.
+ * @riskfactor: per-block, per-msat risk premium.
+ * @fuzz, @base_seed: to randomize fees.
+ * @excluded: sorted (tal) array of edges not to use, or NULL.
+ * @landmarks: computed landmarks for this graph, or NULL.
+ * @max_hops: longest route we'll accept.
+ * @num_edges: set to the length of the route.
+ * @fee: set to the total fees along the route.
+ *
+ * Returns the edges from @from to @to (inside @s, so only valid until the
+ * next search), or NULL if there's no route.  This doesn't allocate or
+ * log, so it can be called from any thread.
+ *
+ * @landmarks don't change the cost of the route found (though it may be a
+ * different one, if there's a tie), but mean far fewer nodes are looked at.
+ */
+const u32 *route_graph_find_route(struct route_graph_scratch *s,
+				  const struct route_graph *graph,
+				  u32 from, u32 to, bool from_is_me,
+				  struct amount_msat msat,
+				  double riskfactor,
+				  double fuzz,
+				  const struct siphash_seed *base_seed,
+				  const u32 *excluded,
+				  const struct route_landmarks *landmarks,
+				  size_t max_hops,
+				  size_t *num_edges,
+				  struct amount_msat *fee);
+
+/**
+ * route_graph_find_tree - cheapest routes from @from to every node.
+ * @s: scratch space from route_graph_tree_scratch_new(graph).
+ * @graph: the graph to search.
+ * @from: index of paying node (that's us: we don't pay fees on first hops).
+ * @msat: amount to deliver.
+ * @riskfactor: per-block, per-msat risk premium.
+ *
+ * This searches forwards, so fees are charged on the amount plus the fees
+ * before each hop, rather than after: routes chosen are very close to, but
+ * not always exactly, what route_graph_find_route() would choose.  The
+ * results stay in @s for route_graph_tree_route().  This doesn't allocate
+ * or log, so it can be called from any thread.
+ */
+void route_graph_find_tree(struct route_graph_scratch *s,
+			   const struct route_graph *graph,
+			   u32 from,
+			   struct amount_msat msat,
+			   double riskfactor);
+
+/* The route to @to found by route_graph_find_tree(), from @from, or NULL.
+ * Like route_graph_find_route(), it's inside @s. */
+const u32 *route_graph_tree_route(struct route_graph_scratch *s,
+				  const struct route_graph *graph,
+				  u32 from, u32 to,
+				  size_t *num_edges);
+#endif /* LIGHTNING_GOSSIPD_ROUTE_GRAPH_H */
@@ -0,0 +1,287 @@
+/*~ Finding a route on a large network takes long enough that doing it in
+ * our single io_loop holds up everything else: gossip from peers, replies
+ * to queries, updates for our own channels.  So we hand route queries to a
+ * small pool of threads.
+ *
+ * This is the only place gossipd uses threads, and we keep them on a tight
+ * leash: a query carries its own snapshot of the graph and preallocated
+ * scratch space, because tal (and hence almost everything else) isn't
+ * thread-safe.  The threads only ever call route_query_run(). */
+#include "route_pool.h"
+#include <ccan/io/io.h>
+#include <ccan/list/list.h>
+#include <common/status.h>
+#include <common/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gossipd/routing.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct route_job {
+	/* In pool->outstanding: only the main thread touches this. */
+	struct list_node list;
+	/* Either a query (answered in order)... */
+	struct route_query *rq;
+	void (*answered)(struct route_query *rq, void *arg);
+	/* ... or background work (done whenever it's done). */
+	void (*run)(void *arg);
+	void (*finish)(void *arg);
+	void *arg;
+
+	/* In pool->queue, protected by pool->lock. */
+	struct list_node qlist;
+	/* Protected by pool->lock. */
+	bool done;
+};
+
+struct route_pool {
+	pthread_t *threads;
+
+	/* Protects everything down to wake_fd */
+	pthread_mutex_t lock;
+	/* Signalled when there's something in the queue, or we're stopping. */
+	pthread_cond_t work;
+	/* Signalled when the last running query finishes. */
+	pthread_cond_t idle;
+	/* Jobs waiting for a thread. */
+	struct list_head queue;
+	u32 queued, running, max_queued;
+	bool stopping;
+
+	/* Threads write here when they've answered something. */
+	int wake_fd[2];
+	char wake_buf[64];
+	size_t wake_len;
+
+	/* Every job not yet handed to answered(), oldest first. */
+	struct list_head outstanding;
+	u64 answered;
+};
+
+static void *route_thread(struct route_pool *pool)
+{
+	struct route_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		job = list_pop(&pool->queue, struct route_job, qlist);
+		if (!job) {
+			if (pool->stopping)
+				break;
+			pthread_cond_wait(&pool->work, &pool->lock);
+			continue;
+		}
+		pool->queued--;
+		pool->running++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (job->rq)
+			route_query_run(job->rq);
+		else
+			job->run(job->arg);
+
+		pthread_mutex_lock(&pool->lock);
+		job->done = true;
+		if (--pool->running == 0)
+			pthread_cond_broadcast(&pool->idle);
+		/* Non-blocking: if it's full, the io_loop will wake anyway. */
+		if (write(pool->wake_fd[1], "", 1) != 1 && errno != EAGAIN)
+			abort();
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void *route_thread_start(void *arg)
+{
+	return route_thread(arg);
+}
+
+static bool job_done(struct route_pool *pool, const struct route_job *job)
+{
+	bool done;
+
+	pthread_mutex_lock(&pool->lock);
+	done = job->done;
+	pthread_mutex_unlock(&pool->lock);
+	return done;
+}
+
+/* Hand back answers in order: a slow query holds up later ones (but
+ * background work doesn't). */
+static void deliver_answers(struct route_pool *pool)
+{
+	struct route_job *job, *next;
+	bool blocked = false;
+
+	list_for_each_safe(&pool->outstanding, job, next, list) {
+		if (!job_done(pool, job)) {
+			if (job->rq)
+				blocked = true;
+			continue;
+		}
+		if (job->rq && blocked)
+			continue;
+
+		list_del_from(&pool->outstanding, &job->list);
+		if (job->rq) {
+			pool->answered++;
+			job->answered(job->rq, job->arg);
+		} else
+			job->finish(job->arg);
+		tal_free(job);
+	}
+}
+
+static struct io_plan *wake_read(struct io_conn *conn, struct route_pool *pool)
+{
+	deliver_answers(pool);
+	return io_read_partial(conn, pool->wake_buf, sizeof(pool->wake_buf),
+			       &pool->wake_len, wake_read, pool);
+}
+
+static struct io_plan *wake_init(struct io_conn *conn, struct route_pool *pool)
+{
+	return io_read_partial(conn, pool->wake_buf, sizeof(pool->wake_buf),
+			       &pool->wake_len, wake_read, pool);
+}
+
+static void destroy_route_pool(struct route_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < tal_count(pool->threads); i++)
+		pthread_join(pool->threads[i], NULL);
+	close(pool->wake_fd[1]);
+}
+
+struct route_pool *new_route_pool(const tal_t *ctx, size_t num_threads)
+{
+	struct route_pool *pool = tal(ctx, struct route_pool);
+
+	pool->answered = 0;
+	pool->queued = pool->running = pool->max_queued = 0;
+	pool->stopping = false;
+	list_head_init(&pool->queue);
+	list_head_init(&pool->outstanding);
+	pool->threads = tal_arr(pool, pthread_t, 0);
+
+	if (num_threads == 0)
+		return pool;
+
+	if (pipe(pool->wake_fd) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Creating route pool pipe: %s", strerror(errno));
+	if (fcntl(pool->wake_fd[1], F_SETFL,
+		  fcntl(pool->wake_fd[1], F_GETFL) | O_NONBLOCK) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Setting route pool pipe nonblocking: %s",
+			      strerror(errno));
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	tal_add_destructor(pool, destroy_route_pool);
+
+	for (size_t i = 0; i < num_threads; i++) {
+		pthread_t thread;
+		int err = pthread_create(&thread, NULL, route_thread_start, pool);
+		if (err != 0) {
+			status_broken("Could only create %zu of %zu route threads: %s",
+				      i, num_threads, strerror(err));
+			break;
+		}
+		tal_arr_expand(&pool->threads, thread);
+	}
+
+	/* Closes wake_fd[0] when pool is freed (after threads stop). */
+	io_new_conn(pool, pool->wake_fd[0], wake_init, pool);
+	return pool;
+}
+
+static void queue_job(struct route_pool *pool, struct route_job *job)
+{
+	job->done = false;
+	list_add_tail(&pool->outstanding, &job->list);
+
+	pthread_mutex_lock(&pool->lock);
+	list_add_tail(&pool->queue, &job->qlist);
+	if (++pool->queued > pool->max_queued)
+		pool->max_queued = pool->queued;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void route_pool_add_(struct route_pool *pool, struct route_query *rq,
+		     void (*answered)(struct route_query *rq, void *arg),
+		     void *arg)
+{
+	struct route_job *job;
+
+	/* No threads?  Just do it now. */
+	if (tal_count(pool->threads) == 0) {
+		route_query_run(rq);
+		pool->answered++;
+		answered(rq, arg);
+		return;
+	}
+
+	job = tal(pool, struct route_job);
+	job->rq = rq;
+	job->answered = answered;
+	job->arg = arg;
+	queue_job(pool, job);
+}
+
+void route_pool_background_(struct route_pool *pool,
+			    void (*run)(void *arg),
+			    void (*finish)(void *arg),
+			    void *arg)
+{
+	struct route_job *job;
+
+	if (tal_count(pool->threads) == 0) {
+		run(arg);
+		finish(arg);
+		return;
+	}
+
+	job = tal(pool, struct route_job);
+	job->rq = NULL;
+	job->run = run;
+	job->finish = finish;
+	job->arg = arg;
+	queue_job(pool, job);
+}
+
+void route_pool_get_stats(struct route_pool *pool,
+			  struct route_pool_stats *stats)
+{
+	stats->threads = tal_count(pool->threads);
+	stats->answered = pool->answered;
+	if (stats->threads == 0) {
+		stats->queued = stats->running = stats->max_queued = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	stats->queued = pool->queued;
+	stats->running = pool->running;
+	stats->max_queued = pool->max_queued;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void route_pool_wait_idle(struct route_pool *pool)
+{
+	if (tal_count(pool->threads) == 0)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->queued || pool->running)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,76 @@
+#ifndef LIGHTNING_GOSSIPD_ROUTE_POOL_H
+#define LIGHTNING_GOSSIPD_ROUTE_POOL_H
+#include "config.h"
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+
+struct route_query;
+
+struct route_pool_stats {
+	/* Number of worker threads (0 means we answer immediately). */
+	u32 threads;
+	/* Queries waiting for a thread. */
+	u32 queued;
+	/* Queries being answered right now. */
+	u32 running;
+	/* Most queries we've had waiting for a thread at once. */
+	u32 max_queued;
+	/* Queries answered so far. */
+	u64 answered;
+};
+
+/**
+ * new_route_pool - threads to answer route queries off the io_loop.
+ * @ctx: context to allocate from: freeing it stops the threads.
+ * @num_threads: number of worker threads (0 to answer synchronously).
+ */
+struct route_pool *new_route_pool(const tal_t *ctx, size_t num_threads);
+
+/**
+ * route_pool_add - queue up a query.
+ * @pool: the pool.
+ * @rq: the query: don't touch or free it until @answered is called.
+ * @answered: called from the io_loop once it's answered.
+ * @arg: argument for @answered.
+ *
+ * Queries are answered in the order they're added: our master expects
+ * replies in the order it sent requests.
+ */
+#define route_pool_add(pool, rq, answered, arg)				\
+	route_pool_add_((pool), (rq),					\
+			typesafe_cb_preargs(void, void *, (answered), (arg), \
+					    struct route_query *),	\
+			(arg))
+
+void route_pool_add_(struct route_pool *pool, struct route_query *rq,
+		     void (*answered)(struct route_query *rq, void *arg),
+		     void *arg);
+
+/**
+ * route_pool_background - run something else in a thread.
+ * @pool: the pool.
+ * @run: called from a worker thread: it mustn't allocate or log.
+ * @finish: called from the io_loop once @run has returned.
+ * @arg: argument for both.
+ *
+ * Unlike queries, this doesn't hold up any answers: @finish is called as
+ * soon as it's done.
+ */
+#define route_pool_background(pool, run, finish, arg)			\
+	route_pool_background_((pool),					\
+			       typesafe_cb(void, void *, (run), (arg)),	\
+			       typesafe_cb(void, void *, (finish), (arg)), \
+			       (arg))
+
+void route_pool_background_(struct route_pool *pool,
+			    void (*run)(void *arg),
+			    void (*finish)(void *arg),
+			    void *arg);
+
+void route_pool_get_stats(struct route_pool *pool,
+			  struct route_pool_stats *stats);
+
+/* Wait until no thread is working on a query (eg. for memleak checks). */
+void route_pool_wait_idle(struct route_pool *pool);
+#endif /* LIGHTNING_GOSSIPD_ROUTE_POOL_H */
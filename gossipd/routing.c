@@ -16,6 +16,8 @@
 #include <gossipd/gen_gossip_peerd_wire.h>
 #include <gossipd/gen_gossip_store.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <gossipd/route_cache.h>
+#include <gossipd/route_graph.h>
 #include <inttypes.h>
 #include <wire/gen_peer_wire.h>
 
@@ -155,14 +157,150 @@ struct chan *next_chan(const struct node *node, struct chan_map_iter *i)
 	return chan_map_next(&node->chans.map, i);
 }
 
+/* Blocks start small (plenty of routing_states only ever have a handful of
+ * channels), and double up to this many elements. */
+#define SLAB_MAX_BLOCK 1024
+
+static void slab_init(const tal_t *ctx, struct slab *slab, size_t elemsize)
+{
+	assert(elemsize >= sizeof(void *));
+	slab->elemsize = elemsize;
+	slab->blocks = tal_arr(ctx, char *, 0);
+	slab->used = 0;
+	slab->free_list = NULL;
+}
+
+static void *slab_alloc(struct slab *slab)
+{
+	size_t n = tal_count(slab->blocks), num_elems;
+	char *elem;
+
+	if (slab->free_list) {
+		elem = slab->free_list;
+		memcpy(&slab->free_list, elem, sizeof(slab->free_list));
+		return elem;
+	}
+
+	num_elems = n ? tal_bytelen(slab->blocks[n-1]) / slab->elemsize : 0;
+	if (slab->used == num_elems) {
+		num_elems = num_elems ? num_elems * 2 : 16;
+		if (num_elems > SLAB_MAX_BLOCK)
+			num_elems = SLAB_MAX_BLOCK;
+		tal_arr_expand(&slab->blocks,
+			       tal_arr(slab->blocks, char,
+				       num_elems * slab->elemsize));
+		slab->used = 0;
+		n++;
+	}
+	return slab->blocks[n-1] + slab->elemsize * slab->used++;
+}
+
+/* We never give blocks back: they get reused as channels come and go. */
+static void slab_free(struct slab *slab, void *elem)
+{
+	memcpy(elem, &slab->free_list, sizeof(slab->free_list));
+	slab->free_list = elem;
+}
+
 static void destroy_routing_state(struct routing_state *rstate)
 {
-	/* Since we omitted destructors on these, clean up manually */
-	u64 idx;
-	for (struct chan *chan = uintmap_first(&rstate->chanmap, &idx);
-	     chan;
-	     chan = uintmap_after(&rstate->chanmap, &idx))
-		free_chan(rstate, chan);
+	struct node *n;
+	struct node_map_iter nit;
+
+	/* The chans and nodes themselves are in our slabs, which tal will
+	 * free: we just need to free the maps which point into them. */
+	for (n = node_map_first(rstate->nodes, &nit);
+	     n;
+	     n = node_map_next(rstate->nodes, &nit)) {
+		if (node_uses_chan_map(n))
+			chan_map_clear(&n->chans.map);
+	}
+	uintmap_clear(&rstate->chanmap);
+	uintmap_clear(&rstate->prune_buckets);
+	chan_map_clear(&rstate->local_disabled_map);
+}
+
+static void init_channel_range(struct channel_range *r,
+			       u32 first_blocknum, u32 last_blocknum)
+{
+	r->first_blocknum = first_blocknum;
+	r->last_blocknum = last_blocknum;
+	r->encoded_scids = NULL;
+	r->timestamps = NULL;
+	r->checksums = NULL;
+}
+
+static void forget_channel_range(struct channel_range *r, bool scids)
+{
+	if (scids)
+		r->encoded_scids = tal_free(r->encoded_scids);
+	r->timestamps = tal_free(r->timestamps);
+	r->checksums = tal_free(r->checksums);
+}
+
+/* Back to one range covering every block, with nothing encoded. */
+static void reset_channel_ranges(struct routing_state *rstate)
+{
+	for (size_t i = 0; i < tal_count(rstate->channel_ranges); i++)
+		forget_channel_range(&rstate->channel_ranges[i], true);
+	tal_resize(&rstate->channel_ranges, 1);
+	init_channel_range(&rstate->channel_ranges[0], 0, UINT32_MAX);
+}
+
+size_t channel_range_idx(const struct routing_state *rstate, u32 blocknum)
+{
+	size_t lo = 0, hi = tal_count(rstate->channel_ranges);
+
+	/* Between them they cover every block, so the answer is lo. */
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (rstate->channel_ranges[mid].first_blocknum <= blocknum)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void split_channel_range(struct routing_state *rstate, size_t idx,
+			 u32 blocknum)
+{
+	size_t n = tal_count(rstate->channel_ranges);
+	struct channel_range *r;
+
+	tal_resize(&rstate->channel_ranges, n + 1);
+	r = rstate->channel_ranges;
+	memmove(r + idx + 2, r + idx + 1, (n - idx - 1) * sizeof(*r));
+
+	assert(blocknum > r[idx].first_blocknum);
+	assert(blocknum <= r[idx].last_blocknum);
+	forget_channel_range(&r[idx], true);
+	init_channel_range(&r[idx + 1], blocknum, r[idx].last_blocknum);
+	r[idx].last_blocknum = blocknum - 1;
+}
+
+void merge_channel_ranges(struct routing_state *rstate, size_t idx)
+{
+	size_t n = tal_count(rstate->channel_ranges);
+	struct channel_range *r = rstate->channel_ranges;
+
+	assert(idx + 1 < n);
+	forget_channel_range(&r[idx], true);
+	forget_channel_range(&r[idx + 1], true);
+	r[idx].last_blocknum = r[idx + 1].last_blocknum;
+	memmove(r + idx + 1, r + idx + 2, (n - idx - 2) * sizeof(*r));
+	tal_resize(&rstate->channel_ranges, n - 1);
+}
+
+/* What we'd tell query_channel_range about this channel's block is stale:
+ * if @scids, because the channels in it have changed. */
+static void channel_range_changed(struct routing_state *rstate,
+				  const struct chan *chan, bool scids)
+{
+	size_t idx = channel_range_idx(rstate,
+				       short_channel_id_blocknum(&chan->scid));
+
+	forget_channel_range(&rstate->channel_ranges[idx], scids);
 }
 
 struct routing_state *new_routing_state(const tal_t *ctx,
@@ -173,6 +311,10 @@ struct routing_state *new_routing_state(const tal_t *ctx,
 					const u32 *dev_gossip_time)
 {
 	struct routing_state *rstate = tal(ctx, struct routing_state);
+	struct timeabs now;
+
+	slab_init(rstate, &rstate->chan_slab, sizeof(struct chan));
+	slab_init(rstate, &rstate->node_slab, sizeof(struct node));
 	rstate->nodes = new_node_map(rstate);
 	rstate->gs = gossip_store_new(rstate, peers);
 	rstate->chainparams = chainparams;
@@ -184,8 +326,24 @@ struct routing_state *new_routing_state(const tal_t *ctx,
 
 	uintmap_init(&rstate->chanmap);
 	uintmap_init(&rstate->unupdated_chanmap);
+	uintmap_init(&rstate->prune_buckets);
 	chan_map_init(&rstate->local_disabled_map);
 	uintmap_init(&rstate->txout_failures);
+	rstate->graph = NULL;
+	rstate->graph_changes = NULL;
+	rstate->graph_refresh = NULL;
+	rstate->num_landmarks = 0;
+	rstate->landmarks = NULL;
+	rstate->landmarks_refresh = NULL;
+	now = time_now();
+	rstate->generation = rstate->topology_generation
+		= (u64)now.ts.tv_sec * 1000000 + now.ts.tv_nsec / 1000;
+	rstate->removed_chans = tal_arr(rstate, struct removed_chan, 0);
+	rstate->removed_nodes = tal_arr(rstate, struct removed_node, 0);
+	rstate->removed_horizon = rstate->generation;
+	rstate->route_cache = NULL;
+	rstate->channel_ranges = tal_arr(rstate, struct channel_range, 0);
+	reset_channel_ranges(rstate);
 
 	rstate->pending_node_map = tal(ctx, struct pending_node_map);
 	pending_node_map_init(rstate->pending_node_map);
@@ -220,19 +378,104 @@ bool node_map_node_eq(const struct node *n, const struct node_id *pc)
 }
 
 
-static void destroy_node(struct node *node, struct routing_state *rstate)
+/* We remember this many removed channels (and nodes) for listchannels (and
+ * listnodes) since: anyone asking about earlier gets everything. */
+#define MAX_REMOVED 65536
+
+/* Forget the older half of a full removed_chans or removed_nodes. */
+#define trim_removed(rstate, arr)					\
+	do {								\
+		size_t n_ = tal_count(arr), keep_ = n_ - n_ / 2;	\
+		if (n_ < MAX_REMOVED)					\
+			break;						\
+		if ((arr)[n_ / 2 - 1].generation			\
+		    > (rstate)->removed_horizon)			\
+			(rstate)->removed_horizon			\
+				= (arr)[n_ / 2 - 1].generation;		\
+		memmove((arr), (arr) + n_ / 2, keep_ * sizeof(*(arr)));	\
+		tal_resize(&(arr), keep_);				\
+	} while (0)
+
+static void note_removed_chan(struct routing_state *rstate,
+			      const struct short_channel_id *scid)
+{
+	struct removed_chan r;
+
+	trim_removed(rstate, rstate->removed_chans);
+	r.generation = ++rstate->generation;
+	r.scid = *scid;
+	tal_arr_expand(&rstate->removed_chans, r);
+}
+
+static void note_removed_node(struct routing_state *rstate,
+			      const struct node_id *id)
+{
+	struct removed_node r;
+
+	trim_removed(rstate, rstate->removed_nodes);
+	r.generation = ++rstate->generation;
+	r.id = *id;
+	tal_arr_expand(&rstate->removed_nodes, r);
+}
+
+/* route_prune runs every prune_timeout/4: this many buckets per prune_timeout
+ * means it only looks at a few of them each time. */
+#define PRUNE_BUCKETS 64
+
+/* The newest of chan's channel_update timestamps (0 if it has none). */
+static u32 newest_update(const struct chan *chan)
 {
-	struct chan_map_iter i;
-	struct chan *c;
-	node_map_del(rstate->nodes, node);
+	u32 newest = 0;
+
+	for (size_t i = 0; i < 2; i++) {
+		if (is_halfchan_defined(&chan->half[i])
+		    && chan->half[i].bcast.timestamp > newest)
+			newest = chan->half[i].bcast.timestamp;
+	}
+	return newest;
+}
+
+static u64 prune_bucket(const struct routing_state *rstate, u32 timestamp)
+{
+	return timestamp / (rstate->prune_timeout / PRUNE_BUCKETS + 1);
+}
+
+/* Timestamps only ever go up, so a channel is never in a later bucket than
+ * its updates say: route_prune moves it along when it gets there. */
+static void file_for_pruning(struct routing_state *rstate, struct chan *chan)
+{
+	u64 key = prune_bucket(rstate, newest_update(chan));
+	struct list_head *bucket = uintmap_get(&rstate->prune_buckets, key);
+
+	if (!bucket) {
+		bucket = tal(rstate, struct list_head);
+		list_head_init(bucket);
+		uintmap_add(&rstate->prune_buckets, key, bucket);
+	}
+	list_del(&chan->prune_list);
+	list_add_tail(bucket, &chan->prune_list);
+}
 
-	/* These remove themselves from chans[]. */
-	while ((c = first_chan(node, &i)) != NULL)
-		free_chan(rstate, c);
+static void clear_prune_buckets(struct routing_state *rstate)
+{
+	struct list_head *bucket;
+	u64 key;
+
+	while ((bucket = uintmap_first(&rstate->prune_buckets, &key)) != NULL) {
+		uintmap_del(&rstate->prune_buckets, key);
+		tal_free(bucket);
+	}
+}
+
+static void free_node(struct routing_state *rstate, struct node *node)
+{
+	note_removed_node(rstate, &node->id);
+	node_map_del(rstate->nodes, node);
 
 	/* Free htable if we need. */
 	if (node_uses_chan_map(node))
 		chan_map_clear(&node->chans.map);
+	slab_free(&rstate->node_slab, node);
 }
 
 struct node *get_node(struct routing_state *rstate,
@@ -248,12 +491,12 @@ static struct node *new_node(struct routing_state *rstate,
 
 	assert(!get_node(rstate, id));
 
-	n = tal(rstate, struct node);
+	n = slab_alloc(&rstate->node_slab);
 	n->id = *id;
 	memset(n->chans.arr, 0, sizeof(n->chans.arr));
 	broadcastable_init(&n->bcast);
+	n->generation = ++rstate->generation;
 	node_map_add(rstate->nodes, n);
-	tal_add_destructor2(n, destroy_node, rstate);
 
 	return n;
 }
@@ -329,7 +572,7 @@ static void remove_chan_from_node(struct routing_state *rstate,
 		gossip_store_delete(rstate->gs,
 				    &node->bcast,
 				    WIRE_NODE_ANNOUNCEMENT);
-		tal_free(node);
+		free_node(rstate, node);
 		return;
 	}
 
@@ -341,6 +584,7 @@ static void remove_chan_from_node(struct routing_state *rstate,
 		gossip_store_delete(rstate->gs,
 				    &node->bcast,
 				    WIRE_NODE_ANNOUNCEMENT);
+		node->generation = ++rstate->generation;
 	} else if (node_announce_predates_channels(node)) {
 		const u8 *announce;
 
@@ -361,10 +605,224 @@ static void remove_chan_from_node(struct routing_state *rstate,
 	}
 }
 
-/* We used to make this a tal_add_destructor2, but that costs 40 bytes per
- * chan, and we only ever explicitly free it anyway. */
+/* Landmarks being computed in the background for a graph. */
+struct landmarks_refresh {
+	struct routing_state *rstate;
+	struct route_graph *graph;
+	struct route_landmarks *landmarks;
+	/* Did the network change so they're wrong before they're done? */
+	bool stale;
+};
+
+/* The landmarks no longer give lower bounds: get new ones when next
+ * needed.  As with the graph, any queries still using them free them. */
+static void drop_landmarks(struct routing_state *rstate)
+{
+	if (rstate->landmarks && rstate->landmarks->readers)
+		rstate->landmarks = NULL;
+	else
+		rstate->landmarks = tal_free(rstate->landmarks);
+
+	if (rstate->landmarks_refresh)
+		rstate->landmarks_refresh->stale = true;
+}
+
+/* Channels which came, went or changed since the graph was made. */
+struct graph_changes {
+	/* The graph reflects everything before this generation. */
+	u64 generation;
+	/* These need merging into a new graph. */
+	struct short_channel_id *added, *removed;
+	/* These need their edges patched, once nothing is reading it. */
+	struct short_channel_id *changed;
+};
+
+/* A new graph being merged in the background. */
+struct graph_refresh {
+	struct routing_state *rstate;
+	/* The graph it starts from, and what's changed since. */
+	struct route_graph *old;
+	struct graph_changes *changes;
+	struct route_graph_merge *merge;
+	/* Did the whole network go before it was done? */
+	bool stale;
+};
+
+/* Record a change the graph doesn't reflect yet: everything before
+ * @generation, it does. */
+static struct graph_changes *graph_changes(struct routing_state *rstate,
+					   u64 generation)
+{
+	struct graph_changes *c = rstate->graph_changes;
+
+	if (!c) {
+		c = rstate->graph_changes = tal(rstate, struct graph_changes);
+		c->generation = generation;
+		c->added = tal_arr(c, struct short_channel_id, 0);
+		c->removed = tal_arr(c, struct short_channel_id, 0);
+		c->changed = tal_arr(c, struct short_channel_id, 0);
+	}
+	return c;
+}
+
+/* Routes found on the current graph are up to date as of this. */
+static u64 route_graph_generation(const struct routing_state *rstate)
+{
+	if (rstate->graph_refresh && !rstate->graph_refresh->stale)
+		return rstate->graph_refresh->changes->generation;
+	if (rstate->graph_changes)
+		return rstate->graph_changes->generation;
+	return rstate->generation;
+}
+
+/* The whole network went: build the graph from scratch when next needed.
+ * If route queries are still using it, the last one frees it. */
+static void invalidate_route_graph(struct routing_state *rstate)
+{
+	if (rstate->graph && rstate->graph->readers)
+		rstate->graph = NULL;
+	else
+		rstate->graph = tal_free(rstate->graph);
+	rstate->graph_changes = tal_free(rstate->graph_changes);
+	if (rstate->graph_refresh)
+		rstate->graph_refresh->stale = true;
+	drop_landmarks(rstate);
+}
+
+static void patch_route_graph(struct routing_state *rstate,
+			      const struct chan *chan)
+{
+	if (route_graph_update_chan(rstate->graph, rstate, chan))
+		drop_landmarks(rstate);
+}
+
+/* Patch the edges of channels which changed while the graph was busy. */
+static void patch_changed_chans(struct routing_state *rstate,
+				struct short_channel_id **changed)
+{
+	for (size_t i = 0; i < tal_count(*changed); i++) {
+		struct chan *chan = get_channel(rstate, &(*changed)[i]);
+
+		/* If it's gone, the next merge removes it. */
+		if (chan)
+			patch_route_graph(rstate, chan);
+	}
+	tal_resize(changed, 0);
+}
+
+/* The graph is up to date, but for anything waiting to be merged. */
+static void route_graph_patched(struct routing_state *rstate)
+{
+	struct graph_changes *c = rstate->graph_changes;
+
+	if (!c)
+		return;
+	patch_changed_chans(rstate, &c->changed);
+	if (tal_count(c->added) == 0 && tal_count(c->removed) == 0)
+		rstate->graph_changes = tal_free(c);
+}
+
+/* A channel's fees, limits or enabled-ness changed (and its generation
+ * was bumped): patch the graph. */
+static void update_route_graph(struct routing_state *rstate,
+			       const struct chan *chan)
+{
+	struct graph_changes *c;
+
+	if (!rstate->graph)
+		return;
+
+	/* Never alter a graph under a running query or merge: the last one
+	 * to finish with it patches it. */
+	if (rstate->graph->readers) {
+		c = graph_changes(rstate, chan->generation - 1);
+		tal_arr_expand(&c->changed, chan->scid);
+		return;
+	}
+	patch_route_graph(rstate, chan);
+}
+
+/* A channel was added (and its generation bumped): the next merge adds it. */
+static void graph_chan_added(struct routing_state *rstate,
+			     const struct chan *chan)
+{
+	struct graph_changes *c;
+
+	if (!rstate->graph)
+		return;
+	c = graph_changes(rstate, chan->generation - 1);
+	tal_arr_expand(&c->added, chan->scid);
+}
+
+/* A channel is going: the next merge removes it. */
+static void graph_chan_removed(struct routing_state *rstate,
+			       const struct chan *chan)
+{
+	struct graph_changes *c;
+
+	if (!rstate->graph)
+		return;
+
+	/* Meanwhile, don't route through it if we can help it. */
+	if (!rstate->graph->readers)
+		route_graph_disable_chan(rstate->graph, chan);
+	c = graph_changes(rstate, rstate->generation);
+	tal_arr_expand(&c->removed, chan->scid);
+}
+
+/* Only the first graph is built here, from the whole network: after that,
+ * changes are merged into a new one in the background (see
+ * routing_graph_refresh), and queries use this one until it's ready. */
+static struct route_graph *current_route_graph(struct routing_state *rstate)
+{
+	if (!rstate->graph)
+		rstate->graph = route_graph_new(rstate, rstate);
+	return rstate->graph;
+}
+
+/* Cached routes through this channel, and its timestamps and checksums for
+ * reply_channel_range, are now stale. */
+static void chan_changed(struct routing_state *rstate, struct chan *chan)
+{
+	chan->generation = ++rstate->generation;
+	channel_range_changed(rstate, chan, false);
+}
+
+/* Could routes which don't use it now be worse than one through it?  hc
+ * has just been updated, so may not have its store index yet. */
+static bool halfchan_improved(const struct half_chan *old,
+			      const struct half_chan *hc)
+{
+	if (hc->channel_flags & ROUTING_FLAGS_DISABLED)
+		return false;
+	if (!is_halfchan_enabled(old))
+		return true;
+	return hc->base_fee < old->base_fee
+		|| hc->proportional_fee < old->proportional_fee
+		|| hc->delay < old->delay
+		|| amount_msat_less(hc->htlc_minimum, old->htlc_minimum)
+		|| amount_msat_greater(hc->htlc_maximum, old->htlc_maximum);
+}
+
+/* Last user of a replaced graph frees it; of the current one, patches
+ * whatever changed while it was busy. */
+static void release_route_graph(struct routing_state *rstate,
+				struct route_graph *graph)
+{
+	if (--graph->readers != 0)
+		return;
+	if (graph != rstate->graph)
+		tal_free(graph);
+	else
+		route_graph_patched(rstate);
+}
+
+/* chans aren't tal objects (see struct slab), so this is the only way to
+ * free one. */
 void free_chan(struct routing_state *rstate, struct chan *chan)
 {
+	/* Before its nodes (which might go too). */
+	graph_chan_removed(rstate, chan);
 	remove_chan_from_node(rstate, chan->nodes[0], chan);
 	remove_chan_from_node(rstate, chan->nodes[1], chan);
 
@@ -372,7 +830,12 @@ void free_chan(struct routing_state *rstate, struct chan *chan)
 
 	/* Remove from local_disabled_map if it's there. */
 	chan_map_del(&rstate->local_disabled_map, chan);
-	tal_free(chan);
+	/* No need to bump its generation: cached routes through it are stale
+	 * because they won't find it any more. */
+	channel_range_changed(rstate, chan, true);
+	note_removed_chan(rstate, &chan->scid);
+	list_del(&chan->prune_list);
+	slab_free(&rstate->chan_slab, chan);
 }
 
 static void init_half_chan(struct routing_state *rstate,
@@ -402,7 +865,7 @@ struct chan *new_chan(struct routing_state *rstate,
 		      const struct node_id *id2,
 		      struct amount_sat satoshis)
 {
-	struct chan *chan = tal(rstate, struct chan);
+	struct chan *chan = slab_alloc(&rstate->chan_slab);
 	int n1idx = node_id_idx(id1, id2);
 	struct node *n1, *n2;
 
@@ -424,9 +887,15 @@ struct chan *new_chan(struct routing_state *rstate,
 	/* This is how we indicate it's not public yet. */
 	chan->bcast.timestamp = 0;
 	chan->sat = satoshis;
+	/* Not filed for pruning until it's public. */
+	list_node_init(&chan->prune_list);
+	/* It might be a better route than any we've cached. */
+	chan->generation = rstate->topology_generation = ++rstate->generation;
+	channel_range_changed(rstate, chan, true);
 
 	add_chan(n2, chan);
 	add_chan(n1, chan);
+	graph_chan_added(rstate, chan);
 
 	/* Populate with (inactive) connections */
 	init_half_chan(rstate, chan, n1idx);
@@ -436,745 +905,814 @@ struct chan *new_chan(struct routing_state *rstate,
 	return chan;
 }
 
-/* Too big to reach, but don't overflow if added. */
-#define INFINITE AMOUNT_MSAT(0x3FFFFFFFFFFFFFFFULL)
-
-/* We hack a multimap into a uintmap to implement a minheap by cost.
- * This is relatively inefficient, containing an array for each cost
- * value, assuming there aren't too many at same cost.
- *
- * We further optimize by never freeing or shrinking these entries,
- * but delete by replacing with NULL.  This means that we cache the
- * lowest index which actually contains something, since others may
- * contain empty arrays. */
-struct unvisited {
-	u64 min_index;
-	UINTMAP(struct node **) map;
-};
+void local_disable_chan(struct routing_state *rstate, struct chan *chan)
+{
+	if (!is_chan_local_disabled(rstate, chan)) {
+		chan_map_add(&rstate->local_disabled_map, chan);
+		chan->generation = ++rstate->generation;
+		update_route_graph(rstate, chan);
+	}
+}
 
+void local_enable_chan(struct routing_state *rstate, struct chan *chan)
+{
+	if (chan_map_del(&rstate->local_disabled_map, chan)) {
+		/* Like a new channel, as far as cached routes are concerned. */
+		chan->generation = rstate->topology_generation
+			= ++rstate->generation;
+		update_route_graph(rstate, chan);
+	}
+}
 
-/* Risk of passing through this channel.
- *
- * There are two ways this function is used:
- *
- * 1. Normally, riskbias = 1.  A tiny bias here in order to prefer
- *    shorter routes, all things equal.
- * 2. Trying to find a shorter route, riskbias > 1.  By adding an extra
- *    cost to every hop, we're trying to bias against overlength routes.
- */
-static WARN_UNUSED_RESULT bool risk_add_fee(struct amount_msat *risk,
-					    struct amount_msat msat,
-					    u32 delay, double riskfactor,
-					    u64 riskbias)
+static int edge_cmp(const void *a, const void *b)
 {
-	double r;
+	const u32 *ea = a, *eb = b;
 
-	/* Won't overflow on add, just lose precision */
-	r = (double)riskbias + riskfactor * delay * msat.millisatoshis + risk->millisatoshis; /* Raw: to double */
-	if (r > UINT64_MAX)
-		return false;
-	risk->millisatoshis = r; /* Raw: from double */
-	return true;
+	if (*ea < *eb)
+		return -1;
+	return *ea > *eb;
 }
 
-/* Check that we can fit through this channel's indicated
- * maximum_ and minimum_msat requirements.
- */
-static bool hc_can_carry(const struct half_chan *hc,
-			 struct amount_msat requiredcap)
+/* Map the excluded channels onto graph edges: we never search those.
+ * We leave room for another @spare edges, padded with EDGE_NONE: that sorts
+ * last, and never matches an edge, so the padding is harmless. */
+#define EDGE_NONE UINT32_MAX
+static u32 *excluded_edges(const tal_t *ctx,
+			   struct routing_state *rstate,
+			   const struct route_graph *graph,
+			   const struct short_channel_id_dir *excluded,
+			   size_t spare)
 {
-	return amount_msat_greater_eq(hc->htlc_maximum, requiredcap) &&
-		amount_msat_less_eq(hc->htlc_minimum, requiredcap);
+	u32 *edges = tal_arr(ctx, u32, 0);
+	size_t n;
+
+	for (size_t i = 0; i < tal_count(excluded); i++) {
+		struct chan *chan = get_channel(rstate, &excluded[i].scid);
+		u32 edge;
+
+		if (!chan)
+			continue;
+		if (!route_graph_chan_edge(graph, chan, excluded[i].dir, &edge))
+			continue;
+		tal_arr_expand(&edges, edge);
+	}
+	qsort(edges, tal_count(edges), sizeof(edges[0]), edge_cmp);
+
+	n = tal_count(edges);
+	tal_resize(&edges, n + spare);
+	for (size_t i = n; i < n + spare; i++)
+		edges[i] = EDGE_NONE;
+	return edges;
 }
 
-/* Theoretically, this could overflow. */
-static bool fuzz_fee(u64 *fee,
-		     const struct short_channel_id *scid,
-		     double fuzz, const struct siphash_seed *base_seed)
+/* Insert into the padding left by excluded_edges(): doesn't allocate. */
+static void exclude_edge(u32 *excluded, u32 edge)
 {
-	u64 fuzzed_fee, h;
- 	double fee_scale;
-
-	if (fuzz == 0.0)
-		return true;
+	size_t i = tal_count(excluded);
 
-	h = siphash24(base_seed, scid, sizeof(*scid));
+	/* Find the first free slot. */
+	assert(excluded[i-1] == EDGE_NONE);
+	while (i > 0 && excluded[i-1] == EDGE_NONE)
+		i--;
 
-	/* Scale fees for this channel */
-	/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
-	 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
-	 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
-	 */
-	fee_scale = 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
-	fuzzed_fee = *fee * fee_scale;
-	if (fee_scale > 1.0 && fuzzed_fee < *fee)
-		return false;
-	*fee = fuzzed_fee;
-	return true;
+	/* Shuffle up the larger ones. */
+	while (i > 0 && excluded[i-1] > edge) {
+		excluded[i] = excluded[i-1];
+		i--;
+	}
+	excluded[i] = edge;
 }
 
-/* Can we carry this amount across the channel?  If so, returns true and
- * sets newtotal and newrisk */
-static bool can_reach(const struct half_chan *c,
-		      const struct short_channel_id *scid,
-		      bool no_charge,
-		      struct amount_msat total,
-		      struct amount_msat risk,
-		      double riskfactor,
-		      u64 riskbias,
-		      double fuzz, const struct siphash_seed *base_seed,
-		      struct amount_msat *newtotal, struct amount_msat *newrisk)
-{
-	/* FIXME: Bias against smaller channels. */
+/* Everything needed to answer a route request, so we can do it without
+ * touching the routing_state (ie. from another thread). */
+struct route_query {
+	/* Only touched by the main thread. */
+	struct routing_state *rstate;
+
+	/* NULL if we already know there's no route. */
+	struct route_graph *graph;
+	struct route_graph_scratch *scratch;
+	u32 src, dst;
+	bool from_is_me;
+	struct amount_msat msat;
+	double riskfactor;
+	u32 final_cltv;
+	double fuzz;
+	struct siphash_seed base_seed;
+	u32 *excluded;
+	size_t max_hops;
+	size_t max_routes;
+	/* NULL if we don't have any (yet). */
+	struct route_landmarks *landmarks;
+	/* Where to cache the answer (NULL if we're not). */
+	struct route_cache_key *cache_key;
+	u64 generation;
+
+	/* Filled in by route_query_run: edges and fee are for the first
+	 * route (edges point into scratch). */
+	const u32 *edges;
 	struct amount_msat fee;
+	/* Route i is num_hops[i] long, at hops[i * hops_per_route]. */
+	size_t num_routes;
+	size_t *num_hops;
+	size_t hops_per_route;
+	struct route_hop *hops;
 
-	if (!amount_msat_fee(&fee, total, c->base_fee, c->proportional_fee))
-		return false;
+	/* For a tree query: which nodes to price (NULL means all), and
+	 * what it costs to reach each one which we can. */
+	bool tree;
+	u32 *tree_dsts;
+	size_t num_tree_dsts;
+	struct route_cost *costs;
+	size_t num_costs;
+};
 
-  	if (!fuzz_fee(&fee.millisatoshis, scid, fuzz, base_seed)) /* Raw: double manipulation */
-		return false;
+static void destroy_route_query(struct route_query *rq)
+{
+	if (!rq->graph)
+		return;
+
+	release_route_graph(rq->rstate, rq->graph);
+	if (rq->landmarks && --rq->landmarks->readers == 0
+	    && rq->landmarks != rq->rstate->landmarks)
+		tal_free(rq->landmarks);
+}
+
+/* riskfactor is already scaled to per-block amount */
+static struct route_query *
+new_route_query_(const tal_t *ctx, struct routing_state *rstate,
+		 const struct node_id *from, const struct node_id *to,
+		 struct amount_msat msat,
+		 double riskfactor,
+		 u32 final_cltv,
+		 double fuzz, const struct siphash_seed *base_seed,
+		 const struct short_channel_id_dir *excluded,
+		 size_t max_hops,
+		 size_t max_routes)
+{
+	struct route_query *rq = tal(ctx, struct route_query);
+	struct route_graph *graph;
+
+	rq->rstate = rstate;
+	rq->graph = NULL;
+	rq->msat = msat;
+	rq->riskfactor = riskfactor;
+	rq->final_cltv = final_cltv;
+	rq->fuzz = fuzz;
+	if (base_seed)
+		rq->base_seed = *base_seed;
+	else
+		memset(&rq->base_seed, 0, sizeof(rq->base_seed));
+	rq->max_hops = max_hops;
+	rq->max_routes = max_routes;
+	rq->edges = NULL;
+	rq->num_routes = 0;
+	rq->cache_key = NULL;
+	/* The graph may not have caught up yet. */
+	rq->generation = route_graph_generation(rstate);
+	rq->tree = false;
+	/* If from is NULL, that's means it's us. */
+	rq->from_is_me = (from == NULL);
 
-	if (no_charge) {
-		*newtotal = total;
+	if (amount_msat_eq(msat, AMOUNT_MSAT(0)) || max_routes == 0)
+		return rq;
 
-		/* We still want to consider the "charge", since it's indicative
-		 * of a bias (we discounted one channel for a reason), but we
-		 * don't pay it.  So we count it as additional risk. */
-		if (!amount_msat_add(newrisk, risk, fee))
+	graph = current_route_graph(rstate);
+
+	if (!route_graph_node_idx(graph, to, &rq->dst)) {
+		status_info("find_route: cannot find %s",
+			    type_to_string(tmpctx, struct node_id, to));
+		return rq;
+	}
+
+	if (!route_graph_node_idx(graph, from ? from : &rstate->local_id,
+				  &rq->src)) {
+		status_info("find_route: cannot find source (%s)",
+			    type_to_string(tmpctx, struct node_id, to));
+		return rq;
+	} else if (rq->src == rq->dst) {
+		status_info("find_route: this is %s, refusing to create empty route",
+			    type_to_string(tmpctx, struct node_id, to));
+		return rq;
+	}
+
+	/* A route can't be longer than the number of nodes. */
+	rq->hops_per_route = max_hops < route_graph_num_nodes(graph)
+		? max_hops : route_graph_num_nodes(graph);
+	/* Each route after the first avoids the edges of those before. */
+	rq->excluded = excluded_edges(rq, rstate, graph, excluded,
+				      (max_routes - 1) * rq->hops_per_route);
+	rq->scratch = route_graph_scratch_new(rq, graph);
+	rq->num_hops = tal_arr(rq, size_t, max_routes);
+	rq->hops = tal_arr(rq, struct route_hop,
+			   max_routes * rq->hops_per_route);
+
+	rq->graph = graph;
+	graph->readers++;
+	/* These are always for the current graph. */
+	rq->landmarks = rstate->landmarks;
+	if (rq->landmarks)
+		rq->landmarks->readers++;
+	tal_add_destructor(rq, destroy_route_query);
+	return rq;
+}
+
+/* Hops for a cached route, worked out from the channels as they are now:
+ * false if any have changed since we found it, or can't carry the amount. */
+static bool cached_route_hops(struct routing_state *rstate,
+			      const struct short_channel_id_dir *path,
+			      size_t num_hops, u64 generation,
+			      struct amount_msat msat, u32 final_cltv,
+			      struct route_hop *hops)
+{
+	struct amount_msat total_amount = msat;
+	unsigned int total_delay = final_cltv;
+
+	for (int i = num_hops - 1; i >= 0; i--) {
+		struct chan *chan = get_channel(rstate, &path[i].scid);
+		const struct half_chan *hc;
+		struct route_hop *hop = &hops[i];
+
+		if (!chan || chan->generation > generation)
 			return false;
-	} else {
-		*newrisk = risk;
+		hc = &chan->half[path[i].dir];
+		if (!is_halfchan_enabled(hc)
+		    || is_chan_local_disabled(rstate, chan))
+			return false;
+		/* It was found for an amount in the same bucket, not this one. */
+		if (amount_msat_greater(total_amount, hc->htlc_maximum)
+		    || amount_msat_less(total_amount, hc->htlc_minimum))
+			return false;
+
+		hop->channel_id = chan->scid;
+		hop->nodeid = chan->nodes[!path[i].dir]->id;
+		hop->amount = total_amount;
+		hop->delay = total_delay;
+		hop->direction = path[i].dir;
 
-		if (!amount_msat_add(newtotal, total, fee))
+		if (!amount_msat_add_fee(&total_amount,
+					 hc->base_fee, hc->proportional_fee))
 			return false;
+		total_delay += hc->delay;
 	}
+	return true;
+}
 
-	/* Skip a channel if it indicated that it won't route the
-	 * requested amount. */
-	if (!hc_can_carry(c, *newtotal))
-		return false;
+static bool cached_routes_valid(const struct route_cache_entry *entry,
+				struct route_query *rq)
+{
+	const struct short_channel_id_dir *path = entry->path;
 
-	if (!risk_add_fee(newrisk, *newtotal, c->delay, riskfactor, riskbias))
+	/* A new channel might offer something better. */
+	if (rq->rstate->topology_generation > entry->generation)
 		return false;
 
+	rq->num_routes = tal_count(entry->route_lens);
+	rq->num_hops = tal_arr(rq, size_t, rq->num_routes);
+	rq->hops_per_route = 0;
+	for (size_t i = 0; i < rq->num_routes; i++) {
+		rq->num_hops[i] = entry->route_lens[i];
+		if (rq->num_hops[i] > rq->hops_per_route)
+			rq->hops_per_route = rq->num_hops[i];
+	}
+	rq->hops = tal_arr(rq, struct route_hop,
+			   rq->num_routes * rq->hops_per_route);
+
+	for (size_t i = 0; i < rq->num_routes; i++) {
+		if (!cached_route_hops(rq->rstate, path, rq->num_hops[i],
+				       entry->generation,
+				       rq->msat, rq->final_cltv,
+				       rq->hops + i * rq->hops_per_route))
+			return false;
+		path += rq->num_hops[i];
+	}
 	return true;
 }
 
-/* Returns false on overflow (shouldn't happen!) */
-typedef bool WARN_UNUSED_RESULT costfn_t(struct amount_msat *,
-					 struct amount_msat,
-					 struct amount_msat);
-
-static WARN_UNUSED_RESULT bool
-normal_cost_function(struct amount_msat *cost,
-		     struct amount_msat total, struct amount_msat risk)
+/* A query which is already answered from the cache (or NULL). */
+static struct route_query *
+cached_route_query(const tal_t *ctx, struct routing_state *rstate,
+		   const struct route_cache_key *key,
+		   struct amount_msat msat, u32 final_cltv)
 {
-	if (amount_msat_add(cost, total, risk))
-		return true;
+	struct route_query *rq = tal(ctx, struct route_query);
 
-	status_broken("Can't add cost of node %s + %s",
-		      type_to_string(tmpctx, struct amount_msat, &total),
-		      type_to_string(tmpctx, struct amount_msat, &risk));
-	return false;
+	rq->rstate = rstate;
+	rq->graph = NULL;
+	rq->landmarks = NULL;
+	rq->cache_key = NULL;
+	rq->edges = NULL;
+	rq->msat = msat;
+	rq->final_cltv = final_cltv;
+	rq->max_routes = key->max_routes;
+	rq->num_routes = 0;
+	rq->tree = false;
+
+	if (!route_cache_get(rstate->route_cache, key,
+			     gossip_time_now(rstate).ts.tv_sec,
+			     cached_routes_valid, rq))
+		return tal_free(rq);
+	return rq;
 }
 
-static WARN_UNUSED_RESULT bool
-shortest_cost_function(struct amount_msat *cost,
-		       struct amount_msat total, struct amount_msat risk)
+struct route_query *new_route_query(const tal_t *ctx,
+				    struct routing_state *rstate,
+				    const struct node_id *source,
+				    const struct node_id *destination,
+				    struct amount_msat msat, double riskfactor,
+				    u32 final_cltv,
+				    double fuzz, u64 seed,
+				    const struct short_channel_id_dir *excluded,
+				    size_t max_hops,
+				    size_t max_routes)
 {
-	/* We add 1, so cost is never 0, for our hacky uintmap-as-minheap. */
-	if (amount_msat_add(cost, risk, AMOUNT_MSAT(1)))
-		return true;
+	struct siphash_seed base_seed;
+	struct route_cache_key *key;
+	struct route_query *rq;
+
+	if (rstate->route_cache) {
+		key = tal(tmpctx, struct route_cache_key);
+		key->from_me = (source == NULL);
+		key->source = source ? *source : rstate->local_id;
+		key->destination = *destination;
+		key->amount_bucket = route_cache_amount_bucket(msat);
+		key->riskfactor = riskfactor;
+		key->fuzz = fuzz;
+		key->max_hops = max_hops;
+		key->max_routes = max_routes;
+		key->excluded = route_cache_sort_excluded(key, excluded);
+
+		rq = cached_route_query(ctx, rstate, key, msat, final_cltv);
+		if (rq)
+			return rq;
+	} else
+		key = NULL;
 
-	status_broken("Can't add 1 to risk of node %s",
-		      type_to_string(tmpctx, struct amount_msat, &risk));
-	return false;
+	base_seed.u.u64[0] = base_seed.u.u64[1] = seed;
+
+	rq = new_route_query_(ctx, rstate, source, destination, msat,
+			      riskfactor / BLOCKS_PER_YEAR / 100,
+			      final_cltv, fuzz, &base_seed, excluded,
+			      max_hops, max_routes);
+	rq->cache_key = tal_steal(rq, key);
+	return rq;
+}
+
+struct route_query *new_route_tree_query(const tal_t *ctx,
+					 struct routing_state *rstate,
+					 struct amount_msat msat,
+					 double riskfactor,
+					 u32 final_cltv,
+					 const struct node_id *destinations,
+					 size_t max_hops)
+{
+	struct route_query *rq = tal(ctx, struct route_query);
+	struct route_graph *graph;
+
+	rq->rstate = rstate;
+	rq->graph = NULL;
+	rq->landmarks = NULL;
+	rq->cache_key = NULL;
+	rq->generation = route_graph_generation(rstate);
+	rq->msat = msat;
+	rq->riskfactor = riskfactor / BLOCKS_PER_YEAR / 100;
+	rq->final_cltv = final_cltv;
+	rq->max_hops = max_hops;
+	rq->from_is_me = true;
+	rq->edges = NULL;
+	rq->num_routes = 0;
+	rq->tree = true;
+	rq->costs = NULL;
+	rq->num_costs = 0;
+
+	if (amount_msat_eq(msat, AMOUNT_MSAT(0)))
+		return rq;
+
+	graph = current_route_graph(rstate);
+	if (!route_graph_node_idx(graph, &rstate->local_id, &rq->src)) {
+		status_info("find_route_tree: we have no channels");
+		return rq;
+	}
+
+	if (destinations) {
+		rq->tree_dsts = tal_arr(rq, u32, 0);
+		for (size_t i = 0; i < tal_count(destinations); i++) {
+			u32 idx;
+			if (route_graph_node_idx(graph, &destinations[i], &idx))
+				tal_arr_expand(&rq->tree_dsts, idx);
+		}
+		rq->num_tree_dsts = tal_count(rq->tree_dsts);
+	} else {
+		rq->tree_dsts = NULL;
+		rq->num_tree_dsts = route_graph_num_nodes(graph);
+	}
+
+	rq->hops_per_route = max_hops < route_graph_num_nodes(graph)
+		? max_hops : route_graph_num_nodes(graph);
+	rq->hops = tal_arr(rq, struct route_hop, rq->hops_per_route);
+	rq->costs = tal_arr(rq, struct route_cost, rq->num_tree_dsts);
+	rq->scratch = route_graph_tree_scratch_new(rq, graph);
+
+	rq->graph = graph;
+	graph->readers++;
+	tal_add_destructor(rq, destroy_route_query);
+	return rq;
 }
 
-/* Does totala+riska add up to less than totalb+riskb?
- * Saves sums if you want them.
- */
-static bool costs_less(struct amount_msat totala,
-		       struct amount_msat riska,
-		       struct amount_msat *costa,
-		       struct amount_msat totalb,
-		       struct amount_msat riskb,
-		       struct amount_msat *costb,
-		       costfn_t *costfn)
+/* Turn edges into hops: false if the amounts overflow. */
+static bool fill_hops(const struct route_graph *graph,
+		      const u32 *edges, size_t num_edges,
+		      struct amount_msat msat, u32 final_cltv,
+		      struct route_hop *hops)
 {
-	struct amount_msat suma, sumb;
+	struct amount_msat total_amount;
+	unsigned int total_delay;
 
-	if (!costfn(&suma, totala, riska))
-		return false;
-	if (!costfn(&sumb, totalb, riskb))
-		return false;
+	/* Fees, delays need to be calculated backwards along route. */
+	total_amount = msat;
+	total_delay = final_cltv;
+
+	for (int i = num_edges - 1; i >= 0; i--) {
+		const struct route_graph_edge *e = &graph->edges[edges[i]];
+		struct route_hop *hop = &hops[i];
 
-	if (costa)
-		*costa = suma;
-	if (costb)
-		*costb = sumb;
-	return amount_msat_less(suma, sumb);
+		hop->channel_id = e->scid;
+		hop->nodeid = graph->ids[route_graph_edge_dst(graph, edges[i])];
+		hop->amount = total_amount;
+		hop->delay = total_delay;
+		hop->direction = e->direction;
+
+		/* Since we calculated this route, it should not overflow! */
+		if (!amount_msat_add_fee(&total_amount,
+					 e->base_fee, e->proportional_fee))
+			return false;
+		total_delay += e->delay;
+	}
+	return true;
 }
 
-/* Determine if the given half_chan is routable */
-static bool hc_is_routable(struct routing_state *rstate,
-			   const struct chan *chan, int idx)
+/* One search prices the routes to all of them: we use rq->hops to work
+ * out each one exactly, as we would for getroute. */
+static void route_tree_run(struct route_query *rq)
 {
-	return is_halfchan_enabled(&chan->half[idx])
-		&& !is_chan_local_disabled(rstate, chan);
+	const struct route_graph *graph = rq->graph;
+
+	route_graph_find_tree(rq->scratch, graph, rq->src,
+			      rq->msat, rq->riskfactor);
+
+	for (size_t i = 0; i < rq->num_tree_dsts; i++) {
+		u32 dst = rq->tree_dsts ? rq->tree_dsts[i] : i;
+		struct route_cost *cost = &rq->costs[rq->num_costs];
+		const u32 *edges;
+		size_t num_edges;
+
+		edges = route_graph_tree_route(rq->scratch, graph, rq->src, dst,
+					       &num_edges);
+		if (!edges || num_edges > rq->hops_per_route)
+			continue;
+		if (!fill_hops(graph, edges, num_edges, rq->msat,
+			       rq->final_cltv, rq->hops))
+			continue;
+		/* We don't pay fees on our own channel. */
+		if (!amount_msat_sub(&cost->fee, rq->hops[0].amount, rq->msat))
+			continue;
+		cost->destination = graph->ids[dst];
+		cost->delay = rq->hops[0].delay;
+		cost->hops = num_edges;
+		rq->num_costs++;
+	}
 }
 
-static void unvisited_add(struct unvisited *unvisited, struct amount_msat cost,
-			  struct node **arr)
+void route_query_run(struct route_query *rq)
 {
-	u64 idx = cost.millisatoshis; /* Raw: uintmap needs u64 index */
-	if (idx < unvisited->min_index) {
-		assert(idx); /* We don't allow sending 0 satoshis */
-		unvisited->min_index = idx - 1;
+	const struct route_graph *graph = rq->graph;
+
+	if (!graph)
+		return;
+
+	if (rq->tree) {
+		route_tree_run(rq);
+		return;
+	}
+
+	/* We don't do anything clever (like Yen's algorithm): each route
+	 * simply avoids every channel direction used by those before it.
+	 * That gives independent alternatives, which is what a payer
+	 * wants: routes which don't share whichever channel failed. */
+	while (rq->num_routes < rq->max_routes) {
+		const u32 *edges;
+		size_t num_edges;
+		struct amount_msat fee;
+		struct route_hop *hops;
+
+		edges = route_graph_find_route(rq->scratch, graph,
+					       rq->src, rq->dst,
+					       rq->from_is_me,
+					       rq->msat, rq->riskfactor,
+					       rq->fuzz, &rq->base_seed,
+					       rq->excluded, rq->landmarks,
+					       rq->max_hops,
+					       &num_edges, &fee);
+		if (!edges)
+			break;
+
+		assert(num_edges <= rq->hops_per_route);
+		assert(graph->edges[edges[0]].src == rq->src);
+		hops = rq->hops + rq->num_routes * rq->hops_per_route;
+		if (!fill_hops(graph, edges, num_edges, rq->msat,
+			       rq->final_cltv, hops))
+			break;
+
+		if (rq->num_routes == 0) {
+			rq->edges = edges;
+			rq->fee = fee;
+		}
+		rq->num_hops[rq->num_routes++] = num_edges;
+
+		if (rq->num_routes < rq->max_routes) {
+			for (size_t i = 0; i < num_edges; i++)
+				exclude_edge(rq->excluded, edges[i]);
+		}
 	}
-	uintmap_add(&unvisited->map, idx, arr);
 }
 
-static struct node **unvisited_get(const struct unvisited *unvisited,
-				   struct amount_msat cost)
+size_t route_query_num_routes(const struct route_query *rq)
 {
-	return uintmap_get(&unvisited->map, cost.millisatoshis); /* Raw: uintmap */
+	return rq->num_routes;
 }
 
-static struct node **unvisited_del(struct unvisited *unvisited,
-				   struct amount_msat cost)
+struct route_hop *route_query_hops(const tal_t *ctx,
+				   const struct route_query *rq,
+				   size_t n)
 {
-	return uintmap_del(&unvisited->map, cost.millisatoshis); /* Raw: uintmap */
+	if (n >= rq->num_routes)
+		return NULL;
+	return tal_dup_arr(ctx, struct route_hop,
+			   rq->hops + n * rq->hops_per_route,
+			   rq->num_hops[n], 0);
 }
 
-static bool is_unvisited(const struct node *node,
-			 const struct unvisited *unvisited,
-			 costfn_t *costfn)
+struct route_cost *route_query_costs(const tal_t *ctx,
+				     const struct route_query *rq)
 {
-	struct node **arr;
-	struct amount_msat cost;
-
-	/* If it's infinite, definitely unvisited */
-	if (amount_msat_eq(node->dijkstra.total, INFINITE))
-		return true;
-
-	/* Shouldn't happen! */
-	if (!costfn(&cost, node->dijkstra.total, node->dijkstra.risk))
-		return false;
-
-	arr = unvisited_get(unvisited, cost);
-	for (size_t i = 0; i < tal_count(arr); i++) {
-		if (arr[i] == node)
-			return true;
-	}
-	return false;
+	assert(rq->tree);
+	return tal_dup_arr(ctx, struct route_cost, rq->costs,
+			   rq->num_costs, 0);
 }
 
-static void unvisited_del_node(struct unvisited *unvisited,
-			       struct amount_msat cost,
-			       const struct node *node)
+size_t route_query_settled(const struct route_query *rq)
 {
-	struct node **arr;
-
-	arr = unvisited_get(unvisited, cost);
-	for (size_t i = 0; i < tal_count(arr); i++) {
-		if (arr[i] == node) {
-			arr[i] = NULL;
-			return;
-		}
-	}
-	abort();
+	if (!rq->graph)
+		return 0;
+	return route_graph_scratch_settled(rq->scratch);
 }
 
-static void adjust_unvisited(struct node *node,
-			     struct unvisited *unvisited,
-			     struct amount_msat cost_before,
-			     struct amount_msat total,
-			     struct amount_msat risk,
-			     struct amount_msat cost_after)
+void route_query_cache(const struct route_query *rq)
 {
-	struct node **arr;
+	struct routing_state *rstate = rq->rstate;
+	struct short_channel_id_dir *path;
+	size_t *route_lens;
+
+	/* We don't cache failures: gossip might arrive any moment. */
+	if (!rq->cache_key || rq->num_routes == 0)
+		return;
 
-	/* If it was in unvisited map, remove it. */
-	if (!amount_msat_eq(node->dijkstra.total, INFINITE))
-		unvisited_del_node(unvisited, cost_before, node);
+	/* If anything changed while we were searching, it may be stale
+	 * already. */
+	if (rstate->topology_generation > rq->generation)
+		return;
 
-	/* Update node */
-	node->dijkstra.total = total;
-	node->dijkstra.risk = risk;
+	route_lens = tal_arr(tmpctx, size_t, rq->num_routes);
+	path = tal_arr(tmpctx, struct short_channel_id_dir, 0);
+	for (size_t i = 0; i < rq->num_routes; i++) {
+		const struct route_hop *hops = rq->hops + i * rq->hops_per_route;
 
-	SUPERVERBOSE("%s now cost %s",
-		     type_to_string(tmpctx, struct node_id, &node->id),
-		     type_to_string(tmpctx, struct amount_msat, &cost_after));
+		route_lens[i] = rq->num_hops[i];
+		for (size_t j = 0; j < rq->num_hops[i]; j++) {
+			struct short_channel_id_dir scidd;
+			const struct chan *chan;
 
-	/* Update map of unvisited nodes */
-	arr = unvisited_get(unvisited, cost_after);
-	if (arr) {
-		struct node **old_arr;
-		/* Try for empty slot */
-		for (size_t i = 0; i < tal_count(arr); i++) {
-			if (arr[i] == NULL) {
-				arr[i] = node;
+			chan = get_channel(rstate, &hops[j].channel_id);
+			if (!chan || chan->generation > rq->generation)
 				return;
-			}
+			scidd.scid = hops[j].channel_id;
+			scidd.dir = hops[j].direction;
+			tal_arr_expand(&path, scidd);
 		}
-		/* Nope, expand */
-		old_arr = arr;
-		tal_arr_expand(&arr, node);
-		if (arr == old_arr)
-			return;
-
-		/* Realloc moved it; del and add again. */
-		unvisited_del(unvisited, cost_after);
-	} else {
-		arr = tal_arr(unvisited, struct node *, 1);
-		arr[0] = node;
 	}
 
-	unvisited_add(unvisited, cost_after, arr);
+	route_cache_add(rstate->route_cache, rq->cache_key, rq->generation,
+			gossip_time_now(rstate).ts.tv_sec, route_lens, path);
 }
 
-static void remove_unvisited(struct node *node, struct unvisited *unvisited,
-			     costfn_t *costfn)
+void routing_route_cache_stats(const struct routing_state *rstate,
+			       struct route_cache_stats *stats)
 {
-	struct amount_msat cost;
+	if (rstate->route_cache)
+		route_cache_get_stats(rstate->route_cache, stats);
+	else
+		memset(stats, 0, sizeof(*stats));
+}
 
-	/* Shouldn't happen! */
-	if (!costfn(&cost, node->dijkstra.total, node->dijkstra.risk))
-		return;
+static int scid_cmp(const void *a, const void *b)
+{
+	const struct short_channel_id *sa = a, *sb = b;
 
-	unvisited_del_node(unvisited, cost, node);
+	if (sa->u64 < sb->u64)
+		return -1;
+	return sa->u64 > sb->u64;
 }
 
-static void update_unvisited_neighbors(struct routing_state *rstate,
-				       struct node *cur,
-				       const struct node *me,
-				       double riskfactor,
-				       u64 riskbias,
-				       double fuzz,
-				       const struct siphash_seed *base_seed,
-				       struct unvisited *unvisited,
-				       costfn_t *costfn)
+/*~ Building the graph from the whole network takes over a second once
+ * it's large, and channels come and go all the time: so, like landmarks,
+ * we make a new one in the background, from the old one and what's changed
+ * since.  Queries carry on with the old one until it's ready. */
+struct graph_refresh *routing_graph_refresh(struct routing_state *rstate)
 {
-	struct chan_map_iter i;
-	struct chan *chan;
+	struct graph_changes *c = rstate->graph_changes;
+	struct graph_refresh *refresh;
+	struct chan **added;
 
-	/* Consider all neighbors */
-	for (chan = first_chan(cur, &i); chan; chan = next_chan(cur, &i)) {
-		struct amount_msat total, risk, cost_before, cost_after;
-		int idx = half_chan_to(cur, chan);
-		struct node *peer = chan->nodes[idx];
-
-		SUPERVERBOSE("CONSIDERING: %s -> %s (%s/%s)",
-			     type_to_string(tmpctx, struct node_id,
-					    &cur->id),
-			     type_to_string(tmpctx, struct node_id,
-					    &peer->id),
-			     type_to_string(tmpctx, struct amount_msat,
-					    &peer->dijkstra.total),
-			     type_to_string(tmpctx, struct amount_msat,
-					    &peer->dijkstra.risk));
-
-		if (!hc_is_routable(rstate, chan, idx)) {
-			SUPERVERBOSE("... not routable");
-			continue;
-		}
+	if (!c || !rstate->graph || rstate->graph_refresh)
+		return NULL;
 
-		if (!is_unvisited(peer, unvisited, costfn)) {
-			SUPERVERBOSE("... already visited");
-			continue;
+	if (tal_count(c->added) == 0 && tal_count(c->removed) == 0) {
+		/* Only edges changed: if nothing's using it, patch it.
+		 * Otherwise queries could keep it busy indefinitely, so we
+		 * copy it in the background (by merging nothing), and patch
+		 * the copy. */
+		if (!rstate->graph->readers) {
+			route_graph_patched(rstate);
+			return NULL;
 		}
+	}
 
-		/* We're looking at channels *backwards*, so peer == me
-		 * is the right test here for whether we don't charge fees. */
-		if (!can_reach(&chan->half[idx], &chan->scid, peer == me,
-			       cur->dijkstra.total, cur->dijkstra.risk,
-			       riskfactor, riskbias, fuzz, base_seed,
-			       &total, &risk)) {
-			SUPERVERBOSE("... can't reach");
-			continue;
-		}
+	/* A channel can be removed and added again: only add it once. */
+	qsort(c->added, tal_count(c->added), sizeof(c->added[0]), scid_cmp);
+	added = tal_arr(tmpctx, struct chan *, 0);
+	for (size_t i = 0; i < tal_count(c->added); i++) {
+		struct chan *chan;
 
-		/* This effectively adds it to the map if it was infinite */
-		if (costs_less(total, risk, &cost_after,
-			       peer->dijkstra.total, peer->dijkstra.risk,
-			       &cost_before,
-			       costfn)) {
-			SUPERVERBOSE("...%s can reach %s"
-				     " total %s risk %s",
-				     type_to_string(tmpctx, struct node_id,
-						    &cur->id),
-				     type_to_string(tmpctx, struct node_id,
-						    &peer->id),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &total),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &risk));
-			adjust_unvisited(peer, unvisited,
-					 cost_before, total, risk, cost_after);
-		}
+		if (i && short_channel_id_eq(&c->added[i], &c->added[i-1]))
+			continue;
+		/* If it's gone again, it's in removed too. */
+		chan = get_channel(rstate, &c->added[i]);
+		if (chan)
+			tal_arr_expand(&added, chan);
 	}
+
+	refresh = tal(rstate, struct graph_refresh);
+	refresh->rstate = rstate;
+	refresh->old = rstate->graph;
+	refresh->old->readers++;
+	refresh->changes = tal_steal(refresh, c);
+	refresh->merge = route_graph_merge_new(refresh, rstate, refresh->old,
+					       c->removed, added);
+	refresh->stale = false;
+	rstate->graph_changes = NULL;
+	rstate->graph_refresh = refresh;
+	return refresh;
 }
 
-static struct node *first_unvisited(struct unvisited *unvisited)
+void graph_refresh_run(struct graph_refresh *refresh)
 {
-	struct node **arr;
+	route_graph_merge_run(refresh->merge);
+}
 
-	while ((arr = uintmap_after(&unvisited->map, &unvisited->min_index))) {
-		for (size_t i = 0; i < tal_count(arr); i++) {
-			if (arr[i]) {
-				unvisited->min_index--;
-				return arr[i];
-			}
-		}
-	}
+void graph_refresh_done(struct graph_refresh *refresh)
+{
+	struct routing_state *rstate = refresh->rstate;
+	struct graph_changes *c = refresh->changes;
+	struct route_graph *graph;
 
-	return NULL;
-}
+	assert(rstate->graph_refresh == refresh);
+	rstate->graph_refresh = NULL;
+	graph = route_graph_merge_done(rstate, refresh->merge);
 
-static void dijkstra(struct routing_state *rstate,
-		     const struct node *dst,
-		     const struct node *me,
-		     double riskfactor,
-		     u64 riskbias,
-		     double fuzz, const struct siphash_seed *base_seed,
-		     struct unvisited *unvisited,
-		     costfn_t *costfn)
-{
-	struct node *cur;
-
-	while ((cur = first_unvisited(unvisited)) != NULL) {
-		update_unvisited_neighbors(rstate, cur, me,
-					   riskfactor, riskbias,
-					   fuzz, base_seed, unvisited, costfn);
-		remove_unvisited(cur, unvisited, costfn);
-		if (cur == dst)
-			return;
-	}
-}
-
-/* Note that we calculated route *backwards*, for fees.  So "from"
- * here has a high cost, "to" has a cost of exact amount sent. */
-static struct chan **build_route(const tal_t *ctx,
-				 struct routing_state *rstate,
-				 const struct node *from,
-				 const struct node *to,
-				 const struct node *me,
-				 double riskfactor,
-				 u64 riskbias,
-				 double fuzz,
-				 const struct siphash_seed *base_seed,
-				 struct amount_msat *fee)
-{
-	const struct node *i;
-	struct chan **route, *chan;
-
-	SUPERVERBOSE("Building route from %s (%s) -> %s (%s)",
-		     type_to_string(tmpctx, struct node_id, &from->id),
-		     type_to_string(tmpctx, struct amount_msat,
-				    &from->dijkstra.total),
-		     type_to_string(tmpctx, struct node_id, &to->id),
-		     type_to_string(tmpctx, struct amount_msat,
-				    &to->dijkstra.total));
-	/* Never reached? */
-	if (amount_msat_eq(from->dijkstra.total, INFINITE))
-		return NULL;
+	if (refresh->stale) {
+		tal_free(graph);
+		release_route_graph(rstate, refresh->old);
+		tal_free(refresh);
+		return;
+	}
 
-	/* Walk to find which neighbors we used */
-	route = tal_arr(ctx, struct chan *, 0);
-	for (i = from; i != to; i = other_node(i, chan)) {
-		struct chan_map_iter it;
-
-		/* Consider all neighbors */
-		for (chan = first_chan(i, &it); chan; chan = next_chan(i, &it)) {
-			struct node *peer = other_node(i, chan);
-			struct half_chan *hc = half_chan_from(i, chan);
-			struct amount_msat total, risk;
-
-			SUPERVERBOSE("CONSIDER: %s -> %s (%s/%s)",
-				     type_to_string(tmpctx, struct node_id,
-						    &i->id),
-				     type_to_string(tmpctx, struct node_id,
-						    &peer->id),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &peer->dijkstra.total),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &peer->dijkstra.risk));
-
-			/* If traversing this wasn't possible, ignore */
-			if (!hc_is_routable(rstate, chan, !half_chan_to(i, chan))) {
-				continue;
-			}
+	assert(rstate->graph == refresh->old);
+	rstate->graph = graph;
+	/* Nodes have moved, so landmarks for the old one are no use. */
+	if (tal_count(c->added) || tal_count(c->removed))
+		drop_landmarks(rstate);
 
-			if (!can_reach(hc, &chan->scid, i == me,
-				       peer->dijkstra.total, peer->dijkstra.risk,
-				       riskfactor,
-				       riskbias,
-				       fuzz, base_seed,
-				       &total, &risk))
-				continue;
+	/* Channels which changed before we started, or since. */
+	patch_changed_chans(rstate, &c->changed);
+	route_graph_patched(rstate);
 
-			/* If this was the path we took, we're done (if there are
-			 * two identical ones, it doesn't matter which) */
-			if (amount_msat_eq(total, i->dijkstra.total)
-			    && amount_msat_eq(risk, i->dijkstra.risk))
-				break;
-		}
+	status_debug("Route graph now has %zu nodes (%zu channels added,"
+		     " %zu removed)", route_graph_num_nodes(graph),
+		     tal_count(c->added), tal_count(c->removed));
+	release_route_graph(rstate, refresh->old);
+	tal_free(refresh);
+}
 
-		if (!chan) {
-			status_broken("Could not find hop to %s",
-				      type_to_string(tmpctx, struct node_id,
-						     &i->id));
-			return tal_free(route);
-		}
-		tal_arr_expand(&route, chan);
-	}
+/* For answering on the spot: merge any changes now. */
+static void route_graph_catch_up(struct routing_state *rstate)
+{
+	struct graph_refresh *refresh = routing_graph_refresh(rstate);
 
-	/* We don't charge ourselves fees, so skip first hop */
-	if (!amount_msat_sub(fee,
-			     other_node(from, route[0])->dijkstra.total,
-			     to->dijkstra.total)) {
-		status_broken("Could not subtract %s - %s for fee",
-			      type_to_string(tmpctx, struct amount_msat,
-					     &other_node(from, route[0])
-					     ->dijkstra.total),
-			      type_to_string(tmpctx, struct amount_msat,
-					     &to->dijkstra.total));
-		return tal_free(route);
+	if (refresh) {
+		graph_refresh_run(refresh);
+		graph_refresh_done(refresh);
 	}
-
-	return route;
 }
 
-static struct unvisited *dijkstra_prepare(const tal_t *ctx,
-					  struct routing_state *rstate,
-					  struct node *src,
-					  struct amount_msat msat,
-					  costfn_t *costfn)
+/*~ Landmarks take a few complete searches of the network to compute,
+ * which is too long to hold up gossipd: so like route queries, they're
+ * computed away from the routing_state, in the background.  Until they're
+ * done (and whenever the network changes so they're not correct any more)
+ * queries simply don't use them. */
+struct landmarks_refresh *routing_landmarks_refresh(struct routing_state *rstate)
 {
-	struct node_map_iter it;
-	struct unvisited *unvisited;
-	struct node *n;
-	struct node **arr;
-	struct amount_msat cost;
+	struct landmarks_refresh *refresh;
 
-	unvisited = tal(tmpctx, struct unvisited);
-	uintmap_init(&unvisited->map);
-	unvisited->min_index = UINT64_MAX;
-
-	/* Reset all the information. */
-	for (n = node_map_first(rstate->nodes, &it);
-	     n;
-	     n = node_map_next(rstate->nodes, &it)) {
-		if (n == src)
-			continue;
-		n->dijkstra.total = INFINITE;
-		n->dijkstra.risk = INFINITE;
-	}
+	/* Landmarks for a graph about to be replaced would be no use. */
+	if (!rstate->num_landmarks
+	    || rstate->landmarks
+	    || rstate->landmarks_refresh
+	    || rstate->graph_refresh)
+		return NULL;
 
-	/* Mark start cost: place in unvisited map. */
-	src->dijkstra.total = msat;
-	src->dijkstra.risk = AMOUNT_MSAT(0);
-	arr = tal_arr(unvisited, struct node *, 1);
-	arr[0] = src;
-	/* Adding 0 can never fail */
-	if (!costfn(&cost, src->dijkstra.total, src->dijkstra.risk))
-		abort();
-	unvisited_add(unvisited, cost, arr);
+	refresh = tal(rstate, struct landmarks_refresh);
+	refresh->rstate = rstate;
+	refresh->graph = current_route_graph(rstate);
+	refresh->graph->readers++;
+	refresh->landmarks = route_landmarks_new(refresh, refresh->graph,
+						 rstate->num_landmarks);
+	refresh->stale = false;
+	rstate->landmarks_refresh = refresh;
+	return refresh;
+}
 
-	return unvisited;
+void landmarks_refresh_run(struct landmarks_refresh *refresh)
+{
+	route_landmarks_compute(refresh->landmarks, refresh->graph);
 }
 
-static void dijkstra_cleanup(struct unvisited *unvisited)
+void landmarks_refresh_done(struct landmarks_refresh *refresh)
 {
-	struct node **arr;
-	u64 idx;
+	struct routing_state *rstate = refresh->rstate;
 
-	/* uintmap uses malloc, so manual cleaning needed */
-	while ((arr = uintmap_first(&unvisited->map, &idx)) != NULL) {
-		tal_free(arr);
-		uintmap_del(&unvisited->map, idx);
-	}
-	tal_free(unvisited);
-}
-
-/* We need to start biassing against long routes. */
-static struct chan **
-find_shorter_route(const tal_t *ctx, struct routing_state *rstate,
-		   struct node *src, struct node *dst,
-		   const struct node *me,
-		   struct amount_msat msat,
-		   size_t max_hops,
-		   double fuzz, const struct siphash_seed *base_seed,
-		   struct chan **long_route,
-		   struct amount_msat *fee)
-{
-	struct unvisited *unvisited;
-	struct chan **short_route = NULL;
-	struct amount_msat long_cost, short_cost, cost_diff;
-	u64 min_bias, max_bias;
-	double riskfactor;
+	assert(rstate->landmarks_refresh == refresh);
+	rstate->landmarks_refresh = NULL;
+	release_route_graph(rstate, refresh->graph);
 
-	/* We traverse backwards, so dst has largest total */
-	if (!amount_msat_sub(&long_cost,
-			     dst->dijkstra.total, src->dijkstra.total))
-		goto bad_total;
-	tal_free(long_route);
-
-	/* FIXME: It's hard to juggle both the riskfactor and riskbias here,
-	 * so we set our riskfactor to rougly equate to 1 millisatoshi
-	 * per block delay, which is close enough to zero to not break
-	 * this algorithm, but still provide some bias towards
-	 * low-delay routes. */
-	riskfactor = (double)1.0 / msat.millisatoshis; /* Raw: inversion */
-
-	/* First, figure out if a short route is even possible.
-	 * We set the cost function to ignore total, riskbias 1 and riskfactor
-	 * ~0 so risk simply operates as a simple hop counter. */
-	unvisited = dijkstra_prepare(tmpctx, rstate, src, msat,
-				     shortest_cost_function);
-	SUPERVERBOSE("Running shortest path from %s -> %s",
-		     type_to_string(tmpctx, struct node_id, &dst->id),
-		     type_to_string(tmpctx, struct node_id, &src->id));
-	dijkstra(rstate, dst, NULL, riskfactor, 1, fuzz, base_seed,
-		 unvisited, shortest_cost_function);
-	dijkstra_cleanup(unvisited);
-
-	/* This must succeed, since we found a route before */
-	short_route = build_route(ctx, rstate, dst, src, me, riskfactor, 1,
-				  fuzz, base_seed, fee);
-	assert(short_route);
-	if (!amount_msat_sub(&short_cost,
-			     dst->dijkstra.total, src->dijkstra.total))
-		goto bad_total;
-
-	/* Still too long?  Oh well. */
-	if (tal_count(short_route) > max_hops) {
-		status_info("Minimal possible route %s->%s is %zu",
-			    type_to_string(tmpctx, struct node_id, &dst->id),
-			    type_to_string(tmpctx, struct node_id, &src->id),
-			    tal_count(short_route));
-		goto out;
-	}
-
-	/* OK, so it's possible, just more expensive. */
-	min_bias = 0;
-
-	if (!amount_msat_sub(&cost_diff, short_cost, long_cost)) {
-		status_broken("Short cost %s < long cost %s?",
-			      type_to_string(tmpctx, struct amount_msat,
-					     &short_cost),
-			      type_to_string(tmpctx, struct amount_msat,
-					     &long_cost));
-		goto out;
-	}
-
-	/* This is a gross overestimate, but it works. */
-	max_bias = cost_diff.millisatoshis; /* Raw: bias calc */
-
-	SUPERVERBOSE("maxbias %"PRIu64" gave rlen %zu",
-		     max_bias, tal_count(short_route));
-
-	/* Now, binary search */
-	while (min_bias < max_bias) {
-		struct chan **route;
-		struct amount_msat this_fee;
-		u64 riskbias = (min_bias + max_bias) / 2;
-
-		unvisited = dijkstra_prepare(tmpctx, rstate, src, msat,
-					     normal_cost_function);
-		dijkstra(rstate, dst, me, riskfactor, riskbias, fuzz, base_seed,
-			 unvisited, normal_cost_function);
-		dijkstra_cleanup(unvisited);
-
-		route = build_route(ctx, rstate, dst, src, me,
-				    riskfactor, riskbias,
-				    fuzz, base_seed, &this_fee);
-
-		SUPERVERBOSE("riskbias %"PRIu64" rlen %zu",
-			     riskbias, tal_count(route));
-		/* Too long still?  This is our new min_bias */
-		if (tal_count(route) > max_hops) {
-			tal_free(route);
-			min_bias = riskbias + 1;
-		} else {
-			/* This route is acceptable. */
-			tal_free(short_route);
-			short_route = route;
-			/* Save this fee in case we exit loop */
-			*fee = this_fee;
-			max_bias = riskbias;
-		}
+	if (refresh->stale)
+		status_debug("Discarding routing landmarks: network changed");
+	else {
+		assert(!rstate->landmarks);
+		rstate->landmarks = tal_steal(rstate, refresh->landmarks);
+		rstate->landmarks->work = tal_free(rstate->landmarks->work);
+		status_debug("Using %zu routing landmarks",
+			     rstate->landmarks->num);
 	}
+	tal_free(refresh);
+}
 
-	return short_route;
-
-bad_total:
-	status_broken("dst total %s < src total %s?",
-		      type_to_string(tmpctx, struct amount_msat,
-				     &dst->dijkstra.total),
-		      type_to_string(tmpctx, struct amount_msat,
-				     &src->dijkstra.total));
-out:
-	tal_free(short_route);
-	return NULL;
+size_t routing_landmarks_in_use(const struct routing_state *rstate)
+{
+	if (!rstate->landmarks)
+		return 0;
+	return rstate->landmarks->num;
 }
 
-/* riskfactor is already scaled to per-block amount */
-static struct chan **
+/* riskfactor is already scaled to per-block amount.  Only the tests use
+ * this now: they like to see the actual channels. */
+static UNNEEDED struct chan **
 find_route(const tal_t *ctx, struct routing_state *rstate,
 	   const struct node_id *from, const struct node_id *to,
 	   struct amount_msat msat,
 	   double riskfactor,
 	   double fuzz, const struct siphash_seed *base_seed,
+	   const struct short_channel_id_dir *excluded,
 	   size_t max_hops,
 	   struct amount_msat *fee)
 {
-	struct node *src, *dst;
-	const struct node *me;
-	struct unvisited *unvisited;
+	struct route_query *rq;
 	struct chan **route;
 
-	/* Note: we map backwards, since we know the amount of satoshi we want
-	 * at the end, and need to derive how much we need to send. */
-	src = get_node(rstate, to);
+	route_graph_catch_up(rstate);
+	rq = new_route_query_(tmpctx, rstate, from, to, msat, riskfactor, 0,
+			      fuzz, base_seed, excluded, max_hops, 1);
+	route_query_run(rq);
+	if (rq->num_routes == 0)
+		return tal_free(rq);
 
-	/* If from is NULL, that's means it's us. */
-	if (!from)
-		me = dst = get_node(rstate, &rstate->local_id);
-	else {
-		dst = get_node(rstate, from);
-		me = NULL;
-	}
+	route = tal_arr(ctx, struct chan *, rq->num_hops[0]);
+	for (size_t i = 0; i < rq->num_hops[0]; i++)
+		route[i] = get_channel(rstate,
+				       &rq->graph->edges[rq->edges[i]].scid);
 
-	if (!src) {
-		status_info("find_route: cannot find %s",
-			    type_to_string(tmpctx, struct node_id, to));
-		return NULL;
-	} else if (!dst) {
-		status_info("find_route: cannot find source (%s)",
-			    type_to_string(tmpctx, struct node_id, to));
-		return NULL;
-	} else if (dst == src) {
-		status_info("find_route: this is %s, refusing to create empty route",
-			    type_to_string(tmpctx, struct node_id, to));
-		return NULL;
-	}
-
-	unvisited = dijkstra_prepare(tmpctx, rstate, src, msat,
-				     normal_cost_function);
-	dijkstra(rstate, dst, me, riskfactor, 1, fuzz, base_seed,
-		 unvisited, normal_cost_function);
-	dijkstra_cleanup(unvisited);
-
-	route = build_route(ctx, rstate, dst, src, me, riskfactor, 1,
-			    fuzz, base_seed, fee);
-	if (tal_count(route) <= max_hops)
-		return route;
-
-	/* This is the far more unlikely case */
-	return find_shorter_route(ctx, rstate, src, dst, me, msat,
-				  max_hops, fuzz, base_seed, route, fee);
+	*fee = rq->fee;
+	tal_free(rq);
+	return route;
 }
 
 /* Checks that key is valid, and signed this hash */
@@ -1387,6 +1925,8 @@ static void add_channel_announce_to_broadcast(struct routing_state *rstate,
 	u8 *addendum = towire_gossip_store_channel_amount(tmpctx, chan->sat);
 
 	chan->bcast.timestamp = timestamp;
+	/* Now it's public, its updates' timestamps and checksums count. */
+	chan_changed(rstate, chan);
 	/* 0, unless we're loading from store */
 	if (index)
 		chan->bcast.index = index;
@@ -1396,6 +1936,7 @@ static void add_channel_announce_to_broadcast(struct routing_state *rstate,
 						     chan->bcast.timestamp,
 						     addendum);
 	rstate->local_channel_announced |= is_local_channel(rstate, chan);
+	file_for_pruning(rstate, chan);
 }
 
 bool routing_add_channel_announcement(struct routing_state *rstate,
@@ -1485,6 +2026,7 @@ bool routing_add_channel_announcement(struct routing_state *rstate,
 
 u8 *handle_channel_announcement(struct routing_state *rstate,
 				const u8 *announce TAKES,
+				bool sigs_checked,
 				const struct short_channel_id **scid)
 {
 	struct pending_cannouncement *pending;
@@ -1500,6 +2042,7 @@ u8 *handle_channel_announcement(struct routing_state *rstate,
 	pending->announce = tal_dup_arr(pending, u8,
 					announce, tal_count(announce), 0);
 	pending->update_timestamps[0] = pending->update_timestamps[1] = 0;
+	pending->updates_checked[0] = pending->updates_checked[1] = false;
 
 	if (!fromwire_channel_announcement(pending, pending->announce,
 					   &node_signature_1,
@@ -1593,8 +2136,12 @@ u8 *handle_channel_announcement(struct routing_state *rstate,
 		goto ignored;
 	}
 
-	/* Note that if node_id_1 or node_id_2 are malformed, it's caught here */
-	err = check_channel_announcement(rstate,
+	/* Note that if node_id_1 or node_id_2 are malformed, it's caught here
+	 * (or by gossip_verify, if sigs_checked). */
+	if (sigs_checked)
+		err = NULL;
+	else
+		err = check_channel_announcement(rstate,
 					 &pending->node_id_1,
 					 &pending->node_id_2,
 					 &pending->bitcoin_key_1,
@@ -1646,7 +2193,8 @@ ignored:
 
 static void process_pending_channel_update(struct routing_state *rstate,
 					   const struct short_channel_id *scid,
-					   const u8 *cupdate)
+					   const u8 *cupdate,
+					   const struct node_id *checked_signer)
 {
 	u8 *err;
 
@@ -1654,7 +2202,8 @@ static void process_pending_channel_update(struct routing_state *rstate,
 		return;
 
 	/* FIXME: We don't remember who sent us updates, so can't error them */
-	err = handle_channel_update(rstate, cupdate, "pending update", NULL);
+	err = handle_channel_update(rstate, cupdate, "pending update",
+				    checked_signer, NULL);
 	if (err) {
 		status_trace("Pending channel_update for %s: %s",
 			     type_to_string(tmpctx, struct short_channel_id, scid),
@@ -1723,8 +2272,12 @@ bool handle_pending_cannouncement(struct routing_state *rstate,
 			      "Could not add channel_announcement");
 
 	/* Did we have an update waiting?  If so, apply now. */
-	process_pending_channel_update(rstate, scid, pending->updates[0]);
-	process_pending_channel_update(rstate, scid, pending->updates[1]);
+	process_pending_channel_update(rstate, scid, pending->updates[0],
+				       pending->updates_checked[0]
+				       ? &pending->node_id_1 : NULL);
+	process_pending_channel_update(rstate, scid, pending->updates[1],
+				       pending->updates_checked[1]
+				       ? &pending->node_id_2 : NULL);
 
 	tal_free(pending);
 	return true;
@@ -1732,8 +2285,11 @@ bool handle_pending_cannouncement(struct routing_state *rstate,
 
 static void update_pending(struct pending_cannouncement *pending,
 			   u32 timestamp, const u8 *update,
-			   const u8 direction)
+			   const u8 direction,
+			   const struct node_id *checked_signer)
 {
+	const struct node_id *owner;
+
 	SUPERVERBOSE("Deferring update for pending channel %s/%d",
 		     type_to_string(tmpctx, struct short_channel_id,
 				    &pending->short_channel_id), direction);
@@ -1745,6 +2301,9 @@ static void update_pending(struct pending_cannouncement *pending,
 		}
 		pending->updates[direction] = tal_dup_arr(pending, u8, update, tal_count(update), 0);
 		pending->update_timestamps[direction] = timestamp;
+		owner = direction ? &pending->node_id_2 : &pending->node_id_1;
+		pending->updates_checked[direction]
+			= checked_signer && node_id_eq(checked_signer, owner);
 	}
 }
 
@@ -1791,6 +2350,7 @@ bool routing_add_channel_update(struct routing_state *rstate,
 	struct bitcoin_blkid chain_hash;
 	struct chan *chan;
 	struct half_chan *hc;
+	struct half_chan old;
 	struct unupdated_channel *uc;
 	u8 direction;
 	struct amount_sat sat;
@@ -1876,10 +2436,16 @@ bool routing_add_channel_update(struct routing_state *rstate,
 	if (amount_msat_greater(htlc_maximum, rstate->chainparams->max_payment))
 		htlc_maximum = rstate->chainparams->max_payment;
 
+	old = *hc;
 	set_connection_values(chan, direction, fee_base_msat,
 			      fee_proportional_millionths, expiry,
 			      message_flags, channel_flags,
 			      timestamp, htlc_minimum, htlc_maximum);
+	chan_changed(rstate, chan);
+	/* Re-enabled, or cheaper: like a new channel, as far as cached
+	 * routes are concerned. */
+	if (halfchan_improved(&old, hc))
+		rstate->topology_generation = chan->generation;
 
 	/* Safe even if was never added, but if it's a private channel it
 	 * would be a WIRE_GOSSIP_STORE_PRIVATE_UPDATE. */
@@ -1910,6 +2476,7 @@ bool routing_add_channel_update(struct routing_state *rstate,
 								  update);
 		} else
 			hc->bcast.index = index;
+		update_route_graph(rstate, chan);
 		return true;
 	}
 
@@ -1921,8 +2488,11 @@ bool routing_add_channel_update(struct routing_state *rstate,
 			= gossip_store_add(rstate->gs, update,
 					   hc->bcast.timestamp,
 					   NULL);
+	update_route_graph(rstate, chan);
 
 	if (uc) {
+		/* It was filed for pruning without any updates. */
+		file_for_pruning(rstate, chan);
 		/* If we were waiting for these nodes to appear (or gain a
 		   public channel), process node_announcements now */
 		process_pending_node_announcement(rstate, &chan->nodes[0]->id);
@@ -1949,6 +2519,19 @@ static const struct node_id *get_channel_owner(struct routing_state *rstate,
 	return NULL;
 }
 
+const struct node_id *channel_update_signer(struct routing_state *rstate,
+					    const struct short_channel_id *scid,
+					    int direction)
+{
+	struct pending_cannouncement *pending;
+
+	/* Same order as handle_channel_update looks. */
+	pending = find_pending_cannouncement(rstate, scid);
+	if (pending)
+		return direction ? &pending->node_id_2 : &pending->node_id_1;
+	return get_channel_owner(rstate, scid, direction);
+}
+
 void remove_channel_from_store(struct routing_state *rstate,
 			       struct chan *chan)
 {
@@ -1973,6 +2556,7 @@ void remove_channel_from_store(struct routing_state *rstate,
 
 u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 			  const char *source,
+			  const struct node_id *checked_signer,
 			  struct short_channel_id *unknown_scid)
 {
 	u8 *serialized;
@@ -2035,7 +2619,8 @@ u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 					    struct short_channel_id,
 					    &short_channel_id),
 			     direction);
-		update_pending(pending, timestamp, serialized, direction);
+		update_pending(pending, timestamp, serialized, direction,
+			       checked_signer);
 		return NULL;
 	}
 
@@ -2053,7 +2638,12 @@ u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 		return NULL;
 	}
 
-	err = check_channel_update(rstate, owner, &signature, serialized);
+	/* gossip_verify may have checked it already: but against whom? */
+	if (checked_signer && node_id_eq(checked_signer, owner))
+		err = NULL;
+	else
+		err = check_channel_update(rstate, owner, &signature,
+					   serialized);
 	if (err) {
 		/* BOLT #7:
 		 *
@@ -2194,6 +2784,7 @@ bool routing_add_node_announcement(struct routing_state *rstate,
 			    WIRE_NODE_ANNOUNCEMENT);
 
 	node->bcast.timestamp = timestamp;
+	node->generation = ++rstate->generation;
 	if (index)
 		node->bcast.index = index;
 	else
@@ -2203,7 +2794,8 @@ bool routing_add_node_announcement(struct routing_state *rstate,
 	return true;
 }
 
-u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node_ann)
+u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node_ann,
+			     bool sig_checked)
 {
 	u8 *serialized;
 	struct sha256_double hash;
@@ -2250,8 +2842,9 @@ u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node_ann)
 	}
 
 	sha256_double(&hash, serialized + 66, tal_count(serialized) - 66);
-	/* If node_id is invalid, it fails here */
-	if (!check_signed_hash_nodeid(&hash, &signature, &node_id)) {
+	/* If node_id is invalid, it fails here (or in gossip_verify) */
+	if (!sig_checked
+	    && !check_signed_hash_nodeid(&hash, &signature, &node_id)) {
 		/* BOLT #7:
 		 *
 		 * - if `signature` is not a valid signature, using
@@ -2304,88 +2897,16 @@ struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    const struct short_channel_id_dir *excluded,
 			    size_t max_hops)
 {
-	struct chan **route;
-	struct amount_msat total_amount;
-	unsigned int total_delay;
-	struct amount_msat fee;
+	struct route_query *rq;
 	struct route_hop *hops;
-	struct node *n;
-	struct amount_msat *saved_capacity;
-	struct siphash_seed base_seed;
-
-	saved_capacity = tal_arr(tmpctx, struct amount_msat, tal_count(excluded));
-
-	base_seed.u.u64[0] = base_seed.u.u64[1] = seed;
-
-	if (amount_msat_eq(msat, AMOUNT_MSAT(0)))
-		return NULL;
-
-	/* Temporarily set excluded channels' capacity to zero. */
-	for (size_t i = 0; i < tal_count(excluded); i++) {
-		struct chan *chan = get_channel(rstate, &excluded[i].scid);
-		if (!chan)
-			continue;
-		saved_capacity[i] = chan->half[excluded[i].dir].htlc_maximum;
-		chan->half[excluded[i].dir].htlc_maximum = AMOUNT_MSAT(0);
-	}
-
-	route = find_route(ctx, rstate, source, destination, msat,
-			   riskfactor / BLOCKS_PER_YEAR / 100,
-			   fuzz, &base_seed, max_hops, &fee);
-
-	/* Now restore the capacity. */
-	/* Restoring is done in reverse order, in order to properly
-	 * handle the case where a channel is indicated twice in
-	 * our input.
-	 * Entries in `saved_capacity` of that channel beyond the
-	 * first entry will be 0, only the first entry of that
-	 * channel will be the correct capacity.
-	 * By restoring in reverse order we ensure we can restore
-	 * the correct capacity.
-	 */
-	for (ssize_t i = tal_count(excluded) - 1; i >= 0; i--) {
-		struct chan *chan = get_channel(rstate, &excluded[i].scid);
-		if (!chan)
-			continue;
-		chan->half[excluded[i].dir].htlc_maximum = saved_capacity[i];
-	}
-
-	if (!route) {
-		return NULL;
-	}
-
-	/* Fees, delays need to be calculated backwards along route. */
-	hops = tal_arr(ctx, struct route_hop, tal_count(route));
-	total_amount = msat;
-	total_delay = final_cltv;
-
-	/* Start at destination node. */
-	n = get_node(rstate, destination);
-	for (int i = tal_count(route) - 1; i >= 0; i--) {
-		const struct half_chan *c;
-
-		int idx = half_chan_to(n, route[i]);
-		c = &route[i]->half[idx];
-		hops[i].channel_id = route[i]->scid;
-		hops[i].nodeid = n->id;
-		hops[i].amount = total_amount;
-		hops[i].delay = total_delay;
-		hops[i].direction = idx;
-
-		/* Since we calculated this route, it should not overflow! */
-		if (!amount_msat_add_fee(&total_amount,
-					 c->base_fee, c->proportional_fee)) {
-			status_broken("Route overflow step %i: %s + %u/%u!?",
-				      i, type_to_string(tmpctx, struct amount_msat,
-							&total_amount),
-				      c->base_fee, c->proportional_fee);
-			return tal_free(hops);
-		}
-		total_delay += c->delay;
-		n = other_node(n, route[i]);
-	}
-	assert(node_id_eq(&n->id, source ? source : &rstate->local_id));
 
+	route_graph_catch_up(rstate);
+	rq = new_route_query(tmpctx, rstate, source, destination, msat,
+			     riskfactor, final_cltv, fuzz, seed, excluded,
+			     max_hops, 1);
+	route_query_run(rq);
+	hops = route_query_hops(ctx, rq, 0);
+	tal_free(rq);
 	return hops;
 }
 
@@ -2397,6 +2918,7 @@ void routing_failure(struct routing_state *rstate,
 		     const u8 *channel_update)
 {
 	struct chan **pruned = tal_arr(tmpctx, struct chan *, 0);
+	struct chan *erring_chan;
 
 	status_trace("Received routing failure 0x%04x (%s), "
 		     "erring node %s, "
@@ -2409,7 +2931,7 @@ void routing_failure(struct routing_state *rstate,
 	/* lightningd will only extract this if UPDATE is set. */
 	if (channel_update) {
 		u8 *err = handle_channel_update(rstate, channel_update, "error",
-						NULL);
+						NULL, NULL);
 		if (err) {
 			status_unusual("routing_failure: "
 				       "bad channel_update %s",
@@ -2423,6 +2945,11 @@ void routing_failure(struct routing_state *rstate,
 			       (int) failcode);
 	}
 
+	/* Whatever the error, don't hand out cached routes through it. */
+	erring_chan = get_channel(rstate, scid);
+	if (erring_chan)
+		chan_changed(rstate, erring_chan);
+
 	/* We respond to permanent errors, ignore the rest: they're
 	 * for the pay command to worry about.  */
 	if (!(failcode & PERM))
@@ -2485,20 +3012,31 @@ void route_prune(struct routing_state *rstate)
 	/* Anything below this highwater mark ought to be pruned */
 	const s64 highwater = now - rstate->prune_timeout;
 	struct chan **pruned = tal_arr(tmpctx, struct chan *, 0);
+	struct list_head **due = tal_arr(tmpctx, struct list_head *, 0);
+	struct list_head *bucket;
 	u64 idx;
 
-	/* Now iterate through all channels and see if it is still alive */
-	for (struct chan *chan = uintmap_first(&rstate->chanmap, &idx);
-	     chan;
-	     chan = uintmap_after(&rstate->chanmap, &idx)) {
-		/* Local-only?  Don't prune. */
-		if (!is_chan_public(chan))
-			continue;
+	/* Only channels in buckets which start before highwater can be old
+	 * enough; we take those out, as we're about to refile what's in them.
+	 * (Local-only channels are never filed, so we never prune them). */
+	while (highwater > 0
+	       && (bucket = uintmap_first(&rstate->prune_buckets, &idx)) != NULL
+	       && idx <= prune_bucket(rstate, highwater - 1)) {
+		uintmap_del(&rstate->prune_buckets, idx);
+		tal_arr_expand(&due, bucket);
+	}
+
+	for (size_t i = 0; i < tal_count(due); i++) {
+		struct chan *chan;
+
+		while ((chan = list_pop(due[i], struct chan, prune_list))
+		       != NULL) {
+			list_node_init(&chan->prune_list);
+			if (newest_update(chan) >= highwater) {
+				file_for_pruning(rstate, chan);
+				continue;
+			}
 
-		if ((!is_halfchan_defined(&chan->half[0])
-		     || chan->half[0].bcast.timestamp < highwater)
-		    && (!is_halfchan_defined(&chan->half[1])
-			|| chan->half[1].bcast.timestamp < highwater)) {
 			status_trace(
 			    "Pruning channel %s from network view (ages %"PRIu64" and %"PRIu64"s)",
 			    type_to_string(tmpctx, struct short_channel_id,
@@ -2508,9 +3046,10 @@ void route_prune(struct routing_state *rstate)
 			    is_halfchan_defined(&chan->half[1])
 			    ? now - chan->half[1].bcast.timestamp : 0);
 
-			/* This may perturb iteration so do outside loop. */
+			/* This may perturb the buckets so do outside loop. */
 			tal_arr_expand(&pruned, chan);
 		}
+		tal_free(due[i]);
 	}
 
 	/* Look for channels we had an announcement for, but no update. */
@@ -2534,19 +3073,11 @@ void route_prune(struct routing_state *rstate)
 void memleak_remove_routing_tables(struct htable *memtable,
 				   const struct routing_state *rstate)
 {
-	struct node *n;
-	struct node_map_iter nit;
-
-	memleak_remove_htable(memtable, &rstate->nodes->raw);
+	/* chans and nodes are found in their slabs: it's only these which
+	 * memleak can't see. */
 	memleak_remove_htable(memtable, &rstate->pending_node_map->raw);
 	memleak_remove_htable(memtable, &rstate->pending_cannouncements.raw);
-
-	for (n = node_map_first(rstate->nodes, &nit);
-	     n;
-	     n = node_map_next(rstate->nodes, &nit)) {
-		if (node_uses_chan_map(n))
-			memleak_remove_htable(memtable, &n->chans.map.raw);
-	}
+	memleak_remove_uintmap(memtable, &rstate->prune_buckets);
 }
 #endif /* DEVELOPER */
 
@@ -2625,13 +3156,8 @@ void remove_all_gossip(struct routing_state *rstate)
 
 	/* We don't want them to try to delete from store, so do this
 	 * manually. */
-	while ((n = node_map_first(rstate->nodes, &nit)) != NULL) {
-		tal_del_destructor2(n, destroy_node, rstate);
-		if (node_uses_chan_map(n))
-			chan_map_clear(&n->chans.map);
-		node_map_del(rstate->nodes, n);
-		tal_free(n);
-	}
+	while ((n = node_map_first(rstate->nodes, &nit)) != NULL)
+		free_node(rstate, n);
 
 	/* Now free all the channels. */
 	while ((c = uintmap_first(&rstate->chanmap, &index)) != NULL) {
@@ -2639,8 +3165,21 @@ void remove_all_gossip(struct routing_state *rstate)
 
 		/* Remove from local_disabled_map if it's there. */
 		chan_map_del(&rstate->local_disabled_map, c);
-		tal_free(c);
+		slab_free(&rstate->chan_slab, c);
 	}
+	clear_prune_buckets(rstate);
+
+	/* The graph (and landmarks) describe a network which is gone, and
+	 * no cached route is any good. */
+	invalidate_route_graph(rstate);
+	rstate->topology_generation = ++rstate->generation;
+
+	reset_channel_ranges(rstate);
+
+	/* Anyone asking what changed since before now gets everything. */
+	tal_resize(&rstate->removed_chans, 0);
+	tal_resize(&rstate->removed_nodes, 0);
+	rstate->removed_horizon = rstate->generation;
 
 	while ((uc = uintmap_first(&rstate->unupdated_chanmap, &index)) != NULL)
 		tal_free(uc);
@@ -5,6 +5,7 @@
 #include <ccan/crypto/siphash24/siphash24.h>
 #include <ccan/htable/htable_type.h>
 #include <ccan/intmap/intmap.h>
+#include <ccan/list/list.h>
 #include <ccan/time/time.h>
 #include <common/amount.h>
 #include <common/node_id.h>
@@ -14,7 +15,30 @@
 #include <wire/gen_onion_wire.h>
 #include <wire/wire.h>
 
+struct graph_changes;
+struct graph_refresh;
+struct landmarks_refresh;
+struct route_cache;
+struct route_cache_stats;
+struct route_graph;
+struct route_landmarks;
 struct routing_state;
+struct tlv_reply_channel_range_tlvs_checksums_tlv;
+struct tlv_reply_channel_range_tlvs_timestamps_tlv;
+
+/* There are a great many chans and nodes, so rather than being tal objects
+ * of their own (with a tal header and malloc overhead each, which is more
+ * than a node's worth), they're carved out of blocks of these. */
+struct slab {
+	/* Size of each element. */
+	size_t elemsize;
+	/* Blocks we've allocated, so memleak can find them. */
+	char **blocks;
+	/* How many elements of the last block we've handed out. */
+	size_t used;
+	/* Freed elements, linked through their first pointer. */
+	void *free_list;
+};
 
 struct half_chan {
 	/* millisatoshi. */
@@ -55,11 +79,42 @@ struct chan {
 	struct broadcastable bcast;
 
 	struct amount_sat sat;
+
+	/* routing_state generation when either half last changed: cached
+	 * routes found before then are stale (and listchannels with an
+	 * earlier since wants it). */
+	u64 generation;
+
+	/* In a routing_state prune_buckets list, once public. */
+	struct list_node prune_list;
+};
+
+/* Channels and nodes we've forgotten, and when, so listchannels and
+ * listnodes can say what's gone since a given generation. */
+struct removed_chan {
+	u64 generation;
+	struct short_channel_id scid;
+};
+
+struct removed_node {
+	u64 generation;
+	struct node_id id;
 };
 
 /* Use this instead of tal_free(chan)! */
 void free_chan(struct routing_state *rstate, struct chan *chan);
 
+/* Index into rstate->channel_ranges of the one containing blocknum. */
+size_t channel_range_idx(const struct routing_state *rstate, u32 blocknum);
+
+/* Make rstate->channel_ranges[idx] end just before blocknum, with a new
+ * range after it (so any ranges after idx move up one). */
+void split_channel_range(struct routing_state *rstate, size_t idx,
+			 u32 blocknum);
+
+/* Join rstate->channel_ranges[idx] and the one after it. */
+void merge_channel_ranges(struct routing_state *rstate, size_t idx);
+
 /* A local channel can exist which isn't announced: we abuse timestamp
  * to indicate this. */
 static inline bool is_chan_public(const struct chan *chan)
@@ -109,19 +164,18 @@ struct node {
 	/* Timestamp and index into store file */
 	struct broadcastable bcast;
 
+	/* Index in the routing graph, while it's being built. */
+	u32 graph_idx;
+
 	/* Channels connecting us to other nodes */
 	union {
 		struct chan_map map;
 		struct chan *arr[NUM_IMMEDIATE_CHANS+1];
 	} chans;
 
-	/* Temporary data for routefinding. */
-	struct {
-		/* Total to get to here from target. */
-		struct amount_msat total;
-		/* Total risk premium of this route. */
-		struct amount_msat risk;
-	} dijkstra;
+	/* routing_state generation when it (or its announcement) last
+	 * changed, for listnodes. */
+	u64 generation;
 };
 
 const struct node_id *node_map_keyof_node(const struct node *n);
@@ -150,6 +204,10 @@ struct pending_cannouncement {
 
 	/* Only ever replace with newer updates */
 	u32 update_timestamps[2];
+
+	/* Did gossip_verify already check updates[] were signed by
+	 * node_id_1/node_id_2? */
+	bool updates_checked[2];
 };
 
 static inline const struct short_channel_id *panding_cannouncement_map_scid(
@@ -179,6 +237,25 @@ HTABLE_DEFINE_TYPE(struct pending_cannouncement, panding_cannouncement_map_scid,
 struct pending_node_map;
 struct unupdated_channel;
 
+/* What we say about a run of blocks in reply to query_channel_range, kept
+ * so we needn't encode (and compress) it again for every peer which asks.
+ * The encodings are NULL until someone asks, and go back to NULL when a
+ * channel in the run changes. */
+struct channel_range {
+	/* Blocks this covers (inclusive). */
+	u32 first_blocknum, last_blocknum;
+
+	/* Encoded short_channel_ids of the channels in it: if set, we also
+	 * know how many there are, and the blocks of the first and last. */
+	u8 *encoded_scids;
+	size_t num_chans;
+	u32 first_chan_block, last_chan_block;
+
+	/* Timestamps and checksums of their channel_updates. */
+	struct tlv_reply_channel_range_tlvs_timestamps_tlv *timestamps;
+	struct tlv_reply_channel_range_tlvs_checksums_tlv *checksums;
+};
+
 /* Fast versions: if you know n is one end of the channel */
 static inline struct node *other_node(const struct node *n,
 				      const struct chan *chan)
@@ -224,12 +301,20 @@ struct routing_state {
 	/* Gossip store */
 	struct gossip_store *gs;
 
+	/* Where our chans and nodes live. */
+	struct slab chan_slab, node_slab;
+
 	/* Our own ID so we can identify local channels */
 	struct node_id local_id;
 
 	/* How old does a channel have to be before we prune it? */
 	u32 prune_timeout;
 
+	/* Public channels, listed by their newest channel_update timestamp
+	 * (when listed) divided by the bucket size, so route_prune only
+	 * has to look at those which might be old enough. */
+	UINTMAP(struct list_head *) prune_buckets;
+
         /* A map of channels indexed by short_channel_ids */
 	UINTMAP(struct chan *) chanmap;
 
@@ -247,6 +332,38 @@ struct routing_state {
         /* A map of (local) disabled channels by short_channel_ids */
 	struct chan_map local_disabled_map;
 
+	/* Snapshot of the network for routefinding, or NULL if it needs
+	 * building from scratch. */
+	struct route_graph *graph;
+	/* Changes it doesn't reflect yet (NULL if none), and any earlier
+	 * ones being merged into a new snapshot. */
+	struct graph_changes *graph_changes;
+	struct graph_refresh *graph_refresh;
+
+	/* How many landmarks to aim route searches with (0 = don't). */
+	size_t num_landmarks;
+	/* Landmarks for graph (NULL if none yet), and any being computed. */
+	struct route_landmarks *landmarks;
+	struct landmarks_refresh *landmarks_refresh;
+
+	/* Bumped whenever a channel or node changes, so we can tell if
+	 * routes found earlier might be stale.  topology_generation is when a
+	 * channel was last added, re-enabled or made cheaper, which can make
+	 * any route stale.  It starts at the time in microseconds, so it's always
+	 * ahead of where it got to before we restarted. */
+	u64 generation, topology_generation;
+
+	/* What we've forgotten since removed_horizon, oldest first. */
+	struct removed_chan *removed_chans;
+	struct removed_node *removed_nodes;
+	u64 removed_horizon;
+	/* Routes found recently (NULL if we're not caching them). */
+	struct route_cache *route_cache;
+
+	/* Every block, in order, divided into runs small enough to answer
+	 * query_channel_range with one reply each. */
+	struct channel_range *channel_ranges;
+
 #if DEVELOPER
 	/* Override local time for gossip messages */
 	struct timeabs *gossip_time;
@@ -268,6 +385,15 @@ struct route_hop {
 	u32 delay;
 };
 
+/* What the cheapest route we found to a node costs. */
+struct route_cost {
+	struct node_id destination;
+	/* Fees we'd pay, and the cltv of the HTLC we'd offer. */
+	struct amount_msat fee;
+	u32 delay;
+	u16 hops;
+};
+
 struct routing_state *new_routing_state(const tal_t *ctx,
 					const struct chainparams *chainparams,
 					const struct node_id *local_id,
@@ -294,9 +420,11 @@ struct chan *new_chan(struct routing_state *rstate,
  *
  * Returns error message if we should fail channel.  Make *scid non-NULL
  * (for checking) if we extracted a short_channel_id, otherwise ignore.
+ * If @sigs_checked, we know the signatures are good already.
  */
 u8 *handle_channel_announcement(struct routing_state *rstate,
 				const u8 *announce TAKES,
+				bool sigs_checked,
 				const struct short_channel_id **scid);
 
 /**
@@ -315,19 +443,103 @@ struct chan *next_chan(const struct node *node, struct chan_map_iter *i);
 
 /* Returns NULL if all OK, otherwise an error for the peer which sent.
  * If the error is that the channel is unknown, fills in *unknown_scid
- * (if not NULL). */
+ * (if not NULL).  If we know it's signed by @checked_signer, we only check
+ * the signature if that's not who should have signed it. */
 u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 			  const char *source,
+			  const struct node_id *checked_signer,
 			  struct short_channel_id *unknown_scid);
 
-/* Returns NULL if all OK, otherwise an error for the peer which sent. */
-u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node);
+/* Who should sign a channel_update for this channel and direction (NULL if
+ * we don't know the channel). */
+const struct node_id *channel_update_signer(struct routing_state *rstate,
+					    const struct short_channel_id *scid,
+					    int direction);
+
+/* Returns NULL if all OK, otherwise an error for the peer which sent.
+ * If @sig_checked, we know the signature is good already. */
+u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node,
+			     bool sig_checked);
 
 /* Get a node: use this instead of node_map_get() */
 struct node *get_node(struct routing_state *rstate,
 		      const struct node_id *id);
 
-/* Compute a route to a destination, for a given amount and riskfactor. */
+/* A route request which can be answered away from the routing_state. */
+struct route_query;
+
+/* Prepare a route request: it holds a reference to the current snapshot of
+ * the network, so answering it never looks at rstate.  If @max_routes > 1,
+ * we look for alternatives too: each avoids the channels used by those
+ * before it. */
+struct route_query *new_route_query(const tal_t *ctx,
+				    struct routing_state *rstate,
+				    const struct node_id *source,
+				    const struct node_id *destination,
+				    struct amount_msat msat, double riskfactor,
+				    u32 final_cltv,
+				    double fuzz, u64 seed,
+				    const struct short_channel_id_dir *excluded,
+				    size_t max_hops,
+				    size_t max_routes);
+
+/* Prepare a search from us which prices the cheapest routes to every node
+ * in @destinations (every node we can reach, if NULL) at once.  This is
+ * one search, rather than one per destination. */
+struct route_query *new_route_tree_query(const tal_t *ctx,
+					 struct routing_state *rstate,
+					 struct amount_msat msat,
+					 double riskfactor,
+					 u32 final_cltv,
+					 const struct node_id *destinations,
+					 size_t max_hops);
+
+/* Answer it: doesn't allocate or log, so it's safe from any thread. */
+void route_query_run(struct route_query *rq);
+
+/* How many routes did we find (cheapest first)? */
+size_t route_query_num_routes(const struct route_query *rq);
+
+/* The @n'th route: NULL if there isn't one. */
+struct route_hop *route_query_hops(const tal_t *ctx,
+				   const struct route_query *rq,
+				   size_t n);
+
+/* What the routes found by a tree query cost (one per node reached). */
+struct route_cost *route_query_costs(const tal_t *ctx,
+				     const struct route_query *rq);
+
+/* How many nodes did answering it look at? */
+size_t route_query_settled(const struct route_query *rq);
+
+/* Remember the answer in rstate->route_cache, if it's still current. */
+void route_query_cache(const struct route_query *rq);
+
+/* How the route cache is doing (all zero if there isn't one). */
+void routing_route_cache_stats(const struct routing_state *rstate,
+			       struct route_cache_stats *stats);
+
+/* Have channels come or gone since the current graph (or changed, while
+ * queries were using it)?  If so, returns the work: call
+ * graph_refresh_run() (from any thread), then graph_refresh_done() (from
+ * this one).  Until then, queries use the graph as it was. */
+struct graph_refresh *routing_graph_refresh(struct routing_state *rstate);
+void graph_refresh_run(struct graph_refresh *refresh);
+void graph_refresh_done(struct graph_refresh *refresh);
+
+/* Do we need new landmarks for the current graph?  If so, returns the
+ * work: call landmarks_refresh_run() (from any thread), then
+ * landmarks_refresh_done() (from this one). */
+struct landmarks_refresh *routing_landmarks_refresh(struct routing_state *rstate);
+void landmarks_refresh_run(struct landmarks_refresh *refresh);
+void landmarks_refresh_done(struct landmarks_refresh *refresh);
+
+/* How many landmarks queries are using now (0 if none). */
+size_t routing_landmarks_in_use(const struct routing_state *rstate);
+
+/* Compute a route to a destination, for a given amount and riskfactor.
+ * This does everything on the spot, bringing the graph up to date first. */
+
 struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    const struct node_id *source,
 			    const struct node_id *destination,
@@ -417,18 +629,8 @@ static inline bool is_chan_local_disabled(struct routing_state *rstate,
 	return chan_map_get(&rstate->local_disabled_map, &chan->scid) != NULL;
 }
 
-static inline void local_disable_chan(struct routing_state *rstate,
-				      const struct chan *chan)
-{
-	if (!is_chan_local_disabled(rstate, chan))
-		chan_map_add(&rstate->local_disabled_map, chan);
-}
-
-static inline void local_enable_chan(struct routing_state *rstate,
-				     const struct chan *chan)
-{
-	chan_map_del(&rstate->local_disabled_map, chan);
-}
+void local_disable_chan(struct routing_state *rstate, struct chan *chan);
+void local_enable_chan(struct routing_state *rstate, struct chan *chan);
 
 /* Helper to convert on-wire addresses format to wireaddrs array */
 struct wireaddr *read_addresses(const tal_t *ctx, const u8 *ser);
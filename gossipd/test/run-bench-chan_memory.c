@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <common/pseudorand.h>
+#include <common/status.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+static void add_channel(struct routing_state *rstate,
+			const struct node_id *nodes, u32 from, u32 to)
+{
+	struct short_channel_id scid;
+	struct chan *chan;
+
+	if (!mk_short_channel_id(&scid, from + 1, to, 0))
+		abort();
+	chan = new_chan(rstate, &scid, &nodes[from], &nodes[to],
+			AMOUNT_SAT(1000000));
+
+	/* Fill it in as gossip would, so it's in the graph too. */
+	for (int dir = 0; dir < 2; dir++) {
+		struct half_chan *c = &chan->half[dir];
+		c->base_fee = pseudorand(1000);
+		c->proportional_fee = pseudorand(1000);
+		c->delay = pseudorand(144);
+		c->bcast.index = 1;
+		c->htlc_maximum = AMOUNT_MSAT(-1ULL);
+		c->htlc_minimum = AMOUNT_MSAT(0);
+	}
+	chan->bcast.timestamp = chan->bcast.index = 1;
+}
+
+/* Peak resident set, in bytes. */
+static u64 maxrss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		err(1, "getrusage");
+#ifdef __APPLE__
+	return ru.ru_maxrss;
+#else
+	return (u64)ru.ru_maxrss * 1024;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	size_t num_nodes = 10000, num_chans = 0, num_graph_nodes = 0;
+	unsigned int max_bytes = 0;
+	struct node_id *nodes;
+	struct node_map_iter nit;
+	u64 before, after, bytes_per_chan;
+	u64 idx;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	opt_register_arg("--max-bytes-per-channel", opt_set_uintval,
+			 opt_show_uintval, &max_bytes,
+			 "Fail if a channel costs more than this (0 = don't)");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+
+	if (argc > 1)
+		num_nodes = atoi(argv[1]);
+	if (argc > 2)
+		opt_usage_and_exit("[num_nodes]");
+
+	nodes = tal_arr(tmpctx, struct node_id, num_nodes);
+	for (size_t i = 0; i < num_nodes; i++)
+		nodes[i] = nodeid(i);
+
+	/* Touch everything we'll need before we start counting. */
+	before = maxrss();
+
+	/* Every node joins its parent in a heap, and one node before it at
+	 * random: like the real network, a few nodes end up with many
+	 * channels and most have only one or two. */
+	rstate = new_routing_state(tmpctx, NULL, &nodes[0], 0, NULL, NULL);
+	for (size_t i = 1; i < num_nodes; i++) {
+		size_t other = pseudorand(i);
+
+		add_channel(rstate, nodes, i, i / 2);
+		if (other != i / 2)
+			add_channel(rstate, nodes, i, other);
+	}
+
+	/* We route over a snapshot of the graph, so that counts too. */
+	assert(current_route_graph(rstate));
+	after = maxrss();
+
+	for (struct chan *c = uintmap_first(&rstate->chanmap, &idx);
+	     c;
+	     c = uintmap_after(&rstate->chanmap, &idx))
+		num_chans++;
+	for (struct node *n = node_map_first(rstate->nodes, &nit);
+	     n;
+	     n = node_map_next(rstate->nodes, &nit))
+		num_graph_nodes++;
+
+	bytes_per_chan = (after - before) / num_chans;
+	printf("%zu channels, %zu nodes: %"PRIu64" bytes per channel"
+	       " (struct chan %zu bytes, struct node %zu bytes)\n",
+	       num_chans, num_graph_nodes, bytes_per_chan,
+	       sizeof(struct chan), sizeof(struct node));
+
+	if (max_bytes && bytes_per_chan > max_bytes)
+		errx(1, "%"PRIu64" bytes per channel exceeds budget of %u",
+		     bytes_per_chan, max_bytes);
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
@@ -12,6 +12,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "../route_cache.c"
+#include "../route_graph.c"
 #include "../routing.c"
 #include "../gossip_store.c"
 
@@ -164,14 +166,18 @@ int main(int argc, char *argv[])
 	setup_locale();
 
 	struct routing_state *rstate;
-	size_t num_nodes = 100, num_runs = 1;
+	size_t num_nodes = 100, num_runs = 1, num_chans = 0;
 	struct timemono start, end;
 	size_t route_lengths[ROUTING_MAX_HOPS+1];
 	struct node_id me;
 	struct node_id *nodes;
 	bool perfme = false;
+	unsigned int num_landmarks = 0;
+	double fuzz = 0.75;
+	size_t settled = 0;
 	const double riskfactor = 0.01 / BLOCKS_PER_YEAR / 10000;
 	struct siphash_seed base_seed;
+	u64 idx;
 
 	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
 						 | SECP256K1_CONTEXT_SIGN);
@@ -181,6 +187,10 @@ int main(int argc, char *argv[])
 	rstate = new_routing_state(tmpctx, NULL, &me, 0, NULL, NULL);
 	opt_register_noarg("--perfme", opt_set_bool, &perfme,
 			   "Run perfme-start and perfme-stop around benchmark");
+	opt_register_arg("--landmarks", opt_set_uintval, opt_show_uintval,
+			 &num_landmarks, "Aim searches with this many landmarks");
+	opt_register_arg("--fuzz", opt_set_doubleval, opt_show_doubleval,
+			 &fuzz, "Fuzz fees by up to this fraction");
 
 	opt_parse(&argc, argv, opt_log_stderr_exit);
 
@@ -201,6 +211,21 @@ int main(int argc, char *argv[])
 	for (size_t i = 0; i < num_nodes; i++)
 		populate_random_node(rstate, nodes, i);
 
+	/* Duplicate random picks share a channel, so count what we got */
+	for (struct chan *c = uintmap_first(&rstate->chanmap, &idx);
+	     c;
+	     c = uintmap_after(&rstate->chanmap, &idx))
+		num_chans++;
+
+	if (num_landmarks) {
+		struct landmarks_refresh *refresh;
+		printf("Computing %u landmarks...\n", num_landmarks);
+		rstate->num_landmarks = num_landmarks;
+		refresh = routing_landmarks_refresh(rstate);
+		landmarks_refresh_run(refresh);
+		landmarks_refresh_done(refresh);
+	}
+
 	if (perfme)
 		run("perfme-start");
 
@@ -210,30 +235,32 @@ int main(int argc, char *argv[])
 	for (size_t i = 0; i < num_runs; i++) {
 		const struct node_id *from = &nodes[pseudorand(num_nodes)];
 		const struct node_id *to = &nodes[pseudorand(num_nodes)];
-		struct amount_msat fee;
-		struct chan **route;
+		struct route_query *rq;
 		size_t num_hops;
 
-		route = find_route(tmpctx, rstate, from, to,
-				   (struct amount_msat){pseudorand(100000)},
-				   riskfactor,
-				   0.75, &base_seed,
-				   ROUTING_MAX_HOPS,
-				   &fee);
-		num_hops = tal_count(route);
+		rq = new_route_query_(tmpctx, rstate, from, to,
+				      (struct amount_msat){pseudorand(100000)},
+				      riskfactor, 0,
+				      fuzz, &base_seed,
+				      NULL,
+				      ROUTING_MAX_HOPS, 1);
+		route_query_run(rq);
+		num_hops = rq->num_routes ? rq->num_hops[0] : 0;
 		assert(num_hops < ARRAY_SIZE(route_lengths));
 		route_lengths[num_hops]++;
-		tal_free(route);
+		settled += route_query_settled(rq);
+		tal_free(rq);
 	}
 	end = time_mono();
 
 	if (perfme)
 		run("perfme-stop");
 
-	printf("%zu (%zu succeeded) routes in %zu nodes in %"PRIu64" msec (%"PRIu64" nanoseconds per route)\n",
-	       num_runs, num_runs - route_lengths[0], num_nodes,
+	printf("%zu (%zu succeeded) routes in %zu nodes (%zu channels) in %"PRIu64" msec (%"PRIu64" nanoseconds per route)\n",
+	       num_runs, num_runs - route_lengths[0], num_nodes, num_chans,
 	       time_to_msec(timemono_between(end, start)),
 	       time_to_nsec(time_divide(timemono_between(end, start), num_runs)));
+	printf(" %zu nodes settled per route\n", settled / num_runs);
 	for (size_t i = 0; i < ARRAY_SIZE(route_lengths); i++)
 		if (route_lengths[i])
 			printf(" Length %zu: %zu\n", i, route_lengths[i]);
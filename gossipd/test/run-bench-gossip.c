@@ -0,0 +1,566 @@
+#include "config.h"
+
+#define main gossipd_main
+int gossipd_main(int argc, char *argv[]);
+
+#include "../gossipd.c"
+#undef main
+#include "../gen_gossip_store.c"
+#include "../gen_gossip_wire.c"
+#include "../gossip_store.c"
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../../lightningd/gossip_msg.c"
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <common/pseudorand.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static bool verbose;
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* Everything gossipd sends to lightningd or peers ends up here. */
+static const u8 *last_sent;
+static size_t num_sent;
+
+void daemon_conn_send(struct daemon_conn *dc UNUSED, const u8 *msg)
+{
+	tal_free(last_sent);
+	last_sent = tal_dup_arr(NULL, u8, msg, tal_count(msg), 0);
+	num_sent++;
+	if (taken(msg))
+		tal_free(msg);
+}
+
+struct io_plan *daemon_conn_read_next(struct io_conn *conn UNUSED,
+				      struct daemon_conn *dc UNUSED)
+{
+	return NULL;
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for check_ping_make_pong */
+bool check_ping_make_pong(const tal_t *ctx UNNEEDED, const u8 *ping UNNEEDED, u8 **pong UNNEEDED)
+{ fprintf(stderr, "check_ping_make_pong called!\n"); abort(); }
+/* Generated stub for daemon_conn_new_ */
+struct daemon_conn *daemon_conn_new_(const tal_t *ctx UNNEEDED, int fd UNNEEDED,
+				     struct io_plan *(*recv)(struct io_conn * UNNEEDED,
+							     const u8 * UNNEEDED,
+							     void *) UNNEEDED,
+				     void (*outq_empty)(void *) UNNEEDED,
+				     void *arg UNNEEDED)
+{ fprintf(stderr, "daemon_conn_new_ called!\n"); abort(); }
+/* Generated stub for daemon_conn_send_fd */
+void daemon_conn_send_fd(struct daemon_conn *dc UNNEEDED, int fd UNNEEDED)
+{ fprintf(stderr, "daemon_conn_send_fd called!\n"); abort(); }
+/* Generated stub for daemon_conn_wake */
+void daemon_conn_wake(struct daemon_conn *dc UNNEEDED)
+{ fprintf(stderr, "daemon_conn_wake called!\n"); abort(); }
+/* Generated stub for daemon_shutdown */
+void daemon_shutdown(void)
+{ fprintf(stderr, "daemon_shutdown called!\n"); abort(); }
+/* Generated stub for decode_short_ids */
+struct short_channel_id *decode_short_ids(const tal_t *ctx UNNEEDED, const u8 *encoded UNNEEDED)
+{ fprintf(stderr, "decode_short_ids called!\n"); abort(); }
+/* Generated stub for fromwire_amount_below_minimum */
+bool fromwire_amount_below_minimum(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct amount_msat *htlc_msat UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_amount_below_minimum called!\n"); abort(); }
+/* Generated stub for fromwire_expiry_too_soon */
+bool fromwire_expiry_too_soon(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_expiry_too_soon called!\n"); abort(); }
+/* Generated stub for fromwire_fee_insufficient */
+bool fromwire_fee_insufficient(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct amount_msat *htlc_msat UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_fee_insufficient called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_get_addrs */
+bool fromwire_gossip_get_addrs(const void *p UNNEEDED, struct node_id *id UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_get_addrs called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_new_peer */
+bool fromwire_gossip_new_peer(const void *p UNNEEDED, struct node_id *id UNNEEDED, bool *gossip_queries_feature UNNEEDED, bool *initial_routing_sync UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_new_peer called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_get_update */
+bool fromwire_gossipd_get_update(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_get_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_channel_update */
+bool fromwire_gossipd_local_channel_update(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, bool *disable UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_hsm_cupdate_sig_reply */
+bool fromwire_hsm_cupdate_sig_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **cu UNNEEDED)
+{ fprintf(stderr, "fromwire_hsm_cupdate_sig_reply called!\n"); abort(); }
+/* Generated stub for fromwire_hsm_node_announcement_sig_reply */
+bool fromwire_hsm_node_announcement_sig_reply(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED)
+{ fprintf(stderr, "fromwire_hsm_node_announcement_sig_reply called!\n"); abort(); }
+/* Generated stub for fromwire_incorrect_cltv_expiry */
+bool fromwire_incorrect_cltv_expiry(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u32 *cltv_expiry UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_incorrect_cltv_expiry called!\n"); abort(); }
+/* Generated stub for fromwire_temporary_channel_failure */
+bool fromwire_temporary_channel_failure(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_temporary_channel_failure called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for gossip_peerd_wire_type_name */
+const char *gossip_peerd_wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "gossip_peerd_wire_type_name called!\n"); abort(); }
+/* Generated stub for gossip_verify_add */
+void gossip_verify_add(struct gossip_verify *gv UNNEEDED, const u8 *msg UNNEEDED, void *source UNNEEDED)
+{ fprintf(stderr, "gossip_verify_add called!\n"); abort(); }
+/* Generated stub for gossip_verify_forget */
+void gossip_verify_forget(struct gossip_verify *gv UNNEEDED, const void *source UNNEEDED)
+{ fprintf(stderr, "gossip_verify_forget called!\n"); abort(); }
+/* Generated stub for got_pong */
+const char *got_pong(const u8 *pong UNNEEDED, size_t *num_pings_outstanding UNNEEDED)
+{ fprintf(stderr, "got_pong called!\n"); abort(); }
+/* Generated stub for make_ping */
+u8 *make_ping(const tal_t *ctx UNNEEDED, u16 num_pong_bytes UNNEEDED, u16 padlen UNNEEDED)
+{ fprintf(stderr, "make_ping called!\n"); abort(); }
+/* Generated stub for master_badmsg */
+void master_badmsg(u32 type_expected UNNEEDED, const u8 *msg)
+{ fprintf(stderr, "master_badmsg called!\n"); abort(); }
+/* Generated stub for new_gossip_verify_ */
+struct gossip_verify *new_gossip_verify_(const tal_t *ctx UNNEEDED,
+					 struct routing_state *rstate UNNEEDED,
+					 struct route_pool *pool UNNEEDED,
+					 void (*apply)(const struct gossip_checked * UNNEEDED,
+						       void *arg) UNNEEDED,
+					 void *arg UNNEEDED)
+{ fprintf(stderr, "new_gossip_verify_ called!\n"); abort(); }
+/* Generated stub for new_reltimer_ */
+struct oneshot *new_reltimer_(struct timers *timers UNNEEDED,
+			      const tal_t *ctx UNNEEDED,
+			      struct timerel expire UNNEEDED,
+			      void (*cb)(void *) UNNEEDED, void *arg UNNEEDED)
+{ fprintf(stderr, "new_reltimer_ called!\n"); abort(); }
+/* Generated stub for new_route_pool */
+struct route_pool *new_route_pool(const tal_t *ctx UNNEEDED, size_t num_threads UNNEEDED)
+{ fprintf(stderr, "new_route_pool called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for route_pool_add_ */
+void route_pool_add_(struct route_pool *pool UNNEEDED, struct route_query *rq UNNEEDED,
+		     void (*answered)(struct route_query *rq UNNEEDED, void *arg) UNNEEDED,
+		     void *arg UNNEEDED)
+{ fprintf(stderr, "route_pool_add_ called!\n"); abort(); }
+/* Generated stub for route_pool_background_ */
+void route_pool_background_(struct route_pool *pool UNNEEDED,
+			    void (*run)(void *arg) UNNEEDED,
+			    void (*finish)(void *arg) UNNEEDED,
+			    void *arg UNNEEDED)
+{ fprintf(stderr, "route_pool_background_ called!\n"); abort(); }
+/* Generated stub for route_pool_get_stats */
+void route_pool_get_stats(struct route_pool *pool UNNEEDED,
+			  struct route_pool_stats *stats UNNEEDED)
+{ fprintf(stderr, "route_pool_get_stats called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for status_setup_async */
+void status_setup_async(struct daemon_conn *master UNNEEDED)
+{ fprintf(stderr, "status_setup_async called!\n"); abort(); }
+/* Generated stub for subdaemon_setup */
+void subdaemon_setup(int argc UNNEEDED, char *argv[])
+{ fprintf(stderr, "subdaemon_setup called!\n"); abort(); }
+/* Generated stub for timer_expired */
+void timer_expired(tal_t *ctx UNNEEDED, struct timer *timer UNNEEDED)
+{ fprintf(stderr, "timer_expired called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_get_addrs_reply */
+u8 *towire_gossip_get_addrs_reply(const tal_t *ctx UNNEEDED, const struct wireaddr *addrs UNNEEDED)
+{ fprintf(stderr, "towire_gossip_get_addrs_reply called!\n"); abort(); }
+/* Generated stub for towire_gossip_new_peer_reply */
+u8 *towire_gossip_new_peer_reply(const tal_t *ctx UNNEEDED, bool success UNNEEDED, const struct gossip_state *gs UNNEEDED)
+{ fprintf(stderr, "towire_gossip_new_peer_reply called!\n"); abort(); }
+/* Generated stub for towire_gossipd_get_update_reply */
+u8 *towire_gossipd_get_update_reply(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossipd_get_update_reply called!\n"); abort(); }
+/* Generated stub for towire_gossipd_new_store_fd */
+u8 *towire_gossipd_new_store_fd(const tal_t *ctx UNNEEDED, u64 offset_shorter UNNEEDED)
+{ fprintf(stderr, "towire_gossipd_new_store_fd called!\n"); abort(); }
+/* Generated stub for towire_hsm_cupdate_sig_req */
+u8 *towire_hsm_cupdate_sig_req(const tal_t *ctx UNNEEDED, const u8 *cu UNNEEDED)
+{ fprintf(stderr, "towire_hsm_cupdate_sig_req called!\n"); abort(); }
+/* Generated stub for towire_hsm_node_announcement_sig_req */
+u8 *towire_hsm_node_announcement_sig_req(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED)
+{ fprintf(stderr, "towire_hsm_node_announcement_sig_req called!\n"); abort(); }
+/* Generated stub for towire_wireaddr */
+void towire_wireaddr(u8 **pptr UNNEEDED, const struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "towire_wireaddr called!\n"); abort(); }
+/* Generated stub for wire_sync_read */
+u8 *wire_sync_read(const tal_t *ctx UNNEEDED, int fd UNNEEDED)
+{ fprintf(stderr, "wire_sync_read called!\n"); abort(); }
+/* Generated stub for wire_sync_write */
+bool wire_sync_write(int fd UNNEEDED, const void *msg TAKES UNNEEDED)
+{ fprintf(stderr, "wire_sync_write called!\n"); abort(); }
+/* Generated stub for wireaddr_eq */
+bool wireaddr_eq(const struct wireaddr *a UNNEEDED, const struct wireaddr *b UNNEEDED)
+{ fprintf(stderr, "wireaddr_eq called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+#endif
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+/* Channel k is from node k/2+1 either to its parent in a heap, or to a node
+ * before it at random: so most nodes have a few channels, a few have many,
+ * and everyone's connected.  There are 8 channels a block. */
+static void write_store(const struct chainparams *chainparams,
+			const struct node_id *nodes, size_t num_nodes,
+			size_t num_channels)
+{
+	struct routing_state *rstate;
+	secp256k1_ecdsa_signature sig;
+	struct pubkey bitcoin_key;
+	struct secret s;
+	u8 rgb[3], alias[32];
+	u32 timestamp = time_now().ts.tv_sec;
+
+	memset(&sig, 0, sizeof(sig));
+	memset(&s, 1, sizeof(s));
+	pubkey_from_secret(&s, &bitcoin_key);
+
+	rstate = new_routing_state(NULL, chainparams, &nodes[0], 0, NULL, NULL);
+	for (size_t k = 0; k < num_channels; k++) {
+		struct short_channel_id scid;
+		size_t from = k / 2 + 1;
+		const struct node_id *a = &nodes[from], *b;
+		u8 *msg;
+
+		if (k % 2 == 0)
+			b = &nodes[from / 2];
+		else
+			b = &nodes[pseudorand(from)];
+		if (node_id_cmp(a, b) > 0) {
+			const struct node_id *t = a;
+			a = b;
+			b = t;
+		}
+		if (!mk_short_channel_id(&scid, 500000 + k / 8, k % 8, 0))
+			abort();
+
+		msg = towire_channel_announcement(tmpctx, &sig, &sig, &sig, &sig,
+						  NULL,
+						  &chainparams->genesis_blockhash,
+						  &scid, a, b,
+						  &bitcoin_key, &bitcoin_key);
+		gossip_store_add(rstate->gs, msg, timestamp,
+				 towire_gossip_store_channel_amount(tmpctx,
+						AMOUNT_SAT(1000000)));
+		for (int dir = 0; dir < 2; dir++) {
+			msg = towire_channel_update_option_channel_htlc_max(
+				tmpctx, &sig, &chainparams->genesis_blockhash,
+				&scid, timestamp, ROUTING_OPT_HTLC_MAX_MSAT,
+				dir, 6 + pseudorand(144), AMOUNT_MSAT(0),
+				pseudorand(1000), pseudorand(1000),
+				AMOUNT_MSAT(1000000000));
+			gossip_store_add(rstate->gs, msg, timestamp, NULL);
+		}
+		clean_tmpctx();
+	}
+
+	memset(rgb, 0, sizeof(rgb));
+	memset(alias, 0, sizeof(alias));
+	for (size_t i = 0; i < num_nodes; i++) {
+		u8 *msg = towire_node_announcement(tmpctx, &sig, NULL,
+						   timestamp, &nodes[i],
+						   rgb, alias, NULL);
+		gossip_store_add(rstate->gs, msg, timestamp, NULL);
+		clean_tmpctx();
+	}
+	tal_free(rstate);
+}
+
+static u64 msec_since(struct timemono start)
+{
+	return time_to_msec(timemono_between(time_mono(), start));
+}
+
+/* Peak resident set, in kilobytes. */
+static u64 maxrss_kb(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		err(1, "getrusage");
+#ifdef __APPLE__
+	return ru.ru_maxrss / 1024;
+#else
+	return ru.ru_maxrss;
+#endif
+}
+
+/* Remove every tenth channel, so compaction has something to do. */
+static size_t delete_channels(struct routing_state *rstate)
+{
+	struct chan **chans = tal_arr(tmpctx, struct chan *, 0);
+	size_t n = 0;
+	u64 idx;
+
+	for (struct chan *c = uintmap_first(&rstate->chanmap, &idx);
+	     c;
+	     c = uintmap_after(&rstate->chanmap, &idx)) {
+		if (n++ % 10 == 0)
+			tal_arr_expand(&chans, c);
+	}
+	for (size_t i = 0; i < tal_count(chans); i++) {
+		remove_channel_from_store(rstate, chans[i]);
+		free_chan(rstate, chans[i]);
+	}
+	return tal_count(chans);
+}
+
+/* Ask for every channel (changed after since, if set), as `listchannels`
+ * does, a page at a time. */
+static size_t getchannels_all(struct daemon *daemon, u64 *since,
+			      u64 *generation)
+{
+	struct short_channel_id *prev = NULL;
+	size_t num_channels = 0;
+	bool complete = false;
+
+	while (!complete) {
+		struct short_channel_id *removed;
+		u8 *entries;
+		const u8 *msg, *cursor;
+		size_t max;
+		bool full;
+
+		msg = towire_gossip_getchannels_request(tmpctx, NULL, NULL,
+							prev, since);
+		getchannels_req(NULL, daemon, msg);
+		if (!fromwire_gossip_getchannels_reply(tmpctx, last_sent,
+						       &complete, generation,
+						       &full, &removed,
+						       &entries))
+			errx(1, "Bad getchannels reply");
+
+		cursor = entries;
+		max = tal_count(entries);
+		while (max) {
+			struct gossip_getchannels_entry e;
+			struct gossip_halfchannel_entry halves[2];
+
+			fromwire_gossip_getchannels_entry(&cursor, &max,
+							  &e, halves);
+			if (!cursor)
+				errx(1, "Bad getchannels entry");
+			num_channels++;
+			prev = tal_dup(tmpctx, struct short_channel_id,
+				       &e.short_channel_id);
+		}
+	}
+	return num_channels;
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	const struct chainparams *chainparams;
+	struct daemon *daemon;
+	struct peer *peer;
+	struct node_id *nodes;
+	unsigned int num_channels = 1000, num_routes = 100;
+	size_t num_nodes, num_loaded = 0, num_deleted, num_listed;
+	size_t routes_found = 0, replies;
+	struct timemono start;
+	u64 load_msec, compact_msec, route_usec, getchannels_msec,
+		getchannels_since_msec, generation, prune_usec,
+		ranges_msec, ranges_again_msec, store_bytes, idx;
+	const double riskfactor = 0.01 / BLOCKS_PER_YEAR / 10000;
+	const u8 *msg;
+	char *dir;
+	bool ok;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	opt_register_arg("--channels", opt_set_uintval, opt_show_uintval,
+			 &num_channels, "Number of channels in the store");
+	opt_register_arg("--routes", opt_set_uintval, opt_show_uintval,
+			 &num_routes, "Number of random routes to find");
+	opt_register_noarg("--verbose", opt_set_bool, &verbose,
+			   "Show gossipd's messages");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc != 1)
+		opt_usage_exit_fail("No arguments expected");
+
+	dir = tal_strdup(NULL, "/tmp/run-bench-gossip.XXXXXX");
+	if (!mkdtemp(dir) || chdir(dir) != 0)
+		err(1, "Making %s", dir);
+
+	chainparams = chainparams_for_network("regtest");
+	if (num_channels == 0)
+		errx(1, "Need some channels");
+	/* The last channel is from node (num_channels-1)/2 + 1 */
+	num_nodes = (num_channels - 1) / 2 + 2;
+	nodes = tal_arr(NULL, struct node_id, num_nodes);
+	for (size_t i = 0; i < num_nodes; i++)
+		nodes[i] = nodeid(i);
+	write_store(chainparams, nodes, num_nodes, num_channels);
+
+	daemon = tal(NULL, struct daemon);
+	daemon->id = nodes[0];
+	list_head_init(&daemon->peers);
+	daemon->master = NULL;
+	daemon->chain_hash = chainparams->genesis_blockhash;
+	/* Not tmpctx: loading cleans that as it goes. */
+	daemon->rstate = new_routing_state(daemon, chainparams, &daemon->id,
+					   1209600, &daemon->peers, NULL);
+
+	start = time_mono();
+	if (!gossip_store_load(daemon->rstate, daemon->rstate->gs))
+		errx(1, "Loading gossip_store failed");
+	load_msec = msec_since(start);
+	store_bytes = daemon->rstate->gs->len;
+
+	for (struct chan *c = uintmap_first(&daemon->rstate->chanmap, &idx);
+	     c;
+	     c = uintmap_after(&daemon->rstate->chanmap, &idx))
+		num_loaded++;
+	if (num_loaded != num_channels)
+		errx(1, "Loaded %zu of %u channels", num_loaded, num_channels);
+
+	start = time_mono();
+	for (size_t i = 0; i < num_routes; i++) {
+		struct node_id src = nodes[pseudorand(num_nodes)];
+		struct node_id dst = nodes[pseudorand(num_nodes)];
+
+		if (get_route(tmpctx, daemon->rstate, &src, &dst,
+			      AMOUNT_MSAT(1000000), riskfactor, 9, 0.75,
+			      pseudorand_u64(), NULL, ROUTING_MAX_HOPS))
+			routes_found++;
+		clean_tmpctx();
+	}
+	route_usec = time_to_usec(timemono_between(time_mono(), start));
+
+	start = time_mono();
+	num_listed = getchannels_all(daemon, NULL, &generation);
+	getchannels_msec = msec_since(start);
+	if (num_listed != num_channels)
+		errx(1, "getchannels found %zu of %u channels",
+		     num_listed, num_channels);
+	clean_tmpctx();
+
+	/* Polling again, when nothing has changed. */
+	start = time_mono();
+	num_listed = getchannels_all(daemon, &generation, &generation);
+	getchannels_since_msec = msec_since(start);
+	if (num_listed != 0)
+		errx(1, "getchannels found %zu changed channels", num_listed);
+	clean_tmpctx();
+
+	/* Nothing's old enough to prune, so this should find nothing to do. */
+	start = time_mono();
+	route_prune(daemon->rstate);
+	prune_usec = time_to_usec(timemono_between(time_mono(), start));
+	clean_tmpctx();
+
+	/* A peer asking for every channel we know. */
+	peer = tal(daemon, struct peer);
+	peer->daemon = daemon;
+	peer->id = nodes[1];
+	peer->dc = NULL;
+#if EXPERIMENTAL_FEATURES
+	msg = towire_query_channel_range(tmpctx, &daemon->chain_hash,
+					 0, UINT_MAX, NULL);
+#else
+	msg = towire_query_channel_range(tmpctx, &daemon->chain_hash,
+					 0, UINT_MAX);
+#endif
+	num_sent = 0;
+	start = time_mono();
+	if (handle_query_channel_range(peer, msg))
+		errx(1, "query_channel_range failed");
+	ranges_msec = msec_since(start);
+	replies = num_sent;
+
+	/* The next peer to ask gets what we encoded for the first. */
+	start = time_mono();
+	if (handle_query_channel_range(peer, msg))
+		errx(1, "query_channel_range failed");
+	ranges_again_msec = msec_since(start);
+	clean_tmpctx();
+
+	num_deleted = delete_channels(daemon->rstate);
+	clean_tmpctx();
+	start = time_mono();
+	if (!gossip_store_compact_start(daemon->rstate->gs))
+		errx(1, "Could not start compaction");
+	/* The same slices as gossipd uses. */
+	while (gossip_store_compact_step(daemon->rstate->gs, 1024 * 1024, &ok));
+	compact_msec = msec_since(start);
+	if (!ok)
+		errx(1, "Compaction failed");
+
+	/* One name=value per line, so scripts can track them. */
+	printf("channels=%u\n", num_channels);
+	printf("nodes=%zu\n", num_nodes);
+	printf("store_bytes=%"PRIu64"\n", store_bytes);
+	printf("store_load_msec=%"PRIu64"\n", load_msec);
+	printf("maxrss_kb=%"PRIu64"\n", maxrss_kb());
+	printf("get_route_usec=%"PRIu64"\n",
+	       num_routes ? route_usec / num_routes : 0);
+	printf("get_route_found=%zu/%u\n", routes_found, num_routes);
+	printf("getchannels_msec=%"PRIu64"\n", getchannels_msec);
+	printf("getchannels_since_msec=%"PRIu64"\n", getchannels_since_msec);
+	printf("route_prune_usec=%"PRIu64"\n", prune_usec);
+	printf("channel_ranges_msec=%"PRIu64"\n", ranges_msec);
+	printf("channel_ranges_replies=%zu\n", replies);
+	printf("channel_ranges_again_msec=%"PRIu64"\n", ranges_again_msec);
+	printf("store_compact_msec=%"PRIu64"\n", compact_msec);
+	printf("store_compact_deleted=%zu\n", num_deleted);
+
+	tal_free(daemon);
+	tal_free(nodes);
+	tal_free(last_sent);
+	unlink(GOSSIP_STORE_FILENAME);
+	rmdir(dir);
+	tal_free(dir);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
@@ -0,0 +1,224 @@
+#include <assert.h>
+#include <bitcoin/chainparams.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
+#include <common/status.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../gen_gossip_store.c"
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+
+static bool verbose;
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+/* Channel i joins node i to node i/2, like a heap: it has two updates. */
+static void write_store(const struct chainparams *chainparams,
+			size_t num_channels)
+{
+	struct node_id *nodes;
+	struct routing_state *rstate;
+	secp256k1_ecdsa_signature sig;
+	struct pubkey bitcoin_key;
+	struct secret s;
+	u32 timestamp = time_now().ts.tv_sec;
+
+	memset(&sig, 0, sizeof(sig));
+	memset(&s, 1, sizeof(s));
+	pubkey_from_secret(&s, &bitcoin_key);
+
+	nodes = tal_arr(tmpctx, struct node_id, num_channels + 1);
+	for (size_t i = 0; i < num_channels + 1; i++)
+		nodes[i] = nodeid(i);
+
+	rstate = new_routing_state(tmpctx, chainparams, &nodes[0], 0,
+				   NULL, NULL);
+	for (size_t i = 1; i < num_channels + 1; i++) {
+		struct short_channel_id scid;
+		const struct node_id *a = &nodes[i], *b = &nodes[i / 2];
+		u8 *msg;
+
+		if (node_id_cmp(a, b) > 0) {
+			const struct node_id *t = a;
+			a = b;
+			b = t;
+		}
+		if (!mk_short_channel_id(&scid, i, 1, 0))
+			abort();
+
+		msg = towire_channel_announcement(tmpctx, &sig, &sig, &sig, &sig,
+						  NULL,
+						  &chainparams->genesis_blockhash,
+						  &scid, a, b,
+						  &bitcoin_key, &bitcoin_key);
+		gossip_store_add(rstate->gs, msg, timestamp,
+				 towire_gossip_store_channel_amount(tmpctx,
+						AMOUNT_SAT(1000000)));
+		for (int dir = 0; dir < 2; dir++) {
+			msg = towire_channel_update_option_channel_htlc_max(
+				tmpctx, &sig, &chainparams->genesis_blockhash,
+				&scid, timestamp, ROUTING_OPT_HTLC_MAX_MSAT,
+				dir, 6, AMOUNT_MSAT(0), 1000, 10,
+				AMOUNT_MSAT(1000000000));
+			gossip_store_add(rstate->gs, msg, timestamp, NULL);
+		}
+	}
+	tal_free(rstate);
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	const struct chainparams *chainparams;
+	size_t num_channels = 1000, num_runs = 1;
+	struct node_id me;
+	char *dir;
+	struct timemono start, end;
+	u64 load_nsec = 0, crc_nsec = 0, store_len = 0;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	opt_register_noarg("--verbose", opt_set_bool, &verbose,
+			   "Show gossipd's messages");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+
+	if (argc > 1)
+		num_channels = atoi(argv[1]);
+	if (argc > 2)
+		num_runs = atoi(argv[2]);
+	if (argc > 3)
+		opt_usage_and_exit("[num_channels [num_runs]]");
+
+	dir = tal_strdup(NULL, "/tmp/run-bench-gossip_store_load.XXXXXX");
+	if (!mkdtemp(dir) || chdir(dir) != 0)
+		err(1, "Making %s", dir);
+
+	chainparams = chainparams_for_network("regtest");
+	me = nodeid(0);
+
+	printf("Writing %zu channels...\n", num_channels);
+	write_store(chainparams, num_channels);
+
+	for (size_t i = 0; i < num_runs; i++) {
+		struct routing_state *rstate;
+		struct store_map map;
+		u64 bad, total;
+		size_t num_chans = 0;
+		u64 idx;
+
+		/* Not tmpctx: loading cleans that as it goes. */
+		rstate = new_routing_state(NULL, chainparams, &me, 0,
+					   NULL, NULL);
+
+		/* Just the checksums, on their own. */
+		start = time_mono();
+		if (!map_store(rstate->gs->fd, &map))
+			err(1, "Mapping store");
+		bad = first_bad_crc(&map, 1, &total);
+		end = time_mono();
+		assert(bad == total);
+		assert(total == map.len);
+		store_len = map.len;
+		unmap_store(&map);
+		crc_nsec += time_to_nsec(timemono_between(end, start));
+
+		start = time_mono();
+		assert(gossip_store_load(rstate, rstate->gs));
+		end = time_mono();
+		load_nsec += time_to_nsec(timemono_between(end, start));
+
+		for (struct chan *c = uintmap_first(&rstate->chanmap, &idx);
+		     c;
+		     c = uintmap_after(&rstate->chanmap, &idx)) {
+			assert(is_halfchan_defined(&c->half[0]));
+			assert(is_halfchan_defined(&c->half[1]));
+			num_chans++;
+		}
+		assert(num_chans == num_channels);
+		tal_free(rstate);
+	}
+
+	printf("Loaded %zu channels (%"PRIu64" bytes) %zu times:"
+	       " %"PRIu64" msec per load, %"PRIu64" msec checking checksums\n",
+	       num_channels, store_len, num_runs,
+	       load_nsec / num_runs / 1000000,
+	       crc_nsec / num_runs / 1000000);
+
+	unlink(GOSSIP_STORE_FILENAME);
+	rmdir(dir);
+	tal_free(dir);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
@@ -77,7 +77,7 @@ bool fromwire_expiry_too_soon(const tal_t *ctx UNNEEDED, const void *p UNNEEDED,
 bool fromwire_fee_insufficient(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct amount_msat *htlc_msat UNNEEDED, u8 **channel_update UNNEEDED)
 { fprintf(stderr, "fromwire_fee_insufficient called!\n"); abort(); }
 /* Generated stub for fromwire_gossipctl_init */
-bool fromwire_gossipctl_init(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct node_id *id UNNEEDED, u8 **globalfeatures UNNEEDED, u8 rgb[3] UNNEEDED, u8 alias[32] UNNEEDED, u32 *update_channel_interval UNNEEDED, struct wireaddr **announcable UNNEEDED, u32 **dev_gossip_time UNNEEDED)
+bool fromwire_gossipctl_init(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct node_id *id UNNEEDED, u8 **globalfeatures UNNEEDED, u8 rgb[3] UNNEEDED, u8 alias[32] UNNEEDED, u32 *update_channel_interval UNNEEDED, struct wireaddr **announcable UNNEEDED, u32 *getroute_threads UNNEEDED, u16 *getroute_landmarks UNNEEDED, u32 *getroute_cache_secs UNNEEDED, u32 *gossip_verify_threads UNNEEDED, u32 **dev_gossip_time UNNEEDED)
 { fprintf(stderr, "fromwire_gossipctl_init called!\n"); abort(); }
 /* Generated stub for fromwire_gossip_dev_set_max_scids_encode_size */
 bool fromwire_gossip_dev_set_max_scids_encode_size(const void *p UNNEEDED, u32 *max UNNEEDED)
@@ -98,17 +98,26 @@ bool fromwire_gossip_get_addrs(const void *p UNNEEDED, struct node_id *id UNNEED
 bool fromwire_gossip_get_channel_peer(const void *p UNNEEDED, struct short_channel_id *channel_id UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_get_channel_peer called!\n"); abort(); }
 /* Generated stub for fromwire_gossip_getchannels_request */
-bool fromwire_gossip_getchannels_request(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct short_channel_id **short_channel_id UNNEEDED, struct node_id **source UNNEEDED, struct short_channel_id **prev UNNEEDED)
+bool fromwire_gossip_getchannels_request(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct short_channel_id **short_channel_id UNNEEDED, struct node_id **source UNNEEDED, struct short_channel_id **prev UNNEEDED, u64 **since UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_getchannels_request called!\n"); abort(); }
 /* Generated stub for fromwire_gossip_get_incoming_channels */
 bool fromwire_gossip_get_incoming_channels(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, bool **private_too UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_get_incoming_channels called!\n"); abort(); }
 /* Generated stub for fromwire_gossip_getnodes_request */
-bool fromwire_gossip_getnodes_request(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct node_id **id UNNEEDED)
+bool fromwire_gossip_getnodes_request(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct node_id **id UNNEEDED, u64 **since UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_getnodes_request called!\n"); abort(); }
 /* Generated stub for fromwire_gossip_getroute_request */
 bool fromwire_gossip_getroute_request(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct node_id **source UNNEEDED, struct node_id *destination UNNEEDED, struct amount_msat *msatoshi UNNEEDED, u64 *riskfactor_by_million UNNEEDED, u32 *final_cltv UNNEEDED, double *fuzz UNNEEDED, struct short_channel_id_dir **excluded UNNEEDED, u32 *max_hops UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_getroute_request called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_getroutes_request */
+bool fromwire_gossip_getroutes_request(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct node_id **source UNNEEDED, struct node_id *destination UNNEEDED, struct amount_msat *msatoshi UNNEEDED, u64 *riskfactor_by_million UNNEEDED, u32 *final_cltv UNNEEDED, double *fuzz UNNEEDED, struct short_channel_id_dir **excluded UNNEEDED, u32 *max_hops UNNEEDED, u16 *max_routes UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_getroutes_request called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_getroutestats_request */
+bool fromwire_gossip_getroutestats_request(const void *p UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_getroutestats_request called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_getroutetree_request */
+bool fromwire_gossip_getroutetree_request(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct amount_msat *msatoshi UNNEEDED, u64 *riskfactor_by_million UNNEEDED, u32 *final_cltv UNNEEDED, struct node_id **destinations UNNEEDED, u32 *max_hops UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_getroutetree_request called!\n"); abort(); }
 /* Generated stub for fromwire_gossip_get_txout_reply */
 bool fromwire_gossip_get_txout_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct amount_sat *satoshis UNNEEDED, u8 **outscript UNNEEDED)
 { fprintf(stderr, "fromwire_gossip_get_txout_reply called!\n"); abort(); }
@@ -152,23 +161,16 @@ bool fromwire_temporary_channel_failure(const tal_t *ctx UNNEEDED, const void *p
 struct node *get_node(struct routing_state *rstate UNNEEDED,
 		      const struct node_id *id UNNEEDED)
 { fprintf(stderr, "get_node called!\n"); abort(); }
-/* Generated stub for get_route */
-struct route_hop *get_route(const tal_t *ctx UNNEEDED, struct routing_state *rstate UNNEEDED,
-			    const struct node_id *source UNNEEDED,
-			    const struct node_id *destination UNNEEDED,
-			    const struct amount_msat msat UNNEEDED, double riskfactor UNNEEDED,
-			    u32 final_cltv UNNEEDED,
-			    double fuzz UNNEEDED,
-			    u64 seed UNNEEDED,
-			    const struct short_channel_id_dir *excluded UNNEEDED,
-			    size_t max_hops UNNEEDED)
-{ fprintf(stderr, "get_route called!\n"); abort(); }
 /* Generated stub for gossip_peerd_wire_type_name */
 const char *gossip_peerd_wire_type_name(int e UNNEEDED)
 { fprintf(stderr, "gossip_peerd_wire_type_name called!\n"); abort(); }
-/* Generated stub for gossip_store_compact */
-bool gossip_store_compact(struct gossip_store *gs UNNEEDED)
-{ fprintf(stderr, "gossip_store_compact called!\n"); abort(); }
+/* Generated stub for gossip_store_compact_start */
+bool gossip_store_compact_start(struct gossip_store *gs UNNEEDED)
+{ fprintf(stderr, "gossip_store_compact_start called!\n"); abort(); }
+/* Generated stub for gossip_store_compact_step */
+bool gossip_store_compact_step(struct gossip_store *gs UNNEEDED, size_t max_bytes UNNEEDED,
+			       bool *ok UNNEEDED)
+{ fprintf(stderr, "gossip_store_compact_step called!\n"); abort(); }
 /* Generated stub for gossip_store_get */
 const u8 *gossip_store_get(const tal_t *ctx UNNEEDED,
 			   struct gossip_store *gs UNNEEDED,
@@ -180,17 +182,25 @@ bool gossip_store_load(struct routing_state *rstate UNNEEDED, struct gossip_stor
 /* Generated stub for gossip_store_readonly_fd */
 int gossip_store_readonly_fd(struct gossip_store *gs UNNEEDED)
 { fprintf(stderr, "gossip_store_readonly_fd called!\n"); abort(); }
+/* Generated stub for gossip_verify_add */
+void gossip_verify_add(struct gossip_verify *gv UNNEEDED, const u8 *msg UNNEEDED, void *source UNNEEDED)
+{ fprintf(stderr, "gossip_verify_add called!\n"); abort(); }
+/* Generated stub for gossip_verify_forget */
+void gossip_verify_forget(struct gossip_verify *gv UNNEEDED, const void *source UNNEEDED)
+{ fprintf(stderr, "gossip_verify_forget called!\n"); abort(); }
 /* Generated stub for got_pong */
 const char *got_pong(const u8 *pong UNNEEDED, size_t *num_pings_outstanding UNNEEDED)
 { fprintf(stderr, "got_pong called!\n"); abort(); }
 /* Generated stub for handle_channel_announcement */
 u8 *handle_channel_announcement(struct routing_state *rstate UNNEEDED,
 				const u8 *announce TAKES UNNEEDED,
+				bool sigs_checked UNNEEDED,
 				const struct short_channel_id **scid UNNEEDED)
 { fprintf(stderr, "handle_channel_announcement called!\n"); abort(); }
 /* Generated stub for handle_channel_update */
 u8 *handle_channel_update(struct routing_state *rstate UNNEEDED, const u8 *update TAKES UNNEEDED,
 			  const char *source UNNEEDED,
+			  const struct node_id *checked_signer UNNEEDED,
 			  struct short_channel_id *unknown_scid UNNEEDED)
 { fprintf(stderr, "handle_channel_update called!\n"); abort(); }
 /* Generated stub for handle_local_add_channel */
@@ -198,7 +208,8 @@ bool handle_local_add_channel(struct routing_state *rstate UNNEEDED, const u8 *m
 			      u64 index UNNEEDED)
 { fprintf(stderr, "handle_local_add_channel called!\n"); abort(); }
 /* Generated stub for handle_node_announcement */
-u8 *handle_node_announcement(struct routing_state *rstate UNNEEDED, const u8 *node UNNEEDED)
+u8 *handle_node_announcement(struct routing_state *rstate UNNEEDED, const u8 *node UNNEEDED,
+			     bool sig_checked UNNEEDED)
 { fprintf(stderr, "handle_node_announcement called!\n"); abort(); }
 /* Generated stub for handle_pending_cannouncement */
 bool handle_pending_cannouncement(struct routing_state *rstate UNNEEDED,
@@ -206,6 +217,18 @@ bool handle_pending_cannouncement(struct routing_state *rstate UNNEEDED,
 				  const struct amount_sat sat UNNEEDED,
 				  const u8 *txscript UNNEEDED)
 { fprintf(stderr, "handle_pending_cannouncement called!\n"); abort(); }
+/* Generated stub for landmarks_refresh_done */
+void landmarks_refresh_done(struct landmarks_refresh *refresh UNNEEDED)
+{ fprintf(stderr, "landmarks_refresh_done called!\n"); abort(); }
+/* Generated stub for landmarks_refresh_run */
+void landmarks_refresh_run(struct landmarks_refresh *refresh UNNEEDED)
+{ fprintf(stderr, "landmarks_refresh_run called!\n"); abort(); }
+/* Generated stub for local_disable_chan */
+void local_disable_chan(struct routing_state *rstate UNNEEDED, const struct chan *chan UNNEEDED)
+{ fprintf(stderr, "local_disable_chan called!\n"); abort(); }
+/* Generated stub for local_enable_chan */
+void local_enable_chan(struct routing_state *rstate UNNEEDED, const struct chan *chan UNNEEDED)
+{ fprintf(stderr, "local_enable_chan called!\n"); abort(); }
 /* Generated stub for make_ping */
 u8 *make_ping(const tal_t *ctx UNNEEDED, u16 num_pong_bytes UNNEEDED, u16 padlen UNNEEDED)
 { fprintf(stderr, "make_ping called!\n"); abort(); }
@@ -230,6 +253,42 @@ struct oneshot *new_reltimer_(struct timers *timers UNNEEDED,
 			      struct timerel expire UNNEEDED,
 			      void (*cb)(void *) UNNEEDED, void *arg UNNEEDED)
 { fprintf(stderr, "new_reltimer_ called!\n"); abort(); }
+/* Generated stub for new_gossip_verify_ */
+struct gossip_verify *new_gossip_verify_(const tal_t *ctx UNNEEDED,
+					 struct routing_state *rstate UNNEEDED,
+					 struct route_pool *pool UNNEEDED,
+					 void (*apply)(const struct gossip_checked * UNNEEDED,
+						       void *arg) UNNEEDED,
+					 void *arg UNNEEDED)
+{ fprintf(stderr, "new_gossip_verify_ called!\n"); abort(); }
+/* Generated stub for new_route_cache */
+struct route_cache *new_route_cache(const tal_t *ctx UNNEEDED, size_t max_entries UNNEEDED,
+				    u32 max_age UNNEEDED)
+{ fprintf(stderr, "new_route_cache called!\n"); abort(); }
+/* Generated stub for new_route_pool */
+struct route_pool *new_route_pool(const tal_t *ctx UNNEEDED, size_t num_threads UNNEEDED)
+{ fprintf(stderr, "new_route_pool called!\n"); abort(); }
+/* Generated stub for new_route_query */
+struct route_query *new_route_query(const tal_t *ctx UNNEEDED,
+				    struct routing_state *rstate UNNEEDED,
+				    const struct node_id *source UNNEEDED,
+				    const struct node_id *destination UNNEEDED,
+				    struct amount_msat msat UNNEEDED, double riskfactor UNNEEDED,
+				    u32 final_cltv UNNEEDED,
+				    double fuzz UNNEEDED, u64 seed UNNEEDED,
+				    const struct short_channel_id_dir *excluded UNNEEDED,
+				    size_t max_hops UNNEEDED,
+				    size_t max_routes UNNEEDED)
+{ fprintf(stderr, "new_route_query called!\n"); abort(); }
+/* Generated stub for new_route_tree_query */
+struct route_query *new_route_tree_query(const tal_t *ctx UNNEEDED,
+					 struct routing_state *rstate UNNEEDED,
+					 struct amount_msat msat UNNEEDED,
+					 double riskfactor UNNEEDED,
+					 u32 final_cltv UNNEEDED,
+					 const struct node_id *destinations UNNEEDED,
+					 size_t max_hops UNNEEDED)
+{ fprintf(stderr, "new_route_tree_query called!\n"); abort(); }
 /* Generated stub for new_routing_state */
 struct routing_state *new_routing_state(const tal_t *ctx UNNEEDED,
 					const struct chainparams *chainparams UNNEEDED,
@@ -251,9 +310,45 @@ struct wireaddr *read_addresses(const tal_t *ctx UNNEEDED, const u8 *ser UNNEEDE
 void remove_channel_from_store(struct routing_state *rstate UNNEEDED,
 			       struct chan *chan UNNEEDED)
 { fprintf(stderr, "remove_channel_from_store called!\n"); abort(); }
+/* Generated stub for route_pool_add_ */
+void route_pool_add_(struct route_pool *pool UNNEEDED, struct route_query *rq UNNEEDED,
+		     void (*answered)(struct route_query *rq UNNEEDED, void *arg) UNNEEDED,
+		     void *arg UNNEEDED)
+{ fprintf(stderr, "route_pool_add_ called!\n"); abort(); }
+/* Generated stub for route_pool_background_ */
+void route_pool_background_(struct route_pool *pool UNNEEDED,
+			    void (*run)(void *arg) UNNEEDED,
+			    void (*finish)(void *arg) UNNEEDED,
+			    void *arg UNNEEDED)
+{ fprintf(stderr, "route_pool_background_ called!\n"); abort(); }
+/* Generated stub for route_pool_get_stats */
+void route_pool_get_stats(struct route_pool *pool UNNEEDED,
+			  struct route_pool_stats *stats UNNEEDED)
+{ fprintf(stderr, "route_pool_get_stats called!\n"); abort(); }
+/* Generated stub for route_pool_wait_idle */
+void route_pool_wait_idle(struct route_pool *pool UNNEEDED)
+{ fprintf(stderr, "route_pool_wait_idle called!\n"); abort(); }
 /* Generated stub for route_prune */
 void route_prune(struct routing_state *rstate UNNEEDED)
 { fprintf(stderr, "route_prune called!\n"); abort(); }
+/* Generated stub for route_query_cache */
+void route_query_cache(const struct route_query *rq UNNEEDED)
+{ fprintf(stderr, "route_query_cache called!\n"); abort(); }
+/* Generated stub for route_query_costs */
+struct route_cost *route_query_costs(const tal_t *ctx UNNEEDED,
+				     const struct route_query *rq UNNEEDED)
+{ fprintf(stderr, "route_query_costs called!\n"); abort(); }
+/* Generated stub for route_query_hops */
+struct route_hop *route_query_hops(const tal_t *ctx UNNEEDED,
+				   const struct route_query *rq UNNEEDED,
+				   size_t n UNNEEDED)
+{ fprintf(stderr, "route_query_hops called!\n"); abort(); }
+/* Generated stub for route_query_num_routes */
+size_t route_query_num_routes(const struct route_query *rq UNNEEDED)
+{ fprintf(stderr, "route_query_num_routes called!\n"); abort(); }
+/* Generated stub for route_query_settled */
+size_t route_query_settled(const struct route_query *rq UNNEEDED)
+{ fprintf(stderr, "route_query_settled called!\n"); abort(); }
 /* Generated stub for routing_failure */
 void routing_failure(struct routing_state *rstate UNNEEDED,
 		     const struct node_id *erring_node UNNEEDED,
@@ -262,6 +357,16 @@ void routing_failure(struct routing_state *rstate UNNEEDED,
 		     enum onion_type failcode UNNEEDED,
 		     const u8 *channel_update UNNEEDED)
 { fprintf(stderr, "routing_failure called!\n"); abort(); }
+/* Generated stub for routing_landmarks_in_use */
+size_t routing_landmarks_in_use(const struct routing_state *rstate UNNEEDED)
+{ fprintf(stderr, "routing_landmarks_in_use called!\n"); abort(); }
+/* Generated stub for routing_landmarks_refresh */
+struct landmarks_refresh *routing_landmarks_refresh(struct routing_state *rstate UNNEEDED)
+{ fprintf(stderr, "routing_landmarks_refresh called!\n"); abort(); }
+/* Generated stub for routing_route_cache_stats */
+void routing_route_cache_stats(const struct routing_state *rstate UNNEEDED,
+			       struct route_cache_stats *stats UNNEEDED)
+{ fprintf(stderr, "routing_route_cache_stats called!\n"); abort(); }
 /* Generated stub for status_failed */
 void status_failed(enum status_failreason code UNNEEDED,
 		   const char *fmt UNNEEDED, ...)
@@ -299,17 +404,26 @@ u8 *towire_gossip_get_addrs_reply(const tal_t *ctx UNNEEDED, const struct wiread
 u8 *towire_gossip_get_channel_peer_reply(const tal_t *ctx UNNEEDED, const struct node_id *peer_id UNNEEDED)
 { fprintf(stderr, "towire_gossip_get_channel_peer_reply called!\n"); abort(); }
 /* Generated stub for towire_gossip_getchannels_reply */
-u8 *towire_gossip_getchannels_reply(const tal_t *ctx UNNEEDED, bool complete UNNEEDED, const struct gossip_getchannels_entry **nodes UNNEEDED)
+u8 *towire_gossip_getchannels_reply(const tal_t *ctx UNNEEDED, bool complete UNNEEDED, u64 generation UNNEEDED, bool full UNNEEDED, const struct short_channel_id *removed UNNEEDED, const u8 *channels UNNEEDED)
 { fprintf(stderr, "towire_gossip_getchannels_reply called!\n"); abort(); }
 /* Generated stub for towire_gossip_get_incoming_channels_reply */
 u8 *towire_gossip_get_incoming_channels_reply(const tal_t *ctx UNNEEDED, const struct route_info *route_info UNNEEDED)
 { fprintf(stderr, "towire_gossip_get_incoming_channels_reply called!\n"); abort(); }
 /* Generated stub for towire_gossip_getnodes_reply */
-u8 *towire_gossip_getnodes_reply(const tal_t *ctx UNNEEDED, const struct gossip_getnodes_entry **nodes UNNEEDED)
+u8 *towire_gossip_getnodes_reply(const tal_t *ctx UNNEEDED, u64 generation UNNEEDED, bool full UNNEEDED, const struct node_id *removed UNNEEDED, const u8 *nodes UNNEEDED)
 { fprintf(stderr, "towire_gossip_getnodes_reply called!\n"); abort(); }
 /* Generated stub for towire_gossip_getroute_reply */
 u8 *towire_gossip_getroute_reply(const tal_t *ctx UNNEEDED, const struct route_hop *hops UNNEEDED)
 { fprintf(stderr, "towire_gossip_getroute_reply called!\n"); abort(); }
+/* Generated stub for towire_gossip_getroutes_reply */
+u8 *towire_gossip_getroutes_reply(const tal_t *ctx UNNEEDED, const u16 *route_lens UNNEEDED, const struct route_hop *hops UNNEEDED)
+{ fprintf(stderr, "towire_gossip_getroutes_reply called!\n"); abort(); }
+/* Generated stub for towire_gossip_getroutestats_reply */
+u8 *towire_gossip_getroutestats_reply(const tal_t *ctx UNNEEDED, u32 threads UNNEEDED, u32 queued UNNEEDED, u32 running UNNEEDED, u32 max_queued UNNEEDED, u64 answered UNNEEDED, u64 settled UNNEEDED, u16 landmarks UNNEEDED, u64 cache_hits UNNEEDED, u64 cache_misses UNNEEDED, u64 cache_invalidated UNNEEDED, u32 cache_entries UNNEEDED)
+{ fprintf(stderr, "towire_gossip_getroutestats_reply called!\n"); abort(); }
+/* Generated stub for towire_gossip_getroutetree_reply */
+u8 *towire_gossip_getroutetree_reply(const tal_t *ctx UNNEEDED, const struct route_cost *costs UNNEEDED)
+{ fprintf(stderr, "towire_gossip_getroutetree_reply called!\n"); abort(); }
 /* Generated stub for towire_gossip_get_txout */
 u8 *towire_gossip_get_txout(const tal_t *ctx UNNEEDED, const struct short_channel_id *short_channel_id UNNEEDED)
 { fprintf(stderr, "towire_gossip_get_txout called!\n"); abort(); }
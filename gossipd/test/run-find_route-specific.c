@@ -11,6 +11,8 @@
 #define status_fmt(level, fmt, ...)					\
 	do { printf((fmt) ,##__VA_ARGS__); printf("\n"); } while(0)
 
+#include "../route_cache.c"
+#include "../route_graph.c"
 #include "../routing.c"
 #include "../gossip_store.c"
 
@@ -175,7 +177,7 @@ int main(void)
 	nc->bcast.timestamp = 1504064344;
 
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(100000), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(route);
 	assert(tal_count(route) == 2);
 	assert(channel_is_between(route[0], &a, &b));
@@ -184,19 +186,19 @@ int main(void)
 
 	/* We should not be able to find a route that exceeds our own capacity */
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(1000001), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(!route);
 
 	/* Now test with a query that exceeds the channel capacity after adding
 	 * some fees */
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(999999), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(!route);
 
 	/* This should fail to return a route because it is smaller than these
 	 * htlc_minimum_msat on the last channel. */
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(1), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(!route);
 
 	/* {'active': True, 'short_id': '6990:2:1/0', 'fee_per_kw': 10, 'delay': 5, 'message_flags': 1, 'htlc_maximum_msat': 500000, 'htlc_minimum_msat': 100, 'channel_flags': 0, 'destination': '02cca6c5c966fcf61d121e3a70e03a1cd9eeeea024b26ea666ce974d43b242e636', 'source': '03c173897878996287a8100469f954dd820fcd8941daed91c327f168f3329be0bf', 'last_update': 1504064344}, */
@@ -212,13 +214,13 @@ int main(void)
 
 	/* This should route correctly at the max_msat level */
 	route = find_route(tmpctx, rstate, &a, &d, AMOUNT_MSAT(500000), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(route);
 
 	/* This should fail to return a route because it's larger than the
 	 * htlc_maximum_msat on the last channel. */
 	route = find_route(tmpctx, rstate, &a, &d, AMOUNT_MSAT(500001), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(!route);
 
 	tal_free(tmpctx);
@@ -1,3 +1,5 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
 #include "../routing.c"
 #include "../gossip_store.c"
 #include <stdio.h>
@@ -97,6 +99,7 @@ static void add_connection(struct routing_state *rstate,
 	c->channel_flags = node_id_idx(from, to);
 	c->htlc_minimum = AMOUNT_MSAT(0);
 	c->htlc_maximum = AMOUNT_MSAT(100000 * 1000);
+	update_route_graph(rstate, chan);
 }
 
 /* Returns chan connecting from and to: *idx set to refer
@@ -160,6 +163,9 @@ int main(void)
 	struct privkey tmp;
 	struct amount_msat fee;
 	struct chan **route;
+	struct route_query *rq;
+	struct route_hop *hops;
+	int idx;
 	const double riskfactor = 1.0 / BLOCKS_PER_YEAR / 10000;
 
 	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
@@ -180,7 +186,7 @@ int main(void)
 	add_connection(rstate, &a, &b, 1, 1, 1);
 
 	route = find_route(tmpctx, rstate, &a, &b, AMOUNT_MSAT(1000), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(route);
 	assert(tal_count(route) == 1);
 	assert(amount_msat_eq(fee, AMOUNT_MSAT(0)));
@@ -196,7 +202,7 @@ int main(void)
 	add_connection(rstate, &b, &c, 1, 1, 1);
 
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(1000), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(route);
 	assert(tal_count(route) == 2);
 	assert(amount_msat_eq(fee, AMOUNT_MSAT(1)));
@@ -212,7 +218,7 @@ int main(void)
 
 	/* Will go via D for small amounts. */
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(1000), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(route);
 	assert(tal_count(route) == 2);
 	assert(channel_is_between(route[0], &a, &d));
@@ -221,17 +227,35 @@ int main(void)
 
 	/* Will go via B for large amounts. */
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(route);
 	assert(tal_count(route) == 2);
 	assert(channel_is_between(route[0], &a, &b));
 	assert(channel_is_between(route[1], &b, &c));
 	assert(amount_msat_eq(fee, AMOUNT_MSAT(1 + 3)));
 
+	/* Ask for alternatives: B first, then D, then nothing left. */
+	rq = new_route_query(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000),
+			     0.01, 9, 0.0, 0, NULL, ROUTING_MAX_HOPS, 3);
+	route_query_run(rq);
+	assert(route_query_num_routes(rq) == 2);
+	hops = route_query_hops(tmpctx, rq, 0);
+	assert(tal_count(hops) == 2);
+	assert(node_id_eq(&hops[0].nodeid, &b));
+	assert(node_id_eq(&hops[1].nodeid, &c));
+	hops = route_query_hops(tmpctx, rq, 1);
+	assert(tal_count(hops) == 2);
+	assert(node_id_eq(&hops[0].nodeid, &d));
+	assert(node_id_eq(&hops[1].nodeid, &c));
+	assert(!route_query_hops(tmpctx, rq, 2));
+	tal_free(rq);
+
 	/* Make B->C inactive, force it back via D */
 	get_connection(rstate, &b, &c)->channel_flags |= ROUTING_FLAGS_DISABLED;
+	update_route_graph(rstate, find_channel(rstate, get_node(rstate, &b),
+						get_node(rstate, &c), &idx));
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), riskfactor, 0.0, NULL,
-			   ROUTING_MAX_HOPS, &fee);
+			   NULL, ROUTING_MAX_HOPS, &fee);
 	assert(route);
 	assert(tal_count(route) == 2);
 	assert(channel_is_between(route[0], &a, &d));
@@ -0,0 +1,288 @@
+#include <assert.h>
+#include <bitcoin/chainparams.h>
+#include <bitcoin/pubkey.h>
+#include <common/status.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../gen_gossip_store.c"
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+#define NUM_CHANNELS 20
+
+static size_t peers_told;
+static u32 shrunk;
+
+void update_peers_broadcast_index(struct list_head *peers UNUSED, u32 offset)
+{
+	peers_told++;
+	shrunk = offset;
+}
+
+static const struct chainparams *chainparams;
+static struct node_id nodes[NUM_CHANNELS + 2];
+static u32 timestamp;
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+static struct short_channel_id channel_scid(size_t i)
+{
+	struct short_channel_id scid;
+
+	if (!mk_short_channel_id(&scid, i, 1, 0))
+		abort();
+	return scid;
+}
+
+static void update_channel(struct routing_state *rstate, size_t i, u32 t)
+{
+	struct short_channel_id scid = channel_scid(i);
+	secp256k1_ecdsa_signature sig;
+
+	memset(&sig, 0, sizeof(sig));
+	for (int dir = 0; dir < 2; dir++) {
+		u8 *msg = towire_channel_update_option_channel_htlc_max(
+			tmpctx, &sig, &chainparams->genesis_blockhash,
+			&scid, t, ROUTING_OPT_HTLC_MAX_MSAT,
+			dir, 6, AMOUNT_MSAT(0), 1000, 10,
+			AMOUNT_MSAT(1000000000));
+		assert(routing_add_channel_update(rstate, take(msg), 0));
+	}
+}
+
+/* Channel i joins node i to node i+1. */
+static void add_channel(struct routing_state *rstate, size_t i)
+{
+	struct short_channel_id scid = channel_scid(i);
+	const struct node_id *a = &nodes[i], *b = &nodes[i + 1];
+	secp256k1_ecdsa_signature sig;
+	struct pubkey bitcoin_key;
+	struct secret s;
+	u8 *msg;
+
+	memset(&sig, 0, sizeof(sig));
+	memset(&s, 1, sizeof(s));
+	pubkey_from_secret(&s, &bitcoin_key);
+
+	if (node_id_cmp(a, b) > 0) {
+		const struct node_id *t = a;
+		a = b;
+		b = t;
+	}
+	msg = towire_channel_announcement(tmpctx, &sig, &sig, &sig, &sig,
+					  NULL,
+					  &chainparams->genesis_blockhash,
+					  &scid, a, b,
+					  &bitcoin_key, &bitcoin_key);
+	assert(routing_add_channel_announcement(rstate, take(msg),
+						AMOUNT_SAT(1000000), 0));
+	update_channel(rstate, i, timestamp);
+}
+
+static void remove_channel(struct routing_state *rstate, size_t i)
+{
+	struct short_channel_id scid = channel_scid(i);
+	struct chan *chan = get_channel(rstate, &scid);
+
+	remove_channel_from_store(rstate, chan);
+	free_chan(rstate, chan);
+}
+
+/* Copy one record at a time until we've copied the one at @index. */
+static void compact_past(struct routing_state *rstate, u64 index)
+{
+	bool ok;
+
+	while (rstate->gs->compaction->from <= index)
+		assert(gossip_store_compact_step(rstate->gs, 1, &ok));
+}
+
+/* Everything points at the right kind of record. */
+static size_t check_store(struct routing_state *rstate)
+{
+	struct chan *chan;
+	size_t num = 0;
+	u64 idx;
+
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx)) {
+		const u8 *msg;
+
+		msg = gossip_store_get(tmpctx, rstate->gs, chan->bcast.index);
+		assert(fromwire_peektype(msg) == WIRE_CHANNEL_ANNOUNCEMENT);
+		for (int dir = 0; dir < 2; dir++) {
+			msg = gossip_store_get(tmpctx, rstate->gs,
+					       chan->half[dir].bcast.index);
+			assert(fromwire_peektype(msg) == WIRE_CHANNEL_UPDATE);
+		}
+		num++;
+	}
+	return num;
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	char *dir;
+	struct chan *chan;
+	struct short_channel_id scid;
+	bool ok;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+	chainparams = chainparams_for_network("regtest");
+	timestamp = time_now().ts.tv_sec - 100;
+
+	dir = tal_strdup(NULL, "/tmp/run-gossip_store_compact.XXXXXX");
+	if (!mkdtemp(dir) || chdir(dir) != 0)
+		abort();
+
+	for (size_t i = 0; i < ARRAY_SIZE(nodes); i++)
+		nodes[i] = nodeid(i);
+
+	rstate = new_routing_state(NULL, chainparams, &nodes[0], 0,
+				   NULL, NULL);
+	for (size_t i = 0; i < NUM_CHANNELS; i++)
+		add_channel(rstate, i);
+
+	/* Replace the updates for the even channels. */
+	for (size_t i = 0; i < NUM_CHANNELS; i += 2)
+		update_channel(rstate, i, timestamp + 1);
+	assert(rstate->gs->deleted == NUM_CHANNELS);
+	assert(check_store(rstate) == NUM_CHANNELS);
+
+	assert(gossip_store_compact_start(rstate->gs));
+
+	/* Channel 1's updates get replaced after we copied them. */
+	scid = channel_scid(1);
+	chan = get_channel(rstate, &scid);
+	compact_past(rstate, chan->half[1].bcast.index);
+	update_channel(rstate, 1, timestamp + 1);
+
+	/* Channel 3 goes away after we copied it all. */
+	scid = channel_scid(3);
+	chan = get_channel(rstate, &scid);
+	compact_past(rstate, chan->half[1].bcast.index);
+	remove_channel(rstate, 3);
+
+	/* Channel 5 goes away after we copied its announcement, but not the
+	 * amount after it. */
+	scid = channel_scid(5);
+	chan = get_channel(rstate, &scid);
+	compact_past(rstate, chan->bcast.index);
+	remove_channel(rstate, 5);
+
+	/* Channel 7 goes away before we get to it. */
+	remove_channel(rstate, 7);
+
+	/* The old store is still the real one meanwhile. */
+	assert(check_store(rstate) == NUM_CHANNELS - 3);
+
+	/* New channels get appended to the old store, and copied. */
+	add_channel(rstate, NUM_CHANNELS);
+	assert(peers_told == 0);
+
+	while (gossip_store_compact_step(rstate->gs, 100, &ok))
+		/* Keep it busy. */
+		update_channel(rstate, 9, timestamp + 2);
+	assert(ok);
+	assert(!rstate->gs->compaction);
+	assert(peers_told == 1);
+	assert(shrunk > 0);
+	assert(check_store(rstate) == NUM_CHANNELS - 2);
+	/* Only the ones deleted after we copied them are left. */
+	assert(rstate->gs->deleted > 0);
+	assert(rstate->gs->deleted < NUM_CHANNELS);
+	tal_free(rstate);
+
+	/* It loads back the same. */
+	rstate = new_routing_state(NULL, chainparams, &nodes[0], 0,
+				   NULL, NULL);
+	assert(gossip_store_load(rstate, rstate->gs));
+	assert(check_store(rstate) == NUM_CHANNELS - 2);
+	for (size_t i = 0; i <= NUM_CHANNELS; i++) {
+		scid = channel_scid(i);
+		chan = get_channel(rstate, &scid);
+		if (i == 3 || i == 5 || i == 7) {
+			assert(!chan);
+			continue;
+		}
+		assert(chan);
+		if (i == 9)
+			assert(chan->half[0].bcast.timestamp == timestamp + 2);
+		else if (i == 1 || (i % 2 == 0 && i != NUM_CHANNELS))
+			assert(chan->half[0].bcast.timestamp == timestamp + 1);
+		else
+			assert(chan->half[0].bcast.timestamp == timestamp);
+	}
+	tal_free(rstate);
+
+	unlink(GOSSIP_STORE_FILENAME);
+	rmdir(dir);
+	tal_free(dir);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
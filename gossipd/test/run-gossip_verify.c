@@ -0,0 +1,390 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+#include "../route_pool.c"
+#include "../gossip_verify.c"
+#include <ccan/io/io.h>
+#include <stdio.h>
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+/* Each round adds one of each of these. */
+enum test_msg {
+	/* For a channel we know: we know who signed it. */
+	UPDATE_KNOWN,
+	/* A new channel... */
+	ANNOUNCE_NEW,
+	/* ... so we know who signed this, even before it's handled. */
+	UPDATE_NEW,
+	/* A channel we've never heard of: can't check it. */
+	UPDATE_UNKNOWN,
+	NODE_ANNOUNCE,
+	/* node_id isn't a valid key: can't be signed by it! */
+	NODE_ANNOUNCE_BADID,
+	MALFORMED,
+	/* We already have this, so don't bother checking it. */
+	ANNOUNCE_KNOWN,
+	NUM_TEST_MSGS
+};
+
+#define NUM_ROUNDS 50
+#define NUM_MSGS (NUM_ROUNDS * NUM_TEST_MSGS)
+
+struct keys {
+	struct privkey priv;
+	struct node_id id;
+	struct pubkey pub;
+};
+
+static struct keys node[4], bitcoin[2];
+
+struct applied {
+	struct routing_state *rstate;
+	const u8 *msgs[NUM_MSGS];
+	/* Two sources, taking turns. */
+	int sources[2];
+	bool forgot;
+	size_t num;
+	bool threaded;
+};
+
+static void make_keys(struct keys *k, char c)
+{
+	memset(&k->priv, c, sizeof(k->priv));
+	pubkey_from_privkey(&k->priv, &k->pub);
+	node_id_from_pubkey(&k->id, &k->pub);
+}
+
+static int keys_cmp(const void *a, const void *b)
+{
+	const struct keys *ka = a, *kb = b;
+	return node_id_cmp(&ka->id, &kb->id);
+}
+
+static void sign_msg(const u8 *msg, size_t offset, const struct keys *k,
+		     secp256k1_ecdsa_signature *sig)
+{
+	struct sha256_double hash;
+
+	sha256_double(&hash, msg + offset, tal_count(msg) - offset);
+	sign_hash(&k->priv, &hash, sig);
+}
+
+static u8 *make_update(const tal_t *ctx, const struct bitcoin_blkid *chain,
+		       u64 scid, int direction, u32 timestamp,
+		       const struct keys *signer)
+{
+	secp256k1_ecdsa_signature sig;
+	struct short_channel_id short_channel_id;
+	u8 *msg;
+
+	short_channel_id.u64 = scid;
+	memset(&sig, 0, sizeof(sig));
+	msg = towire_channel_update(ctx, &sig, chain, &short_channel_id,
+				    timestamp, 0, direction, 6, AMOUNT_MSAT(0),
+				    1, 1);
+	sign_msg(msg, 66, signer, &sig);
+	return towire_channel_update(ctx, &sig, chain, &short_channel_id,
+				     timestamp, 0, direction, 6,
+				     AMOUNT_MSAT(0), 1, 1);
+}
+
+/* node[n1] and node[n2] must be in order. */
+static u8 *make_announce(const tal_t *ctx, const struct bitcoin_blkid *chain,
+			 u64 scid, int n1, int n2)
+{
+	secp256k1_ecdsa_signature sig[4];
+	struct short_channel_id short_channel_id;
+	u8 *msg;
+
+	short_channel_id.u64 = scid;
+	memset(sig, 0, sizeof(sig));
+	msg = towire_channel_announcement(ctx, &sig[0], &sig[1],
+					  &sig[2], &sig[3], NULL, chain,
+					  &short_channel_id,
+					  &node[n1].id, &node[n2].id,
+					  &bitcoin[0].pub, &bitcoin[1].pub);
+	sign_msg(msg, 258, &node[n1], &sig[0]);
+	sign_msg(msg, 258, &node[n2], &sig[1]);
+	sign_msg(msg, 258, &bitcoin[0], &sig[2]);
+	sign_msg(msg, 258, &bitcoin[1], &sig[3]);
+	return towire_channel_announcement(ctx, &sig[0], &sig[1],
+					   &sig[2], &sig[3], NULL, chain,
+					   &short_channel_id,
+					   &node[n1].id, &node[n2].id,
+					   &bitcoin[0].pub, &bitcoin[1].pub);
+}
+
+static u8 *make_node_announce(const tal_t *ctx, const struct keys *k)
+{
+	secp256k1_ecdsa_signature sig;
+	u8 rgb[3], alias[32];
+	u8 *msg;
+
+	memset(&sig, 0, sizeof(sig));
+	memset(rgb, 0, sizeof(rgb));
+	memset(alias, 0, sizeof(alias));
+	msg = towire_node_announcement(ctx, &sig, NULL, 100, &k->id, rgb,
+				       alias, NULL);
+	sign_msg(msg, 66, k, &sig);
+	return towire_node_announcement(ctx, &sig, NULL, 100, &k->id, rgb,
+					alias, NULL);
+}
+
+static void check_applied(const struct gossip_checked *gc,
+			  struct applied *applied)
+{
+	size_t i = applied->num++;
+	int *source = &applied->sources[(i / NUM_TEST_MSGS) % 2];
+	const struct short_channel_id *scid;
+	const struct node_id *signer = NULL;
+
+	/* In order, and what we handed in. */
+	assert(i < NUM_MSGS);
+	assert(tal_count(gc->msg) == tal_count(applied->msgs[i]));
+	assert(memcmp(gc->msg, applied->msgs[i], tal_count(gc->msg)) == 0);
+	if (applied->forgot && source == &applied->sources[1])
+		assert(gc->source == NULL);
+	else
+		assert(gc->source == source);
+
+	switch ((enum test_msg)(i % NUM_TEST_MSGS)) {
+	case UPDATE_KNOWN:
+		signer = &node[0].id;
+		goto checked;
+	case UPDATE_NEW:
+		signer = &node[3].id;
+		goto checked;
+	case ANNOUNCE_NEW:
+		/* Like gossipd: then the routing state knows who signs. */
+		assert(gc->ok);
+		assert(!handle_channel_announcement(applied->rstate, gc->msg,
+						    gc->ok, &scid));
+		goto out;
+	case NODE_ANNOUNCE:
+		assert(gc->ok);
+		goto out;
+	case UPDATE_UNKNOWN:
+	case NODE_ANNOUNCE_BADID:
+	case MALFORMED:
+	case ANNOUNCE_KNOWN:
+		assert(!gc->ok);
+		goto out;
+	case NUM_TEST_MSGS:
+		break;
+	}
+	abort();
+
+checked:
+	assert(gc->ok);
+	assert(node_id_eq(&gc->signer, signer));
+
+out:
+	if (applied->num == NUM_MSGS && applied->threaded)
+		io_break(applied);
+}
+
+static void run_test(const struct bitcoin_blkid *chain, size_t num_threads)
+{
+	struct routing_state *rstate;
+	struct route_pool *pool;
+	struct gossip_verify *gv;
+	struct gossip_verify_stats stats;
+	struct applied applied;
+	struct chan *chan;
+	struct short_channel_id scid;
+	struct pending_cannouncement *pending;
+	u8 *msg;
+
+	rstate = new_routing_state(tmpctx, chainparams_for_network("regtest"),
+				   &node[0].id, 0, NULL, NULL);
+	/* Channel 1 (node 0 -> node 1) is public, and known. */
+	scid.u64 = 1;
+	chan = new_chan(rstate, &scid, &node[0].id, &node[1].id,
+			AMOUNT_SAT(100000));
+	chan->bcast.timestamp = 1;
+	assert(node_id_eq(&chan->nodes[0]->id, &node[0].id));
+
+	for (size_t i = 0; i < NUM_MSGS; i++) {
+		switch ((enum test_msg)(i % NUM_TEST_MSGS)) {
+		case UPDATE_KNOWN:
+			msg = make_update(tmpctx, chain, 1, 0, 100, &node[0]);
+			break;
+		case ANNOUNCE_NEW:
+			msg = make_announce(tmpctx, chain, 2, 2, 3);
+			break;
+		case UPDATE_NEW:
+			msg = make_update(tmpctx, chain, 2, 1, 100, &node[3]);
+			break;
+		case UPDATE_UNKNOWN:
+			msg = make_update(tmpctx, chain, 3, 0, 100, &node[0]);
+			break;
+		case NODE_ANNOUNCE:
+			msg = make_node_announce(tmpctx, &node[0]);
+			break;
+		case NODE_ANNOUNCE_BADID:
+			msg = make_node_announce(tmpctx, &node[0]);
+			/* type, signature, flen, timestamp, then node_id. */
+			msg[2 + 64 + 2 + 4] = 4;
+			break;
+		case MALFORMED:
+			msg = make_announce(tmpctx, chain, 4, 2, 3);
+			msg = tal_dup_arr(tmpctx, u8, msg, 100, 0);
+			break;
+		case ANNOUNCE_KNOWN:
+			msg = make_announce(tmpctx, chain, 1, 0, 1);
+			break;
+		default:
+			abort();
+		}
+		applied.msgs[i] = msg;
+	}
+
+	applied.rstate = rstate;
+	applied.num = 0;
+	applied.forgot = false;
+	applied.threaded = (num_threads != 0);
+
+	pool = new_route_pool(tmpctx, num_threads);
+	gv = new_gossip_verify(pool, rstate, pool, check_applied, &applied);
+	/* Small enough that we fill up before the threads get going. */
+	if (num_threads)
+		gv->max_pending = NUM_MSGS / 2;
+	for (size_t i = 0; i < NUM_MSGS; i++) {
+		gossip_verify_add(gv, applied.msgs[i],
+				  &applied.sources[(i / NUM_TEST_MSGS) % 2]);
+		/* With no threads, nothing is ever left pending. */
+		assert(gossip_verify_full(gv)
+		       == (num_threads && i + 1 >= NUM_MSGS / 2));
+	}
+
+	if (num_threads) {
+		/* None of them are applied until the io_loop runs. */
+		gossip_verify_get_stats(gv, &stats);
+		assert(stats.pending == NUM_MSGS);
+		/* Full batches go even if the threads are busy. */
+		assert(stats.batches >= NUM_MSGS / GOSSIP_VERIFY_BATCH);
+
+		gossip_verify_forget(gv, &applied.sources[1]);
+		applied.forgot = true;
+		io_loop(NULL, NULL);
+	}
+	assert(applied.num == NUM_MSGS);
+
+	gossip_verify_get_stats(gv, &stats);
+	assert(stats.pending == 0);
+	assert(stats.batches == 0);
+	assert(!gossip_verify_full(gv));
+	/* UPDATE_UNKNOWN, MALFORMED and ANNOUNCE_KNOWN aren't checked. */
+	assert(stats.checked + stats.unchecked == NUM_MSGS);
+	assert(stats.unchecked == NUM_ROUNDS * 3);
+
+	/* The channel_updates we checked for the pending announcement don't
+	 * get checked again. */
+	scid.u64 = 2;
+	pending = find_pending_cannouncement(rstate, &scid);
+	assert(pending);
+	for (size_t i = 0; i < NUM_ROUNDS; i++)
+		assert(!handle_channel_update(rstate,
+					      applied.msgs[UPDATE_NEW], "test",
+					      &node[3].id, NULL));
+	assert(pending->updates[1]);
+	assert(pending->updates_checked[1]);
+	assert(!pending->updates[0]);
+
+	/* But if we checked against the wrong key, it will be. */
+	assert(!handle_channel_update(rstate, make_update(tmpctx, chain, 2, 1,
+							  101, &node[3]),
+				      "test", &node[2].id, NULL));
+	assert(!pending->updates_checked[1]);
+
+	/* Its destructor needs the rstate's pending node map. */
+	tal_free(pending);
+	tal_free(pool);
+}
+
+int main(void)
+{
+	struct bitcoin_blkid chain;
+
+	setup_locale();
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	/* Channel announcements want their node_ids in order. */
+	for (size_t i = 0; i < ARRAY_SIZE(node); i++)
+		make_keys(&node[i], 'a' + i);
+	qsort(node, ARRAY_SIZE(node), sizeof(node[0]), keys_cmp);
+	make_keys(&bitcoin[0], 'x');
+	make_keys(&bitcoin[1], 'y');
+	chain = chainparams_for_network("regtest")->genesis_blockhash;
+
+	/* Synchronous, then with various numbers of threads. */
+	run_test(&chain, 0);
+	run_test(&chain, 1);
+	run_test(&chain, 4);
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
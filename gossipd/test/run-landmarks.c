@@ -0,0 +1,209 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+#include <common/pseudorand.h>
+#include <stdio.h>
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+#define NUM_NODES 300
+#define NUM_LANDMARKS 8
+#define NUM_QUERIES 500
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+static void add_connection(struct routing_state *rstate,
+			   const struct node_id *nodes,
+			   u32 from, u32 to)
+{
+	struct short_channel_id scid;
+	struct chan *chan;
+	int idx = node_id_idx(&nodes[from], &nodes[to]);
+
+	/* Encode src and dst in scid. */
+	memcpy((char *)&scid + idx * sizeof(from), &from, sizeof(from));
+	memcpy((char *)&scid + (!idx) * sizeof(to), &to, sizeof(to));
+
+	chan = get_channel(rstate, &scid);
+	if (!chan)
+		chan = new_chan(rstate, &scid, &nodes[from], &nodes[to],
+				AMOUNT_SAT(1000000));
+
+	for (size_t i = 0; i < 2; i++) {
+		struct half_chan *c = &chan->half[i];
+		c->base_fee = pseudorand(1000);
+		c->proportional_fee = pseudorand(1000);
+		c->delay = pseudorand(144);
+		c->channel_flags = i;
+		/* This must be non-zero, otherwise we consider it disabled! */
+		c->bcast.index = 1;
+		c->htlc_maximum = AMOUNT_MSAT(-1ULL);
+		c->htlc_minimum = AMOUNT_MSAT(0);
+	}
+}
+
+/* What did the last search from src to dst cost? */
+static u64 search_cost(const struct route_graph_scratch *s, u32 dst)
+{
+	struct amount_msat cost;
+
+	if (!amount_msat_add(&cost, s->d[dst].total, s->d[dst].risk))
+		abort();
+	return cost.millisatoshis; /* Raw: test */
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct node_id nodes[NUM_NODES];
+	struct route_graph *graph;
+	struct route_landmarks *lm;
+	struct route_graph_scratch *plain, *aimed;
+	struct siphash_seed base_seed;
+	const double fuzzes[] = { 0.0, 0.05, 0.75 };
+	size_t plain_settled, aimed_settled;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	rstate = new_routing_state(tmpctx, NULL, &nodes[0], 0, NULL, NULL);
+	for (size_t i = 0; i < NUM_NODES; i++)
+		nodes[i] = nodeid(i);
+	/* Like run-bench-find_route: each node joins two earlier ones. */
+	for (size_t i = 1; i < NUM_NODES; i++) {
+		add_connection(rstate, nodes, i, pseudorand(i));
+		add_connection(rstate, nodes, i, pseudorand(i));
+	}
+
+	graph = route_graph_new(tmpctx, rstate);
+	lm = route_landmarks_new(tmpctx, graph, NUM_LANDMARKS);
+	route_landmarks_compute(lm, graph);
+
+	/* Neighbors' distances differ by no more than the cheaper fee. */
+	for (u32 e = 0; e < tal_count(graph->edges); e++) {
+		const u32 *a, *b;
+
+		a = lm->dist + graph->edges[e].src * NUM_LANDMARKS;
+		b = lm->dist + route_graph_edge_dst(graph, e) * NUM_LANDMARKS;
+		for (size_t l = 0; l < NUM_LANDMARKS; l++) {
+			assert(a[l] != LANDMARK_UNREACHABLE);
+			assert(a[l] - b[l] <= graph->edges[e].base_fee
+			       || b[l] - a[l] <= graph->edges[e].base_fee);
+		}
+	}
+
+	/* A landmark is where its own distances start. */
+	for (size_t l = 0; l < NUM_LANDMARKS; l++) {
+		size_t zeroes = 0;
+		for (size_t i = 0; i < NUM_NODES; i++)
+			zeroes += (lm->dist[i * NUM_LANDMARKS + l] == 0);
+		assert(zeroes >= 1);
+	}
+
+	/* Aimed searches find routes exactly as cheap, looking at less. */
+	plain = route_graph_scratch_new(tmpctx, graph);
+	aimed = route_graph_scratch_new(tmpctx, graph);
+	memset(&base_seed, 0, sizeof(base_seed));
+	for (size_t i = 0; i < NUM_QUERIES; i++) {
+		u32 from = pseudorand(NUM_NODES), to = pseudorand(NUM_NODES);
+		struct amount_msat msat = { 1 + pseudorand(100000) };
+		double fuzz = fuzzes[i % ARRAY_SIZE(fuzzes)];
+		const u32 *r1, *r2;
+		size_t len1, len2;
+		struct amount_msat fee1, fee2;
+
+		if (from == to)
+			continue;
+
+		r1 = route_graph_find_route(plain, graph, from, to, i % 2,
+					    msat, 1e-9, fuzz, &base_seed,
+					    NULL, NULL, ROUTING_MAX_HOPS,
+					    &len1, &fee1);
+		r2 = route_graph_find_route(aimed, graph, from, to, i % 2,
+					    msat, 1e-9, fuzz, &base_seed,
+					    NULL, lm, ROUTING_MAX_HOPS,
+					    &len2, &fee2);
+		assert(r1 && r2);
+		assert(search_cost(plain, from) == search_cost(aimed, from));
+	}
+
+	plain_settled = route_graph_scratch_settled(plain);
+	aimed_settled = route_graph_scratch_settled(aimed);
+	assert(aimed_settled < plain_settled);
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
@@ -1,3 +1,5 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
 #include "../routing.c"
 #include "../gossip_store.c"
 #include <stdio.h>
@@ -149,7 +151,7 @@ int main(void)
 
 		route = find_route(tmpctx, rstate, &ids[0], &ids[NUM_NODES-1],
 				   AMOUNT_MSAT(1000), 0, 0.0, NULL,
-				   i, &fee);
+				   NULL, i, &fee);
 		assert(route);
 		assert(tal_count(route) == i);
 		if (i != ROUTING_MAX_HOPS)
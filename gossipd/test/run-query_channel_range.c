@@ -0,0 +1,411 @@
+#include "config.h"
+
+#define main gossipd_main
+int gossipd_main(int argc, char *argv[]);
+
+#include "../gossipd.c"
+#undef main
+#include "../gen_gossip_store.c"
+#include "../gen_gossip_wire.c"
+#include "../gossip_store.c"
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../../common/decode_short_channel_ids.c"
+#include "../../lightningd/gossip_msg.c"
+#include <ccan/err/err.h>
+#include <common/pseudorand.h>
+#include <stdio.h>
+#include <unistd.h>
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+}
+
+/* Replies to the peer end up here. */
+static const u8 **sent;
+
+void daemon_conn_send(struct daemon_conn *dc UNUSED, const u8 *msg)
+{
+	tal_arr_expand(&sent, tal_dup_arr(sent, u8, msg, tal_count(msg), 0));
+	if (taken(msg))
+		tal_free(msg);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for check_ping_make_pong */
+bool check_ping_make_pong(const tal_t *ctx UNNEEDED, const u8 *ping UNNEEDED, u8 **pong UNNEEDED)
+{ fprintf(stderr, "check_ping_make_pong called!\n"); abort(); }
+/* Generated stub for daemon_conn_new_ */
+struct daemon_conn *daemon_conn_new_(const tal_t *ctx UNNEEDED, int fd UNNEEDED,
+				     struct io_plan *(*recv)(struct io_conn * UNNEEDED,
+							     const u8 * UNNEEDED,
+							     void *) UNNEEDED,
+				     void (*outq_empty)(void *) UNNEEDED,
+				     void *arg UNNEEDED)
+{ fprintf(stderr, "daemon_conn_new_ called!\n"); abort(); }
+/* Generated stub for daemon_conn_read_next */
+struct io_plan *daemon_conn_read_next(struct io_conn *conn UNNEEDED,
+				      struct daemon_conn *dc UNNEEDED)
+{ fprintf(stderr, "daemon_conn_read_next called!\n"); abort(); }
+/* Generated stub for daemon_conn_send_fd */
+void daemon_conn_send_fd(struct daemon_conn *dc UNNEEDED, int fd UNNEEDED)
+{ fprintf(stderr, "daemon_conn_send_fd called!\n"); abort(); }
+/* Generated stub for daemon_conn_wake */
+void daemon_conn_wake(struct daemon_conn *dc UNNEEDED)
+{ fprintf(stderr, "daemon_conn_wake called!\n"); abort(); }
+/* Generated stub for daemon_shutdown */
+void daemon_shutdown(void)
+{ fprintf(stderr, "daemon_shutdown called!\n"); abort(); }
+/* Generated stub for fromwire_amount_below_minimum */
+bool fromwire_amount_below_minimum(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct amount_msat *htlc_msat UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_amount_below_minimum called!\n"); abort(); }
+/* Generated stub for fromwire_expiry_too_soon */
+bool fromwire_expiry_too_soon(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_expiry_too_soon called!\n"); abort(); }
+/* Generated stub for fromwire_fee_insufficient */
+bool fromwire_fee_insufficient(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct amount_msat *htlc_msat UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_fee_insufficient called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_get_addrs */
+bool fromwire_gossip_get_addrs(const void *p UNNEEDED, struct node_id *id UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_get_addrs called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_new_peer */
+bool fromwire_gossip_new_peer(const void *p UNNEEDED, struct node_id *id UNNEEDED, bool *gossip_queries_feature UNNEEDED, bool *initial_routing_sync UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_new_peer called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_get_update */
+bool fromwire_gossipd_get_update(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_get_update called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_channel_update */
+bool fromwire_gossipd_local_channel_update(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, bool *disable UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_hsm_cupdate_sig_reply */
+bool fromwire_hsm_cupdate_sig_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **cu UNNEEDED)
+{ fprintf(stderr, "fromwire_hsm_cupdate_sig_reply called!\n"); abort(); }
+/* Generated stub for fromwire_hsm_node_announcement_sig_reply */
+bool fromwire_hsm_node_announcement_sig_reply(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED)
+{ fprintf(stderr, "fromwire_hsm_node_announcement_sig_reply called!\n"); abort(); }
+/* Generated stub for fromwire_incorrect_cltv_expiry */
+bool fromwire_incorrect_cltv_expiry(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u32 *cltv_expiry UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_incorrect_cltv_expiry called!\n"); abort(); }
+/* Generated stub for fromwire_temporary_channel_failure */
+bool fromwire_temporary_channel_failure(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **channel_update UNNEEDED)
+{ fprintf(stderr, "fromwire_temporary_channel_failure called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for gossip_peerd_wire_type_name */
+const char *gossip_peerd_wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "gossip_peerd_wire_type_name called!\n"); abort(); }
+/* Generated stub for gossip_verify_add */
+void gossip_verify_add(struct gossip_verify *gv UNNEEDED, const u8 *msg UNNEEDED, void *source UNNEEDED)
+{ fprintf(stderr, "gossip_verify_add called!\n"); abort(); }
+/* Generated stub for gossip_verify_forget */
+void gossip_verify_forget(struct gossip_verify *gv UNNEEDED, const void *source UNNEEDED)
+{ fprintf(stderr, "gossip_verify_forget called!\n"); abort(); }
+/* Generated stub for got_pong */
+const char *got_pong(const u8 *pong UNNEEDED, size_t *num_pings_outstanding UNNEEDED)
+{ fprintf(stderr, "got_pong called!\n"); abort(); }
+/* Generated stub for make_ping */
+u8 *make_ping(const tal_t *ctx UNNEEDED, u16 num_pong_bytes UNNEEDED, u16 padlen UNNEEDED)
+{ fprintf(stderr, "make_ping called!\n"); abort(); }
+/* Generated stub for master_badmsg */
+void master_badmsg(u32 type_expected UNNEEDED, const u8 *msg)
+{ fprintf(stderr, "master_badmsg called!\n"); abort(); }
+/* Generated stub for new_gossip_verify_ */
+struct gossip_verify *new_gossip_verify_(const tal_t *ctx UNNEEDED,
+					 struct routing_state *rstate UNNEEDED,
+					 struct route_pool *pool UNNEEDED,
+					 void (*apply)(const struct gossip_checked * UNNEEDED,
+						       void *arg) UNNEEDED,
+					 void *arg UNNEEDED)
+{ fprintf(stderr, "new_gossip_verify_ called!\n"); abort(); }
+/* Generated stub for new_reltimer_ */
+struct oneshot *new_reltimer_(struct timers *timers UNNEEDED,
+			      const tal_t *ctx UNNEEDED,
+			      struct timerel expire UNNEEDED,
+			      void (*cb)(void *) UNNEEDED, void *arg UNNEEDED)
+{ fprintf(stderr, "new_reltimer_ called!\n"); abort(); }
+/* Generated stub for new_route_pool */
+struct route_pool *new_route_pool(const tal_t *ctx UNNEEDED, size_t num_threads UNNEEDED)
+{ fprintf(stderr, "new_route_pool called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for route_pool_add_ */
+void route_pool_add_(struct route_pool *pool UNNEEDED, struct route_query *rq UNNEEDED,
+		     void (*answered)(struct route_query *rq UNNEEDED, void *arg) UNNEEDED,
+		     void *arg UNNEEDED)
+{ fprintf(stderr, "route_pool_add_ called!\n"); abort(); }
+/* Generated stub for route_pool_background_ */
+void route_pool_background_(struct route_pool *pool UNNEEDED,
+			    void (*run)(void *arg) UNNEEDED,
+			    void (*finish)(void *arg) UNNEEDED,
+			    void *arg UNNEEDED)
+{ fprintf(stderr, "route_pool_background_ called!\n"); abort(); }
+/* Generated stub for route_pool_get_stats */
+void route_pool_get_stats(struct route_pool *pool UNNEEDED,
+			  struct route_pool_stats *stats UNNEEDED)
+{ fprintf(stderr, "route_pool_get_stats called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for status_setup_async */
+void status_setup_async(struct daemon_conn *master UNNEEDED)
+{ fprintf(stderr, "status_setup_async called!\n"); abort(); }
+/* Generated stub for subdaemon_setup */
+void subdaemon_setup(int argc UNNEEDED, char *argv[])
+{ fprintf(stderr, "subdaemon_setup called!\n"); abort(); }
+/* Generated stub for timer_expired */
+void timer_expired(tal_t *ctx UNNEEDED, struct timer *timer UNNEEDED)
+{ fprintf(stderr, "timer_expired called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_get_addrs_reply */
+u8 *towire_gossip_get_addrs_reply(const tal_t *ctx UNNEEDED, const struct wireaddr *addrs UNNEEDED)
+{ fprintf(stderr, "towire_gossip_get_addrs_reply called!\n"); abort(); }
+/* Generated stub for towire_gossip_new_peer_reply */
+u8 *towire_gossip_new_peer_reply(const tal_t *ctx UNNEEDED, bool success UNNEEDED, const struct gossip_state *gs UNNEEDED)
+{ fprintf(stderr, "towire_gossip_new_peer_reply called!\n"); abort(); }
+/* Generated stub for towire_gossipd_get_update_reply */
+u8 *towire_gossipd_get_update_reply(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossipd_get_update_reply called!\n"); abort(); }
+/* Generated stub for towire_gossipd_new_store_fd */
+u8 *towire_gossipd_new_store_fd(const tal_t *ctx UNNEEDED, u64 offset_shorter UNNEEDED)
+{ fprintf(stderr, "towire_gossipd_new_store_fd called!\n"); abort(); }
+/* Generated stub for towire_hsm_cupdate_sig_req */
+u8 *towire_hsm_cupdate_sig_req(const tal_t *ctx UNNEEDED, const u8 *cu UNNEEDED)
+{ fprintf(stderr, "towire_hsm_cupdate_sig_req called!\n"); abort(); }
+/* Generated stub for towire_hsm_node_announcement_sig_req */
+u8 *towire_hsm_node_announcement_sig_req(const tal_t *ctx UNNEEDED, const u8 *announcement UNNEEDED)
+{ fprintf(stderr, "towire_hsm_node_announcement_sig_req called!\n"); abort(); }
+/* Generated stub for towire_wireaddr */
+void towire_wireaddr(u8 **pptr UNNEEDED, const struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "towire_wireaddr called!\n"); abort(); }
+/* Generated stub for wire_sync_read */
+u8 *wire_sync_read(const tal_t *ctx UNNEEDED, int fd UNNEEDED)
+{ fprintf(stderr, "wire_sync_read called!\n"); abort(); }
+/* Generated stub for wire_sync_write */
+bool wire_sync_write(int fd UNNEEDED, const void *msg TAKES UNNEEDED)
+{ fprintf(stderr, "wire_sync_write called!\n"); abort(); }
+/* Generated stub for wireaddr_eq */
+bool wireaddr_eq(const struct wireaddr *a UNNEEDED, const struct wireaddr *b UNNEEDED)
+{ fprintf(stderr, "wireaddr_eq called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+#endif
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+/* Random txnums and outnums, so they don't compress much, and several
+ * channels in most blocks. */
+static void add_channels(struct routing_state *rstate,
+			 const struct node_id *nodes,
+			 u32 first_blocknum, u32 num_blocks, size_t num)
+{
+	for (size_t i = 0; i < num; i++) {
+		struct short_channel_id scid;
+
+		do {
+			if (!mk_short_channel_id(&scid,
+						 first_blocknum
+						 + pseudorand(num_blocks),
+						 pseudorand(1 << 24),
+						 pseudorand(1 << 16)))
+				abort();
+		} while (get_channel(rstate, &scid));
+		new_chan(rstate, &scid, &nodes[0], &nodes[1],
+			 AMOUNT_SAT(1000000));
+	}
+}
+
+/* Ask for blocks first_blocknum to first_blocknum + number_of_blocks - 1,
+ * and check the replies cover exactly those, with every channel in them. */
+static size_t check_query(struct peer *peer,
+			  u32 first_blocknum, u32 number_of_blocks)
+{
+	struct routing_state *rstate = peer->daemon->rstate;
+	struct short_channel_id scid;
+	u64 next_block = first_blocknum;
+	size_t num_replies;
+	const u8 *msg;
+
+#if EXPERIMENTAL_FEATURES
+	msg = towire_query_channel_range(tmpctx, &peer->daemon->chain_hash,
+					 first_blocknum, number_of_blocks,
+					 NULL);
+#else
+	msg = towire_query_channel_range(tmpctx, &peer->daemon->chain_hash,
+					 first_blocknum, number_of_blocks);
+#endif
+	sent = tal_arr(tmpctx, const u8 *, 0);
+	assert(!handle_query_channel_range(peer, msg));
+
+	/* We expect every channel from here on, in order. */
+	if (!mk_short_channel_id(&scid,
+				 first_blocknum ? first_blocknum : 1, 0, 0))
+		abort();
+	scid.u64--;
+
+	for (size_t i = 0; i < tal_count(sent); i++) {
+		struct bitcoin_blkid chain;
+		u32 first, num;
+		u8 complete, *encoded;
+		struct short_channel_id *scids;
+#if EXPERIMENTAL_FEATURES
+		struct tlv_reply_channel_range_tlvs *tlvs
+			= tlv_reply_channel_range_tlvs_new(tmpctx);
+
+		assert(fromwire_reply_channel_range(tmpctx, sent[i], &chain,
+						    &first, &num, &complete,
+						    &encoded, tlvs));
+#else
+		assert(fromwire_reply_channel_range(tmpctx, sent[i], &chain,
+						    &first, &num, &complete,
+						    &encoded));
+#endif
+		assert(tal_count(sent[i]) <= 65535);
+		assert(bitcoin_blkid_eq(&chain, &peer->daemon->chain_hash));
+		assert(complete == 1);
+		assert(first == next_block);
+		assert(num > 0);
+		next_block = (u64)first + num;
+
+		scids = decode_short_ids(tmpctx, encoded);
+		assert(scids);
+		for (size_t j = 0; j < tal_count(scids); j++) {
+			assert(uintmap_after(&rstate->chanmap, &scid.u64));
+			assert(short_channel_id_eq(&scids[j], &scid));
+			assert(short_channel_id_blocknum(&scid) >= first);
+			assert(short_channel_id_blocknum(&scid) < next_block);
+		}
+	}
+	assert(next_block == (u64)first_blocknum + number_of_blocks);
+
+	/* And there are none we missed. */
+	if (uintmap_after(&rstate->chanmap, &scid.u64))
+		assert(short_channel_id_blocknum(&scid) >= next_block);
+
+	num_replies = tal_count(sent);
+	clean_tmpctx();
+	return num_replies;
+}
+
+int main(void)
+{
+	struct daemon *daemon;
+	struct peer *peer;
+	struct node_id nodes[2];
+	struct short_channel_id scid;
+	char *dir;
+	size_t n;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	/* Making a routing_state makes a gossip_store. */
+	dir = tal_strdup(NULL, "/tmp/run-query_channel_range.XXXXXX");
+	if (!mkdtemp(dir) || chdir(dir) != 0)
+		err(1, "Making %s", dir);
+
+	nodes[0] = nodeid(0);
+	nodes[1] = nodeid(1);
+
+	daemon = tal(NULL, struct daemon);
+	daemon->id = nodes[0];
+	list_head_init(&daemon->peers);
+	daemon->chain_hash = chainparams_for_network("regtest")->genesis_blockhash;
+	daemon->rstate = new_routing_state(daemon,
+					   chainparams_for_network("regtest"),
+					   &daemon->id, 0, &daemon->peers,
+					   NULL);
+	peer = tal(daemon, struct peer);
+	peer->daemon = daemon;
+	peer->id = nodes[1];
+	peer->dc = NULL;
+
+	/* Nothing at all. */
+	assert(check_query(peer, 0, UINT_MAX) == 1);
+
+	/* Far too many to fit in one reply. */
+	add_channels(daemon->rstate, nodes, 100, 10000, 30000);
+	n = check_query(peer, 0, UINT_MAX);
+	assert(n > 1);
+	assert(tal_count(daemon->rstate->channel_ranges) > 1);
+
+	/* The second time, it's all from the ranges we encoded. */
+	for (size_t i = 0; i < tal_count(daemon->rstate->channel_ranges); i++)
+		assert(daemon->rstate->channel_ranges[i].encoded_scids);
+	assert(check_query(peer, 0, UINT_MAX) == n);
+
+	/* Queries which start or end part way through a range. */
+	check_query(peer, 150, 10);
+	check_query(peer, 5000, 3000);
+	check_query(peer, 0, 101);
+	check_query(peer, 10099, 1);
+	check_query(peer, 5000, UINT_MAX - 5000);
+
+#if DEVELOPER
+	/* Smaller replies mean splitting what we have. */
+	max_encoding_bytes = 1000;
+	assert(check_query(peer, 0, UINT_MAX) > n);
+	check_query(peer, 5000, 3000);
+	max_encoding_bytes = -1U;
+#endif
+
+	/* Adding and removing channels gets noticed. */
+	add_channels(daemon->rstate, nodes, 5000, 100, 1000);
+	add_channels(daemon->rstate, nodes, 10100, 10000, 10000);
+	for (size_t i = 0; i < 1000; i++) {
+		if (!mk_short_channel_id(&scid, 100 + pseudorand(10000),
+					 pseudorand(1 << 24),
+					 pseudorand(1 << 16)))
+			abort();
+		if (uintmap_after(&daemon->rstate->chanmap, &scid.u64))
+			free_chan(daemon->rstate,
+				  get_channel(daemon->rstate, &scid));
+	}
+	check_query(peer, 0, UINT_MAX);
+	check_query(peer, 5000, 100);
+	check_query(peer, 2000, 17000);
+
+	/* And if they all go, there's nothing to send. */
+	while (uintmap_first(&daemon->rstate->chanmap, &scid.u64))
+		free_chan(daemon->rstate, get_channel(daemon->rstate, &scid));
+	assert(check_query(peer, 0, UINT_MAX) == 1);
+	check_query(peer, 100, 10000);
+
+	tal_free(daemon);
+	unlink(GOSSIP_STORE_FILENAME);
+	rmdir(dir);
+	tal_free(dir);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
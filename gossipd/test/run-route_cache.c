@@ -0,0 +1,427 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+#include <stdio.h>
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+#define NUM_NODES 10
+
+static struct node_id ids[NUM_NODES];
+
+static void node_id_from_privkey(const struct privkey *p, struct node_id *id)
+{
+	struct pubkey k;
+	pubkey_from_privkey(p, &k);
+	node_id_from_pubkey(id, &k);
+}
+
+static struct chan *add_connection(struct routing_state *rstate,
+				   const struct node_id *from,
+				   const struct node_id *to,
+				   u32 base_fee)
+{
+	struct short_channel_id scid;
+	struct chan *chan;
+
+	/* Make a unique scid. */
+	memcpy(&scid, from, sizeof(scid) / 2);
+	memcpy((char *)&scid + sizeof(scid) / 2, to, sizeof(scid) / 2);
+
+	chan = new_chan(rstate, &scid, from, to, AMOUNT_SAT(100000));
+	for (size_t i = 0; i < 2; i++) {
+		struct half_chan *c = &chan->half[i];
+		/* Make sure it's seen as initialized (index non-zero). */
+		c->bcast.index = 1;
+		c->base_fee = base_fee;
+		c->proportional_fee = 10;
+		c->delay = 6;
+		c->channel_flags = i;
+		c->htlc_minimum = AMOUNT_MSAT(0);
+		c->htlc_maximum = AMOUNT_MSAT(100000 * 1000);
+	}
+	update_route_graph(rstate, chan);
+	return chan;
+}
+
+/* From us (node 0) to the far end of the line. */
+static struct route_query *query(struct routing_state *rstate,
+				 struct amount_msat msat,
+				 const struct short_channel_id_dir *excluded)
+{
+	struct route_query *rq;
+
+	/* gossipd merges new channels into the graph in the background. */
+	route_graph_catch_up(rstate);
+	rq = new_route_query(tmpctx, rstate, NULL, &ids[NUM_NODES-1],
+			     msat, 1.0, 9, 0.0, 0, excluded,
+			     ROUTING_MAX_HOPS, 1);
+	route_query_run(rq);
+	return rq;
+}
+
+static bool was_cached(const struct route_query *rq)
+{
+	return rq->num_routes && !rq->graph;
+}
+
+static bool hops_eq(const struct route_hop *a, const struct route_hop *b)
+{
+	if (tal_count(a) != tal_count(b))
+		return false;
+	for (size_t i = 0; i < tal_count(a); i++) {
+		if (!short_channel_id_eq(&a[i].channel_id, &b[i].channel_id)
+		    || a[i].direction != b[i].direction
+		    || !node_id_eq(&a[i].nodeid, &b[i].nodeid)
+		    || !amount_msat_eq(a[i].amount, b[i].amount)
+		    || a[i].delay != b[i].delay)
+			return false;
+	}
+	return true;
+}
+
+/* What we'd find without the cache. */
+static struct route_hop *uncached_hops(struct routing_state *rstate,
+				       struct amount_msat msat)
+{
+	struct route_cache *cache = rstate->route_cache;
+	struct route_query *rq;
+
+	rstate->route_cache = NULL;
+	rq = query(rstate, msat, NULL);
+	rstate->route_cache = cache;
+	return route_query_hops(tmpctx, rq, 0);
+}
+
+static void check_stats(struct routing_state *rstate,
+			u64 hits, u64 misses, u64 invalidated, u32 entries)
+{
+	struct route_cache_stats stats;
+
+	routing_route_cache_stats(rstate, &stats);
+	assert(stats.hits == hits);
+	assert(stats.misses == misses);
+	assert(stats.invalidated == invalidated);
+	assert(stats.entries == entries);
+}
+
+static bool always_valid(const struct route_cache_entry *entry UNUSED,
+			 void *unused UNUSED)
+{
+	return true;
+}
+
+static struct route_cache_key *test_key(const tal_t *ctx, u32 max_hops)
+{
+	struct route_cache_key *key = talz(ctx, struct route_cache_key);
+
+	key->from_me = true;
+	key->destination = ids[1];
+	key->max_hops = max_hops;
+	key->max_routes = 1;
+	key->excluded = tal_arr(key, struct short_channel_id_dir, 0);
+	return key;
+}
+
+/* A channel_update for one direction of chan, as if from the store. */
+static void update(struct routing_state *rstate, struct chan *chan,
+		   int direction, u32 timestamp, u32 base_fee, bool disabled)
+{
+	secp256k1_ecdsa_signature sig;
+	struct bitcoin_blkid chain_hash;
+	u8 *msg;
+
+	memset(&sig, 0, sizeof(sig));
+	memset(&chain_hash, 0, sizeof(chain_hash));
+	msg = towire_channel_update(tmpctx, &sig, &chain_hash, &chan->scid,
+				    timestamp, 0,
+				    direction
+				    | (disabled ? ROUTING_FLAGS_DISABLED : 0),
+				    6, AMOUNT_MSAT(0), base_fee, 10);
+	assert(routing_add_channel_update(rstate, msg, 1));
+}
+
+/* The cache itself: least recently used goes first, and things expire. */
+static void test_lru(void)
+{
+	struct route_cache *cache = new_route_cache(tmpctx, 2, 10);
+	struct route_cache_key *a = test_key(tmpctx, 1),
+		*b = test_key(tmpctx, 2), *c = test_key(tmpctx, 3);
+	size_t *lens = tal_arrz(tmpctx, size_t, 1);
+	struct short_channel_id_dir *path
+		= tal_arr(tmpctx, struct short_channel_id_dir, 0);
+	struct route_cache_stats stats;
+
+	route_cache_add(cache, a, 1, 100, lens, path);
+	route_cache_add(cache, b, 1, 100, lens, path);
+	assert(route_cache_get(cache, a, 100, always_valid, NULL));
+	/* b is now the least recently used. */
+	route_cache_add(cache, c, 1, 100, lens, path);
+	assert(!route_cache_get(cache, b, 100, always_valid, NULL));
+	assert(route_cache_get(cache, c, 100, always_valid, NULL));
+	assert(route_cache_get(cache, a, 110, always_valid, NULL));
+	assert(!route_cache_get(cache, a, 111, always_valid, NULL));
+
+	route_cache_get_stats(cache, &stats);
+	assert(stats.hits == 3);
+	assert(stats.misses == 2);
+	assert(stats.invalidated == 0);
+	assert(stats.entries == 1);
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct privkey tmp;
+	struct route_query *rq;
+	struct chan *chans[NUM_NODES];
+	struct short_channel_id_dir *excluded;
+	struct route_hop *hops;
+	struct amount_msat msat = AMOUNT_MSAT(1000000);
+	struct chan *chan;
+	struct half_chan old, new;
+	int dir;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	/* Amounts within a quarter of each other share a bucket. */
+	assert(route_cache_amount_bucket(AMOUNT_MSAT(1024))
+	       == route_cache_amount_bucket(AMOUNT_MSAT(1279)));
+	assert(route_cache_amount_bucket(AMOUNT_MSAT(1279))
+	       != route_cache_amount_bucket(AMOUNT_MSAT(1280)));
+	assert(route_cache_amount_bucket(AMOUNT_MSAT(5))
+	       != route_cache_amount_bucket(AMOUNT_MSAT(6)));
+	assert(route_cache_amount_bucket(AMOUNT_MSAT(7))
+	       != route_cache_amount_bucket(AMOUNT_MSAT(8)));
+
+	/* A line of nodes: 0 <-> 1 <-> ... <-> NUM_NODES-1 */
+	for (size_t i = 0; i < NUM_NODES; i++) {
+		memset(&tmp, 'a' + i, sizeof(tmp));
+		node_id_from_privkey(&tmp, &ids[i]);
+	}
+	test_lru();
+
+	rstate = new_routing_state(tmpctx, NULL, &ids[0], 0, NULL, NULL);
+	rstate->chainparams = chainparams_for_network("regtest");
+	for (size_t i = 0; i < NUM_NODES; i++)
+		new_node(rstate, &ids[i]);
+	for (size_t i = 1; i < NUM_NODES; i++)
+		chans[i] = add_connection(rstate, &ids[i-1], &ids[i], 1000);
+
+	/* Off by default. */
+	rq = query(rstate, msat, NULL);
+	route_query_cache(rq);
+	check_stats(rstate, 0, 0, 0, 0);
+
+	rstate->route_cache = new_route_cache(rstate, 100, 1000000);
+
+	/* First time we have to search. */
+	rq = query(rstate, msat, NULL);
+	assert(!was_cached(rq));
+	assert(route_query_num_routes(rq) == 1);
+	route_query_cache(rq);
+	check_stats(rstate, 0, 1, 0, 1);
+
+	/* Then we don't, even for a slightly different amount: but we get
+	 * exactly the same answer. */
+	rq = query(rstate, msat, NULL);
+	assert(was_cached(rq));
+	assert(route_query_settled(rq) == 0);
+	assert(hops_eq(route_query_hops(tmpctx, rq, 0),
+		       uncached_hops(rstate, msat)));
+	rq = query(rstate, AMOUNT_MSAT(1040000), NULL);
+	assert(was_cached(rq));
+	assert(hops_eq(route_query_hops(tmpctx, rq, 0),
+		       uncached_hops(rstate, AMOUNT_MSAT(1040000))));
+	check_stats(rstate, 2, 1, 0, 1);
+
+	/* But an amount in another bucket is a different question. */
+	rq = query(rstate, AMOUNT_MSAT(2000000), NULL);
+	assert(!was_cached(rq));
+	check_stats(rstate, 2, 2, 0, 1);
+
+	/* The order of excluded channels doesn't matter. */
+	excluded = tal_arr(tmpctx, struct short_channel_id_dir, 2);
+	excluded[0].scid = excluded[1].scid = chans[1]->scid;
+	excluded[0].dir = 1;
+	excluded[1].dir = 0;
+	/* Excluding both directions of the first channel: no route! */
+	rq = query(rstate, msat, excluded);
+	assert(route_query_num_routes(rq) == 0);
+	route_query_cache(rq);
+	/* ... and we don't cache failures. */
+	check_stats(rstate, 2, 3, 0, 1);
+
+	/* Excluding the directions we don't use doesn't stop us. */
+	hops = uncached_hops(rstate, msat);
+	excluded[0].scid = hops[1].channel_id;
+	excluded[0].dir = !hops[1].direction;
+	excluded[1].scid = hops[0].channel_id;
+	excluded[1].dir = !hops[0].direction;
+	rq = query(rstate, msat, excluded);
+	assert(route_query_num_routes(rq) == 1);
+	route_query_cache(rq);
+	check_stats(rstate, 2, 4, 0, 2);
+	excluded[0].scid = hops[0].channel_id;
+	excluded[0].dir = !hops[0].direction;
+	excluded[1].scid = hops[1].channel_id;
+	excluded[1].dir = !hops[1].direction;
+	rq = query(rstate, msat, excluded);
+	assert(was_cached(rq));
+	check_stats(rstate, 3, 4, 0, 2);
+
+	/* A channel_update (or a routing failure) for a channel on the
+	 * route means we search again. */
+	chan_changed(rstate, chans[5]);
+	rq = query(rstate, msat, NULL);
+	assert(!was_cached(rq));
+	check_stats(rstate, 3, 5, 1, 1);
+	route_query_cache(rq);
+	check_stats(rstate, 3, 5, 1, 2);
+
+	/* If it changes while we're searching, we don't cache that. */
+	rq = query(rstate, AMOUNT_MSAT(2000000), NULL);
+	assert(!was_cached(rq));
+	chan_changed(rstate, chans[3]);
+	route_query_cache(rq);
+	check_stats(rstate, 3, 6, 1, 2);
+
+	/* Disabling a channel locally means we won't use it... */
+	rq = query(rstate, msat, NULL);
+	route_query_cache(rq);
+	check_stats(rstate, 3, 7, 2, 2);
+	local_disable_chan(rstate, chans[NUM_NODES-1]);
+	rq = query(rstate, msat, NULL);
+	assert(route_query_num_routes(rq) == 0);
+	check_stats(rstate, 3, 8, 3, 1);
+
+	/* ... and enabling it could give a better route to anywhere. */
+	local_enable_chan(rstate, chans[NUM_NODES-1]);
+	rq = query(rstate, msat, NULL);
+	assert(route_query_num_routes(rq) == 1);
+	route_query_cache(rq);
+	rq = query(rstate, msat, NULL);
+	assert(was_cached(rq));
+	check_stats(rstate, 4, 9, 3, 2);
+
+	/* So could a new channel: this one is a shortcut. */
+	add_connection(rstate, &ids[0], &ids[NUM_NODES-1], 1);
+	rq = query(rstate, msat, NULL);
+	assert(!was_cached(rq));
+	assert(tal_count(route_query_hops(tmpctx, rq, 0)) == 1);
+	check_stats(rstate, 4, 10, 4, 1);
+
+	/* Removing a channel on the route means we don't find it. */
+	route_query_cache(rq);
+	free_chan(rstate, get_channel(rstate,
+				      &route_query_hops(tmpctx, rq, 0)[0].channel_id));
+	rq = query(rstate, msat, NULL);
+	assert(!was_cached(rq));
+	assert(tal_count(route_query_hops(tmpctx, rq, 0)) == NUM_NODES - 1);
+	check_stats(rstate, 4, 11, 5, 1);
+
+	/* A shortcut we haven't had a channel_update for yet can't be used. */
+	route_query_cache(rq);
+	chan = add_connection(rstate, &ids[0], &ids[NUM_NODES-1], 1);
+	chan->half[0].bcast.index = chan->half[1].bcast.index = 0;
+	update_route_graph(rstate, chan);
+	rq = query(rstate, msat, NULL);
+	assert(tal_count(route_query_hops(tmpctx, rq, 0)) == NUM_NODES - 1);
+	route_query_cache(rq);
+	rq = query(rstate, msat, NULL);
+	assert(was_cached(rq));
+	check_stats(rstate, 5, 12, 6, 2);
+
+	/* Once it's enabled (by the other end), any route might be worse. */
+	dir = node_id_eq(&chan->nodes[0]->id, &ids[0]) ? 0 : 1;
+	update(rstate, chan, dir, 100, 1, false);
+	rq = query(rstate, msat, NULL);
+	assert(!was_cached(rq));
+	assert(tal_count(route_query_hops(tmpctx, rq, 0)) == 1);
+	check_stats(rstate, 5, 13, 7, 1);
+
+	/* Which is what becoming cheaper (or enabled again) means, too;
+	 * anything else only matters to routes through it. */
+	old = new = chan->half[dir];
+	assert(!halfchan_improved(&old, &new));
+	new.base_fee++;
+	assert(!halfchan_improved(&old, &new));
+	new.proportional_fee--;
+	assert(halfchan_improved(&old, &new));
+	new = old;
+	new.delay--;
+	assert(halfchan_improved(&old, &new));
+	new = old;
+	new.htlc_maximum.millisatoshis++; /* Raw: test */
+	assert(halfchan_improved(&old, &new));
+	new = old;
+	new.channel_flags |= ROUTING_FLAGS_DISABLED;
+	assert(!halfchan_improved(&old, &new));
+	assert(halfchan_improved(&new, &old));
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
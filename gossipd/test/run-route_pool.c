@@ -0,0 +1,409 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+#include "../route_pool.c"
+#include <ccan/io/io.h>
+#include <stdio.h>
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+#define NUM_NODES 20
+#define NUM_QUERIES 50
+
+static struct node_id ids[NUM_NODES];
+
+/* Refreshes running in the background. */
+static size_t background;
+
+struct answers {
+	struct route_query *queries[NUM_QUERIES];
+	/* Are answers coming from io_loop? */
+	bool threaded;
+	size_t num;
+	/* Which query each answer was for, and how long its route was. */
+	size_t order[NUM_QUERIES];
+	size_t hops[NUM_QUERIES];
+};
+
+static void node_id_from_privkey(const struct privkey *p, struct node_id *id)
+{
+	struct pubkey k;
+	pubkey_from_privkey(p, &k);
+	node_id_from_pubkey(id, &k);
+}
+
+static struct chan *add_connection(struct routing_state *rstate,
+				   const struct node_id *from,
+				   const struct node_id *to)
+{
+	struct short_channel_id scid;
+	struct chan *chan;
+
+	/* Make a unique scid. */
+	memcpy(&scid, from, sizeof(scid) / 2);
+	memcpy((char *)&scid + sizeof(scid) / 2, to, sizeof(scid) / 2);
+
+	chan = new_chan(rstate, &scid, from, to, AMOUNT_SAT(100000));
+	for (size_t i = 0; i < 2; i++) {
+		struct half_chan *c = &chan->half[i];
+		/* Make sure it's seen as initialized (index non-zero). */
+		c->bcast.index = 1;
+		c->base_fee = 1;
+		c->proportional_fee = 1;
+		c->delay = 1;
+		c->channel_flags = i;
+		c->htlc_minimum = AMOUNT_MSAT(0);
+		c->htlc_maximum = AMOUNT_MSAT(100000 * 1000);
+	}
+	update_route_graph(rstate, chan);
+	return chan;
+}
+
+/* Query i asks for a route from node 0 to node i % NUM_NODES: node 0 has no
+ * route to itself, otherwise it's i % NUM_NODES hops down the line. */
+static size_t expected_hops(size_t i)
+{
+	return i % NUM_NODES;
+}
+
+static struct route_query *make_query(struct routing_state *rstate, size_t i)
+{
+	return new_route_query(tmpctx, rstate, &ids[0], &ids[i % NUM_NODES],
+			       AMOUNT_MSAT(1000), 1.0, 9, 0.0, i, NULL,
+			       ROUTING_MAX_HOPS, 1);
+}
+
+static void answered(struct route_query *rq, struct answers *answers)
+{
+	struct route_hop *hops = route_query_hops(tmpctx, rq, 0);
+	size_t i;
+
+	for (i = 0; answers->queries[i] != rq; i++)
+		assert(i < NUM_QUERIES);
+
+	answers->order[answers->num] = i;
+	answers->hops[answers->num] = tal_count(hops);
+	answers->num++;
+	/* Its address may be reused by a later query. */
+	answers->queries[i] = NULL;
+	tal_free(rq);
+
+	if (answers->num == NUM_QUERIES && answers->threaded)
+		io_break(answers);
+}
+
+static void landmarks_done(struct landmarks_refresh *refresh)
+{
+	landmarks_refresh_done(refresh);
+	background--;
+	io_break(&background);
+}
+
+static void graph_done(struct graph_refresh *refresh)
+{
+	graph_refresh_done(refresh);
+	background--;
+	io_break(&background);
+}
+
+static void start_graph_refresh(struct routing_state *rstate,
+				struct route_pool *pool)
+{
+	struct graph_refresh *refresh = routing_graph_refresh(rstate);
+
+	assert(refresh);
+	/* Only one at a time. */
+	assert(!routing_graph_refresh(rstate));
+	background++;
+	route_pool_background(pool, graph_refresh_run, graph_done, refresh);
+}
+
+/* Compute landmarks in the background: they're used if the graph isn't
+ * replaced meanwhile. */
+static void refresh_landmarks(struct routing_state *rstate,
+			      struct route_pool *pool,
+			      bool change_network)
+{
+	struct landmarks_refresh *refresh = routing_landmarks_refresh(rstate);
+
+	assert(refresh);
+	/* Only one at a time. */
+	assert(!routing_landmarks_refresh(rstate));
+	background++;
+	route_pool_background(pool, landmarks_refresh_run, landmarks_done,
+			      refresh);
+	/* It keeps the graph it's working on. */
+	if (change_network) {
+		add_connection(rstate, &ids[1], &ids[NUM_NODES-1]);
+		start_graph_refresh(rstate, pool);
+	}
+	while (background)
+		io_loop(NULL, NULL);
+}
+
+/* Same nodes, and the same edges into each (in any order)? */
+static bool graphs_match(const struct route_graph *a,
+			 const struct route_graph *b)
+{
+	if (route_graph_num_nodes(a) != route_graph_num_nodes(b)
+	    || tal_count(a->edges) != tal_count(b->edges))
+		return false;
+
+	for (size_t n = 0; n < route_graph_num_nodes(a); n++) {
+		if (!node_id_eq(&a->ids[n], &b->ids[n])
+		    || a->edge_start[n] != b->edge_start[n])
+			return false;
+		for (u32 i = a->edge_start[n]; i < a->edge_start[n+1]; i++) {
+			const struct route_graph_edge *ea = &a->edges[i], *eb;
+			u32 j;
+
+			for (j = b->edge_start[n]; j < b->edge_start[n+1]; j++) {
+				eb = &b->edges[j];
+				if (short_channel_id_eq(&ea->scid, &eb->scid)
+				    && ea->direction == eb->direction)
+					break;
+			}
+			if (j == b->edge_start[n+1])
+				return false;
+			if (ea->src != eb->src
+			    || ea->base_fee != eb->base_fee
+			    || ea->proportional_fee != eb->proportional_fee
+			    || ea->delay != eb->delay
+			    || ea->routable != eb->routable
+			    || !amount_msat_eq(ea->htlc_minimum, eb->htlc_minimum)
+			    || !amount_msat_eq(ea->htlc_maximum, eb->htlc_maximum))
+				return false;
+		}
+	}
+	return true;
+}
+
+static void run_queries(struct routing_state *rstate, size_t num_threads)
+{
+	struct answers answers;
+	struct route_pool *pool;
+	struct route_pool_stats stats;
+
+	answers.num = 0;
+	answers.threaded = (num_threads != 0);
+	pool = new_route_pool(tmpctx, num_threads);
+	for (size_t i = 0; i < NUM_QUERIES; i++) {
+		answers.queries[i] = make_query(rstate, i);
+		route_pool_add(pool, answers.queries[i], answered, &answers);
+	}
+
+	/* Without threads, they're all answered already. */
+	if (num_threads)
+		io_loop(NULL, NULL);
+
+	assert(answers.num == NUM_QUERIES);
+	for (size_t i = 0; i < NUM_QUERIES; i++) {
+		assert(answers.order[i] == i);
+		assert(answers.hops[i] == expected_hops(i));
+	}
+
+	route_pool_get_stats(pool, &stats);
+	assert(stats.threads == num_threads);
+	assert(stats.answered == NUM_QUERIES);
+	assert(stats.queued == 0);
+	assert(stats.running == 0);
+	assert(stats.max_queued <= NUM_QUERIES);
+	tal_free(pool);
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct privkey tmp;
+	struct route_query *rq, *rq2;
+	struct route_graph *graph;
+	struct route_pool *pool;
+	struct chan *chan, *shortcut;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	/* A line of nodes: 0 <-> 1 <-> ... <-> NUM_NODES-1 */
+	for (size_t i = 0; i < NUM_NODES; i++) {
+		memset(&tmp, 'a' + i, sizeof(tmp));
+		node_id_from_privkey(&tmp, &ids[i]);
+	}
+	rstate = new_routing_state(tmpctx, NULL, &ids[0], 0, NULL, NULL);
+	for (size_t i = 0; i < NUM_NODES; i++)
+		new_node(rstate, &ids[i]);
+
+	chan = NULL;
+	for (size_t i = 1; i < NUM_NODES; i++)
+		chan = add_connection(rstate, &ids[i-1], &ids[i]);
+
+	/* Synchronous, then with various numbers of threads. */
+	run_queries(rstate, 0);
+	run_queries(rstate, 1);
+	run_queries(rstate, 4);
+
+	/* A query in flight keeps its snapshot as it was: changes wait for
+	 * the last query using it to finish. */
+	rq = make_query(rstate, NUM_NODES - 1);
+	graph = rstate->graph;
+	assert(graph->readers == 1);
+	local_enable_chan(rstate, chan);
+	local_disable_chan(rstate, chan);
+	assert(rstate->graph == graph);
+	assert(rstate->graph_changes);
+	tal_free(rq);
+	assert(rstate->graph == graph);
+	assert(!rstate->graph_changes);
+
+	/* Or for a copy, made in the background, if queries keep coming. */
+	pool = new_route_pool(tmpctx, 2);
+	rq = make_query(rstate, NUM_NODES - 1);
+	local_enable_chan(rstate, chan);
+	rq2 = make_query(rstate, NUM_NODES - 1);
+	start_graph_refresh(rstate, pool);
+	while (background)
+		io_loop(NULL, NULL);
+	assert(rstate->graph != graph);
+	assert(graph->readers == 2);
+	assert(graphs_match(rstate->graph, route_graph_new(tmpctx, rstate)));
+
+	route_query_run(rq);
+	assert(route_query_hops(tmpctx, rq, 0) == NULL);
+	route_query_run(rq2);
+	assert(route_query_hops(tmpctx, rq2, 0) == NULL);
+	tal_free(rq);
+	tal_free(rq2);
+
+	/* New queries see the change. */
+	rq = make_query(rstate, NUM_NODES - 1);
+	route_query_run(rq);
+	assert(tal_count(route_query_hops(tmpctx, rq, 0)) == NUM_NODES - 1);
+	tal_free(rq);
+	local_disable_chan(rstate, chan);
+
+	/* A new channel is merged into a new graph in the background:
+	 * meanwhile, queries use the old one. */
+	graph = rstate->graph;
+	shortcut = add_connection(rstate, &ids[0], &ids[NUM_NODES-1]);
+	assert(rstate->graph == graph);
+	rq = make_query(rstate, NUM_NODES - 1);
+	start_graph_refresh(rstate, pool);
+	while (background)
+		io_loop(NULL, NULL);
+	assert(rstate->graph != graph);
+	assert(graphs_match(rstate->graph, route_graph_new(tmpctx, rstate)));
+
+	route_query_run(rq);
+	assert(route_query_hops(tmpctx, rq, 0) == NULL);
+	tal_free(rq);
+
+	rq = make_query(rstate, NUM_NODES - 1);
+	route_query_run(rq);
+	assert(tal_count(route_query_hops(tmpctx, rq, 0)) == 1);
+	tal_free(rq);
+
+	/* So is one going: its nodes stay, as they have other channels. */
+	free_chan(rstate, shortcut);
+	start_graph_refresh(rstate, pool);
+	while (background)
+		io_loop(NULL, NULL);
+	assert(graphs_match(rstate->graph, route_graph_new(tmpctx, rstate)));
+	assert(route_graph_num_nodes(rstate->graph) == NUM_NODES);
+	shortcut = add_connection(rstate, &ids[0], &ids[NUM_NODES-1]);
+
+	/* Landmarks which are out of date by the time they're done are
+	 * thrown away. */
+	rstate->num_landmarks = 2;
+	refresh_landmarks(rstate, pool, true);
+	assert(routing_landmarks_in_use(rstate) == 0);
+
+	/* (The shortcut was merged in along with that channel.) */
+	assert(!routing_graph_refresh(rstate));
+	refresh_landmarks(rstate, pool, false);
+	assert(routing_landmarks_in_use(rstate) == 2);
+	assert(!routing_landmarks_refresh(rstate));
+
+	/* Queries use them (and settle each node once at most). */
+	rq = make_query(rstate, NUM_NODES - 1);
+	assert(rq->landmarks == rstate->landmarks);
+	route_query_run(rq);
+	assert(tal_count(route_query_hops(tmpctx, rq, 0)) == 1);
+	assert(route_query_settled(rq) <= NUM_NODES);
+
+	/* Fees going up doesn't hurt them, but fees going down does. */
+	chan->half[0].base_fee++;
+	update_route_graph(rstate, chan);
+	assert(routing_landmarks_in_use(rstate) == 2);
+	chan->half[0].base_fee = 0;
+	update_route_graph(rstate, chan);
+	/* (Not until the query's done, and the graph is patched.) */
+	assert(routing_landmarks_in_use(rstate) == 2);
+	assert(rq->landmarks->readers == 1);
+	tal_free(rq);
+	assert(routing_landmarks_in_use(rstate) == 0);
+	assert(routing_landmarks_refresh(rstate));
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
@@ -0,0 +1,246 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include <stdio.h>
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+}
+
+/* We don't have a store: just count what would be deleted. */
+static size_t num_deleted;
+
+struct gossip_store *gossip_store_new(struct routing_state *rstate UNUSED,
+				      struct list_head *peers UNUSED)
+{
+	return NULL;
+}
+
+void gossip_store_delete(struct gossip_store *gs UNUSED,
+			 struct broadcastable *bcast,
+			 int type UNUSED)
+{
+	if (bcast->index)
+		num_deleted++;
+	bcast->index = 0;
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for gossip_store_add */
+u64 gossip_store_add(struct gossip_store *gs UNNEEDED, const u8 *gossip_msg UNNEEDED,
+		     u32 timestamp UNNEEDED, const u8 *addendum UNNEEDED)
+{ fprintf(stderr, "gossip_store_add called!\n"); abort(); }
+/* Generated stub for gossip_store_add_private_update */
+u64 gossip_store_add_private_update(struct gossip_store *gs UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_private_update called!\n"); abort(); }
+/* Generated stub for gossip_store_get */
+const u8 *gossip_store_get(const tal_t *ctx UNNEEDED,
+			   struct gossip_store *gs UNNEEDED,
+			   u64 offset UNNEEDED)
+{ fprintf(stderr, "gossip_store_get called!\n"); abort(); }
+/* Generated stub for gossip_store_get_private_update */
+const u8 *gossip_store_get_private_update(const tal_t *ctx UNNEEDED,
+					  struct gossip_store *gs UNNEEDED,
+					  u64 offset UNNEEDED)
+{ fprintf(stderr, "gossip_store_get_private_update called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+#define NUM_NODES 8
+
+static struct node_id ids[NUM_NODES];
+
+static void node_id_from_privkey(const struct privkey *p, struct node_id *id)
+{
+	struct pubkey k;
+	pubkey_from_privkey(p, &k);
+	node_id_from_pubkey(id, &k);
+}
+
+/* A public channel between ids[n] and ids[n+1], with updates at these
+ * times (0 meaning no update). */
+static struct chan *add_public(struct routing_state *rstate, size_t n,
+			       u32 block, u32 timestamp0, u32 timestamp1)
+{
+	struct short_channel_id scid;
+	struct chan *chan;
+	u32 timestamps[2] = { timestamp0, timestamp1 };
+
+	if (!mk_short_channel_id(&scid, block, 0, 0))
+		abort();
+	chan = new_chan(rstate, &scid, &ids[n], &ids[n+1],
+			AMOUNT_SAT(1000000));
+	for (size_t i = 0; i < 2; i++) {
+		if (!timestamps[i])
+			continue;
+		chan->half[i].bcast.index = 1;
+		chan->half[i].bcast.timestamp = timestamps[i];
+	}
+	/* As add_channel_announce_to_broadcast does. */
+	chan->bcast.timestamp = 1;
+	chan->bcast.index = 1;
+	file_for_pruning(rstate, chan);
+	return chan;
+}
+
+static bool has_chan(struct routing_state *rstate, u32 block)
+{
+	struct short_channel_id scid;
+
+	if (!mk_short_channel_id(&scid, block, 0, 0))
+		abort();
+	return get_channel(rstate, &scid) != NULL;
+}
+
+/* Every public channel is in exactly one bucket. */
+static size_t num_filed(struct routing_state *rstate)
+{
+	struct list_head *bucket;
+	struct chan *chan;
+	size_t n = 0;
+	u64 idx;
+
+	for (bucket = uintmap_first(&rstate->prune_buckets, &idx);
+	     bucket;
+	     bucket = uintmap_after(&rstate->prune_buckets, &idx)) {
+		list_for_each(bucket, chan, prune_list) {
+			assert(is_chan_public(chan));
+			assert(prune_bucket(rstate, newest_update(chan)) >= idx);
+			n++;
+		}
+	}
+	return n;
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct privkey tmp;
+	struct short_channel_id scid;
+	struct chan *chan;
+	struct route_graph *graph, *fresh;
+	u32 prune_timeout = 1209600, now, highwater, node_idx;
+	u64 idx, topology_generation;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	for (size_t i = 0; i < NUM_NODES; i++) {
+		memset(&tmp, 'a' + i, sizeof(tmp));
+		node_id_from_privkey(&tmp, &ids[i]);
+	}
+
+	rstate = new_routing_state(tmpctx, NULL, &ids[0], prune_timeout,
+				   NULL, NULL);
+	now = time_now().ts.tv_sec;
+	highwater = now - prune_timeout;
+
+	/* Both sides old: goes. */
+	add_public(rstate, 1, 100, highwater - 86400, highwater - 100);
+	/* One side recent: stays. */
+	add_public(rstate, 2, 101, highwater - 86400, now - 86400);
+	/* Neither side ever updated: goes. */
+	add_public(rstate, 3, 102, 0, 0);
+	/* Either side of highwater, probably in the same bucket. */
+	add_public(rstate, 4, 103, highwater - 100, 0);
+	add_public(rstate, 5, 104, 0, highwater + 100);
+	/* From the future: stays. */
+	add_public(rstate, 6, 105, now + 86400, now + 86400);
+
+	/* Filed when old, but updated since: stays (and gets refiled). */
+	chan = add_public(rstate, 1, 106, highwater - 86400, 0);
+	chan->half[0].bcast.timestamp = now;
+
+	/* Old, but never announced: stays. */
+	if (!mk_short_channel_id(&scid, 107, 0, 0))
+		abort();
+	chan = new_chan(rstate, &scid, &ids[0], &ids[1], AMOUNT_SAT(1000000));
+	chan->half[0].bcast.index = 1;
+	chan->half[0].bcast.timestamp = highwater - 86400;
+
+	assert(num_filed(rstate) == 7);
+	graph = current_route_graph(rstate);
+	assert(route_graph_node_idx(graph, &ids[4], &node_idx));
+	route_prune(rstate);
+
+	assert(!has_chan(rstate, 100));
+	assert(has_chan(rstate, 101));
+	assert(!has_chan(rstate, 102));
+	assert(!has_chan(rstate, 103));
+	assert(has_chan(rstate, 104));
+	assert(has_chan(rstate, 105));
+	assert(has_chan(rstate, 106));
+	assert(has_chan(rstate, 107));
+	/* The channel_announcements and any channel_updates. */
+	assert(num_deleted == 3 + 1 + 2);
+	assert(num_filed(rstate) == 4);
+
+	/* Node 4 only had pruned channels. */
+	assert(!get_node(rstate, &ids[4]));
+	assert(get_node(rstate, &ids[5]));
+
+	/* Which the graph catches up with. */
+	assert(rstate->graph == graph);
+	route_graph_catch_up(rstate);
+	assert(rstate->graph != graph);
+	assert(!route_graph_node_idx(rstate->graph, &ids[4], &node_idx));
+	fresh = route_graph_new(tmpctx, rstate);
+	assert(route_graph_num_nodes(rstate->graph)
+	       == route_graph_num_nodes(fresh));
+	assert(tal_count(rstate->graph->edges) == tal_count(fresh->edges));
+
+	/* Nothing else is due. */
+	route_prune(rstate);
+	assert(num_deleted == 6);
+	assert(num_filed(rstate) == 4);
+
+	/* Removing the rest empties the buckets too, and forgets the
+	 * graph, and any routes we found over it. */
+	assert(current_route_graph(rstate));
+	topology_generation = rstate->topology_generation;
+	remove_all_gossip(rstate);
+	assert(num_filed(rstate) == 0);
+	assert(!uintmap_first(&rstate->prune_buckets, &idx));
+	assert(!rstate->graph);
+	assert(rstate->topology_generation > topology_generation);
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
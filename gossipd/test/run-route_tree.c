@@ -0,0 +1,236 @@
+#include "../route_cache.c"
+#include "../route_graph.c"
+#include "../routing.c"
+#include "../gossip_store.c"
+#include <stdio.h>
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+
+#define NUM_NODES 30
+
+static struct node_id ids[NUM_NODES];
+
+static void node_id_from_privkey(const struct privkey *p, struct node_id *id)
+{
+	struct pubkey k;
+	pubkey_from_privkey(p, &k);
+	node_id_from_pubkey(id, &k);
+}
+
+static void add_connection(struct routing_state *rstate,
+			   size_t from, size_t to,
+			   u32 base_fee, u32 proportional_fee)
+{
+	struct short_channel_id scid;
+	struct chan *chan;
+
+	if (!mk_short_channel_id(&scid, from + 1, to + 1, 0))
+		abort();
+	chan = get_channel(rstate, &scid);
+	if (!chan)
+		chan = new_chan(rstate, &scid, &ids[from], &ids[to],
+				AMOUNT_SAT(1000000));
+
+	for (size_t i = 0; i < 2; i++) {
+		struct half_chan *c = &chan->half[i];
+		c->bcast.index = 1;
+		c->base_fee = base_fee;
+		c->proportional_fee = proportional_fee;
+		c->delay = 1 + i;
+		c->channel_flags = i;
+		c->htlc_minimum = AMOUNT_MSAT(0);
+		c->htlc_maximum = AMOUNT_MSAT(1000000 * 1000);
+	}
+	update_route_graph(rstate, chan);
+}
+
+static const struct route_cost *find_cost(const struct route_cost *costs,
+					  const struct node_id *id)
+{
+	for (size_t i = 0; i < tal_count(costs); i++)
+		if (node_id_eq(&costs[i].destination, id))
+			return &costs[i];
+	return NULL;
+}
+
+/* Compare every node's cost against what getroute would find. */
+static void check_tree(struct routing_state *rstate, struct amount_msat msat,
+		       bool exact)
+{
+	struct route_query *rq;
+	struct route_cost *costs;
+
+	rq = new_route_tree_query(tmpctx, rstate, msat, 0.0, 9, NULL,
+				  ROUTING_MAX_HOPS);
+	route_query_run(rq);
+	costs = route_query_costs(tmpctx, rq);
+
+	for (size_t i = 1; i < NUM_NODES; i++) {
+		const struct route_cost *cost = find_cost(costs, &ids[i]);
+		struct route_hop *hops;
+		struct amount_msat fee;
+
+		rq = new_route_query(tmpctx, rstate, NULL, &ids[i], msat,
+				     0.0, 9, 0.0, 0, NULL, ROUTING_MAX_HOPS, 1);
+		route_query_run(rq);
+		hops = route_query_hops(tmpctx, rq, 0);
+
+		if (!hops) {
+			assert(!cost);
+			continue;
+		}
+		assert(cost);
+		assert(amount_msat_sub(&fee, hops[0].amount, msat));
+		if (exact)
+			assert(amount_msat_eq(cost->fee, fee));
+		else
+			/* Never cheaper than the best route; not much dearer. */
+			assert(amount_msat_greater_eq(cost->fee, fee)
+			       && cost->fee.millisatoshis /* Raw: test */
+			       <= fee.millisatoshis * 11 / 10 + 1); /* Raw: test */
+		assert(cost->hops >= 1 && cost->hops <= ROUTING_MAX_HOPS);
+		assert(cost->delay >= 9 + cost->hops - 1);
+	}
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct privkey tmp;
+	struct route_query *rq;
+	struct route_cost *costs;
+	struct node_id *dsts;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+	srandom(1);
+
+	for (size_t i = 0; i < NUM_NODES; i++) {
+		memset(&tmp, 'a' + i, sizeof(tmp));
+		node_id_from_privkey(&tmp, &ids[i]);
+	}
+	rstate = new_routing_state(tmpctx, NULL, &ids[0], 0, NULL, NULL);
+	for (size_t i = 0; i < NUM_NODES; i++)
+		new_node(rstate, &ids[i]);
+
+	/* The last node is unreachable. */
+	for (size_t i = 0; i < NUM_NODES * 3; i++) {
+		size_t from = random() % (NUM_NODES - 1);
+		size_t to = random() % (NUM_NODES - 1);
+		if (from == to)
+			continue;
+		add_connection(rstate, from, to, random() % 1000, 0);
+	}
+
+	/* Without proportional fees, the fees are exactly getroute's. */
+	check_tree(rstate, AMOUNT_MSAT(100000), true);
+
+	/* With them, the forward search only estimates what it'll pay. */
+	for (size_t i = 0; i < NUM_NODES * 3; i++) {
+		size_t from = random() % (NUM_NODES - 1);
+		size_t to = random() % (NUM_NODES - 1);
+		if (from == to)
+			continue;
+		add_connection(rstate, from, to, random() % 1000,
+			       random() % 1000);
+	}
+	check_tree(rstate, AMOUNT_MSAT(100000), false);
+
+	/* Only the ones we ask about (and can reach) come back. */
+	dsts = tal_arr(tmpctx, struct node_id, 3);
+	dsts[0] = ids[1];
+	dsts[1] = ids[NUM_NODES - 1];
+	dsts[2] = ids[2];
+	rq = new_route_tree_query(tmpctx, rstate, AMOUNT_MSAT(100000), 0.0, 9,
+				  dsts, ROUTING_MAX_HOPS);
+	route_query_run(rq);
+	costs = route_query_costs(tmpctx, rq);
+	assert(tal_count(costs) <= 2);
+	for (size_t i = 0; i < tal_count(costs); i++)
+		assert(!node_id_eq(&costs[i].destination, &ids[NUM_NODES - 1]));
+
+	/* A line: max_hops cuts it off. */
+	rstate = new_routing_state(tmpctx, NULL, &ids[0], 0, NULL, NULL);
+	for (size_t i = 0; i < NUM_NODES; i++)
+		new_node(rstate, &ids[i]);
+	for (size_t i = 1; i < NUM_NODES; i++)
+		add_connection(rstate, i - 1, i, 1, 0);
+
+	rq = new_route_tree_query(tmpctx, rstate, AMOUNT_MSAT(1000), 0.0, 9,
+				  NULL, 5);
+	route_query_run(rq);
+	costs = route_query_costs(tmpctx, rq);
+	assert(tal_count(costs) == 5);
+	for (size_t i = 1; i <= 5; i++) {
+		const struct route_cost *cost = find_cost(costs, &ids[i]);
+		assert(cost);
+		assert(cost->hops == i);
+		/* We don't pay a fee for our own channel. */
+		assert(cost->fee.millisatoshis == i - 1); /* Raw: test */
+	}
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <lightningd/chaintopology.h>
+#include <lightningd/plugin_hook.h>
 
 /* Bitcoind's web server has a default of 4 threads, with queue depth 16.
  * It will *fail* rather than queue beyond that, so we must not stress it!
@@ -450,17 +451,41 @@ static bool process_sendrawtx(struct bitcoin_cli *bcli)
 	return true;
 }
 
+/* A transaction waiting for the db_write plugin before we broadcast it. */
+struct sendrawtx_wait {
+	struct bitcoind *bitcoind;
+	const char *hextx;
+	void (*cb)(struct bitcoind *bitcoind,
+		   int exitstatus, const char *msg, void *);
+	void *arg;
+};
+
+static void sendrawtx_synced(struct sendrawtx_wait *w)
+{
+	start_bitcoin_cli(w->bitcoind, NULL, process_sendrawtx, true,
+			  BITCOIND_HIGH_PRIO,
+			  w->cb, w->arg,
+			  "sendrawtransaction", w->hextx, NULL);
+	tal_free(w);
+}
+
 void bitcoind_sendrawtx_(struct bitcoind *bitcoind,
 			 const char *hextx,
 			 void (*cb)(struct bitcoind *bitcoind,
 				    int exitstatus, const char *msg, void *),
 			 void *arg)
 {
+	struct sendrawtx_wait *w = tal(bitcoind, struct sendrawtx_wait);
+
 	log_debug(bitcoind->log, "sendrawtransaction: %s", hextx);
-	start_bitcoin_cli(bitcoind, NULL, process_sendrawtx, true,
-			  BITCOIND_HIGH_PRIO,
-			  cb, arg,
-			  "sendrawtransaction", hextx, NULL);
+	w->bitcoind = bitcoind;
+	w->hextx = tal_strdup(w, hextx);
+	w->cb = cb;
+	w->arg = arg;
+
+	/* Once it's out, everything it depends on had better be backed up. */
+	if (plugin_hook_db_synced(w, sendrawtx_synced, w))
+		sendrawtx_synced(w);
 }
 
 static bool process_rawblock(struct bitcoin_cli *bcli)
@@ -136,6 +136,9 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIPCTL_INIT:
 	case WIRE_GOSSIP_GETNODES_REQUEST:
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
+	case WIRE_GOSSIP_GETROUTETREE_REQUEST:
+	case WIRE_GOSSIP_GETROUTESTATS_REQUEST:
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 	case WIRE_GOSSIP_PING:
 	case WIRE_GOSSIP_GET_CHANNEL_PEER:
@@ -154,6 +157,9 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	/* This is a reply, so never gets through to here. */
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
+	case WIRE_GOSSIP_GETROUTETREE_REPLY:
+	case WIRE_GOSSIP_GETROUTESTATS_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_SCIDS_REPLY:
 	case WIRE_GOSSIP_QUERY_CHANNEL_RANGE_REPLY:
@@ -196,6 +202,10 @@ void gossip_init(struct lightningd *ld, int connectd_fd)
 	    ld->rgb,
 	    ld->alias, ld->config.channel_update_interval,
 	    ld->announcable,
+	    ld->config.getroute_threads,
+	    ld->config.getroute_landmarks,
+	    ld->config.getroute_cache_secs,
+	    ld->config.gossip_verify_threads,
 #if DEVELOPER
 	    ld->dev_gossip_time ? &ld->dev_gossip_time: NULL
 #else
@@ -212,52 +222,89 @@ void gossipd_notify_spend(struct lightningd *ld,
 	subd_send_msg(ld->gossip, msg);
 }
 
+static void json_add_node_entry(struct json_stream *response,
+				const struct gossip_getnodes_entry *e)
+{
+	struct json_escape *esc;
+
+	json_object_start(response, NULL);
+	json_add_node_id(response, "nodeid", &e->nodeid);
+	if (e->last_timestamp < 0) {
+		json_object_end(response);
+		return;
+	}
+	esc = json_escape(NULL,
+			  take(tal_strndup(NULL,
+					   (const char *)e->alias,
+					   ARRAY_SIZE(e->alias))));
+	json_add_escaped_string(response, "alias", take(esc));
+	json_add_hex(response, "color", e->color, ARRAY_SIZE(e->color));
+	json_add_u64(response, "last_timestamp", e->last_timestamp);
+	json_add_hex_talarr(response, "globalfeatures", e->globalfeatures);
+	json_array_start(response, "addresses");
+	for (size_t i = 0; i < tal_count(e->addresses); i++)
+		json_add_address(response, NULL, &e->addresses[i]);
+	json_array_end(response);
+	json_object_end(response);
+}
+
+struct listnodes_info {
+	struct command *cmd;
+	/* Only those changed after this generation, if set. */
+	u64 *since;
+};
+
 static void json_getnodes_reply(struct subd *gossip UNUSED, const u8 *reply,
 				const int *fds UNUSED,
-				struct command *cmd)
+				struct listnodes_info *linfo)
 {
-	struct gossip_getnodes_entry **nodes;
 	struct json_stream *response;
-	size_t i, j;
-
-	if (!fromwire_gossip_getnodes_reply(reply, reply, &nodes)) {
-		was_pending(command_fail(cmd, LIGHTNINGD,
+	struct node_id *removed;
+	u8 *entries;
+	const u8 *cursor;
+	size_t max;
+	u64 generation;
+	bool full;
+
+	if (!fromwire_gossip_getnodes_reply(reply, reply, &generation, &full,
+					    &removed, &entries)) {
+		was_pending(command_fail(linfo->cmd, LIGHTNINGD,
 					 "Malformed gossip_getnodes response"));
 		return;
 	}
 
-	response = json_stream_success(cmd);
+	response = json_stream_success(linfo->cmd);
 	json_array_start(response, "nodes");
 
-	for (i = 0; i < tal_count(nodes); i++) {
-		struct json_escape *esc;
-
-		json_object_start(response, NULL);
-		json_add_node_id(response, "nodeid", &nodes[i]->nodeid);
-		if (nodes[i]->last_timestamp < 0) {
-			json_object_end(response);
-			continue;
-		}
-		esc = json_escape(NULL,
-				  take(tal_strndup(NULL,
-						   (const char *)nodes[i]->alias,
-						   ARRAY_SIZE(nodes[i]->alias))));
-		json_add_escaped_string(response, "alias", take(esc));
-		json_add_hex(response, "color",
-			     nodes[i]->color, ARRAY_SIZE(nodes[i]->color));
-		json_add_u64(response, "last_timestamp",
-			     nodes[i]->last_timestamp);
-		json_add_hex_talarr(response, "globalfeatures",
-				    nodes[i]->globalfeatures);
-		json_array_start(response, "addresses");
-		for (j=0; j<tal_count(nodes[i]->addresses); j++) {
-			json_add_address(response, NULL, &nodes[i]->addresses[j]);
+	/* There can be a great many: turn each into JSON as we go. */
+	cursor = entries;
+	max = tal_count(entries);
+	while (max) {
+		struct gossip_getnodes_entry *e;
+
+		e = fromwire_gossip_getnodes_entry(NULL, &cursor, &max);
+		if (!cursor) {
+			log_broken(linfo->cmd->ld->log,
+				   "Invalid node from gossipd");
+			tal_free(e);
+			break;
 		}
-		json_array_end(response);
-		json_object_end(response);
+		json_add_node_entry(response, e);
+		tal_free(e);
 	}
 	json_array_end(response);
-	was_pending(command_success(cmd, response));
+
+	json_add_u64(response, "next_since", generation);
+	if (linfo->since) {
+		json_add_bool(response, "full", full);
+		if (!full) {
+			json_array_start(response, "removed_nodes");
+			for (size_t i = 0; i < tal_count(removed); i++)
+				json_add_node_id(response, NULL, &removed[i]);
+			json_array_end(response);
+		}
+	}
+	was_pending(command_success(linfo->cmd, response));
 }
 
 static struct command_result *json_listnodes(struct command *cmd,
@@ -267,14 +314,17 @@ static struct command_result *json_listnodes(struct command *cmd,
 {
 	u8 *req;
 	struct node_id *id;
+	struct listnodes_info *linfo = tal(cmd, struct listnodes_info);
 
+	linfo->cmd = cmd;
 	if (!param(cmd, buffer, params,
 		   p_opt("id", param_node_id, &id),
+		   p_opt("since", param_u64, &linfo->since),
 		   NULL))
 		return command_param_failed();
 
-	req = towire_gossip_getnodes_request(cmd, id);
-	subd_req(cmd, cmd->ld->gossip, req, -1, 0, json_getnodes_reply, cmd);
+	req = towire_gossip_getnodes_request(cmd, id, linfo->since);
+	subd_req(cmd, cmd->ld->gossip, req, -1, 0, json_getnodes_reply, linfo);
 	return command_still_pending(cmd);
 }
 
@@ -283,6 +333,7 @@ static const struct json_command listnodes_command = {
 	"network",
 	json_listnodes,
 	"Show node {id} (or all, if no {id}), in our local network view"
+	" (only those changed {since} an earlier call's next_since, if set)"
 };
 AUTODATA(json_command, &listnodes_command);
 
@@ -305,6 +356,38 @@ static void json_getroute_reply(struct subd *gossip UNUSED, const u8 *reply, con
 	was_pending(command_success(cmd, response));
 }
 
+/* Parses the exclude array shared by getroute and getroutes. */
+static struct command_result *parse_excluded(struct command *cmd,
+					     const char *buffer,
+					     const jsmntok_t *excludetok,
+					     struct short_channel_id_dir **excluded)
+{
+	const jsmntok_t *t;
+	size_t i;
+
+	if (!excludetok) {
+		*excluded = NULL;
+		return NULL;
+	}
+
+	*excluded = tal_arr(cmd, struct short_channel_id_dir,
+			    excludetok->size);
+
+	json_for_each_arr(i, t, excludetok) {
+		if (!short_channel_id_dir_from_str(buffer + t->start,
+						   t->end - t->start,
+						   &(*excluded)[i],
+						   deprecated_apis)) {
+			return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+					    "%.*s is not a valid"
+					    " short_channel_id/direction",
+					    t->end - t->start,
+					    buffer + t->start);
+		}
+	}
+	return NULL;
+}
+
 static struct command_result *json_getroute(struct command *cmd,
 					    const char *buffer,
 					    const jsmntok_t *obj UNNEEDED,
@@ -319,6 +402,7 @@ static struct command_result *json_getroute(struct command *cmd,
 	double *riskfactor;
 	struct short_channel_id_dir *excluded;
 	u32 *max_hops;
+	struct command_result *ret;
 
 	/* Higher fuzz means that some high-fee paths can be discounted
 	 * for an even larger value, increasing the scope for route
@@ -343,28 +427,9 @@ static struct command_result *json_getroute(struct command *cmd,
 	/* Convert from percentage */
 	*fuzz = *fuzz / 100.0;
 
-	if (excludetok) {
-		const jsmntok_t *t;
-		size_t i;
-
-		excluded = tal_arr(cmd, struct short_channel_id_dir,
-				   excludetok->size);
-
-		json_for_each_arr(i, t, excludetok) {
-			if (!short_channel_id_dir_from_str(buffer + t->start,
-							   t->end - t->start,
-							   &excluded[i],
-							   deprecated_apis)) {
-				return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
-						    "%.*s is not a valid"
-						    " short_channel_id/direction",
-						    t->end - t->start,
-						    buffer + t->start);
-			}
-		}
-	} else {
-		excluded = NULL;
-	}
+	ret = parse_excluded(cmd, buffer, excludetok, &excluded);
+	if (ret)
+		return ret;
 
 	u8 *req = towire_gossip_getroute_request(cmd, source, destination,
 						 *msat,
@@ -389,6 +454,258 @@ static const struct json_command getroute_command = {
 };
 AUTODATA(json_command, &getroute_command);
 
+static void json_getroutes_reply(struct subd *gossip UNUSED,
+				 const u8 *reply,
+				 const int *fds UNUSED,
+				 struct command *cmd)
+{
+	struct json_stream *response;
+	u16 *route_lens;
+	struct route_hop *hops;
+	size_t off = 0;
+
+	if (!fromwire_gossip_getroutes_reply(reply, reply, &route_lens,
+					     &hops)) {
+		was_pending(command_fail(cmd, LIGHTNINGD,
+					 "Gossip gave bad getroutes_reply"));
+		return;
+	}
+
+	if (tal_count(route_lens) == 0) {
+		was_pending(command_fail(cmd, PAY_ROUTE_NOT_FOUND,
+					 "Could not find a route"));
+		return;
+	}
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "routes");
+	for (size_t i = 0; i < tal_count(route_lens); i++) {
+		assert(off + route_lens[i] <= tal_count(hops));
+		json_object_start(response, NULL);
+		json_add_route(response, "route", hops + off, route_lens[i]);
+		json_object_end(response);
+		off += route_lens[i];
+	}
+	json_array_end(response);
+	was_pending(command_success(cmd, response));
+}
+
+static struct command_result *json_getroutes(struct command *cmd,
+					     const char *buffer,
+					     const jsmntok_t *obj UNNEEDED,
+					     const jsmntok_t *params)
+{
+	struct lightningd *ld = cmd->ld;
+	struct node_id *destination;
+	struct node_id *source;
+	const jsmntok_t *excludetok;
+	struct amount_msat *msat;
+	unsigned *cltv;
+	double *riskfactor;
+	struct short_channel_id_dir *excluded;
+	u32 *max_hops, *max_routes;
+	double *fuzz;
+	struct command_result *ret;
+	u8 *req;
+
+	if (!param(cmd, buffer, params,
+		   p_req("id", param_node_id, &destination),
+		   p_req("msatoshi", param_msat, &msat),
+		   p_req("riskfactor", param_double, &riskfactor),
+		   p_opt_def("cltv", param_number, &cltv, 9),
+		   p_opt("fromid", param_node_id, &source),
+		   p_opt_def("fuzzpercent", param_percent, &fuzz, 5.0),
+		   p_opt("exclude", param_array, &excludetok),
+		   p_opt_def("maxhops", param_number, &max_hops,
+			     ROUTING_MAX_HOPS),
+		   p_opt_def("maxroutes", param_number, &max_routes, 3),
+		   NULL))
+		return command_param_failed();
+
+	if (*max_routes == 0 || *max_routes > UINT16_MAX)
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "maxroutes must be between 1 and %u",
+				    UINT16_MAX);
+
+	/* Convert from percentage */
+	*fuzz = *fuzz / 100.0;
+
+	ret = parse_excluded(cmd, buffer, excludetok, &excluded);
+	if (ret)
+		return ret;
+
+	req = towire_gossip_getroutes_request(cmd, source, destination,
+					      *msat,
+					      *riskfactor * 1000000.0,
+					      *cltv, fuzz,
+					      excluded,
+					      *max_hops, *max_routes);
+	subd_req(ld->gossip, ld->gossip, req, -1, 0, json_getroutes_reply, cmd);
+	return command_still_pending(cmd);
+}
+
+static const struct json_command getroutes_command = {
+	"getroutes",
+	"channels",
+	json_getroutes,
+	"Show up to {maxroutes} (default 3) routes to {id} for {msatoshi}, "
+	"cheapest first: each avoids the channels used by those before it. "
+	"Other parameters are as for getroute."
+};
+AUTODATA(json_command, &getroutes_command);
+
+static void json_getroutetree_reply(struct subd *gossip UNUSED,
+				    const u8 *reply,
+				    const int *fds UNUSED,
+				    struct command *cmd)
+{
+	struct json_stream *response;
+	struct route_cost *costs;
+
+	if (!fromwire_gossip_getroutetree_reply(reply, reply, &costs)) {
+		was_pending(command_fail(cmd, LIGHTNINGD,
+					 "Gossip gave bad getroutetree_reply"));
+		return;
+	}
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "destinations");
+	for (size_t i = 0; i < tal_count(costs); i++) {
+		json_object_start(response, NULL);
+		json_add_node_id(response, "id", &costs[i].destination);
+		json_add_amount_msat_compat(response, costs[i].fee,
+					    "fee_msatoshi", "fee_msat");
+		json_add_num(response, "delay", costs[i].delay);
+		json_add_num(response, "hops", costs[i].hops);
+		json_object_end(response);
+	}
+	json_array_end(response);
+	was_pending(command_success(cmd, response));
+}
+
+static struct command_result *json_getroutetree(struct command *cmd,
+						const char *buffer,
+						const jsmntok_t *obj UNNEEDED,
+						const jsmntok_t *params)
+{
+	struct lightningd *ld = cmd->ld;
+	const jsmntok_t *idstok, *t;
+	struct amount_msat *msat;
+	unsigned *cltv;
+	double *riskfactor;
+	struct node_id *destinations;
+	u32 *max_hops;
+	size_t i;
+	u8 *req;
+
+	if (!param(cmd, buffer, params,
+		   p_req("msatoshi", param_msat, &msat),
+		   p_req("riskfactor", param_double, &riskfactor),
+		   p_opt_def("cltv", param_number, &cltv, 9),
+		   p_opt("ids", param_array, &idstok),
+		   p_opt_def("maxhops", param_number, &max_hops,
+			     ROUTING_MAX_HOPS),
+		   NULL))
+		return command_param_failed();
+
+	destinations = tal_arr(cmd, struct node_id, 0);
+	if (idstok) {
+		if (idstok->size == 0)
+			return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+					    "ids must not be empty");
+		tal_resize(&destinations, idstok->size);
+		json_for_each_arr(i, t, idstok) {
+			if (!json_to_node_id(buffer, t, &destinations[i]))
+				return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+						    "%.*s is not a valid node id",
+						    t->end - t->start,
+						    buffer + t->start);
+		}
+	}
+
+	req = towire_gossip_getroutetree_request(cmd, *msat,
+						 *riskfactor * 1000000.0,
+						 *cltv, destinations,
+						 *max_hops);
+	subd_req(ld->gossip, ld->gossip, req, -1, 0,
+		 json_getroutetree_reply, cmd);
+	return command_still_pending(cmd);
+}
+
+static const struct json_command getroutetree_command = {
+	"getroutetree",
+	"channels",
+	json_getroutetree,
+	"Show what the cheapest routes from us cost to deliver {msatoshi} to "
+	"each of {ids} (or every node we can reach), using one search. "
+	"Other parameters are as for getroute."
+};
+AUTODATA(json_command, &getroutetree_command);
+
+static void json_getroutestats_reply(struct subd *gossip UNUSED,
+				     const u8 *reply,
+				     const int *fds UNUSED,
+				     struct command *cmd)
+{
+	struct json_stream *response;
+	u32 threads, queued, running, max_queued;
+	u64 answered, settled;
+	u16 landmarks;
+	u64 cache_hits, cache_misses, cache_invalidated;
+	u32 cache_entries;
+
+	if (!fromwire_gossip_getroutestats_reply(reply, &threads, &queued,
+						 &running, &max_queued,
+						 &answered, &settled,
+						 &landmarks,
+						 &cache_hits, &cache_misses,
+						 &cache_invalidated,
+						 &cache_entries)) {
+		was_pending(command_fail(cmd, LIGHTNINGD,
+					 "Gossip gave bad getroutestats_reply"));
+		return;
+	}
+
+	response = json_stream_success(cmd);
+	json_add_num(response, "threads", threads);
+	json_add_num(response, "queued", queued);
+	json_add_num(response, "running", running);
+	json_add_num(response, "max_queued", max_queued);
+	json_add_u64(response, "answered", answered);
+	json_add_u64(response, "nodes_settled", settled);
+	json_add_num(response, "landmarks", landmarks);
+	json_object_start(response, "cache");
+	json_add_u64(response, "hits", cache_hits);
+	json_add_u64(response, "misses", cache_misses);
+	json_add_u64(response, "invalidated", cache_invalidated);
+	json_add_num(response, "entries", cache_entries);
+	json_object_end(response);
+	was_pending(command_success(cmd, response));
+}
+
+static struct command_result *json_getroutestats(struct command *cmd,
+						 const char *buffer,
+						 const jsmntok_t *obj UNNEEDED,
+						 const jsmntok_t *params)
+{
+	u8 *msg;
+	if (!param(cmd, buffer, params, NULL))
+		return command_param_failed();
+
+	msg = towire_gossip_getroutestats_request(NULL);
+	subd_req(cmd->ld->gossip, cmd->ld->gossip,
+		 take(msg), -1, 0, json_getroutestats_reply, cmd);
+	return command_still_pending(cmd);
+}
+
+static const struct json_command getroutestats_command = {
+	"getroutestats",
+	"channels",
+	json_getroutestats,
+	"Show how busy gossipd's route-finding threads are."
+};
+AUTODATA(json_command, &getroutestats_command);
+
 static void json_add_halfchan(struct json_stream *response,
 			      const struct gossip_getchannels_entry *e,
 			      int idx)
@@ -424,6 +741,12 @@ struct listchannels_info {
 	struct json_stream *response;
 	struct short_channel_id *id;
 	struct node_id *source;
+	/* Only those changed after this generation, if set. */
+	u64 *since;
+	/* From the first reply: anything changing after that, they'll see
+	 * next time. */
+	u64 generation;
+	bool full;
 };
 
 /* Called upon receiving a getchannels_reply from `gossipd` */
@@ -431,36 +754,73 @@ static void json_listchannels_reply(struct subd *gossip UNUSED, const u8 *reply,
 				    const int *fds UNUSED,
 				    struct listchannels_info *linfo)
 {
-	size_t i;
-	struct gossip_getchannels_entry **entries;
-	bool complete;
+	u8 *entries;
+	const u8 *cursor;
+	struct short_channel_id *removed, last;
+	size_t max, num_entries = 0;
+	u64 generation;
+	bool complete, full;
 
 	if (!fromwire_gossip_getchannels_reply(reply, reply,
-					       &complete, &entries)) {
+					       &complete, &generation, &full,
+					       &removed,
+					       &entries)) {
 		/* Shouldn't happen: just end json stream. */
 		log_broken(linfo->cmd->ld->log, "Invalid reply from gossipd");
 		was_pending(command_raw_complete(linfo->cmd, linfo->response));
 		return;
 	}
 
-	for (i = 0; i < tal_count(entries); i++) {
-		json_add_halfchan(linfo->response, entries[i], 0);
-		json_add_halfchan(linfo->response, entries[i], 1);
+	if (!linfo->generation) {
+		linfo->generation = generation;
+		linfo->full = full;
+	}
+
+	/* There can be a great many: turn each into JSON as we go. */
+	cursor = entries;
+	max = tal_count(entries);
+	while (max) {
+		struct gossip_getchannels_entry e;
+		struct gossip_halfchannel_entry halves[2];
+
+		fromwire_gossip_getchannels_entry(&cursor, &max, &e, halves);
+		if (!cursor) {
+			log_broken(linfo->cmd->ld->log,
+				   "Invalid channel from gossipd");
+			break;
+		}
+		json_add_halfchan(linfo->response, &e, 0);
+		json_add_halfchan(linfo->response, &e, 1);
+		last = e.short_channel_id;
+		num_entries++;
 	}
 
 	/* More coming?  Ask from this point on.. */
 	if (!complete) {
 		u8 *req;
-		assert(tal_count(entries) != 0);
+		assert(num_entries != 0);
 		req = towire_gossip_getchannels_request(linfo->cmd,
 							linfo->id,
 							linfo->source,
-							&entries[i-1]
-							->short_channel_id);
+							&last,
+							linfo->since);
 		subd_req(linfo->cmd->ld->gossip, linfo->cmd->ld->gossip,
 			 req, -1, 0, json_listchannels_reply, linfo);
 	} else {
 		json_array_end(linfo->response);
+		json_add_u64(linfo->response, "next_since", linfo->generation);
+		if (linfo->since) {
+			json_add_bool(linfo->response, "full", linfo->full);
+			if (!linfo->full) {
+				json_array_start(linfo->response,
+						 "removed_channels");
+				for (size_t i = 0; i < tal_count(removed); i++)
+					json_add_short_channel_id(linfo->response,
+								  NULL,
+								  &removed[i]);
+				json_array_end(linfo->response);
+			}
+		}
 		was_pending(command_success(linfo->cmd, linfo->response));
 	}
 }
@@ -474,9 +834,11 @@ static struct command_result *json_listchannels(struct command *cmd,
 	struct listchannels_info *linfo = tal(cmd, struct listchannels_info);
 
 	linfo->cmd = cmd;
+	linfo->generation = 0;
 	if (!param(cmd, buffer, params,
 		   p_opt("short_channel_id", param_short_channel_id, &linfo->id),
 		   p_opt("source", param_node_id, &linfo->source),
+		   p_opt("since", param_u64, &linfo->since),
 		   NULL))
 		return command_param_failed();
 
@@ -489,7 +851,7 @@ static struct command_result *json_listchannels(struct command *cmd,
 	json_array_start(linfo->response, "channels");
 
 	req = towire_gossip_getchannels_request(cmd, linfo->id, linfo->source,
-						NULL);
+						NULL, linfo->since);
 	subd_req(cmd->ld->gossip, cmd->ld->gossip,
 		 req, -1, 0, json_listchannels_reply, linfo);
 
@@ -500,7 +862,8 @@ static const struct json_command listchannels_command = {
 	"listchannels",
 	"channels",
 	json_listchannels,
-	"Show channel {short_channel_id} or {source} (or all known channels, if not specified)"
+	"Show channel {short_channel_id} or {source} (or all known channels, if not specified),"
+	" only those changed {since} an earlier call's next_since, if set"
 };
 AUTODATA(json_command, &listchannels_command);
 
@@ -78,6 +78,22 @@ void towire_route_hop(u8 **pptr, const struct route_hop *entry)
 	towire_u32(pptr, entry->delay);
 }
 
+void fromwire_route_cost(const u8 **pptr, size_t *max, struct route_cost *entry)
+{
+	fromwire_node_id(pptr, max, &entry->destination);
+	entry->fee = fromwire_amount_msat(pptr, max);
+	entry->delay = fromwire_u32(pptr, max);
+	entry->hops = fromwire_u16(pptr, max);
+}
+
+void towire_route_cost(u8 **pptr, const struct route_cost *entry)
+{
+	towire_node_id(pptr, &entry->destination);
+	towire_amount_msat(pptr, entry->fee);
+	towire_u32(pptr, entry->delay);
+	towire_u16(pptr, entry->hops);
+}
+
 void fromwire_route_info(const u8 **pptr, size_t *max, struct route_info *entry)
 {
 	fromwire_node_id(pptr, max, &entry->pubkey);
@@ -109,13 +125,10 @@ static void fromwire_gossip_halfchannel_entry(const u8 **pptr, size_t *max,
 	entry->max = fromwire_amount_msat(pptr, max);
 }
 
-struct gossip_getchannels_entry *
-fromwire_gossip_getchannels_entry(const tal_t *ctx,
-				  const u8 **pptr, size_t *max)
+void fromwire_gossip_getchannels_entry(const u8 **pptr, size_t *max,
+				       struct gossip_getchannels_entry *entry,
+				       struct gossip_halfchannel_entry halves[2])
 {
-	struct gossip_getchannels_entry *entry;
-
-	entry= tal(ctx, struct gossip_getchannels_entry);
 	fromwire_node_id(pptr, max, &entry->node[0]);
 	fromwire_node_id(pptr, max, &entry->node[1]);
 	entry->sat = fromwire_amount_sat(pptr, max);
@@ -123,18 +136,14 @@ fromwire_gossip_getchannels_entry(const tal_t *ctx,
 	entry->public = fromwire_bool(pptr, max);
 	entry->local_disabled = fromwire_bool(pptr, max);
 
-	if (fromwire_bool(pptr, max)) {
-		entry->e[0] = tal(entry, struct gossip_halfchannel_entry);
-		fromwire_gossip_halfchannel_entry(pptr, max, entry->e[0]);
-	} else
-		entry->e[0] = NULL;
-	if (fromwire_bool(pptr, max)) {
-		entry->e[1] = tal(entry, struct gossip_halfchannel_entry);
-		fromwire_gossip_halfchannel_entry(pptr, max, entry->e[1]);
-	} else
-		entry->e[1] = NULL;
-
-	return entry;
+	for (size_t i = 0; i < 2; i++) {
+		if (fromwire_bool(pptr, max)) {
+			entry->e[i] = &halves[i];
+			fromwire_gossip_halfchannel_entry(pptr, max,
+							  entry->e[i]);
+		} else
+			entry->e[i] = NULL;
+	}
 }
 
 static void towire_gossip_halfchannel_entry(u8 **pptr,
@@ -52,12 +52,17 @@ void towire_peer_features(u8 **pptr, const struct peer_features *features);
 void fromwire_route_hop(const u8 **pprt, size_t *max, struct route_hop *entry);
 void towire_route_hop(u8 **pprt, const struct route_hop *entry);
 
+void fromwire_route_cost(const u8 **pprt, size_t *max, struct route_cost *entry);
+void towire_route_cost(u8 **pprt, const struct route_cost *entry);
+
 void fromwire_route_info(const u8 **pprt, size_t *max, struct route_info *entry);
 void towire_route_info(u8 **pprt, const struct route_info *entry);
 
-struct gossip_getchannels_entry *
-fromwire_gossip_getchannels_entry(const tal_t *ctx,
-				  const u8 **pptr, size_t *max);
+/* There are a great many of these, so we unmarshal them one at a time,
+ * into @entry (whose e[] point into @halves). */
+void fromwire_gossip_getchannels_entry(const u8 **pptr, size_t *max,
+				       struct gossip_getchannels_entry *entry,
+				       struct gossip_halfchannel_entry halves[2]);
 void towire_gossip_getchannels_entry(
     u8 **pptr, const struct gossip_getchannels_entry *entry);
 
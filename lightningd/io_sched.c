@@ -0,0 +1,152 @@
+/*~ ccan/io has no notion of fairness: a connection which returns
+ * io_always() runs again before io_loop() polls, so one which always has
+ * more to do (a script flooding the JSON-RPC socket, say) starves every
+ * other fd.  Timers don't help, either: io_loop() returns for an expired
+ * timer before it polls.
+ *
+ * So we use the oldest trick there is: a pipe to ourselves.  A connection
+ * with more to do io_wait()s, and we write a byte into the pipe.  That's
+ * only readable once io_loop() polls, at which point everyone else who was
+ * ready has had their turn too, and we wake everyone who was waiting. */
+#include "io_sched.h"
+#include <ccan/err/err.h>
+#include <ccan/list/list.h>
+#include <ccan/time/time.h>
+#include <unistd.h>
+
+struct sched_entry {
+	/* In io_sched->waiting */
+	struct list_node list;
+	struct io_sched *sched;
+	struct timemono since;
+};
+
+struct io_sched {
+	/* fds[0] is read by conn, fds[1] written to wake it. */
+	int fds[2];
+	struct io_conn *conn;
+	char byte;
+
+	/* Have we written a byte conn hasn't read yet? */
+	bool signalled;
+
+	/* Connections waiting for a turn, in order. */
+	struct list_head waiting;
+	size_t num_waiting;
+
+	u64 yields;
+	u64 max_wait_usec;
+};
+
+static void destroy_sched_entry(struct sched_entry *e)
+{
+	list_del(&e->list);
+	e->sched->num_waiting--;
+}
+
+static void signal_sched(struct io_sched *sched)
+{
+	if (sched->signalled)
+		return;
+
+	/* There's never more than one byte in the pipe, so this can't
+	 * block. */
+	if (write(sched->fds[1], "", 1) != 1)
+		err(1, "Writing to scheduler pipe");
+	sched->signalled = true;
+}
+
+static struct io_plan *sched_run(struct io_conn *conn,
+				 struct io_sched *sched)
+{
+	struct sched_entry *e;
+	struct timemono now = time_mono();
+
+	sched->signalled = false;
+
+	/* Waking only schedules them to run, so nobody can yield again
+	 * (or close) while we do this. */
+	while ((e = list_pop(&sched->waiting, struct sched_entry, list))
+	       != NULL) {
+		u64 usec = time_to_usec(timemono_between(now, e->since));
+		if (usec > sched->max_wait_usec)
+			sched->max_wait_usec = usec;
+
+		io_wake(e);
+		sched->num_waiting--;
+		tal_del_destructor(e, destroy_sched_entry);
+		tal_free(e);
+	}
+
+	return io_read(conn, &sched->byte, 1, sched_run, sched);
+}
+
+static struct io_plan *sched_conn_init(struct io_conn *conn,
+				       struct io_sched *sched)
+{
+	return io_read(conn, &sched->byte, 1, sched_run, sched);
+}
+
+struct io_plan *io_sched_yield_(struct io_sched *sched,
+				struct io_conn *conn,
+				struct io_plan *(*next)(struct io_conn *,
+							void *),
+				void *arg)
+{
+	/* Off conn, so if it closes we forget it. */
+	struct sched_entry *e = tal(conn, struct sched_entry);
+
+	e->sched = sched;
+	e->since = time_mono();
+	list_add_tail(&sched->waiting, &e->list);
+	sched->num_waiting++;
+	tal_add_destructor(e, destroy_sched_entry);
+
+	sched->yields++;
+	signal_sched(sched);
+	return io_wait(conn, e, next, arg);
+}
+
+void io_sched_exclusive(struct io_sched *sched, bool excl)
+{
+	io_conn_exclusive(sched->conn, excl);
+}
+
+void io_sched_get_stats(const struct io_sched *sched,
+			struct io_sched_stats *stats)
+{
+	stats->yields = sched->yields;
+	stats->waiting = sched->num_waiting;
+	stats->max_wait_usec = sched->max_wait_usec;
+}
+
+static void destroy_io_sched(struct io_sched *sched)
+{
+	struct sched_entry *e;
+
+	/* Anyone still waiting may outlive us. */
+	while ((e = list_pop(&sched->waiting, struct sched_entry, list))
+	       != NULL)
+		tal_del_destructor(e, destroy_sched_entry);
+
+	/* Closing conn closes fds[0]. */
+	close(sched->fds[1]);
+}
+
+struct io_sched *new_io_sched(const tal_t *ctx)
+{
+	struct io_sched *sched = tal(ctx, struct io_sched);
+
+	if (pipe(sched->fds) != 0)
+		err(1, "Creating scheduler pipe");
+	io_fd_block(sched->fds[1], false);
+
+	sched->signalled = false;
+	list_head_init(&sched->waiting);
+	sched->num_waiting = 0;
+	sched->yields = 0;
+	sched->max_wait_usec = 0;
+	sched->conn = io_new_conn(sched, sched->fds[0], sched_conn_init, sched);
+	tal_add_destructor(sched, destroy_io_sched);
+	return sched;
+}
@@ -0,0 +1,60 @@
+#ifndef LIGHTNING_LIGHTNINGD_IO_SCHED_H
+#define LIGHTNING_LIGHTNINGD_IO_SCHED_H
+#include "config.h"
+#include <ccan/io/io.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+
+/* JSON-RPC connections and plugins can have far more buffered than they
+ * should handle in one go.  Rather than io_always() (which runs before
+ * io_loop polls anything else), they yield here, and get another turn
+ * once every other fd has had a chance. */
+struct io_sched;
+
+struct io_sched *new_io_sched(const tal_t *ctx);
+
+/**
+ * io_sched_yield - call next(conn, arg) after the next poll.
+ * @sched: the scheduler.
+ * @conn: the connection which has more to do.
+ * @next: what to do then.
+ * @arg: argument to @next.
+ *
+ * Connections which yield in the same round get their turns in the order
+ * they yielded; if @conn closes first, it's forgotten.
+ */
+#define io_sched_yield(sched, conn, next, arg)				\
+	io_sched_yield_((sched), (conn),				\
+			typesafe_cb_preargs(struct io_plan *, void *,	\
+					    (next), (arg),		\
+					    struct io_conn *),		\
+			(arg))
+struct io_plan *io_sched_yield_(struct io_sched *sched,
+				struct io_conn *conn,
+				struct io_plan *(*next)(struct io_conn *,
+							void *),
+				void *arg);
+
+/**
+ * io_sched_exclusive - keep giving turns during io_conn_exclusive().
+ * @sched: the scheduler.
+ * @excl: true on entering an exclusive io_loop, false on leaving it.
+ *
+ * An exclusive connection may be waiting for its turn, so the scheduler
+ * needs to be polled too.  (Others woken meanwhile wait until it's over.)
+ */
+void io_sched_exclusive(struct io_sched *sched, bool excl);
+
+struct io_sched_stats {
+	/* How many times anyone has yielded. */
+	u64 yields;
+	/* How many are waiting for their turn now. */
+	size_t waiting;
+	/* Longest anyone has waited for their turn. */
+	u64 max_wait_usec;
+};
+
+void io_sched_get_stats(const struct io_sched *sched,
+			struct io_sched_stats *stats);
+
+#endif /* LIGHTNING_LIGHTNINGD_IO_SCHED_H */
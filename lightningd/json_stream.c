@@ -1,9 +1,10 @@
 #include <ccan/io/io.h>
-  /* To reach into io_plan: not a public header! */
-  #include <ccan/io/backend.h>
+#include <ccan/io/io_plan.h>
 #include <ccan/json_escape/json_escape.h>
 #include <ccan/json_out/json_out.h>
+#include <ccan/list/list.h>
 #include <ccan/str/hex/hex.h>
+#include <ccan/tal/link/link.h>
 #include <ccan/tal/str/str.h>
 #include <common/daemon.h>
 #include <common/utils.h>
@@ -12,8 +13,32 @@
 #include <lightningd/log.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/uio.h>
+
+/* Once this much has built up in jout, we move it out into segments: so jout
+ * never has to grow (and be copied) to the size of a huge response. */
+#define JSON_SEGMENT_SIZE 65536
+
+/* Most pieces we hand to writev at once. */
+#define JSON_WRITEV_MAX 16
+
+struct json_segment {
+	/* In json_stream->segments */
+	struct list_node list;
+	/* buf[start] to buf[end] is yet to be written out. */
+	size_t start, end;
+	char buf[JSON_SEGMENT_SIZE];
+};
 
 struct json_stream {
+	/* If non-NULL, a tal_link'ed buffer (see json_stream_share): we
+	 * write out shared[shared_off] onwards before anything else. */
+	char *shared;
+	size_t shared_off;
+
+	/* Output which was in jout, oldest first: this all goes before jout. */
+	struct list_head segments;
+
 	/* NULL if we ran OOM! */
 	struct json_out *jout;
 
@@ -26,22 +51,11 @@ struct json_stream {
 				     struct json_stream *js,
 				     void *arg);
 	void *reader_arg;
-	size_t len_read;
 
 	/* Where to log I/O */
 	struct log *log;
 };
 
-static void adjust_io_write(struct json_out *jout,
-			    ptrdiff_t delta,
-			    struct json_stream *js)
-{
-	/* If io_write is in progress, we shift it to point to new buffer pos */
-	if (js->reader)
-	/* FIXME: This, or something prettier (io_replan?) belong in ccan/io! */
-		js->reader->plan[IO_OUT].arg.u1.cp += delta;
-}
-
 struct json_stream *new_json_stream(const tal_t *ctx,
 				    struct command *writer,
 				    struct log *log)
@@ -49,26 +63,15 @@ struct json_stream *new_json_stream(const tal_t *ctx,
 	struct json_stream *js = tal(ctx, struct json_stream);
 
 	/* FIXME: Add magic so tal_resize can fail! */
+	js->shared = NULL;
+	list_head_init(&js->segments);
 	js->jout = json_out_new(js);
-	json_out_call_on_move(js->jout, adjust_io_write, js);
 	js->writer = writer;
 	js->reader = NULL;
 	js->log = log;
 	return js;
 }
 
-struct json_stream *json_stream_dup(const tal_t *ctx,
-				    struct json_stream *original,
-				    struct log *log)
-{
-	struct json_stream *js = tal_dup(ctx, struct json_stream, original);
-
-	if (original->jout)
-		js->jout = json_out_dup(js, original->jout);
-	js->log = log;
-	return js;
-}
-
 bool json_stream_still_writing(const struct json_stream *js)
 {
 	return js->writer != NULL;
@@ -87,12 +90,137 @@ static void COLD js_oom(struct json_stream *js)
 	js->jout = tal_free(js->jout);
 }
 
+/* If enough has built up in jout, move it to the end of the segments. */
+static void json_stream_seal(struct json_stream *js)
+{
+	struct json_segment *seg;
+	const char *p;
+	size_t len, n;
+
+	p = json_out_contents(js->jout, &len);
+	if (len < JSON_SEGMENT_SIZE)
+		return;
+
+	/* Consuming doesn't move anything, so p stays valid. */
+	json_out_consume(js->jout, len);
+	while (len) {
+		seg = list_tail(&js->segments, struct json_segment, list);
+		if (!seg || seg->end == JSON_SEGMENT_SIZE) {
+			seg = tal(js, struct json_segment);
+			seg->start = seg->end = 0;
+			list_add_tail(&js->segments, &seg->list);
+		}
+		n = JSON_SEGMENT_SIZE - seg->end;
+		if (n > len)
+			n = len;
+		memcpy(seg->buf + seg->end, p, n);
+		seg->end += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/* Called before each addition: false if we've run out of memory. */
+static bool js_ready(struct json_stream *js)
+{
+	if (!js->jout)
+		return false;
+	json_stream_seal(js);
+	return true;
+}
+
+/* How much is waiting to be written out? */
+static size_t json_stream_unwritten(const struct json_stream *js)
+{
+	const struct json_segment *seg;
+	size_t len;
+
+	json_out_contents(js->jout, &len);
+	if (js->shared)
+		len += tal_count(js->shared) - js->shared_off;
+	list_for_each(&js->segments, seg, list)
+		len += seg->end - seg->start;
+	return len;
+}
+
+/* Copy everything waiting to be written out to dest. */
+static void json_stream_copy(char *dest, const struct json_stream *js)
+{
+	const struct json_segment *seg;
+	const char *p;
+	size_t len;
+
+	if (js->shared) {
+		len = tal_count(js->shared) - js->shared_off;
+		memcpy(dest, js->shared + js->shared_off, len);
+		dest += len;
+	}
+	list_for_each(&js->segments, seg, list) {
+		memcpy(dest, seg->buf + seg->start, seg->end - seg->start);
+		dest += seg->end - seg->start;
+	}
+	p = json_out_contents(js->jout, &len);
+	memcpy(dest, p, len);
+}
+
+/* We've written out len bytes: shared, then segments, then jout. */
+static void json_stream_consume(struct json_stream *js, size_t len)
+{
+	struct json_segment *seg;
+	const char *p;
+	size_t n;
+
+	if (js->shared) {
+		n = tal_count(js->shared) - js->shared_off;
+		if (n > len)
+			n = len;
+		if (js->log && n)
+			log_io(js->log, LOG_IO_OUT, "",
+			       js->shared + js->shared_off, n);
+		js->shared_off += n;
+		len -= n;
+		if (js->shared_off != tal_count(js->shared))
+			return;
+		/* We're done with it: if we were the last, it's freed. */
+		tal_delink(js, js->shared);
+		js->shared = NULL;
+	}
+
+	while ((seg = list_top(&js->segments, struct json_segment, list))
+	       != NULL) {
+		n = seg->end - seg->start;
+		if (n > len)
+			n = len;
+		if (js->log && n)
+			log_io(js->log, LOG_IO_OUT, "", seg->buf + seg->start, n);
+		seg->start += n;
+		len -= n;
+		if (seg->start != seg->end)
+			return;
+		/* Keep the last one, to fill up again. */
+		if (seg == list_tail(&js->segments, struct json_segment, list)) {
+			seg->start = seg->end = 0;
+			break;
+		}
+		list_del_from(&js->segments, &seg->list);
+		tal_free(seg);
+	}
+
+	if (len) {
+		p = json_out_contents(js->jout, &n);
+		assert(len <= n);
+		if (js->log)
+			log_io(js->log, LOG_IO_OUT, "", p, len);
+		json_out_consume(js->jout, len);
+	}
+}
+
 void json_stream_append(struct json_stream *js,
 			const char *str, size_t len)
 {
 	char *dest;
 
-	if (!js->jout)
+	if (!js_ready(js))
 		return;
 	dest = json_out_direct(js->jout, len);
 	if (!dest) {
@@ -102,6 +230,43 @@ void json_stream_append(struct json_stream *js,
 	memcpy(dest, str, len);
 }
 
+struct json_stream *json_stream_share(const tal_t *ctx,
+				      struct json_stream *original,
+				      struct log *log)
+{
+	struct json_stream *js = new_json_stream(ctx, NULL, log);
+	struct json_segment *seg;
+	char *shared;
+	size_t len;
+
+	assert(!json_stream_still_writing(original));
+	if (!original->jout) {
+		js_oom(js);
+		return js;
+	}
+
+	/* The first time, move it all into one buffer everyone can share. */
+	if (!original->shared
+	    || original->shared_off != 0
+	    || json_stream_unwritten(original) != tal_count(original->shared)) {
+		shared = tal_arr(NULL, char, json_stream_unwritten(original));
+		json_stream_copy(shared, original);
+
+		tal_delink(original, original->shared);
+		original->shared = tal_link(original, tal_linkable(shared));
+		original->shared_off = 0;
+		while ((seg = list_pop(&original->segments,
+				       struct json_segment, list)) != NULL)
+			tal_free(seg);
+		json_out_contents(original->jout, &len);
+		json_out_consume(original->jout, len);
+	}
+
+	js->shared = tal_link(js, original->shared);
+	js->shared_off = 0;
+	return js;
+}
+
 void json_stream_close(struct json_stream *js, struct command *writer)
 {
 	/* FIXME: We use writer == NULL for malformed: make writer a void *?
@@ -115,6 +280,30 @@ void json_stream_close(struct json_stream *js, struct command *writer)
 	js->writer = NULL;
 }
 
+void json_stream_splice(struct json_stream *js, struct json_stream *from,
+			struct command *writer)
+{
+	char *dest;
+
+	assert(from->writer == writer);
+	from->writer = NULL;
+
+	if (!js_ready(js))
+		return;
+	if (!from->jout) {
+		js_oom(js);
+		return;
+	}
+
+	dest = json_out_member_direct(js->jout, NULL,
+				      json_stream_unwritten(from));
+	if (!dest) {
+		js_oom(js);
+		return;
+	}
+	json_stream_copy(dest, from);
+}
+
 /* Also called when we're oom, so it will kill reader. */
 void json_stream_flush(struct json_stream *js)
 {
@@ -127,7 +316,7 @@ char *json_member_direct(struct json_stream *js,
 {
 	char *dest;
 
-	if (!js->jout)
+	if (!js_ready(js))
 		return NULL;
 
 	dest = json_out_member_direct(js->jout, fieldname, extra);
@@ -138,25 +327,25 @@ char *json_member_direct(struct json_stream *js,
 
 void json_array_start(struct json_stream *js, const char *fieldname)
 {
-	if (js->jout && !json_out_start(js->jout, fieldname, '['))
+	if (js_ready(js) && !json_out_start(js->jout, fieldname, '['))
 		js_oom(js);
 }
 
 void json_array_end(struct json_stream *js)
 {
-	if (js->jout && !json_out_end(js->jout, ']'))
+	if (js_ready(js) && !json_out_end(js->jout, ']'))
 		js_oom(js);
 }
 
 void json_object_start(struct json_stream *js, const char *fieldname)
 {
-	if (js->jout && !json_out_start(js->jout, fieldname, '{'))
+	if (js_ready(js) && !json_out_start(js->jout, fieldname, '{'))
 		js_oom(js);
 }
 
 void json_object_end(struct json_stream *js)
 {
-	if (js->jout && !json_out_end(js->jout, '}'))
+	if (js_ready(js) && !json_out_end(js->jout, '}'))
 		js_oom(js);
 }
 
@@ -177,30 +366,66 @@ void json_add_member(struct json_stream *js,
 	va_list ap;
 
 	va_start(ap, fmt);
-	if (js->jout && !json_out_addv(js->jout, fieldname, quote, fmt, ap))
+	if (js_ready(js) && !json_out_addv(js->jout, fieldname, quote, fmt, ap))
 		js_oom(js);
 	va_end(ap);
 }
 
+/* Write as much as we can, straight from the segments and jout.  We look
+ * at them afresh each time, since more may have been added (and jout may
+ * have moved) since last time. */
+static int do_write_json_stream(int fd, struct io_plan_arg *arg)
+{
+	struct json_stream *js = arg->u1.vp;
+	struct iovec iov[JSON_WRITEV_MAX];
+	struct json_segment *seg;
+	int iovcnt = 0;
+	ssize_t ret;
+
+	/* Ran out of memory while we were waiting? */
+	if (!js->jout)
+		return -1;
+
+	if (js->shared) {
+		iov[iovcnt].iov_base = js->shared + js->shared_off;
+		iov[iovcnt].iov_len = tal_count(js->shared) - js->shared_off;
+		iovcnt++;
+	}
+	list_for_each(&js->segments, seg, list) {
+		if (iovcnt == JSON_WRITEV_MAX)
+			break;
+		if (seg->start == seg->end)
+			continue;
+		iov[iovcnt].iov_base = seg->buf + seg->start;
+		iov[iovcnt].iov_len = seg->end - seg->start;
+		iovcnt++;
+	}
+	if (iovcnt < JSON_WRITEV_MAX) {
+		iov[iovcnt].iov_base = (char *)json_out_contents(js->jout,
+							  &iov[iovcnt].iov_len);
+		if (iov[iovcnt].iov_len)
+			iovcnt++;
+	}
+
+	ret = writev(fd, iov, iovcnt);
+	if (ret < 0)
+		return -1;
+
+	json_stream_consume(js, ret);
+	return json_stream_unwritten(js) == 0;
+}
+
 /* This is where we read the json_stream and write it to conn */
 static struct io_plan *json_stream_output_write(struct io_conn *conn,
 						struct json_stream *js)
 {
-	const char *p;
-
 	/* Out of memory?  Nothing we can do but close conn */
 	if (!js->jout)
 		return io_close(conn);
 
-	/* For when we've just done some output */
-	json_out_consume(js->jout, js->len_read);
-
-	/* Get how much we can write out from js */
-	p = json_out_contents(js->jout, &js->len_read);
-
 	/* Nothing in buffer? */
-	if (!p) {
-		/* We're not doing io_write now, unset. */
+	if (!json_stream_unwritten(js)) {
+		/* We're not writing now, unset. */
 		js->reader = NULL;
 		if (!json_stream_still_writing(js))
 			return js->reader_cb(conn, js, js->reader_arg);
@@ -208,11 +433,12 @@ static struct io_plan *json_stream_output_write(struct io_conn *conn,
 	}
 
 	js->reader = conn;
-	if (js->log)
-		log_io(js->log, LOG_IO_OUT, "", p, js->len_read);
-	return io_write(conn,
-			p, js->len_read,
-			json_stream_output_write, js);
+	io_plan_arg(conn, IO_OUT)->u1.vp = js;
+	return io_set_plan(conn, IO_OUT, do_write_json_stream,
+			   typesafe_cb_preargs(struct io_plan *, void *,
+					       json_stream_output_write, js,
+					       struct io_conn *),
+			   js);
 }
 
 struct io_plan *json_stream_output_(struct json_stream *js,
@@ -227,6 +453,5 @@ struct io_plan *json_stream_output_(struct json_stream *js,
 	js->reader_cb = cb;
 	js->reader_arg = arg;
 
-	js->len_read = 0;
 	return json_stream_output_write(conn, js);
 }
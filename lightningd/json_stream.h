@@ -27,20 +27,23 @@ struct json_stream *new_json_stream(const tal_t *ctx, struct command *writer,
 				    struct log *log);
 
 /**
- * Duplicate an existing stream.
+ * Share the output of a finished stream.
  *
- * Mostly useful when we want to send copies of a given stream to
- * multiple recipients, that might read at different speeds from the
- * stream. For example this is used when construcing a single
- * notification and then duplicating it for the fanout.
+ * Useful when we want to send a given stream to multiple recipients,
+ * that might read at different speeds from the stream. For example this
+ * is used when constructing a single notification for the fanout.
+ *
+ * The first time, @original's output is moved into a refcounted buffer:
+ * each stream returned writes out from that, without copying it, and it's
+ * freed once they (and @original) are done with it.
  *
  * @ctx: tal context for allocation.
- * @original: the stream to duplicate.
+ * @original: the stream to share (must not be written to any more).
  * @log: log for new stream.
  */
-struct json_stream *json_stream_dup(const tal_t *ctx,
-				    struct json_stream *original,
-				    struct log *log);
+struct json_stream *json_stream_share(const tal_t *ctx,
+				      struct json_stream *original,
+				      struct log *log);
 
 /**
  * json_stream_close - finished writing to a JSON stream.
@@ -49,6 +52,19 @@ struct json_stream *json_stream_dup(const tal_t *ctx,
  */
 void json_stream_close(struct json_stream *js, struct command *writer);
 
+/**
+ * json_stream_splice - finished writing to a JSON stream; append it to another.
+ * @js: the json_stream to append to (inside an array).
+ * @from: the json_stream which is finished.
+ * @writer: object responsible for writing to @from.
+ *
+ * Rather than closing @from to be sent on its own, this appends it to @js
+ * as the next array member: this is how JSON-RPC batch responses are put
+ * together.
+ */
+void json_stream_splice(struct json_stream *js, struct json_stream *from,
+			struct command *writer);
+
 /* For low-level JSON stream access: */
 void json_stream_log_suppress(struct json_stream *js, const char *cmd_name);
 
@@ -21,6 +21,7 @@
 #include <ccan/array_size/array_size.h>
 #include <ccan/asort/asort.h>
 #include <ccan/err/err.h>
+#include <ccan/ilog/ilog.h>
 #include <ccan/io/io.h>
 #include <ccan/json_escape/json_escape.h>
 #include <ccan/json_out/json_out.h>
@@ -39,6 +40,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <lightningd/chaintopology.h>
+#include <lightningd/io_sched.h>
 #include <lightningd/json.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/log.h>
@@ -50,6 +52,13 @@
 #include <sys/types.h>
 #include <sys/un.h>
 
+/* Most requests a connection handles before letting others have a turn. */
+#define JSONRPC_REQUESTS_PER_TURN 16
+
+/* Latencies are counted in power-of-two buckets of microseconds: bucket n
+ * is those under 2^n usec, except the last, which is everything else. */
+#define LATENCY_BUCKETS 28
+
 /* Dummy structure. */
 struct command_result {
 	char c;
@@ -88,16 +97,55 @@ struct json_connection {
 	size_t used;
 	/* How much has just been filled. */
 	size_t len_read;
+	/* How far we've tokenized the buffer. */
+	struct json_incremental *input;
 
 	/* Our commands */
 	struct list_head commands;
 
+	/* How many requests we've handled since we last yielded. */
+	unsigned int turn_requests;
+
+	/* A batch we haven't started every request of yet. */
+	struct json_batch *batch;
+
+	/* Statistics, logged when we close. */
+	u64 num_requests, num_yields;
+	size_t num_commands, max_commands;
+	u64 total_usec, max_usec;
+
 	/* Our json_streams (owned by the commands themselves while running).
 	 * Since multiple streams could start returning data at once, we
 	 * always service these in order, freeing once empty. */
 	struct json_stream **js_arr;
 };
 
+/* A JSON-RPC batch request: an array of requests, which gets one array of
+ * responses. */
+struct json_batch {
+	struct json_connection *jcon;
+
+	/* The requests, and the next one to start. */
+	const jsmntok_t *toks, *next_tok;
+	size_t next;
+
+	/* The responses so far (in the order they completed). */
+	struct json_stream *js;
+
+	/* How many responses we're still waiting for. */
+	size_t pending;
+};
+
+/* How a command (builtin or from a plugin) has been doing: kept by name, so
+ * they survive a plugin being restarted. */
+struct json_command_stats {
+	const char *name;
+	u64 calls, errors;
+	size_t in_flight;
+	u64 total_usec, max_usec;
+	u64 latency[LATENCY_BUCKETS];
+};
+
 /**
  * `jsonrpc` encapsulates the entire state of the JSON-RPC interface,
  * including a list of methods that the interface supports (can be
@@ -112,21 +160,30 @@ struct jsonrpc {
 	/* Map from json command names to usage strings: we don't put this inside
 	 * struct json_command as it's good practice to have those const. */
 	STRMAP(const char *) usagemap;
+
+	/* Map from json command names to how they've been doing. */
+	STRMAP(struct json_command_stats *) statsmap;
 };
 
 /* The command itself usually owns the stream, because jcon may get closed.
  * The command transfers ownership once it's done though. */
-static struct json_stream *jcon_new_json_stream(const tal_t *ctx,
-						struct json_connection *jcon,
-						struct command *writer)
+static void jcon_add_json_stream(struct json_connection *jcon,
+				 struct json_stream *js)
 {
-	struct json_stream *js = new_json_stream(ctx, writer, jcon->log);
-
 	/* Wake writer to start streaming, in case it's not already. */
 	io_wake(jcon);
 
 	/* FIXME: Keep streams around for recycling. */
 	tal_arr_expand(&jcon->js_arr, js);
+}
+
+static struct json_stream *jcon_new_json_stream(const tal_t *ctx,
+						struct json_connection *jcon,
+						struct command *writer)
+{
+	struct json_stream *js = new_json_stream(ctx, writer, jcon->log);
+
+	jcon_add_json_stream(jcon, js);
 	return js;
 }
 
@@ -151,8 +208,19 @@ static void destroy_jcon(struct json_connection *jcon)
 	list_for_each(&jcon->commands, c, list) {
 		log_debug(jcon->log, "Abandoning command %s", c->json_cmd->name);
 		c->jcon = NULL;
+		c->batch = NULL;
 	}
 
+	if (jcon->num_requests)
+		log_debug(jcon->log,
+			  "%"PRIu64" requests (%zu at once at most),"
+			  " %"PRIu64" yields,"
+			  " latency average %"PRIu64"usec max %"PRIu64"usec",
+			  jcon->num_requests, jcon->max_commands,
+			  jcon->num_yields,
+			  jcon->total_usec / jcon->num_requests,
+			  jcon->max_usec);
+
 	/* Make sure this happens last! */
 	tal_free(jcon->log);
 }
@@ -424,17 +492,79 @@ static const struct json_command *find_cmd(const struct jsonrpc *rpc,
 /* This can be called directly on shutdown, even with unfinished cmd */
 static void destroy_command(struct command *cmd)
 {
+	u64 usec;
+
 	if (!cmd->jcon) {
 		log_debug(cmd->ld->log,
 			    "Command returned result after jcon close");
 		return;
 	}
 	list_del_from(&cmd->jcon->commands, &cmd->list);
+	cmd->jcon->num_commands--;
+
+	usec = time_to_usec(timemono_between(time_mono(), cmd->start));
+	cmd->jcon->total_usec += usec;
+	if (usec > cmd->jcon->max_usec)
+		cmd->jcon->max_usec = usec;
+}
+
+/* Once every response is in, send them all. */
+static void batch_response_done(struct json_batch *batch)
+{
+	if (--batch->pending != 0)
+		return;
+
+	json_array_end(batch->js);
+	tal_steal(batch->jcon, batch->js);
+	jcon_add_json_stream(batch->jcon, batch->js);
+	json_stream_close(batch->js, NULL);
+	tal_free(batch);
+}
+
+static struct json_command_stats *command_stats(struct jsonrpc *rpc,
+						const char *name)
+{
+	struct json_command_stats *stats = strmap_get(&rpc->statsmap, name);
+
+	if (!stats) {
+		stats = talz(rpc, struct json_command_stats);
+		stats->name = tal_strdup(stats, name);
+		strmap_add(&rpc->statsmap, stats->name, stats);
+	}
+	return stats;
+}
+
+static void command_stats_done(struct command *cmd)
+{
+	struct json_command_stats *stats = cmd->stats;
+	u64 usec = time_to_usec(timemono_between(time_mono(), cmd->start));
+
+	stats->in_flight--;
+	if (cmd->failed)
+		stats->errors++;
+	stats->total_usec += usec;
+	if (usec > stats->max_usec)
+		stats->max_usec = usec;
+	if (ilog64(usec) < LATENCY_BUCKETS)
+		stats->latency[ilog64(usec)]++;
+	else
+		stats->latency[LATENCY_BUCKETS - 1]++;
 }
 
 struct command_result *command_raw_complete(struct command *cmd,
 					    struct json_stream *result)
 {
+	if (cmd->stats)
+		command_stats_done(cmd);
+
+	/* Part of a batch?  It gets sent with the others. */
+	if (cmd->batch) {
+		json_stream_splice(cmd->batch->js, result, cmd);
+		batch_response_done(cmd->batch);
+		tal_free(cmd);
+		return &complete;
+	}
+
 	json_stream_close(result, cmd);
 
 	/* If we have a jcon, it will free result for us. */
@@ -464,6 +594,7 @@ struct command_result *command_failed(struct command *cmd,
 	json_object_end(result);
 	json_object_compat_end(result);
 
+	cmd->failed = true;
 	return command_raw_complete(cmd, result);
 }
 
@@ -495,11 +626,17 @@ struct command_result *command_still_pending(struct command *cmd)
 }
 
 static void json_command_malformed(struct json_connection *jcon,
+				   struct json_batch *batch,
 				   const char *id,
 				   const char *error)
 {
 	/* NULL writer is OK here, since we close it immediately. */
-	struct json_stream *js = jcon_new_json_stream(jcon, jcon, NULL);
+	struct json_stream *js;
+
+	if (batch)
+		js = new_json_stream(tmpctx, NULL, NULL);
+	else
+		js = jcon_new_json_stream(jcon, jcon, NULL);
 
 	json_object_start(js, NULL);
 	json_add_string(js, "jsonrpc", "2.0");
@@ -510,15 +647,22 @@ static void json_command_malformed(struct json_connection *jcon,
 	json_object_end(js);
 	json_object_compat_end(js);
 
-	json_stream_close(js, NULL);
+	if (batch) {
+		json_stream_splice(batch->js, js, NULL);
+		batch_response_done(batch);
+	} else
+		json_stream_close(js, NULL);
 }
 
 struct json_stream *json_stream_raw_for_cmd(struct command *cmd)
 {
 	struct json_stream *js;
 
-	/* If they still care about the result, attach it to them. */
-	if (cmd->jcon)
+	/* If they still care about the result, attach it to them (unless
+	 * it's going into a batch response). */
+	if (cmd->batch)
+		js = new_json_stream(cmd, cmd, NULL);
+	else if (cmd->jcon)
 		js = jcon_new_json_stream(cmd, cmd->jcon, cmd);
 	else
 		js = new_json_stream(cmd, cmd, NULL);
@@ -583,14 +727,18 @@ struct json_stream *json_stream_fail(struct command *cmd,
 /* We return struct command_result so command_fail return value has a natural
  * sink; we don't actually use the result. */
 static struct command_result *
-parse_request(struct json_connection *jcon, const jsmntok_t tok[])
+parse_request(struct json_connection *jcon, struct json_batch *batch,
+	      const jsmntok_t tok[])
 {
 	const jsmntok_t *method, *id, *params;
 	struct command *c;
 	struct command_result *res;
 
+	/* Every request counts towards our turn, even a bad one. */
+	jcon->turn_requests++;
+
 	if (tok[0].type != JSMN_OBJECT) {
-		json_command_malformed(jcon, "null",
+		json_command_malformed(jcon, batch, "null",
 				       "Expected {} for json command");
 		return NULL;
 	}
@@ -600,11 +748,11 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 	id = json_get_member(jcon->buffer, tok, "id");
 
 	if (!id) {
-		json_command_malformed(jcon, "null", "No id");
+		json_command_malformed(jcon, batch, "null", "No id");
 		return NULL;
 	}
 	if (id->type != JSMN_STRING && id->type != JSMN_PRIMITIVE) {
-		json_command_malformed(jcon, "null",
+		json_command_malformed(jcon, batch, "null",
 				       "Expected string/primitive for id");
 		return NULL;
 	}
@@ -613,6 +761,7 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 	 * the connection since the command may outlive `conn`. */
 	c = tal(jcon->ld->jsonrpc, struct command);
 	c->jcon = jcon;
+	c->batch = batch;
 	c->ld = jcon->ld;
 	c->pending = false;
 	c->json_stream = NULL;
@@ -620,9 +769,16 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 			    json_tok_full(jcon->buffer, id),
 			    json_tok_full_len(id));
 	c->mode = CMD_NORMAL;
+	c->start = time_mono();
+	c->stats = NULL;
+	c->failed = false;
 	list_add_tail(&jcon->commands, &c->list);
 	tal_add_destructor(c, destroy_command);
 
+	jcon->num_requests++;
+	if (++jcon->num_commands > jcon->max_commands)
+		jcon->max_commands = jcon->num_commands;
+
 	if (!method || !params) {
 		return command_fail(c, JSONRPC2_INVALID_REQUEST,
 				    method ? "No params" : "No method");
@@ -646,6 +802,10 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 				    jcon->buffer + method->start);
 	}
 
+	c->stats = command_stats(jcon->ld->jsonrpc, c->json_cmd->name);
+	c->stats->calls++;
+	c->stats->in_flight++;
+
 	db_begin_transaction(jcon->ld->wallet->db);
 	res = c->json_cmd->dispatch(c, jcon->buffer, tok, params);
 	db_commit_transaction(jcon->ld->wallet->db);
@@ -664,6 +824,52 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 	return res;
 }
 
+/* JSON-RPC 2.0 lets them send an array of requests, to get an array of
+ * responses back: this saves a round trip for each one.  Each is a request
+ * as far as taking turns goes, so continue_batch() starts them a turn's worth
+ * at a time. */
+static void parse_batch(struct json_connection *jcon, const jsmntok_t *toks)
+{
+	struct json_batch *batch;
+
+	if (toks[0].size == 0) {
+		jcon->turn_requests++;
+		json_command_malformed(jcon, NULL, "null", "Empty batch");
+		tal_free(toks);
+		return;
+	}
+
+	batch = tal(jcon, struct json_batch);
+	batch->jcon = jcon;
+	batch->toks = tal_steal(batch, toks);
+	batch->next_tok = toks + 1;
+	batch->next = 0;
+	batch->js = new_json_stream(batch, NULL, jcon->log);
+	json_array_start(batch->js, NULL);
+	/* Don't let it complete before we've started them all. */
+	batch->pending = toks[0].size + 1;
+
+	jcon->batch = batch;
+}
+
+/* Start what this turn allows of jcon->batch: true once it's all started. */
+static bool continue_batch(struct json_connection *jcon)
+{
+	struct json_batch *batch = jcon->batch;
+
+	while (batch->next < batch->toks[0].size) {
+		if (jcon->turn_requests >= JSONRPC_REQUESTS_PER_TURN)
+			return false;
+		parse_request(jcon, batch, batch->next_tok);
+		batch->next_tok = json_next(batch->next_tok);
+		batch->next++;
+	}
+
+	jcon->batch = NULL;
+	batch_response_done(batch);
+	return true;
+}
+
 /* Mutual recursion */
 static struct io_plan *stream_out_complete(struct io_conn *conn,
 					   struct json_stream *js,
@@ -708,6 +914,7 @@ static struct io_plan *read_json(struct io_conn *conn,
 {
 	jsmntok_t *toks;
 	bool valid;
+	size_t consumed;
 
 	if (jcon->len_read)
 		log_io(jcon->log, LOG_IO_IN, "",
@@ -724,46 +931,59 @@ static struct io_plan *read_json(struct io_conn *conn,
 		return io_wait(conn, conn, read_json, jcon);
 	}
 
-	toks = json_parse_input(jcon->buffer, jcon->buffer, jcon->used, &valid);
-	if (!toks) {
-		if (!valid) {
-			log_unusual(jcon->log,
-				    "Invalid token in json input: '%.*s'",
-				    (int)jcon->used, jcon->buffer);
-			json_command_malformed(
-			    jcon, "null",
-			    "Invalid token in json input");
-			return io_halfclose(conn);
+	/* A batch we're part way through comes before anything after it (and
+	 * its tokens refer to the buffer, so we can't move that yet). */
+	if (!jcon->batch) {
+		/* This only tokenizes what's arrived since last time. */
+		toks = json_parse_incremental(jcon, jcon->input,
+					      jcon->buffer, jcon->used, &valid);
+		if (!toks) {
+			if (!valid) {
+				log_unusual(jcon->log,
+					    "Invalid token in json input:"
+					    " '%.*s'",
+					    (int)jcon->used, jcon->buffer);
+				json_command_malformed(
+				    jcon, NULL, "null",
+				    "Invalid token in json input");
+				return io_halfclose(conn);
+			}
+			/* We need more. */
+			goto read_more;
 		}
-		/* We need more. */
-		goto read_more;
-	}
 
-	/* Empty buffer? (eg. just whitespace). */
-	if (tal_count(toks) == 1) {
-		jcon->used = 0;
-		goto read_more;
+		if (toks[0].type == JSMN_ARRAY)
+			parse_batch(jcon, toks);
+		else {
+			parse_request(jcon, NULL, toks);
+			tal_free(toks);
+		}
 	}
 
-	parse_request(jcon, toks);
-
-	/* Remove first {}. */
-	memmove(jcon->buffer, jcon->buffer + toks[0].end,
-		tal_count(jcon->buffer) - toks[0].end);
-	jcon->used -= toks[0].end;
-
-	/* If we have more to process, try again.  FIXME: this still gets
-	 * first priority in io_loop, so can starve others.  Hack would be
-	 * a (non-zero) timer, but better would be to have io_loop avoid
-	 * such livelock */
-	if (jcon->used) {
-		tal_free(toks);
+	/* If we have more to process, try again: io_always() would run
+	 * before io_loop polls anything else, so once we've had our share we
+	 * go to the back of the queue. */
+	if ((jcon->batch && !continue_batch(jcon))
+	    || json_incremental_consumed(jcon->input) < jcon->used) {
 		jcon->len_read = 0;
-		return io_always(conn, read_json, jcon);
+		if (jcon->turn_requests < JSONRPC_REQUESTS_PER_TURN)
+			return io_always(conn, read_json, jcon);
+		jcon->turn_requests = 0;
+		jcon->num_yields++;
+		return io_sched_yield(jcon->ld->io_sched, conn, read_json, jcon);
 	}
+	jcon->turn_requests = 0;
 
 read_more:
-	tal_free(toks);
+	/* Only move what's left once we've handled all we can: at most part
+	 * of one request. */
+	consumed = json_incremental_consumed(jcon->input);
+	if (consumed) {
+		memmove(jcon->buffer, jcon->buffer + consumed,
+			jcon->used - consumed);
+		jcon->used -= consumed;
+		json_incremental_discard(jcon->input);
+	}
 	return io_read_partial(conn, jcon->buffer + jcon->used,
 			       tal_count(jcon->buffer) - jcon->used,
 			       &jcon->len_read, read_json, jcon);
@@ -780,9 +1000,15 @@ static struct io_plan *jcon_connected(struct io_conn *conn,
 	jcon->ld = ld;
 	jcon->used = 0;
 	jcon->buffer = tal_arr(jcon, char, 64);
+	jcon->input = new_json_incremental(jcon);
 	jcon->js_arr = tal_arr(jcon, struct json_stream *, 0);
 	jcon->len_read = 0;
 	list_head_init(&jcon->commands);
+	jcon->turn_requests = 0;
+	jcon->batch = NULL;
+	jcon->num_requests = jcon->num_yields = 0;
+	jcon->num_commands = jcon->max_commands = 0;
+	jcon->total_usec = jcon->max_usec = 0;
 
 	/* We want to log on destruction, so we free this in destructor. */
 	jcon->log = new_log(ld->log_book, ld->log_book, "%sjcon fd %i:",
@@ -875,6 +1101,7 @@ static bool jsonrpc_command_add_perm(struct lightningd *ld,
 static void destroy_jsonrpc(struct jsonrpc *jsonrpc)
 {
 	strmap_clear(&jsonrpc->usagemap);
+	strmap_clear(&jsonrpc->statsmap);
 }
 
 void jsonrpc_setup(struct lightningd *ld)
@@ -884,6 +1111,7 @@ void jsonrpc_setup(struct lightningd *ld)
 	ld->rpc_filename = default_rpcfile(ld);
 	ld->jsonrpc = tal(ld, struct jsonrpc);
 	strmap_init(&ld->jsonrpc->usagemap);
+	strmap_init(&ld->jsonrpc->statsmap);
 	ld->jsonrpc->commands = tal_arr(ld->jsonrpc, struct json_command *, 0);
 	ld->jsonrpc->log = new_log(ld->jsonrpc, ld->log_book, "jsonrpc");
 	for (size_t i=0; i<num_cmdlist; i++) {
@@ -1202,10 +1430,100 @@ static const struct json_command check_command = {
 
 AUTODATA(json_command, &check_command);
 
+static void json_add_command_stats(struct json_stream *response,
+				   const struct jsonrpc *rpc,
+				   const struct json_command_stats *stats)
+{
+	json_object_start(response, NULL);
+	json_add_string(response, "command", stats->name);
+	/* A plugin's command may have gone away. */
+	for (size_t i = 0; i < tal_count(rpc->commands); i++) {
+		if (streq(rpc->commands[i]->name, stats->name))
+			json_add_string(response, "category",
+					rpc->commands[i]->category);
+	}
+	json_add_u64(response, "calls", stats->calls);
+	json_add_num(response, "in_flight", stats->in_flight);
+	json_add_u64(response, "errors", stats->errors);
+	json_add_u64(response, "total_usec", stats->total_usec);
+	json_add_u64(response, "max_usec", stats->max_usec);
+	json_array_start(response, "latency");
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+		if (!stats->latency[i])
+			continue;
+		json_object_start(response, NULL);
+		if (i != LATENCY_BUCKETS - 1)
+			json_add_u64(response, "under_usec", (u64)1 << i);
+		json_add_u64(response, "count", stats->latency[i]);
+		json_object_end(response);
+	}
+	json_array_end(response);
+	json_object_end(response);
+}
+
+static bool add_command_stats(const char *name UNUSED,
+			      struct json_command_stats *stats,
+			      struct command *cmd)
+{
+	json_add_command_stats(cmd->json_stream, cmd->ld->jsonrpc, stats);
+	return true;
+}
+
+static struct command_result *json_getrpcstats(struct command *cmd,
+					       const char *buffer,
+					       const jsmntok_t *obj UNNEEDED,
+					       const jsmntok_t *params)
+{
+	struct json_stream *response;
+	struct json_command_stats *stats;
+	struct io_sched_stats sched;
+	const char *name;
+
+	if (!param(cmd, buffer, params,
+		   p_opt("command", param_string, &name),
+		   NULL))
+		return command_param_failed();
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "commands");
+	if (name) {
+		stats = strmap_get(&cmd->ld->jsonrpc->statsmap, name);
+		if (stats)
+			json_add_command_stats(response, cmd->ld->jsonrpc,
+					       stats);
+	} else
+		strmap_iterate(&cmd->ld->jsonrpc->statsmap,
+			       add_command_stats, cmd);
+	json_array_end(response);
+
+	io_sched_get_stats(cmd->ld->io_sched, &sched);
+	json_object_start(response, "scheduler");
+	json_add_u64(response, "yields", sched.yields);
+	json_add_num(response, "waiting", sched.waiting);
+	json_add_u64(response, "max_wait_usec", sched.max_wait_usec);
+	json_object_end(response);
+	return command_success(cmd, response);
+}
+
+static const struct json_command getrpcstats_command = {
+	"getrpcstats",
+	"utility",
+	json_getrpcstats,
+	"Show how many times each JSON-RPC command (or just {command}) has "
+	"been called, how many failed and how long they took.",
+	.verbose = "getrpcstats [command]\n"
+	"Each command has 'calls', 'in_flight', 'errors', 'total_usec' and "
+	"'max_usec', and 'latency': how many responses took under each "
+	"'under_usec' (a power of two) but at least the one before.  Only "
+	"commands which have been called are shown."
+};
+AUTODATA(json_command, &getrpcstats_command);
+
 #if DEVELOPER
 void jsonrpc_remove_memleak(struct htable *memtable,
 			    const struct jsonrpc *jsonrpc)
 {
 	memleak_remove_strmap(memtable, &jsonrpc->usagemap);
+	memleak_remove_strmap(memtable, &jsonrpc->statsmap);
 }
 #endif /* DEVELOPER */
@@ -4,6 +4,7 @@
 #include <bitcoin/chainparams.h>
 #include <ccan/autodata/autodata.h>
 #include <ccan/list/list.h>
+#include <ccan/time/time.h>
 #include <common/json.h>
 #include <lightningd/json_stream.h>
 #include <stdarg.h>
@@ -33,12 +34,21 @@ struct command {
 	const struct json_command *json_cmd;
 	/* The connection, or NULL if it closed. */
 	struct json_connection *jcon;
+	/* If we're part of a batch request (and jcon is still open), the
+	 * batch response we add ours to. */
+	struct json_batch *batch;
 	/* Have we been marked by command_still_pending?  For debugging... */
 	bool pending;
 	/* Tell param() how to process the command */
 	enum command_mode mode;
 	/* Have we started a json stream already?  For debugging. */
 	struct json_stream *json_stream;
+	/* When we read the request. */
+	struct timemono start;
+	/* Statistics for this json_cmd, once we know what it is. */
+	struct json_command_stats *stats;
+	/* Is the response an error? */
+	bool failed;
 };
 
 /**
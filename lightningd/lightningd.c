@@ -70,10 +70,12 @@
 #include <lightningd/connect_control.h>
 #include <lightningd/invoice.h>
 #include <lightningd/io_loop_with_timers.h>
+#include <lightningd/io_sched.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/log.h>
 #include <lightningd/onchain_control.h>
 #include <lightningd/options.h>
+#include <lightningd/plugin_hook.h>
 #include <onchaind/onchain_wire.h>
 #include <signal.h>
 #include <sys/stat.h>
@@ -196,6 +198,10 @@ static struct lightningd *new_lightningd(const tal_t *ctx)
 	ld->timers = tal(ld, struct timers);
 	timers_init(ld->timers, time_mono());
 
+	/*~ JSON-RPC connections and plugins take turns through this, so
+	 * none of them can hog the io_loop: see io_sched.c. */
+	ld->io_sched = new_io_sched(ld);
+
 	/*~ This is detailed in chaintopology.c */
 	ld->topology = new_topology(ld, ld->log);
 	ld->daemon_parent_fd = -1;
@@ -845,6 +851,9 @@ int main(int argc, char *argv[])
 
 	shutdown_subdaemons(ld);
 
+	/* The backup plugin must have everything before it goes. */
+	plugin_hook_db_flush();
+
 	/* Remove plugins. */
 	ld->plugins = tal_free(ld->plugins);
 
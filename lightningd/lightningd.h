@@ -73,6 +73,21 @@ struct config {
 
 	/* Minimal amount of effective funding_satoshis for accepting channels */
 	u64 min_capacity_sat;
+
+	/* Threads gossipd uses to answer getroute (0 means none) */
+	u32 getroute_threads;
+
+	/* Landmarks gossipd uses for goal-directed routing (0 means none) */
+	u32 getroute_landmarks;
+
+	/* How long gossipd remembers routes it found (0 means it doesn't) */
+	u32 getroute_cache_secs;
+
+	/* Threads gossipd checks gossip signatures on (0 means none) */
+	u32 gossip_verify_threads;
+
+	/* db_write hook calls outstanding at once (0 means wait for each) */
+	u32 db_write_pipeline;
 };
 
 struct lightningd {
@@ -118,6 +133,9 @@ struct lightningd {
 	/* Any pending timers. */
 	struct timers *timers;
 
+	/* Busy JSON-RPC connections and plugins take turns here. */
+	struct io_sched *io_sched;
+
 	/* Port we're listening on */
 	u16 portnum;
 
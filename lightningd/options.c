@@ -495,6 +495,21 @@ static const struct config testnet_config = {
 
 	/* Sets min_effective_htlc_capacity - at 1000$/BTC this is 10ct */
 	.min_capacity_sat = 10000,
+
+	/* Keep getroute off gossipd's main loop. */
+	.getroute_threads = 2,
+
+	/* Plain dijkstra unless asked. */
+	.getroute_landmarks = 0,
+
+	/* Always search afresh unless asked. */
+	.getroute_cache_secs = 0,
+
+	/* Initial gossip sync is mostly checking signatures. */
+	.gossip_verify_threads = 2,
+
+	/* Wait for the backup plugin on every commit unless asked. */
+	.db_write_pipeline = 0,
 };
 
 /* aka. "Dude, where's my coins?" */
@@ -564,6 +579,21 @@ static const struct config mainnet_config = {
 
 	/* Sets min_effective_htlc_capacity - at 1000$/BTC this is 10ct */
 	.min_capacity_sat = 10000,
+
+	/* Keep getroute off gossipd's main loop. */
+	.getroute_threads = 2,
+
+	/* Plain dijkstra unless asked. */
+	.getroute_landmarks = 0,
+
+	/* Always search afresh unless asked. */
+	.getroute_cache_secs = 0,
+
+	/* Initial gossip sync is mostly checking signatures. */
+	.gossip_verify_threads = 2,
+
+	/* Wait for the backup plugin on every commit unless asked. */
+	.db_write_pipeline = 0,
 };
 
 static void check_config(struct lightningd *ld)
@@ -589,6 +619,10 @@ static void check_config(struct lightningd *ld)
 
 	if (ld->use_proxy_always && !ld->proxyaddr)
 		fatal("--always-use-proxy needs --proxy");
+
+	if (ld->config.getroute_landmarks > UINT16_MAX)
+		fatal("--getroute-landmarks must be no more than %u",
+		      UINT16_MAX);
 }
 
 static void setup_default_config(struct lightningd *ld)
@@ -948,6 +982,21 @@ static void register_opts(struct lightningd *ld)
 	opt_register_arg("--min-capacity-sat", opt_set_u64, opt_show_u64,
 			 &ld->config.min_capacity_sat,
 			 "Minimum capacity in satoshis for accepting channels");
+	opt_register_arg("--getroute-threads", opt_set_u32, opt_show_u32,
+			 &ld->config.getroute_threads,
+			 "Threads gossipd uses to find routes (0 to use none)");
+	opt_register_arg("--getroute-landmarks", opt_set_u32, opt_show_u32,
+			 &ld->config.getroute_landmarks,
+			 "Landmarks gossipd aims route searches with (0 to use none)");
+	opt_register_arg("--getroute-cache-secs", opt_set_u32, opt_show_u32,
+			 &ld->config.getroute_cache_secs,
+			 "Seconds gossipd remembers routes it found (0 to not cache)");
+	opt_register_arg("--gossip-verify-threads", opt_set_u32, opt_show_u32,
+			 &ld->config.gossip_verify_threads,
+			 "Threads gossipd checks gossip signatures on (0 to use none)");
+	opt_register_arg("--db-write-pipeline", opt_set_u32, opt_show_u32,
+			 &ld->config.db_write_pipeline,
+			 "db_write hook calls outstanding at once (0 to wait for each)");
 	opt_register_arg("--addr", opt_add_addr, NULL,
 			 ld,
 			 "Set an IP address (v4 or v6) to listen on and announce to the network for incoming connections");
@@ -629,6 +629,8 @@ struct htlc_accepted_hook_payload {
 	struct channel *channel;
 	struct lightningd *ld;
 	u8 *next_onion;
+	/* When we asked the plugins. */
+	struct timemono start;
 };
 
 /* The possible return value types that a plugin may return for the
@@ -756,6 +758,10 @@ htlc_accepted_hook_callback(struct htlc_accepted_hook_payload *request,
 	u8 *channel_update;
 	struct hop_data *hop_data;
 	result = htlc_accepted_hook_deserialize(buffer, toks, &payment_preimage, &failure_code, &channel_update);
+	if (buffer)
+		log_debug(channel->log, "htlc_accepted hook took %"PRIu64" usec",
+			  time_to_usec(timemono_between(time_mono(),
+							request->start)));
 
 	hop_data = &rs->payload.v0;
 	switch (result) {
@@ -793,7 +799,8 @@ htlc_accepted_hook_callback(struct htlc_accepted_hook_payload *request,
 	tal_free(request);
 }
 
-REGISTER_PLUGIN_HOOK(htlc_accepted, htlc_accepted_hook_callback,
+REGISTER_PLUGIN_HOOK(htlc_accepted, PLUGIN_HOOK_CHAIN,
+		     htlc_accepted_hook_callback,
 		     struct htlc_accepted_hook_payload *,
 		     htlc_accepted_hook_serialize,
 		     struct htlc_accepted_hook_payload *);
@@ -904,6 +911,7 @@ static bool peer_accepted_htlc(struct channel *channel, u64 id,
 	hook_payload->hin = hin;
 	hook_payload->channel = channel;
 	hook_payload->next_onion = serialize_onionpacket(hook_payload, rs->next);
+	hook_payload->start = time_mono();
 
 	plugin_hook_call_htlc_accepted(ld, hook_payload, hook_payload);
 
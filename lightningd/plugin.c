@@ -13,6 +13,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <lightningd/io_loop_with_timers.h>
+#include <lightningd/io_sched.h>
 #include <lightningd/json.h>
 #include <lightningd/lightningd.h>
 #include <lightningd/notification.h>
@@ -32,6 +33,14 @@
  * `getmanifest` call anyway, that's what `init `is for. */
 #define PLUGIN_MANIFEST_TIMEOUT 60
 
+/* Most messages we handle from one plugin before letting others have a
+ * turn. */
+#define PLUGIN_MESSAGES_PER_TURN 16
+
+/* Most messages we queue for a plugin: one which isn't keeping up with its
+ * notifications gets killed, rather than using all our memory. */
+#define PLUGIN_MAX_QUEUED 1000
+
 struct plugins *plugins_new(const tal_t *ctx, struct log_book *log_book,
 			    struct lightningd *ld)
 {
@@ -41,12 +50,21 @@ struct plugins *plugins_new(const tal_t *ctx, struct log_book *log_book,
 	p->log_book = log_book;
 	p->log = new_log(p, log_book, "plugin-manager");
 	p->ld = ld;
+	p->manifest_timer = NULL;
 	return p;
 }
 
 static void destroy_plugin(struct plugin *p)
 {
 	list_del(&p->list);
+
+	if (p->num_messages)
+		log_debug(p->log,
+			  "%"PRIu64" messages, %"PRIu64" yields,"
+			  " at most %zu queued to send,"
+			  " %"PRIu64" notifications sent",
+			  p->num_messages, p->num_yields, p->max_js_arr,
+			  p->notifications_sent);
 }
 
 void plugin_register(struct plugins *plugins, const char* path TAKES)
@@ -86,7 +104,13 @@ void plugin_register(struct plugins *plugins, const char* path TAKES)
 	p->plugin_state = UNCONFIGURED;
 	p->js_arr = tal_arr(p, struct json_stream *, 0);
 	p->used = 0;
+	p->num_messages = p->num_yields = 0;
+	p->max_js_arr = 0;
+	p->notifications_sent = 0;
 	p->subscriptions = NULL;
+	p->debugging = false;
+	p->spawn_usec = p->manifest_usec = p->init_usec = UINT64_MAX;
+	p->hook_latency = tal_arr(p, struct plugin_hook_latency, 0);
 
 	p->log = new_log(p, plugins->log_book, "plugin-%s",
 			 path_basename(tmpctx, p->cmd));
@@ -155,6 +179,8 @@ static void plugin_send(struct plugin *plugin, struct json_stream *stream)
 {
 	tal_steal(plugin->js_arr, stream);
 	tal_arr_expand(&plugin->js_arr, stream);
+	if (tal_count(plugin->js_arr) > plugin->max_js_arr)
+		plugin->max_js_arr = tal_count(plugin->js_arr);
 	io_wake(plugin);
 }
 
@@ -258,18 +284,17 @@ static void plugin_response_handle(struct plugin *plugin,
  * Try to parse a complete message from the plugin's buffer.
  *
  * Internally calls the handler if it was able to fully parse a JSON message,
- * and returns true in that case.
+ * and returns true in that case.  Only what's arrived since last time gets
+ * tokenized, and the messages stay in the buffer until we've handled all we
+ * can.
  */
 static bool plugin_read_json_one(struct plugin *plugin)
 {
 	bool valid;
 	const jsmntok_t *toks, *jrtok, *idtok;
 
-	/* FIXME: This could be done more efficiently by storing the
-	 * toks and doing an incremental parse, like lightning-cli
-	 * does. */
-	toks = json_parse_input(plugin->buffer, plugin->buffer, plugin->used,
-				&valid);
+	toks = json_parse_incremental(tmpctx, plugin->input,
+				      plugin->buffer, plugin->used, &valid);
 	if (!toks) {
 		if (!valid) {
 			plugin_kill(plugin, "Failed to parse JSON response '%.*s'",
@@ -280,12 +305,6 @@ static bool plugin_read_json_one(struct plugin *plugin)
 		return false;
 	}
 
-	/* Empty buffer? (eg. just whitespace). */
-	if (tal_count(toks) == 1) {
-		plugin->used = 0;
-		return false;
-	}
-
 	jrtok = json_get_member(plugin->buffer, toks, "jsonrpc");
 	idtok = json_get_member(plugin->buffer, toks, "id");
 
@@ -341,10 +360,6 @@ static bool plugin_read_json_one(struct plugin *plugin)
 		plugin_response_handle(plugin, toks, idtok);
 	}
 
-	/* Move this object out of the buffer */
-	memmove(plugin->buffer, plugin->buffer + toks[0].end,
-		tal_count(plugin->buffer) - toks[0].end);
-	plugin->used -= toks[0].end;
 	tal_free(toks);
 	return true;
 }
@@ -353,15 +368,19 @@ static struct io_plan *plugin_read_json(struct io_conn *conn UNUSED,
 					struct plugin *plugin)
 {
 	bool success;
+	size_t num = 0, consumed;
 
-	log_io(plugin->log, LOG_IO_IN, "",
-	       plugin->buffer + plugin->used, plugin->len_read);
+	if (plugin->len_read)
+		log_io(plugin->log, LOG_IO_IN, "",
+		       plugin->buffer + plugin->used, plugin->len_read);
 
 	plugin->used += plugin->len_read;
+	plugin->len_read = 0;
 	if (plugin->used == tal_count(plugin->buffer))
 		tal_resize(&plugin->buffer, plugin->used * 2);
 
-	/* Read and process all messages from the connection */
+	/* Read and process the messages from the connection, until
+	 * others deserve a turn. */
 	do {
 		success = plugin_read_json_one(plugin);
 
@@ -369,7 +388,26 @@ static struct io_plan *plugin_read_json(struct io_conn *conn UNUSED,
 		 * resulted in it stopping, so let's check. */
 		if (plugin->stop)
 			return io_close(plugin->stdout_conn);
+
+		if (success && ++num == PLUGIN_MESSAGES_PER_TURN) {
+			plugin->num_messages += num;
+			plugin->num_yields++;
+			return io_sched_yield(plugin->plugins->ld->io_sched,
+					      plugin->stdout_conn,
+					      plugin_read_json, plugin);
+		}
 	} while (success);
+	plugin->num_messages += num;
+
+	/* Only move what's left once we've handled all we can: at most part
+	 * of one message. */
+	consumed = json_incremental_consumed(plugin->input);
+	if (consumed) {
+		memmove(plugin->buffer, plugin->buffer + consumed,
+			plugin->used - consumed);
+		plugin->used -= consumed;
+		json_incremental_discard(plugin->input);
+	}
 
 	/* Now read more from the connection */
 	return io_read_partial(plugin->stdout_conn,
@@ -427,10 +465,11 @@ static struct io_plan *plugin_stdin_conn_init(struct io_conn *conn,
 					      struct plugin *plugin)
 {
 	/* We write to their stdin */
-	/* We don't have anything queued yet, wait for notification */
+	/* We don't have anything queued yet, wait for notification (as an
+	 * output plan, so plugin_exclusive_loop services it). */
 	plugin->stdin_conn = conn;
 	io_set_finish(conn, plugin_conn_finish, plugin);
-	return io_wait(plugin->stdin_conn, plugin, plugin_write_json, plugin);
+	return io_out_wait(plugin->stdin_conn, plugin, plugin_write_json, plugin);
 }
 
 static struct io_plan *plugin_stdout_conn_init(struct io_conn *conn,
@@ -582,6 +621,7 @@ static void plugin_rpcmethod_cb(const char *buffer,
 
 	response = json_stream_raw_for_cmd(cmd);
 	json_stream_forward_change_id(response, buffer, toks, idtok, cmd->id);
+	cmd->failed = json_get_member(buffer, toks, "error") != NULL;
 	command_raw_complete(cmd, response);
 }
 
@@ -779,15 +819,37 @@ static bool plugin_hooks_add(struct plugin *plugin, const char *buffer,
 		return true;
 
 	for (int i = 0; i < hookstok->size; i++) {
-		char *name = json_strdup(NULL, plugin->buffer,
-					 json_get_arr(hookstok, i));
-		if (!plugin_hook_register(plugin, name)) {
+		const jsmntok_t *hooktok = json_get_arr(hookstok, i);
+		const jsmntok_t *nametok = hooktok, *observertok;
+		bool observer = false;
+		char *name;
+
+		/* Either "name", or {"name": "name", "observer": true} */
+		if (hooktok->type == JSMN_OBJECT) {
+			nametok = json_get_member(buffer, hooktok, "name");
+			observertok = json_get_member(buffer, hooktok,
+						      "observer");
+			if (!nametok
+			    || (observertok
+				&& !json_to_bool(buffer, observertok,
+						 &observer))) {
+				plugin_kill(plugin, "hook %.*s is invalid",
+					    json_tok_full_len(hooktok),
+					    json_tok_full(buffer, hooktok));
+				plugin_hook_unregister_all(plugin);
+				return false;
+			}
+		}
+		name = json_strdup(NULL, buffer, nametok);
+		if (!plugin_hook_register(plugin, name, observer)) {
 			plugin_kill(plugin,
 				    "could not register hook '%s', either the "
-				    "name doesn't exist or another plugin "
-				    "already registered it.",
+				    "name doesn't exist, another plugin "
+				    "already registered it, or it can't be "
+				    "observed.",
 				    name);
 			tal_free(name);
+			plugin_hook_unregister_all(plugin);
 			return false;
 		}
 		tal_free(name);
@@ -795,10 +857,35 @@ static bool plugin_hooks_add(struct plugin *plugin, const char *buffer,
 	return true;
 }
 
-static void plugin_manifest_timeout(struct plugin *plugin)
+static u64 usec_since(struct timemono start)
+{
+	return time_to_usec(timemono_between(time_mono(), start));
+}
+
+/* Started, but hasn't answered getmanifest yet? */
+static bool plugin_awaiting_manifest(const struct plugin *plugin)
+{
+	return plugin->spawn_usec != UINT64_MAX
+		&& plugin->manifest_usec == UINT64_MAX;
+}
+
+/* Name every plugin we're still waiting for, not just the first. */
+static void plugins_manifest_timeout(struct plugins *plugins)
 {
-	log_broken(plugin->log, "The plugin failed to respond to \"getmanifest\" in time, terminating.");
-	fatal("Can't recover from plugin failure, terminating.");
+	struct plugin *p;
+	bool failed = false;
+
+	plugins->manifest_timer = NULL;
+	list_for_each(&plugins->plugins, p, list) {
+		if (!plugin_awaiting_manifest(p) || p->debugging)
+			continue;
+		log_broken(p->log, "The plugin failed to respond to"
+			   " \"getmanifest\" in %"PRIu64" msec, terminating.",
+			   usec_since(p->step_start) / 1000);
+		failed = true;
+	}
+	if (failed)
+		fatal("Can't recover from plugin failure, terminating.");
 }
 
 /**
@@ -812,9 +899,14 @@ static void plugin_manifest_cb(const char *buffer,
 	const jsmntok_t *resulttok, *dynamictok;
 	bool dynamic_plugin;
 
+	plugin->manifest_usec = usec_since(plugin->step_start);
+
 	/* Check if all plugins have replied to getmanifest, and break
 	 * if they have and this is the startup init */
 	plugin->plugins->pending_manifests--;
+	if (plugin->plugins->pending_manifests == 0)
+		plugin->plugins->manifest_timer
+			= tal_free(plugin->plugins->manifest_timer);
 	if (plugin->plugins->startup && plugin->plugins->pending_manifests == 0)
 		io_break(plugin->plugins);
 
@@ -843,9 +935,6 @@ static void plugin_manifest_cb(const char *buffer,
 	 * the startup init, configure them */
 	if (!plugin->plugins->startup && plugin->plugins->pending_manifests == 0)
 		plugins_config(plugin->plugins);
-
-	/* Reset timer, it'd kill us otherwise. */
-	tal_free(plugin->timeout_timer);
 }
 
 /* If this is a valid plugin return full path name, otherwise NULL */
@@ -958,9 +1047,12 @@ void plugins_start(struct plugins *plugins, const char *dev_plugin_debug)
 	char **cmd;
 	int stdin, stdout;
 	struct jsonrpc_request *req;
+	bool deadline = false;
 
+	/* We spawn them all, then they all answer getmanifest at once. */
 	list_for_each(&plugins->plugins, p, list) {
-		if (p->plugin_state != UNCONFIGURED)
+		if (p->plugin_state != UNCONFIGURED
+		    || p->spawn_usec != UINT64_MAX)
 			continue;
 
 		bool debug;
@@ -970,6 +1062,7 @@ void plugins_start(struct plugins *plugins, const char *dev_plugin_debug)
 		cmd[0] = p->cmd;
 		if (debug)
 			cmd[1] = "--debugger";
+		p->step_start = time_mono();
 		p->pid = pipecmdarr(&stdin, &stdout, &pipecmd_preserve, cmd);
 
 		if (p->pid == -1)
@@ -977,7 +1070,10 @@ void plugins_start(struct plugins *plugins, const char *dev_plugin_debug)
 			      strerror(errno));
 		else
 			log_debug(plugins->log, "started(%u) %s", p->pid, p->cmd);
+		p->spawn_usec = usec_since(p->step_start);
+		p->step_start = time_mono();
 		p->buffer = tal_arr(p, char, 64);
+		p->input = new_json_incremental(p);
 		p->stop = false;
 
 		/* Create two connections, one read-only on top of p->stdin, and one
@@ -991,16 +1087,18 @@ void plugins_start(struct plugins *plugins, const char *dev_plugin_debug)
 
 		plugins->pending_manifests++;
 		/* Don't timeout if they're running a debugger. */
-		if (debug)
-			p->timeout_timer = NULL;
-		else {
-			p->timeout_timer
-				= new_reltimer(plugins->ld->timers, p,
-					       time_from_sec(PLUGIN_MANIFEST_TIMEOUT),
-					       plugin_manifest_timeout, p);
-		}
+		p->debugging = debug;
+		deadline |= !debug;
 		tal_free(cmd);
 	}
+
+	/* One deadline for all of them (or, if we're already waiting for
+	 * some, the one they have). */
+	if (deadline && !plugins->manifest_timer)
+		plugins->manifest_timer
+			= new_reltimer(plugins->ld->timers, plugins,
+				       time_from_sec(PLUGIN_MANIFEST_TIMEOUT),
+				       plugins_manifest_timeout, plugins);
 }
 
 void plugins_init(struct plugins *plugins, const char *dev_plugin_debug)
@@ -1026,6 +1124,7 @@ static void plugin_config_cb(const char *buffer,
 			     const jsmntok_t *idtok,
 			     struct plugin *plugin)
 {
+	plugin->init_usec = usec_since(plugin->step_start);
 	plugin->plugin_state = CONFIGURED;
 }
 
@@ -1038,6 +1137,7 @@ static void plugin_config(struct plugin *plugin)
 	const char *name;
 	struct jsonrpc_request *req;
 	struct lightningd *ld = plugin->plugins->ld;
+	plugin->step_start = time_mono();
 	req = jsonrpc_request_start(plugin, "init", plugin->log,
 				    plugin_config_cb, plugin);
 
@@ -1099,14 +1199,25 @@ static bool plugin_subscriptions_contains(struct plugin *plugin,
 void plugins_notify(struct plugins *plugins,
 		    const struct jsonrpc_notification *n TAKES)
 {
-	struct plugin *p;
+	struct plugin *p, *next;
 
 	/* If we're shutting down, ld->plugins will be NULL */
 	if (plugins) {
-		list_for_each(&plugins->plugins, p, list) {
-			if (plugin_subscriptions_contains(p, n->method))
-				plugin_send(p, json_stream_dup(p, n->stream,
-							       p->log));
+		list_for_each_safe(&plugins->plugins, p, next, list) {
+			if (!plugin_subscriptions_contains(p, n->method))
+				continue;
+			/* Notifications can matter (invoice_payment, say), so
+			 * we don't drop them: it has to keep up. */
+			if (tal_count(p->js_arr) >= PLUGIN_MAX_QUEUED) {
+				plugin_kill(p, "%zu messages queued: not keeping"
+					    " up with notifications",
+					    tal_count(p->js_arr));
+				continue;
+			}
+			/* They all write out the same buffer. */
+			plugin_send(p, json_stream_share(p, n->stream,
+							 p->log));
+			p->notifications_sent++;
 		}
 	}
 	if (taken(n))
@@ -1131,10 +1242,13 @@ void *plugin_exclusive_loop(struct plugin *plugin)
 
 	io_conn_out_exclusive(plugin->stdin_conn, true);
 	io_conn_exclusive(plugin->stdout_conn, true);
+	/* stdout_conn may be waiting for its turn. */
+	io_sched_exclusive(plugin->plugins->ld->io_sched, true);
 
 	/* We don't service timers here, either! */
 	ret = io_loop(NULL, NULL);
 
+	io_sched_exclusive(plugin->plugins->ld->io_sched, false);
 	io_conn_out_exclusive(plugin->stdin_conn, false);
 	if (io_conn_exclusive(plugin->stdout_conn, false))
 		fatal("Still io_exclusive after removing plugin %s?",
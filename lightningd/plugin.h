@@ -5,6 +5,7 @@
 #include <ccan/io/io.h>
 #include <ccan/take/take.h>
 #include <ccan/tal/tal.h>
+#include <ccan/time/time.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/log.h>
 
@@ -14,6 +15,12 @@ enum plugin_state {
 	CONFIGURED
 };
 
+/* How long a plugin has taken to answer calls to one hook. */
+struct plugin_hook_latency {
+	const char *hook;
+	u64 calls, total_usec, max_usec;
+};
+
 /**
  * A plugin, exposed as a stub so we can pass it as an argument.
  */
@@ -36,6 +43,8 @@ struct plugin {
 	/* Stuff we read */
 	char *buffer;
 	size_t used, len_read;
+	/* How far we've tokenized buffer. */
+	struct json_incremental *input;
 
 	/* Our json_streams. Since multiple streams could start
 	 * returning data at once, we always service these in order,
@@ -49,12 +58,27 @@ struct plugin {
 
 	const char **methods;
 
-	/* Timer to add a timeout to some plugin RPC calls. Used to
-	 * guarantee that `getmanifest` doesn't block indefinitely. */
-	const struct oneshot *timeout_timer;
+	/* Being debugged, so no deadline for `getmanifest`. */
+	bool debugging;
+
+	/* Startup timeline, for `plugin list`: when the current step
+	 * started, and how long spawning it, `getmanifest` and `init` took
+	 * (UINT64_MAX until done). */
+	struct timemono step_start;
+	u64 spawn_usec, manifest_usec, init_usec;
 
 	/* An array of subscribed topics */
 	char **subscriptions;
+
+	/* Statistics, logged when we're freed. */
+	u64 num_messages, num_yields;
+	size_t max_js_arr;
+
+	/* Notifications sent. */
+	u64 notifications_sent;
+
+	/* One for each hook it has answered. */
+	struct plugin_hook_latency *hook_latency;
 };
 
 /**
@@ -67,6 +91,9 @@ struct plugins {
 	size_t pending_manifests;
 	bool startup;
 
+	/* Deadline for all the plugins we started to answer `getmanifest`. */
+	const struct oneshot *manifest_timer;
+
 	/* Currently pending requests by their request ID */
 	UINTMAP(struct jsonrpc_request *) pending_requests;
 	struct log *log;
@@ -109,6 +109,32 @@ static struct command_result *json_plugin_control(struct command *cmd,
 		json_add_string(response, "name", p->cmd);
 		json_add_bool(response, "active",
 			      p->plugin_state == CONFIGURED);
+		json_add_num(response, "queued", tal_count(p->js_arr));
+		json_add_num(response, "max_queued", p->max_js_arr);
+		json_add_u64(response, "notifications_sent",
+			     p->notifications_sent);
+		/* Only the steps it has finished. */
+		json_object_start(response, "startup");
+		if (p->spawn_usec != UINT64_MAX)
+			json_add_u64(response, "spawn_usec", p->spawn_usec);
+		if (p->manifest_usec != UINT64_MAX)
+			json_add_u64(response, "manifest_usec",
+				     p->manifest_usec);
+		if (p->init_usec != UINT64_MAX)
+			json_add_u64(response, "init_usec", p->init_usec);
+		json_object_end(response);
+		json_array_start(response, "hook_latency");
+		for (size_t i = 0; i < tal_count(p->hook_latency); i++) {
+			const struct plugin_hook_latency *lat
+				= &p->hook_latency[i];
+			json_object_start(response, NULL);
+			json_add_string(response, "hook", lat->hook);
+			json_add_u64(response, "calls", lat->calls);
+			json_add_u64(response, "total_usec", lat->total_usec);
+			json_add_u64(response, "max_usec", lat->max_usec);
+			json_object_end(response);
+		}
+		json_array_end(response);
 		json_object_end(response);
 	}
 	json_array_end(response);
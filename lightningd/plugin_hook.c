@@ -1,5 +1,8 @@
 #include <ccan/io/io.h>
+#include <ccan/list/list.h>
 #include <common/memleak.h>
+#include <inttypes.h>
+#include <lightningd/json.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/plugin_hook.h>
 #include <wallet/db.h>
@@ -9,7 +12,13 @@
 struct plugin_hook_request {
 	const struct plugin_hook *hook;
 	void *cb_arg;
+	/* For PLUGIN_HOOK_CHAIN, serialized again for the next decider. */
+	void *payload;
 	struct db *db;
+
+	/* Who we're waiting for, and since when. */
+	struct plugin *plugin;
+	struct timemono sent;
 };
 
 static struct plugin_hook *plugin_hook_by_name(const char *name)
@@ -25,12 +34,82 @@ static struct plugin_hook *plugin_hook_by_name(const char *name)
 	return NULL;
 }
 
-bool plugin_hook_register(struct plugin *plugin, const char *method)
+/* Where the plugin is in `plugin list`. */
+static size_t plugin_index(const struct plugin *plugin)
+{
+	const struct plugin *p;
+	size_t i = 0;
+
+	list_for_each(&plugin->plugins->plugins, p, list) {
+		if (p == plugin)
+			break;
+		i++;
+	}
+	return i;
+}
+
+static bool plugin_arr_has(struct plugin **arr, const struct plugin *plugin)
+{
+	for (size_t i = 0; i < tal_count(arr); i++)
+		if (arr[i] == plugin)
+			return true;
+	return false;
+}
+
+static bool plugin_arr_remove(struct plugin ***arr, const struct plugin *plugin)
+{
+	for (size_t i = 0; i < tal_count(*arr); i++) {
+		if ((*arr)[i] == plugin) {
+			tal_arr_remove(arr, i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool plugin_hook_chain_add(struct plugin_hook *hook,
+				  struct plugin *plugin, bool observer)
+{
+	size_t i, n;
+
+	if (!hook->deciders) {
+		hook->deciders = notleak(tal_arr(NULL, struct plugin *, 0));
+		hook->observers = notleak(tal_arr(NULL, struct plugin *, 0));
+	}
+	if (plugin_arr_has(hook->deciders, plugin)
+	    || plugin_arr_has(hook->observers, plugin))
+		return false;
+
+	if (observer) {
+		tal_arr_expand(&hook->observers, plugin);
+		return true;
+	}
+
+	/* Manifests arrive in any order, but deciders are asked in the
+	 * order the plugins were given to us. */
+	n = tal_count(hook->deciders);
+	for (i = 0; i < n; i++)
+		if (plugin_index(hook->deciders[i]) > plugin_index(plugin))
+			break;
+	tal_resize(&hook->deciders, n + 1);
+	memmove(hook->deciders + i + 1, hook->deciders + i,
+		(n - i) * sizeof(hook->deciders[0]));
+	hook->deciders[i] = plugin;
+	return true;
+}
+
+bool plugin_hook_register(struct plugin *plugin, const char *method,
+			  bool observer)
 {
 	struct plugin_hook *hook = plugin_hook_by_name(method);
 	if (!hook) {
 		/* No such hook name registered */
 		return false;
+	} else if (hook->type == PLUGIN_HOOK_CHAIN) {
+		return plugin_hook_chain_add(hook, plugin, observer);
+	} else if (observer) {
+		/* Only chained hooks can have observers */
+		return false;
 	} else if (hook->plugin != NULL) {
 		/* Another plugin already registered for this name */
 		return false;
@@ -45,6 +124,9 @@ bool plugin_hook_unregister(struct plugin *plugin, const char *method)
 	if (!hook) {
 		/* No such hook name registered */
 		return false;
+	} else if (hook->type == PLUGIN_HOOK_CHAIN) {
+		return plugin_arr_remove(&hook->deciders, plugin)
+			|| plugin_arr_remove(&hook->observers, plugin);
 	} else if (hook->plugin == NULL) {
 		/* This name is not registered */
 		return false;
@@ -60,55 +142,169 @@ void plugin_hook_unregister_all(struct plugin *plugin)
 	if (!hooks)
 		hooks = autodata_get(hooks, &num_hooks);
 
-	for (size_t i = 0; i < num_hooks; i++)
+	for (size_t i = 0; i < num_hooks; i++) {
 		if (hooks[i]->plugin == plugin)
 			hooks[i]->plugin = NULL;
+		plugin_arr_remove(&hooks[i]->deciders, plugin);
+		plugin_arr_remove(&hooks[i]->observers, plugin);
+	}
+}
+
+/* Keep track of how long each plugin takes to answer each hook. */
+static void plugin_hook_answered(struct plugin_hook_request *r)
+{
+	struct plugin_hook_latency *lat = NULL;
+	u64 usec = time_to_usec(timemono_between(time_mono(), r->sent));
+
+	for (size_t i = 0; i < tal_count(r->plugin->hook_latency); i++) {
+		if (streq(r->plugin->hook_latency[i].hook, r->hook->name)) {
+			lat = &r->plugin->hook_latency[i];
+			break;
+		}
+	}
+	if (!lat) {
+		struct plugin_hook_latency newlat;
+		newlat.hook = r->hook->name;
+		newlat.calls = newlat.total_usec = newlat.max_usec = 0;
+		tal_arr_expand(&r->plugin->hook_latency, newlat);
+		lat = &r->plugin->hook_latency[tal_count(r->plugin->hook_latency)-1];
+	}
+	lat->calls++;
+	lat->total_usec += usec;
+	if (usec > lat->max_usec)
+		lat->max_usec = usec;
+	log_debug(r->plugin->log, "%s hook answered in %"PRIu64" usec",
+		  r->hook->name, usec);
+}
+
+static void plugin_hook_send(struct plugin_hook_request *r,
+			     struct plugin *plugin, bool observer);
+
+/* The decider after r->plugin, if any. */
+static struct plugin *next_decider(const struct plugin_hook_request *r)
+{
+	struct plugin **deciders = r->hook->deciders;
+
+	for (size_t i = 0; i + 1 < tal_count(deciders); i++)
+		if (deciders[i] == r->plugin)
+			return deciders[i+1];
+	return NULL;
+}
+
+static bool hook_result_continue(const char *buffer, const jsmntok_t *resulttok)
+{
+	const jsmntok_t *t = json_get_member(buffer, resulttok, "result");
+	return t && json_tok_streq(buffer, t, "continue");
 }
 
 /**
  * Callback to be passed to the jsonrpc_request.
  *
  * Unbundles the arguments, deserializes the response and dispatches
- * it to the hook callback.
+ * it to the hook callback (or, if it says continue, to the next plugin
+ * in the chain).
  */
 static void plugin_hook_callback(const char *buffer, const jsmntok_t *toks,
 				 const jsmntok_t *idtok,
 				 struct plugin_hook_request *r)
 {
 	const jsmntok_t *resulttok = json_get_member(buffer, toks, "result");
+	struct plugin *next;
 
 	if (!resulttok)
 		fatal("Plugin for %s returned non-result response %.*s",
 		      r->hook->name,
 		      toks->end - toks->start, buffer + toks->start);
 
+	plugin_hook_answered(r);
+	if (r->hook->type == PLUGIN_HOOK_CHAIN
+	    && hook_result_continue(buffer, resulttok)
+	    && (next = next_decider(r)) != NULL) {
+		plugin_hook_send(r, next, false);
+		return;
+	}
+
 	db_begin_transaction(r->db);
 	r->hook->response_cb(r->cb_arg, buffer, resulttok);
 	db_commit_transaction(r->db);
 	tal_free(r);
 }
 
-void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
-		       void *payload, void *cb_arg)
+/* Observers only tell us how long they took. */
+static void plugin_hook_observed(const char *buffer, const jsmntok_t *toks,
+				 const jsmntok_t *idtok,
+				 struct plugin_hook_request *r)
+{
+	if (!json_get_member(buffer, toks, "result"))
+		log_unusual(r->plugin->log,
+			    "Observer for %s returned non-result response %.*s",
+			    r->hook->name,
+			    toks->end - toks->start, buffer + toks->start);
+	else
+		plugin_hook_answered(r);
+	tal_free(r);
+}
+
+static void plugin_hook_send(struct plugin_hook_request *r,
+			     struct plugin *plugin, bool observer)
 {
 	struct jsonrpc_request *req;
+
+	/* FIXME: technically this is a leak, but we don't
+	 * currently have a list to store these. We might want
+	 * to eventually to inspect in-flight requests. */
+	r->plugin = plugin;
+	tal_steal(plugin, r);
+	if (observer)
+		req = jsonrpc_request_start(NULL, r->hook->name,
+					    plugin_get_log(plugin),
+					    plugin_hook_observed, r);
+	else
+		req = jsonrpc_request_start(NULL, r->hook->name,
+					    plugin_get_log(plugin),
+					    plugin_hook_callback, r);
+	r->hook->serialize_payload(r->payload, req->stream);
+	jsonrpc_request_end(req);
+	r->sent = time_mono();
+	plugin_request_send(plugin, req);
+}
+
+static struct plugin_hook_request *
+new_plugin_hook_request(struct lightningd *ld, const struct plugin_hook *hook,
+			void *payload, void *cb_arg)
+{
 	struct plugin_hook_request *ph_req;
-	if (hook->plugin) {
+
+	ph_req = notleak(tal(NULL, struct plugin_hook_request));
+	ph_req->hook = hook;
+	ph_req->cb_arg = cb_arg;
+	ph_req->payload = payload;
+	ph_req->db = ld->wallet->db;
+	return ph_req;
+}
+
+void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
+		       void *payload, void *cb_arg)
+{
+	if (hook->type == PLUGIN_HOOK_CHAIN) {
+		/* Observers can't change the outcome, so don't wait. */
+		for (size_t i = 0; i < tal_count(hook->observers); i++)
+			plugin_hook_send(new_plugin_hook_request(ld, hook,
+								 payload, NULL),
+					 hook->observers[i], true);
+		if (tal_count(hook->deciders) != 0)
+			plugin_hook_send(new_plugin_hook_request(ld, hook,
+								 payload,
+								 cb_arg),
+					 hook->deciders[0], false);
+		else
+			hook->response_cb(cb_arg, NULL, NULL);
+	} else if (hook->plugin) {
 		/* If we have a plugin that has registered for this
 		 * hook, serialize and call it */
-		/* FIXME: technically this is a leak, but we don't
-		 * currently have a list to store these. We might want
-		 * to eventually to inspect in-flight requests. */
-		ph_req = notleak(tal(hook->plugin, struct plugin_hook_request));
-		req = jsonrpc_request_start(NULL, hook->name,
-					    plugin_get_log(hook->plugin),
-					    plugin_hook_callback, ph_req);
-		ph_req->hook = hook;
-		ph_req->cb_arg = cb_arg;
-		ph_req->db = ld->wallet->db;
-		hook->serialize_payload(payload, req->stream);
-		jsonrpc_request_end(req);
-		plugin_request_send(hook->plugin, req);
+		plugin_hook_send(new_plugin_hook_request(ld, hook, payload,
+							 cb_arg),
+				 hook->plugin, false);
 	} else {
 		/* If no plugin has registered for this hook, just
 		 * call the callback with a NULL result. Saves us the
@@ -120,15 +316,50 @@ void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
 }
 
 /* We open-code this, because it's just different and special enough to be
- * annoying, and to make it clear that it's totally synchronous. */
+ * annoying, and to make it clear that (by default) it's totally
+ * synchronous. */
 
 /* Special synchronous hook for db */
-static struct plugin_hook db_write_hook = { "db_write", NULL, NULL, NULL };
+static struct plugin_hook db_write_hook = { "db_write", PLUGIN_HOOK_SINGLE,
+					    NULL, NULL, NULL, NULL, NULL };
 AUTODATA(hooks, &db_write_hook);
 
-static void db_hook_response(const char *buffer, const jsmntok_t *toks,
-			     const jsmntok_t *idtok,
-			     struct plugin_hook_request *ph_req)
+/* With --db-write-pipeline, we don't wait for the plugin on each commit:
+ * we keep up to that many db_write calls outstanding, and batch what's
+ * committed meanwhile into the next one.  Instead, nothing may leave the
+ * node until the plugin has acknowledged everything committed before it
+ * (see plugin_hook_db_synced). */
+struct db_write_request {
+	/* In db_write_reqs */
+	struct list_node list;
+	/* Each db_write call gets the next sequence number. */
+	u64 seq;
+	bool acked;
+};
+
+/* Someone waiting for the plugin to acknowledge a db_write call. */
+struct db_write_waiter {
+	/* In db_write_waiters */
+	struct list_node list;
+	u64 seq;
+	void (*cb)(void *arg);
+	void *arg;
+};
+
+/* Last db_write call (or batch we've started), and the last one which the
+ * plugin has acknowledged, along with all those before it. */
+static u64 db_write_seq, db_write_acked;
+/* Calls still outstanding, oldest first. */
+static LIST_HEAD(db_write_reqs);
+static size_t db_write_in_flight;
+/* Waiters, in the order of the seq they wait for. */
+static LIST_HEAD(db_write_waiters);
+/* The next call, if changes are waiting for a slot. */
+static struct jsonrpc_request *db_write_batch;
+/* Set by plugin_hook_db_flush, so the last acknowledgement breaks out. */
+static bool db_write_flushing;
+
+static void check_db_write_response(const char *buffer, const jsmntok_t *toks)
 {
 	const jsmntok_t *resulttok;
 	bool resp;
@@ -146,38 +377,155 @@ static void db_hook_response(const char *buffer, const jsmntok_t *toks,
 	/* If it fails, we must not commit to our db. */
 	if (!resp)
 		fatal("Plugin returned failed db_write: %s.", buffer);
+}
+
+static void db_hook_response(const char *buffer, const jsmntok_t *toks,
+			     const jsmntok_t *idtok,
+			     struct plugin_hook_request *ph_req)
+{
+	check_db_write_response(buffer, toks);
 
 	/* We're done, exit exclusive loop. */
 	io_break(ph_req);
 }
 
+static void db_write_add(struct jsonrpc_request *req,
+			 const char **changes, const char *final)
+{
+	for (size_t i = 0; i < tal_count(changes); i++)
+		json_add_string(req->stream, NULL, changes[i]);
+	if (final)
+		json_add_string(req->stream, NULL, final);
+}
+
+static void db_write_send(struct plugin *plugin, struct jsonrpc_request *req)
+{
+	json_array_end(req->stream);
+	jsonrpc_request_end(req);
+	plugin_request_send(plugin, req);
+}
+
+static void destroy_db_write_request(struct db_write_request *dwreq)
+{
+	/* If the plugin dies, so do we: we've already committed these. */
+	if (!dwreq->acked)
+		fatal("db_write plugin went away before acknowledging %"PRIu64,
+		      dwreq->seq);
+	list_del_from(&db_write_reqs, &dwreq->list);
+}
+
+static void destroy_db_write_waiter(struct db_write_waiter *w)
+{
+	list_del_from(&db_write_waiters, &w->list);
+}
+
+static void send_db_write_batch(struct plugin *plugin)
+{
+	db_write_send(plugin, db_write_batch);
+	db_write_batch = NULL;
+	db_write_in_flight++;
+}
+
+static void db_write_response(const char *buffer, const jsmntok_t *toks,
+			      const jsmntok_t *idtok,
+			      struct db_write_request *dwreq)
+{
+	struct db_write_waiter *w;
+	struct plugin *plugin;
+
+	check_db_write_response(buffer, toks);
+	dwreq->acked = true;
+	db_write_in_flight--;
+
+	/* The plugin may answer out of order: we only care when everything
+	 * up to a call is acknowledged. */
+	while ((dwreq = list_top(&db_write_reqs, struct db_write_request, list))
+	       && dwreq->acked) {
+		db_write_acked = dwreq->seq;
+		tal_free(dwreq);
+	}
+
+	while ((w = list_top(&db_write_waiters, struct db_write_waiter, list))
+	       && w->seq <= db_write_acked) {
+		void (*cb)(void *arg) = w->cb;
+		void *arg = w->arg;
+
+		/* cb may free w's parent, so free w first. */
+		tal_free(w);
+		cb(arg);
+	}
+
+	plugin = db_write_hook.plugin;
+	if (db_write_batch
+	    && db_write_in_flight < plugin->plugins->ld->config.db_write_pipeline)
+		send_db_write_batch(plugin);
+
+	if (db_write_flushing && db_write_acked == db_write_seq)
+		io_break(&db_write_flushing);
+}
+
+static struct jsonrpc_request *db_write_start(struct plugin_hook_request *ph_req,
+					      struct db_write_request *dwreq)
+{
+	struct jsonrpc_request *req;
+
+	/* FIXME: do IO logging for this! */
+	if (ph_req)
+		req = jsonrpc_request_start(NULL, db_write_hook.name, NULL,
+					    db_hook_response, ph_req);
+	else
+		req = jsonrpc_request_start(NULL, db_write_hook.name, NULL,
+					    db_write_response, dwreq);
+	json_add_u64(req->stream, "seq", ++db_write_seq);
+	json_array_start(req->stream, "writes");
+	return req;
+}
+
+/* Changes go into the current batch, which we send if there's a slot. */
+static void plugin_hook_db_pipeline(struct plugin *plugin, u32 max,
+				    const char **changes, const char *final)
+{
+	if (!db_write_batch) {
+		struct db_write_request *dwreq;
+
+		dwreq = notleak(tal(plugin, struct db_write_request));
+		db_write_batch = db_write_start(NULL, dwreq);
+		dwreq->seq = db_write_seq;
+		dwreq->acked = false;
+		list_add_tail(&db_write_reqs, &dwreq->list);
+		tal_add_destructor(dwreq, destroy_db_write_request);
+	}
+	db_write_add(db_write_batch, changes, final);
+
+	if (db_write_in_flight < max)
+		send_db_write_batch(plugin);
+}
+
 void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
 {
 	const struct plugin_hook *hook = &db_write_hook;
 	struct jsonrpc_request *req;
 	struct plugin_hook_request *ph_req;
 	void *ret;
+	u32 max;
 
 	if (!hook->plugin)
 		return;
 
+	max = hook->plugin->plugins->ld->config.db_write_pipeline;
+	if (max) {
+		plugin_hook_db_pipeline(hook->plugin, max, changes, final);
+		return;
+	}
+
 	ph_req = notleak(tal(hook->plugin, struct plugin_hook_request));
-	/* FIXME: do IO logging for this! */
-	req = jsonrpc_request_start(NULL, hook->name, NULL, db_hook_response,
-				    ph_req);
+	req = db_write_start(ph_req, NULL);
 
 	ph_req->hook = hook;
 	ph_req->db = db;
 
-	json_array_start(req->stream, "writes");
-	for (size_t i = 0; i < tal_count(changes); i++)
-		json_add_string(req->stream, NULL, changes[i]);
-	if (final)
-		json_add_string(req->stream, NULL, final);
-	json_array_end(req->stream);
-	jsonrpc_request_end(req);
-
-	plugin_request_send(hook->plugin, req);
+	db_write_add(req, changes, final);
+	db_write_send(hook->plugin, req);
 
 	/* We can be called on way out of an io_loop, which is already breaking.
 	 * That will make this immediately return; save the break value and call
@@ -188,4 +536,44 @@ void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
 		assert(ret2 == ph_req);
 		io_break(ret);
 	}
+	db_write_acked = db_write_seq;
+}
+
+bool plugin_hook_db_synced_(const tal_t *ctx, void (*cb)(void *arg), void *arg)
+{
+	struct db_write_waiter *w;
+
+	if (db_write_acked == db_write_seq)
+		return true;
+
+	w = tal(ctx, struct db_write_waiter);
+	w->seq = db_write_seq;
+	w->cb = cb;
+	w->arg = arg;
+	list_add_tail(&db_write_waiters, &w->list);
+	tal_add_destructor(w, destroy_db_write_waiter);
+	return false;
+}
+
+void plugin_hook_db_flush(void)
+{
+	void *ret, *outer = NULL;
+
+	if (!db_write_hook.plugin)
+		return;
+
+	if (db_write_batch)
+		send_db_write_batch(db_write_hook.plugin);
+
+	db_write_flushing = true;
+	while (db_write_acked != db_write_seq) {
+		/* As in plugin_hook_db_sync, we may be inside a breaking
+		 * io_loop: hand that on once we're done. */
+		ret = plugin_exclusive_loop(db_write_hook.plugin);
+		if (ret != &db_write_flushing)
+			outer = ret;
+	}
+	db_write_flushing = false;
+	if (outer)
+		io_break(outer);
 }
@@ -36,6 +36,14 @@
  *   additional argument of type `cb_arg_type` can be passed along
  *   that may contain any additional context necessary.
  *
+ * Only one plugin may register for a `PLUGIN_HOOK_SINGLE` hook.  Any
+ * number may register for a `PLUGIN_HOOK_CHAIN` hook: the deciders are
+ * called in turn, and `response_cb` gets the first answer which isn't
+ * `{"result": "continue"}` (or the last one, or NULL if there are no
+ * deciders).  Observers are called alongside them, and nothing waits for
+ * their answers.  Since the payload is serialized again for each decider,
+ * it must remain valid until `response_cb` is called.
+ *
  *
  * To make hook invocations easier, each hook registered with
  * `REGISTER_PLUGIN_HOOK` provides a `plugin_hook_call_hookname`
@@ -44,13 +52,23 @@
  * and callback have the correct type.
  */
 
+enum plugin_hook_type {
+	PLUGIN_HOOK_SINGLE,
+	PLUGIN_HOOK_CHAIN,
+};
+
 struct plugin_hook {
 	const char *name;
+	enum plugin_hook_type type;
 	void (*response_cb)(void *arg, const char *buffer, const jsmntok_t *toks);
 	void (*serialize_payload)(void *src, struct json_stream *dest);
 
-	/* Which plugin has registered this hook? */
+	/* Which plugin has registered this hook? (PLUGIN_HOOK_SINGLE) */
 	struct plugin *plugin;
+
+	/* PLUGIN_HOOK_CHAIN: deciders, in the order of `plugin list`, and
+	 * observers. */
+	struct plugin **deciders, **observers;
 };
 AUTODATA_TYPE(hooks, struct plugin_hook);
 
@@ -84,10 +102,11 @@ void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
  * response_cb function accepts the deserialized response format and
  * an arbitrary extra argument used to maintain context.
  */
-#define REGISTER_PLUGIN_HOOK(name, response_cb, response_cb_arg_type,          \
+#define REGISTER_PLUGIN_HOOK(name, type, response_cb, response_cb_arg_type,    \
 			     serialize_payload, payload_type)                  \
 	struct plugin_hook name##_hook_gen = {                                 \
 	    stringify(name),                                                   \
+	    type,                                                              \
 	    typesafe_cb_cast(void (*)(void *, const char *, const jsmntok_t *),\
 			     void (*)(response_cb_arg_type,		       \
 				      const char *, const jsmntok_t *),	       \
@@ -96,11 +115,15 @@ void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
 			     void (*)(payload_type, struct json_stream *),     \
 			     serialize_payload),                               \
 	    NULL, /* .plugin */                                                \
+	    NULL, /* .deciders */                                              \
+	    NULL, /* .observers */                                             \
 	};                                                                     \
 	AUTODATA(hooks, &name##_hook_gen);                                     \
 	PLUGIN_HOOK_CALL_DEF(name, payload_type, response_cb_arg_type);
 
-bool plugin_hook_register(struct plugin *plugin, const char *method);
+/* Observers can only register for PLUGIN_HOOK_CHAIN hooks. */
+bool plugin_hook_register(struct plugin *plugin, const char *method,
+			  bool observer);
 
 /* Unregister a hook a plugin has registered for */
 bool plugin_hook_unregister(struct plugin *plugin, const char *method);
@@ -112,4 +135,23 @@ void plugin_hook_unregister_all(struct plugin *plugin);
  * final command appended. */
 void plugin_hook_db_sync(struct db *db, const char **changes, const char *final);
 
+/**
+ * plugin_hook_db_synced - has the db_write plugin got everything committed?
+ * @ctx: context to allocate the wait from; freeing it cancels the wait.
+ * @cb: callback once it has (if this returns false).
+ * @arg: argument to @cb.
+ *
+ * With --db-write-pipeline, commits don't wait for the plugin, so anything
+ * which would tell the outside world about our state (a message for a peer,
+ * a transaction to broadcast) must wait for this instead.
+ */
+#define plugin_hook_db_synced(ctx, cb, arg)				\
+	plugin_hook_db_synced_((ctx),					\
+			       typesafe_cb(void, void *, (cb), (arg)),	\
+			       (arg))
+bool plugin_hook_db_synced_(const tal_t *ctx, void (*cb)(void *arg), void *arg);
+
+/* Wait until the db_write plugin has acknowledged everything committed. */
+void plugin_hook_db_flush(void);
+
 #endif /* LIGHTNING_LIGHTNINGD_PLUGIN_HOOK_H */
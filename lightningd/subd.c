@@ -18,6 +18,7 @@
 #include <lightningd/log.h>
 #include <lightningd/log_status.h>
 #include <lightningd/peer_control.h>
+#include <lightningd/plugin_hook.h>
 #include <lightningd/subd.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -576,15 +577,13 @@ static void destroy_subd(struct subd *sd)
 	}
 }
 
-static struct io_plan *msg_send_next(struct io_conn *conn, struct subd *sd)
+static struct io_plan *msg_send_next(struct io_conn *conn, struct subd *sd);
+
+static struct io_plan *msg_send_synced(struct io_conn *conn, struct subd *sd)
 {
 	const u8 *msg = msg_dequeue(sd->outq);
 	int fd;
 
-	/* Nothing to do?  Wait for msg_enqueue. */
-	if (!msg)
-		return msg_queue_wait(conn, sd->outq, msg_send_next, sd);
-
 	fd = msg_extract_fd(msg);
 	if (fd >= 0) {
 		tal_free(msg);
@@ -593,6 +592,25 @@ static struct io_plan *msg_send_next(struct io_conn *conn, struct subd *sd)
 	return io_write_wire(conn, take(msg), msg_send_next, sd);
 }
 
+static void subd_db_synced(struct subd *sd)
+{
+	io_wake(&sd->outq);
+}
+
+static struct io_plan *msg_send_next(struct io_conn *conn, struct subd *sd)
+{
+	/* Nothing to do?  Wait for msg_enqueue. */
+	if (!msg_queue_length(sd->outq))
+		return msg_queue_wait(conn, sd->outq, msg_send_next, sd);
+
+	/* What we send may reveal what we've committed to our db (eg. a
+	 * revoke_and_ack), so the backup plugin must have it first. */
+	if (!plugin_hook_db_synced(sd, subd_db_synced, sd))
+		return io_out_wait(conn, &sd->outq, msg_send_synced, sd);
+
+	return msg_send_synced(conn, sd);
+}
+
 static struct io_plan *msg_setup(struct io_conn *conn, struct subd *sd)
 {
 	return io_duplex(conn,
@@ -0,0 +1,387 @@
+/* How many HTLCs a second can we handle with a backup plugin on the
+ * db_write hook?  Each channel commits an HTLC's changes, then must wait
+ * until the backup has them before telling its peer, as channeld does.  The
+ * stub backup plugin (a child process) takes --fsync-usec to "sync" what it
+ * has read before acknowledging all of it, as a real one would.  Compares
+ * no plugin, waiting for each commit, and --db-write-pipeline. */
+#include "../io_sched.c"
+#include "../json_stream.c"
+#include "../plugin.c"
+#include "../plugin_hook.c"
+#include <ccan/err/err.h>
+#include <ccan/read_write_all/read_write_all.h>
+#include <ccan/time/time.h>
+#include <common/bigsize.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
+bool deprecated_apis;
+
+/* Plugins log at debug level; anything else is us killing it. */
+void log_(struct log *log UNUSED, enum log_level level,
+	  bool call_notifier UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level != LOG_DBG) {
+		va_start(ap, fmt);
+		verrx(1, fmt, ap);
+	}
+}
+
+void fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	verrx(1, fmt, ap);
+}
+
+void log_io(struct log *log UNUSED, enum log_level dir UNUSED,
+	    const char *comment UNUSED,
+	    const void *data UNUSED, size_t len UNUSED)
+{
+}
+
+/* Our SQL has no quotes to escape. */
+void json_add_string(struct json_stream *result, const char *fieldname,
+		     const char *value TAKES)
+{
+	json_add_member(result, fieldname, true, "%s", value);
+	if (taken(value))
+		tal_free(value);
+}
+
+void json_add_u64(struct json_stream *result, const char *fieldname,
+		  uint64_t value)
+{
+	json_add_member(result, fieldname, false, "%"PRIu64, value);
+}
+
+/* As jsonrpc.c does it. */
+struct jsonrpc_request *jsonrpc_request_start_(
+    const tal_t *ctx, const char *method, struct log *log,
+    void (*response_cb)(const char *buffer, const jsmntok_t *toks,
+			const jsmntok_t *idtok, void *),
+    void *response_cb_arg)
+{
+	struct jsonrpc_request *r = tal(ctx, struct jsonrpc_request);
+	static u64 next_request_id = 0;
+
+	r->id = next_request_id++;
+	r->response_cb = response_cb;
+	r->response_cb_arg = response_cb_arg;
+	r->method = tal_strdup(r, method);
+	r->stream = new_json_stream(r, NULL, log);
+	json_object_start(r->stream, NULL);
+	json_add_string(r->stream, "jsonrpc", "2.0");
+	json_add_u64(r->stream, "id", r->id);
+	json_add_string(r->stream, "method", method);
+	json_object_start(r->stream, "params");
+	return r;
+}
+
+void jsonrpc_request_end(struct jsonrpc_request *r)
+{
+	json_object_end(r->stream);
+	json_object_end(r->stream);
+	json_stream_append(r->stream, "\n\n", strlen("\n\n"));
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for bigsize_get */
+size_t bigsize_get(const u8 *p UNNEEDED, size_t max UNNEEDED, bigsize_t *val UNNEEDED)
+{ fprintf(stderr, "bigsize_get called!\n"); abort(); }
+/* Generated stub for bigsize_put */
+size_t bigsize_put(u8 buf[BIGSIZE_MAX_LEN] UNNEEDED, bigsize_t v UNNEEDED)
+{ fprintf(stderr, "bigsize_put called!\n"); abort(); }
+/* Generated stub for command_param_failed */
+struct command_result *command_param_failed(void)
+
+{ fprintf(stderr, "command_param_failed called!\n"); abort(); }
+/* Generated stub for command_raw_complete */
+struct command_result *command_raw_complete(struct command *cmd UNNEEDED,
+					    struct json_stream *result UNNEEDED)
+{ fprintf(stderr, "command_raw_complete called!\n"); abort(); }
+/* Generated stub for command_still_pending */
+struct command_result *command_still_pending(struct command *cmd)
+
+{ fprintf(stderr, "command_still_pending called!\n"); abort(); }
+/* Generated stub for db_begin_transaction_ */
+void db_begin_transaction_(struct db *db UNNEEDED, const char *location UNNEEDED)
+{ fprintf(stderr, "db_begin_transaction_ called!\n"); abort(); }
+/* Generated stub for db_commit_transaction */
+void db_commit_transaction(struct db *db UNNEEDED)
+{ fprintf(stderr, "db_commit_transaction called!\n"); abort(); }
+/* Generated stub for io_loop_with_timers */
+void *io_loop_with_timers(struct lightningd *ld UNNEEDED)
+{ fprintf(stderr, "io_loop_with_timers called!\n"); abort(); }
+/* Generated stub for json_add_bool */
+void json_add_bool(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		   bool value UNNEEDED)
+{ fprintf(stderr, "json_add_bool called!\n"); abort(); }
+/* Generated stub for json_stream_raw_for_cmd */
+struct json_stream *json_stream_raw_for_cmd(struct command *cmd UNNEEDED)
+{ fprintf(stderr, "json_stream_raw_for_cmd called!\n"); abort(); }
+/* Generated stub for jsonrpc_command_add */
+bool jsonrpc_command_add(struct jsonrpc *rpc UNNEEDED, struct json_command *command UNNEEDED,
+			 const char *usage TAKES UNNEEDED)
+{ fprintf(stderr, "jsonrpc_command_add called!\n"); abort(); }
+/* Generated stub for new_log */
+struct log *new_log(const tal_t *ctx UNNEEDED, struct log_book *record UNNEEDED, const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "new_log called!\n"); abort(); }
+/* Generated stub for new_reltimer_ */
+struct oneshot *new_reltimer_(struct timers *timers UNNEEDED,
+			      const tal_t *ctx UNNEEDED,
+			      struct timerel expire UNNEEDED,
+			      void (*cb)(void *) UNNEEDED, void *arg UNNEEDED)
+{ fprintf(stderr, "new_reltimer_ called!\n"); abort(); }
+/* Generated stub for notifications_have_topic */
+bool notifications_have_topic(const char *topic UNNEEDED)
+{ fprintf(stderr, "notifications_have_topic called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+struct bench_channel {
+	size_t id;
+	/* Not waiting for the backup plugin? */
+	bool ready;
+};
+
+static size_t num_done;
+
+/* The backup plugin: each time it reads requests, it "syncs" them, then
+ * acknowledges them all at once. */
+static void stub_backup(int in, int out, unsigned int fsync_usec)
+{
+	char *buf = tal_arr(NULL, char, 65536);
+	size_t used = 0;
+	ssize_t r;
+
+	while ((r = read(in, buf + used, tal_count(buf) - used - 1)) > 0) {
+		char *resp = tal_strdup(buf, ""), *p = buf, *end;
+
+		used += r;
+		buf[used] = '\0';
+		while ((end = strstr(p, "\n\n")) != NULL) {
+			u64 id = strtoull(strstr(p, "\"id\":") + 5, NULL, 10);
+			tal_append_fmt(&resp, "{\"jsonrpc\":\"2.0\",\"id\":%"PRIu64
+				       ",\"result\":true}\n\n", id);
+			p = end + 2;
+		}
+		used -= p - buf;
+		memmove(buf, p, used);
+		if (used + 1 == tal_count(buf))
+			tal_resize(&buf, tal_count(buf) * 2);
+
+		if (strlen(resp)) {
+			usleep(fsync_usec);
+			if (!write_all(out, resp, strlen(resp)))
+				err(1, "Writing acknowledgements");
+		}
+		tal_free(resp);
+	}
+	exit(0);
+}
+
+/* io_sched's conn is still there, so io_loop won't stop by itself. */
+static void plugin_freed(struct plugin *p)
+{
+	io_break(p);
+}
+
+static struct plugin *start_backup(struct plugins *plugins,
+				   unsigned int fsync_usec)
+{
+	struct plugin *p = talz(plugins, struct plugin);
+	int to_plugin[2], from_plugin[2];
+
+	if (pipe(to_plugin) != 0 || pipe(from_plugin) != 0)
+		err(1, "pipe");
+
+	fflush(stdout);
+	p->pid = fork();
+	if (p->pid < 0)
+		err(1, "fork");
+	if (p->pid == 0) {
+		close(to_plugin[1]);
+		close(from_plugin[0]);
+		stub_backup(to_plugin[0], from_plugin[1], fsync_usec);
+	}
+	close(to_plugin[0]);
+	close(from_plugin[1]);
+
+	p->plugins = plugins;
+	p->cmd = "stub";
+	p->buffer = tal_arr(p, char, 64);
+	p->input = new_json_incremental(p);
+	p->js_arr = tal_arr(p, struct json_stream *, 0);
+	tal_add_destructor(p, plugin_freed);
+	io_new_conn(p, from_plugin[0], plugin_stdout_conn_init, p);
+	io_new_conn(p, to_plugin[1], plugin_stdin_conn_init, p);
+	db_write_hook.plugin = p;
+	return p;
+}
+
+static void stop_backup(struct plugin *p)
+{
+	int status;
+	pid_t pid = p->pid;
+
+	/* Closing its stdin makes it exit, and then p is freed. */
+	p->stop = true;
+	io_wake(p);
+	io_loop(NULL, NULL);
+	db_write_hook.plugin = NULL;
+
+	if (waitpid(pid, &status, 0) < 0
+	    || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "Stub plugin failed");
+}
+
+/* Roughly what an HTLC changing state writes. */
+static void commit_htlc(struct bench_channel *chan, size_t htlc)
+{
+	const char **changes = tal_arr(tmpctx, const char *, 3);
+
+	changes[0] = "BEGIN TRANSACTION;";
+	changes[1] = tal_fmt(changes, "UPDATE channel_htlcs SET hstate=%zu,"
+			     " payment_key=X'%064zx', malformed_onion=0,"
+			     " failuremsg=NULL, shared_secret=X'%064zx'"
+			     " WHERE id=%zu;", htlc % 20, htlc, htlc, htlc);
+	changes[2] = tal_fmt(changes, "UPDATE channels SET"
+			     " next_index_local=%zu, next_index_remote=%zu,"
+			     " msatoshi_local=%zu WHERE id=%zu;",
+			     htlc, htlc, 1000000 + htlc, chan->id);
+	plugin_hook_db_sync(NULL, changes, "COMMIT;");
+	clean_tmpctx();
+}
+
+/* Now we can tell the peer about it. */
+static void htlc_sent(struct bench_channel *chan)
+{
+	chan->ready = true;
+	num_done++;
+}
+
+static void htlc_synced(struct bench_channel *chan)
+{
+	htlc_sent(chan);
+	io_break(&num_done);
+}
+
+static u64 time_htlcs(struct lightningd *ld, struct plugins *plugins,
+		      unsigned int pipeline, bool backup,
+		      size_t num_channels, size_t num_htlcs,
+		      unsigned int fsync_usec, u64 *calls)
+{
+	struct bench_channel *chans = tal_arrz(NULL, struct bench_channel,
+					       num_channels);
+	struct plugin *p = NULL;
+	struct timemono start;
+	size_t num_started = 0;
+	u64 first_seq = db_write_seq;
+	u64 msec;
+
+	ld->config.db_write_pipeline = pipeline;
+	if (backup)
+		p = start_backup(plugins, fsync_usec);
+	for (size_t i = 0; i < num_channels; i++) {
+		chans[i].id = i;
+		chans[i].ready = true;
+	}
+
+	num_done = 0;
+	start = time_mono();
+	while (num_done < num_htlcs) {
+		bool any_ready = false;
+
+		for (size_t i = 0; i < num_channels; i++) {
+			if (!chans[i].ready || num_started == num_htlcs)
+				continue;
+			chans[i].ready = false;
+			commit_htlc(&chans[i], num_started++);
+			if (plugin_hook_db_synced(chans, htlc_synced, &chans[i]))
+				htlc_sent(&chans[i]);
+			any_ready |= chans[i].ready;
+		}
+		/* Someone's waiting for the backup. */
+		if (num_done < num_htlcs && !any_ready)
+			io_loop(NULL, NULL);
+	}
+	msec = time_to_msec(timemono_between(time_mono(), start));
+
+	plugin_hook_db_flush();
+	*calls = db_write_seq - first_seq;
+	if (p)
+		stop_backup(p);
+	tal_free(chans);
+	return msec;
+}
+
+static void report(const char *name, size_t num_htlcs, u64 msec, u64 calls)
+{
+	/* One name=value per line, so scripts can track them. */
+	printf("%s_msec=%"PRIu64"\n", name, msec);
+	printf("%s_htlcs_per_sec=%"PRIu64"\n", name,
+	       num_htlcs * 1000 / (msec ? msec : 1));
+	printf("%s_db_write_calls=%"PRIu64"\n", name, calls);
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	unsigned int num_channels = 10, num_htlcs = 200, fsync_usec = 100,
+		pipeline = 8;
+	struct lightningd *ld;
+	struct plugins *plugins;
+	u64 msec, calls;
+
+	setup_tmpctx();
+	opt_register_arg("--channels", opt_set_uintval, opt_show_uintval,
+			 &num_channels, "Channels adding HTLCs at once");
+	opt_register_arg("--htlcs", opt_set_uintval, opt_show_uintval,
+			 &num_htlcs, "Number of HTLCs to add");
+	opt_register_arg("--fsync-usec", opt_set_uintval, opt_show_uintval,
+			 &fsync_usec, "How long the backup takes to sync");
+	opt_register_arg("--pipeline", opt_set_uintval, opt_show_uintval,
+			 &pipeline, "--db-write-pipeline to use");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc != 1)
+		opt_usage_exit_fail("No arguments expected");
+	if (num_channels == 0 || pipeline == 0)
+		errx(1, "Need at least one channel, and a pipeline");
+
+	ld = tal(NULL, struct lightningd);
+	ld->io_sched = new_io_sched(ld);
+	plugins = tal(ld, struct plugins);
+	list_head_init(&plugins->plugins);
+	uintmap_init(&plugins->pending_requests);
+	plugins->ld = ld;
+	ld->plugins = plugins;
+
+	printf("htlcs=%u\n", num_htlcs);
+	printf("channels=%u\n", num_channels);
+	msec = time_htlcs(ld, plugins, 0, false, num_channels, num_htlcs,
+			  fsync_usec, &calls);
+	report("no_backup", num_htlcs, msec, calls);
+	assert(calls == 0);
+
+	msec = time_htlcs(ld, plugins, 0, true, num_channels, num_htlcs,
+			  fsync_usec, &calls);
+	report("sync", num_htlcs, msec, calls);
+	assert(calls == num_htlcs);
+
+	msec = time_htlcs(ld, plugins, pipeline, true, num_channels,
+			  num_htlcs, fsync_usec, &calls);
+	report("pipelined", num_htlcs, msec, calls);
+	assert(calls <= num_htlcs);
+
+	uintmap_clear(&plugins->pending_requests);
+	tal_free(ld);
+	opt_free_table();
+	tal_free(tmpctx);
+	return 0;
+}
@@ -0,0 +1,269 @@
+/* How much memory and time does it take to produce a huge response, like
+ * listinvoices on a node with 100,000 invoices?  Compares building it in one
+ * contiguous json_out then writing it, as json_stream used to, with
+ * json_stream's segments and writev, and with writing out a shared copy (as
+ * notifications are).  Each runs in its own process, so we can measure its
+ * peak RSS. */
+#include "../json_stream.c"
+#include <ccan/crypto/sha256/sha256.h>
+#include <ccan/err/err.h>
+#include <ccan/mem/mem.h>
+#include <ccan/opt/opt.h>
+#include <ccan/read_write_all/read_write_all.h>
+#include <ccan/time/time.h>
+#include <common/bigsize.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for bigsize_get */
+size_t bigsize_get(const u8 *p UNNEEDED, size_t max UNNEEDED, bigsize_t *val UNNEEDED)
+{ fprintf(stderr, "bigsize_get called!\n"); abort(); }
+/* Generated stub for bigsize_put */
+size_t bigsize_put(u8 buf[BIGSIZE_MAX_LEN] UNNEEDED, bigsize_t v UNNEEDED)
+{ fprintf(stderr, "bigsize_put called!\n"); abort(); }
+/* Generated stub for log_io */
+void log_io(struct log *log UNNEEDED, enum log_level dir UNNEEDED, const char *comment UNNEEDED,
+	    const void *data UNNEEDED, size_t len UNNEEDED)
+{ fprintf(stderr, "log_io called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+/* The length of a typical bolt11 string. */
+static const char bolt11[] = "lnbcrt10n1pwmfqxhpp5"
+	"qqqsyqcyq5rqwzqfqqqsyqcyq5rqwzqfqqqsyqcyq5rqwzqfqypqdq5xysxxatsyp3k7"
+	"enxv4jsxqzpuaztrnwngzn3kdzw5hydlzf03qdgm2hdq27cqv3agm2awhz5se903vruat"
+	"fhq77w3ls4evs3ch9zw97j25emudupq63nyw24cg27h2rspfj9srpqqqqqqqqqqqqqqqq"
+	"qqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq";
+
+/* Roughly what json_add_invoice produces, both ways. */
+static void add_invoice_jout(struct json_out *jout, size_t i)
+{
+	json_out_start(jout, NULL, '{');
+	json_out_add(jout, "label", true, "invoice-%zu", i);
+	json_out_add(jout, "bolt11", true, "%s", bolt11);
+	json_out_add(jout, "payment_hash", true, "%064zx", i);
+	json_out_add(jout, "msatoshi", false, "%zu", 1000 + i);
+	json_out_add(jout, "amount_msat", true, "%zumsat", 1000 + i);
+	json_out_add(jout, "status", true, "unpaid");
+	json_out_add(jout, "description", true, "Invoice number %zu", i);
+	json_out_add(jout, "expires_at", false, "%zu", 1560000000 + i);
+	json_out_end(jout, '}');
+}
+
+static void add_invoice(struct json_stream *js, size_t i)
+{
+	json_object_start(js, NULL);
+	json_add_member(js, "label", true, "invoice-%zu", i);
+	json_add_member(js, "bolt11", true, "%s", bolt11);
+	json_add_member(js, "payment_hash", true, "%064zx", i);
+	json_add_member(js, "msatoshi", false, "%zu", 1000 + i);
+	json_add_member(js, "amount_msat", true, "%zumsat", 1000 + i);
+	json_add_member(js, "status", true, "unpaid");
+	json_add_member(js, "description", true, "Invoice number %zu", i);
+	json_add_member(js, "expires_at", false, "%zu", 1560000000 + i);
+	json_object_end(js);
+}
+
+static struct json_out *build_jout(const tal_t *ctx, size_t num)
+{
+	struct json_out *jout = json_out_new(ctx);
+
+	json_out_start(jout, NULL, '{');
+	json_out_start(jout, "invoices", '[');
+	for (size_t i = 0; i < num; i++)
+		add_invoice_jout(jout, i);
+	json_out_end(jout, ']');
+	json_out_end(jout, '}');
+	json_out_finished(jout);
+	return jout;
+}
+
+static struct json_stream *build_stream(const tal_t *ctx, size_t num)
+{
+	struct json_stream *js = new_json_stream(ctx, NULL, NULL);
+
+	json_object_start(js, NULL);
+	json_array_start(js, "invoices");
+	for (size_t i = 0; i < num; i++)
+		add_invoice(js, i);
+	json_array_end(js);
+	json_object_end(js);
+	return js;
+}
+
+static bool stream_is(const struct json_stream *js,
+		      const char *prefix, const struct json_out *jout,
+		      const char *suffix)
+{
+	char *str = tal_arr(tmpctx, char, json_stream_unwritten(js));
+	const char *p;
+	size_t len;
+
+	json_stream_copy(str, js);
+	p = json_out_contents(jout, &len);
+	return tal_count(str) == strlen(prefix) + len + strlen(suffix)
+		&& memeq(str, strlen(prefix), prefix, strlen(prefix))
+		&& memeq(str + strlen(prefix), len, p, len)
+		&& memeq(str + strlen(prefix) + len, strlen(suffix),
+			 suffix, strlen(suffix));
+}
+
+/* Segments are shared by json_stream_share, and copied by
+ * json_stream_splice. */
+static void check_stream(size_t num)
+{
+	struct json_out *jout = build_jout(tmpctx, num);
+	struct json_stream *js = build_stream(tmpctx, num), *batch, *s1, *s2;
+
+	assert(!list_empty(&js->segments));
+	assert(stream_is(js, "", jout, ""));
+
+	/* Both share the one buffer, which outlives the original. */
+	s1 = json_stream_share(tmpctx, js, NULL);
+	s2 = json_stream_share(tmpctx, js, NULL);
+	assert(s1->shared && s1->shared == s2->shared);
+	assert(list_empty(&js->segments));
+	assert(stream_is(js, "", jout, ""));
+	assert(stream_is(s1, "", jout, ""));
+	json_stream_consume(s1, 10);
+	assert(stream_is(s2, "", jout, ""));
+	json_stream_consume(s1, json_stream_unwritten(s1));
+	assert(!s1->shared);
+
+	batch = new_json_stream(tmpctx, NULL, NULL);
+	json_array_start(batch, NULL);
+	json_stream_splice(batch, js, NULL);
+	json_array_end(batch);
+	assert(stream_is(batch, "[", jout, "]"));
+
+	tal_free(js);
+	assert(stream_is(s2, "", jout, ""));
+	clean_tmpctx();
+}
+
+static void write_contiguous(int fd, size_t num)
+{
+	struct json_out *jout = build_jout(NULL, num);
+	const char *p;
+	size_t len;
+
+	memcpy(json_out_direct(jout, 2), "\n\n", 2);
+	p = json_out_contents(jout, &len);
+	if (!write_all(fd, p, len))
+		err(1, "Writing contiguous");
+	tal_free(jout);
+}
+
+static struct io_plan *output_done(struct io_conn *conn,
+				   struct json_stream *js UNUSED,
+				   void *unused UNUSED)
+{
+	return io_close(conn);
+}
+
+static struct io_plan *start_output(struct io_conn *conn,
+				    struct json_stream *js)
+{
+	return json_stream_output(js, conn, output_done, NULL);
+}
+
+static void write_segmented(int fd, size_t num)
+{
+	struct json_stream *js = build_stream(NULL, num);
+
+	json_stream_close(js, NULL);
+	io_new_conn(js, fd, start_output, js);
+	io_loop(NULL, NULL);
+	tal_free(js);
+}
+
+/* As each plugin is sent a notification. */
+static void write_shared(int fd, size_t num)
+{
+	struct json_stream *js = build_stream(NULL, num), *shared;
+
+	json_stream_close(js, NULL);
+	shared = json_stream_share(js, js, NULL);
+	io_new_conn(js, fd, start_output, shared);
+	io_loop(NULL, NULL);
+	tal_free(js);
+}
+
+/* Runs writefn in a child, and returns the hash of what it wrote. */
+static void run(const char *name, void (*writefn)(int fd, size_t num),
+		size_t num, struct sha256 *hash)
+{
+	struct sha256_ctx sctx = SHA256_INIT;
+	int fds[2], status;
+	char buf[65536];
+	ssize_t len;
+	size_t total = 0;
+	pid_t pid;
+
+	if (pipe(fds) != 0)
+		err(1, "pipe");
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		err(1, "fork");
+	if (pid == 0) {
+		struct timemono start = time_mono();
+		struct rusage ru;
+
+		close(fds[0]);
+		writefn(fds[1], num);
+		close(fds[1]);
+		getrusage(RUSAGE_SELF, &ru);
+		printf("%s_msec=%"PRIu64"\n", name,
+		       time_to_msec(timemono_between(time_mono(), start)));
+		printf("%s_peak_rss_kb=%ld\n", name, ru.ru_maxrss);
+		exit(0);
+	}
+
+	close(fds[1]);
+	while ((len = read(fds[0], buf, sizeof(buf))) > 0) {
+		sha256_update(&sctx, buf, len);
+		total += len;
+	}
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) != pid
+	    || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "%s failed", name);
+	sha256_done(&sctx, hash);
+	printf("%s_bytes=%zu\n", name, total);
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	unsigned int num = 1000;
+	struct sha256 contiguous, segmented, shared;
+
+	setup_tmpctx();
+	opt_register_arg("--invoices", opt_set_uintval, opt_show_uintval,
+			 &num, "Number of invoices in the response");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc != 1)
+		opt_usage_exit_fail("No arguments expected");
+
+	check_stream(1000);
+
+	/* One name=value per line, so scripts can track them. */
+	printf("invoices=%u\n", num);
+	run("contiguous", write_contiguous, num, &contiguous);
+	run("segmented", write_segmented, num, &segmented);
+	run("shared", write_shared, num, &shared);
+	if (!sha256_eq(&contiguous, &segmented)
+	    || !sha256_eq(&contiguous, &shared))
+		errx(1, "Outputs differ");
+
+	opt_free_table();
+	tal_free(tmpctx);
+	return 0;
+}
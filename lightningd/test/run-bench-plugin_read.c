@@ -0,0 +1,287 @@
+/* How long does lightningd take to read what a plugin sends it?  A stub
+ * plugin (a child process) sends some huge responses, then a flood of log
+ * notifications, and we read them just as we would from a real plugin. */
+#include "../io_sched.c"
+#include "../plugin.c"
+#include <ccan/err/err.h>
+#include <ccan/read_write_all/read_write_all.h>
+#include <ccan/time/time.h>
+#include <common/bigsize.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
+static size_t num_logged, num_responses;
+
+bool deprecated_apis;
+
+/* Plugins log at debug level; anything else is us killing it. */
+void log_(struct log *log UNUSED, enum log_level level,
+	  bool call_notifier UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level != LOG_DBG) {
+		va_start(ap, fmt);
+		verrx(1, fmt, ap);
+	}
+	num_logged++;
+}
+
+void log_io(struct log *log UNUSED, enum log_level dir UNUSED,
+	    const char *comment UNUSED,
+	    const void *data UNUSED, size_t len UNUSED)
+{
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for bigsize_get */
+size_t bigsize_get(const u8 *p UNNEEDED, size_t max UNNEEDED, bigsize_t *val UNNEEDED)
+{ fprintf(stderr, "bigsize_get called!\n"); abort(); }
+/* Generated stub for bigsize_put */
+size_t bigsize_put(u8 buf[BIGSIZE_MAX_LEN] UNNEEDED, bigsize_t v UNNEEDED)
+{ fprintf(stderr, "bigsize_put called!\n"); abort(); }
+/* Generated stub for command_param_failed */
+struct command_result *command_param_failed(void)
+
+{ fprintf(stderr, "command_param_failed called!\n"); abort(); }
+/* Generated stub for command_raw_complete */
+struct command_result *command_raw_complete(struct command *cmd UNNEEDED,
+					    struct json_stream *result UNNEEDED)
+{ fprintf(stderr, "command_raw_complete called!\n"); abort(); }
+/* Generated stub for command_still_pending */
+struct command_result *command_still_pending(struct command *cmd)
+
+{ fprintf(stderr, "command_still_pending called!\n"); abort(); }
+/* Generated stub for fatal */
+void   fatal(const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "fatal called!\n"); abort(); }
+/* Generated stub for io_loop_with_timers */
+void *io_loop_with_timers(struct lightningd *ld UNNEEDED)
+{ fprintf(stderr, "io_loop_with_timers called!\n"); abort(); }
+/* Generated stub for json_add_bool */
+void json_add_bool(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		   bool value UNNEEDED)
+{ fprintf(stderr, "json_add_bool called!\n"); abort(); }
+/* Generated stub for json_add_string */
+void json_add_string(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED, const char *value UNNEEDED)
+{ fprintf(stderr, "json_add_string called!\n"); abort(); }
+/* Generated stub for json_object_end */
+void json_object_end(struct json_stream *js UNNEEDED)
+{ fprintf(stderr, "json_object_end called!\n"); abort(); }
+/* Generated stub for json_object_start */
+void json_object_start(struct json_stream *ks UNNEEDED, const char *fieldname UNNEEDED)
+{ fprintf(stderr, "json_object_start called!\n"); abort(); }
+/* Generated stub for json_stream_append */
+void json_stream_append(struct json_stream *js UNNEEDED, const char *str UNNEEDED, size_t len UNNEEDED)
+{ fprintf(stderr, "json_stream_append called!\n"); abort(); }
+/* Generated stub for json_stream_output_ */
+struct io_plan *json_stream_output_(struct json_stream *js UNNEEDED,
+				    struct io_conn *conn UNNEEDED,
+				    struct io_plan *(*cb)(struct io_conn *conn UNNEEDED,
+							  struct json_stream *js UNNEEDED,
+							  void *arg) UNNEEDED,
+				    void *arg UNNEEDED)
+{ fprintf(stderr, "json_stream_output_ called!\n"); abort(); }
+/* Generated stub for json_stream_raw_for_cmd */
+struct json_stream *json_stream_raw_for_cmd(struct command *cmd UNNEEDED)
+{ fprintf(stderr, "json_stream_raw_for_cmd called!\n"); abort(); }
+/* Generated stub for json_stream_share */
+struct json_stream *json_stream_share(const tal_t *ctx UNNEEDED,
+				      struct json_stream *original UNNEEDED,
+				      struct log *log UNNEEDED)
+{ fprintf(stderr, "json_stream_share called!\n"); abort(); }
+/* Generated stub for jsonrpc_command_add */
+bool jsonrpc_command_add(struct jsonrpc *rpc UNNEEDED, struct json_command *command UNNEEDED,
+			 const char *usage TAKES UNNEEDED)
+{ fprintf(stderr, "jsonrpc_command_add called!\n"); abort(); }
+/* Generated stub for jsonrpc_request_end */
+void jsonrpc_request_end(struct jsonrpc_request *request UNNEEDED)
+{ fprintf(stderr, "jsonrpc_request_end called!\n"); abort(); }
+/* Generated stub for jsonrpc_request_start_ */
+struct jsonrpc_request *jsonrpc_request_start_(
+    const tal_t *ctx UNNEEDED, const char *method UNNEEDED, struct log *log UNNEEDED,
+    void (*response_cb)(const char *buffer UNNEEDED, const jsmntok_t *toks UNNEEDED,
+			const jsmntok_t *idtok UNNEEDED, void *) UNNEEDED,
+    void *response_cb_arg UNNEEDED)
+{ fprintf(stderr, "jsonrpc_request_start_ called!\n"); abort(); }
+/* Generated stub for new_log */
+struct log *new_log(const tal_t *ctx UNNEEDED, struct log_book *record UNNEEDED, const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "new_log called!\n"); abort(); }
+/* Generated stub for new_reltimer_ */
+struct oneshot *new_reltimer_(struct timers *timers UNNEEDED,
+			      const tal_t *ctx UNNEEDED,
+			      struct timerel expire UNNEEDED,
+			      void (*cb)(void *) UNNEEDED, void *arg UNNEEDED)
+{ fprintf(stderr, "new_reltimer_ called!\n"); abort(); }
+/* Generated stub for notifications_have_topic */
+bool notifications_have_topic(const char *topic UNNEEDED)
+{ fprintf(stderr, "notifications_have_topic called!\n"); abort(); }
+/* Generated stub for plugin_hook_register */
+bool plugin_hook_register(struct plugin *plugin UNNEEDED, const char *method UNNEEDED,
+			  bool observer UNNEEDED)
+{ fprintf(stderr, "plugin_hook_register called!\n"); abort(); }
+/* Generated stub for plugin_hook_unregister_all */
+void plugin_hook_unregister_all(struct plugin *plugin UNNEEDED)
+{ fprintf(stderr, "plugin_hook_unregister_all called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+/* Like tal_append_fmt, without the strlen each time (*len excludes the
+ * NUL terminator). */
+static void PRINTF_FMT(3,4) append(char **buf, size_t *len,
+				   const char *fmt, ...)
+{
+	va_list ap;
+	char *piece;
+
+	va_start(ap, fmt);
+	piece = tal_vfmt(NULL, fmt, ap);
+	va_end(ap);
+
+	if (*len + strlen(piece) + 1 > tal_count(*buf))
+		tal_resize(buf, (*len + strlen(piece) + 1) * 2);
+	strcpy(*buf + *len, piece);
+	*len += strlen(piece);
+	tal_free(piece);
+}
+
+/* Something like what a listforwards replacement might return. */
+static void big_response(char **buf, size_t *len, u64 id, size_t bytes)
+{
+	size_t end = *len + bytes;
+
+	append(buf, len, "{\"jsonrpc\":\"2.0\",\"id\":%"PRIu64","
+	       "\"result\":{\"forwards\":[", id);
+	for (size_t i = 0; *len < end; i++)
+		append(buf, len, "%s{\"in_channel\":\"%zux1x0\","
+		       "\"out_channel\":\"%zux2x1\","
+		       "\"in_msatoshi\":%zu,\"out_msatoshi\":%zu,"
+		       "\"fee\":1,\"status\":\"settled\"}",
+		       i ? "," : "", i, i, 1000001 + i, 1000000 + i);
+	append(buf, len, "]}}\n\n");
+}
+
+static void log_notifications(char **buf, size_t *len, size_t num)
+{
+	for (size_t i = 0; i < num; i++)
+		append(buf, len, "{\"jsonrpc\":\"2.0\",\"method\":\"log\","
+		       "\"params\":{\"level\":\"debug\","
+		       "\"message\":\"Notification number %zu\"}}\n\n", i);
+}
+
+static void response_cb(const char *buffer UNUSED,
+			const jsmntok_t *toks UNUSED,
+			const jsmntok_t *idtok UNUSED, void *arg UNUSED)
+{
+	num_responses++;
+}
+
+/* io_sched's conn is still there, so io_loop won't stop by itself. */
+static void plugin_freed(struct plugin *p)
+{
+	io_break(p);
+}
+
+/* Feeds output to a new plugin, and times how long it takes to read it. */
+static u64 time_plugin(struct plugins *plugins, const char *output)
+{
+	struct plugin *p = talz(plugins, struct plugin);
+	struct timemono start;
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds) != 0)
+		err(1, "pipe");
+
+	fflush(stdout);
+	pid = p->pid = fork();
+	if (pid < 0)
+		err(1, "fork");
+	if (pid == 0) {
+		close(fds[0]);
+		if (!write_all(fds[1], output, strlen(output)))
+			err(1, "writing output");
+		exit(0);
+	}
+	close(fds[1]);
+
+	start = time_mono();
+	p->plugins = plugins;
+	p->cmd = "stub";
+	p->buffer = tal_arr(p, char, 64);
+	p->input = new_json_incremental(p);
+	tal_add_destructor(p, plugin_freed);
+	io_new_conn(p, fds[0], plugin_stdout_conn_init, p);
+	/* When the stub exits and the connection closes, p is freed. */
+	io_loop(NULL, NULL);
+
+	if (waitpid(pid, &status, 0) < 0
+	    || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "Stub plugin failed");
+	return time_to_msec(timemono_between(time_mono(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	unsigned int num_big = 2, big_bytes = 1000000, num_notes = 1000;
+	struct lightningd *ld;
+	struct plugins *plugins;
+	char *output;
+	size_t len;
+	u64 msec;
+
+	setup_tmpctx();
+	opt_register_arg("--responses", opt_set_uintval, opt_show_uintval,
+			 &num_big, "Number of big responses");
+	opt_register_arg("--response-bytes", opt_set_uintval,
+			 opt_show_uintval, &big_bytes, "Size of each response");
+	opt_register_arg("--notifications", opt_set_uintval,
+			 opt_show_uintval, &num_notes,
+			 "Number of log notifications");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc != 1)
+		opt_usage_exit_fail("No arguments expected");
+
+	ld = tal(NULL, struct lightningd);
+	ld->io_sched = new_io_sched(ld);
+	plugins = tal(ld, struct plugins);
+	list_head_init(&plugins->plugins);
+	uintmap_init(&plugins->pending_requests);
+	plugins->ld = ld;
+
+	output = tal_arr(ld, char, 1);
+	len = 0;
+	for (size_t i = 0; i < num_big; i++) {
+		struct jsonrpc_request *req = tal(plugins,
+						  struct jsonrpc_request);
+		req->id = i;
+		req->response_cb = response_cb;
+		req->response_cb_arg = NULL;
+		uintmap_add(&plugins->pending_requests, i, req);
+		big_response(&output, &len, i, big_bytes);
+	}
+
+	/* One name=value per line, so scripts can track them. */
+	printf("response_bytes=%zu\n", len);
+	msec = time_plugin(plugins, output);
+	if (num_responses != num_big)
+		errx(1, "Got %zu responses, not %u", num_responses, num_big);
+	printf("responses_msec=%"PRIu64"\n", msec);
+
+	len = 0;
+	log_notifications(&output, &len, num_notes);
+	printf("notifications=%u\n", num_notes);
+	msec = time_plugin(plugins, output);
+	if (num_logged != num_notes)
+		errx(1, "Got %zu notifications, not %u", num_logged, num_notes);
+	printf("notifications_msec=%"PRIu64"\n", msec);
+
+	uintmap_clear(&plugins->pending_requests);
+	tal_free(ld);
+	opt_free_table();
+	tal_free(tmpctx);
+	return 0;
+}
@@ -121,6 +121,9 @@ const char *log_prefix(const struct log *log UNNEEDED)
 /* Generated stub for log_status_msg */
 bool log_status_msg(struct log *log UNNEEDED, const u8 *msg UNNEEDED)
 { fprintf(stderr, "log_status_msg called!\n"); abort(); }
+/* Generated stub for new_io_sched */
+struct io_sched *new_io_sched(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "new_io_sched called!\n"); abort(); }
 /* Generated stub for new_log */
 struct log *new_log(const tal_t *ctx UNNEEDED, struct log_book *record UNNEEDED, const char *fmt UNNEEDED, ...)
 { fprintf(stderr, "new_log called!\n"); abort(); }
@@ -137,6 +140,12 @@ void onchaind_replay_channels(struct lightningd *ld UNNEEDED)
 /* Generated stub for per_peer_state_set_fds_arr */
 void per_peer_state_set_fds_arr(struct per_peer_state *pps UNNEEDED, const int *fds UNNEEDED)
 { fprintf(stderr, "per_peer_state_set_fds_arr called!\n"); abort(); }
+/* Generated stub for plugin_hook_db_flush */
+void plugin_hook_db_flush(void)
+{ fprintf(stderr, "plugin_hook_db_flush called!\n"); abort(); }
+/* Generated stub for plugin_hook_db_synced_ */
+bool plugin_hook_db_synced_(const tal_t *ctx UNNEEDED, void (*cb)(void *arg) UNNEEDED, void *arg UNNEEDED)
+{ fprintf(stderr, "plugin_hook_db_synced_ called!\n"); abort(); }
 /* Generated stub for plugins_config */
 void plugins_config(struct plugins *plugins UNNEEDED)
 { fprintf(stderr, "plugins_config called!\n"); abort(); }
@@ -0,0 +1,81 @@
+#include "../io_sched.c"
+#include <assert.h>
+#include <common/bigsize.h>
+#include <common/utils.h>
+#include <stdio.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for bigsize_get */
+size_t bigsize_get(const u8 *p UNNEEDED, size_t max UNNEEDED, bigsize_t *val UNNEEDED)
+{ fprintf(stderr, "bigsize_get called!\n"); abort(); }
+/* Generated stub for bigsize_put */
+size_t bigsize_put(u8 buf[BIGSIZE_MAX_LEN] UNNEEDED, bigsize_t v UNNEEDED)
+{ fprintf(stderr, "bigsize_put called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static struct io_sched *sched;
+static size_t busy_turns;
+
+/* Always has more to do, but yields each time. */
+static struct io_plan *busy(struct io_conn *conn, void *unused)
+{
+	busy_turns++;
+	return io_sched_yield(sched, conn, busy, unused);
+}
+
+static struct io_plan *quiet_read(struct io_conn *conn, void *unused)
+{
+	io_break(conn);
+	return io_close(conn);
+}
+
+static struct io_plan *quiet_init(struct io_conn *conn, char *byte)
+{
+	return io_read(conn, byte, 1, quiet_read, NULL);
+}
+
+static struct io_plan *yield_init(struct io_conn *conn, void *unused)
+{
+	return io_sched_yield(sched, conn, busy, unused);
+}
+
+int main(void)
+{
+	setup_locale();
+
+	int busyfds[2], quietfds[2], idlefds[2];
+	char byte;
+	struct io_conn *idle;
+	struct io_sched_stats stats;
+
+	setup_tmpctx();
+	sched = new_io_sched(tmpctx);
+
+	/* A connection which closes while waiting is forgotten. */
+	if (pipe(idlefds) != 0)
+		abort();
+	idle = io_new_conn(tmpctx, idlefds[0], yield_init, NULL);
+	io_sched_get_stats(sched, &stats);
+	assert(stats.waiting == 1);
+	tal_free(idle);
+	io_sched_get_stats(sched, &stats);
+	assert(stats.waiting == 0);
+
+	/* One connection which never stops, one with a byte to read: the
+	 * busy one used to starve the other. */
+	if (pipe(busyfds) != 0 || pipe(quietfds) != 0)
+		abort();
+	io_new_conn(tmpctx, busyfds[0], yield_init, NULL);
+	io_new_conn(tmpctx, quietfds[0], quiet_init, &byte);
+	if (write(quietfds[1], "x", 1) != 1)
+		abort();
+
+	/* With io_always(), this would never return. */
+	io_loop(NULL, NULL);
+	assert(busy_turns <= 1);
+	io_sched_get_stats(sched, &stats);
+	assert(stats.yields >= 1);
+
+	tal_free(tmpctx);
+	return 0;
+}
@@ -2,6 +2,15 @@
 #include "../jsonrpc.c"
 #include "../json.c"
 
+/* We run commands in test_json_batch, without a database. */
+void db_begin_transaction_(struct db *db UNUSED, const char *location UNUSED)
+{
+}
+
+void db_commit_transaction(struct db *db UNUSED)
+{
+}
+
 /* AUTOGENERATED MOCKS START */
 /* Generated stub for bigsize_get */
 size_t bigsize_get(const u8 *p UNNEEDED, size_t max UNNEEDED, bigsize_t *val UNNEEDED)
@@ -9,12 +18,6 @@ size_t bigsize_get(const u8 *p UNNEEDED, size_t max UNNEEDED, bigsize_t *val UNN
 /* Generated stub for bigsize_put */
 size_t bigsize_put(u8 buf[BIGSIZE_MAX_LEN] UNNEEDED, bigsize_t v UNNEEDED)
 { fprintf(stderr, "bigsize_put called!\n"); abort(); }
-/* Generated stub for db_begin_transaction_ */
-void db_begin_transaction_(struct db *db UNNEEDED, const char *location UNNEEDED)
-{ fprintf(stderr, "db_begin_transaction_ called!\n"); abort(); }
-/* Generated stub for db_commit_transaction */
-void db_commit_transaction(struct db *db UNNEEDED)
-{ fprintf(stderr, "db_commit_transaction called!\n"); abort(); }
 /* Generated stub for default_rpcfile */
 char *default_rpcfile(const tal_t *ctx UNNEEDED)
 { fprintf(stderr, "default_rpcfile called!\n"); abort(); }
@@ -30,6 +33,13 @@ const char *feerate_name(enum feerate feerate UNNEEDED)
 /* Generated stub for fmt_wireaddr_without_port */
 char *fmt_wireaddr_without_port(const tal_t *ctx UNNEEDED, const struct wireaddr *a UNNEEDED)
 { fprintf(stderr, "fmt_wireaddr_without_port called!\n"); abort(); }
+/* Generated stub for io_sched_yield_ */
+struct io_plan *io_sched_yield_(struct io_sched *sched UNNEEDED,
+				struct io_conn *conn UNNEEDED,
+				struct io_plan *(*next)(struct io_conn * UNNEEDED,
+							void *) UNNEEDED,
+				void *arg UNNEEDED)
+{ fprintf(stderr, "io_sched_yield_ called!\n"); abort(); }
 /* Generated stub for json_to_node_id */
 bool json_to_node_id(const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
 			       struct node_id *id UNNEEDED)
@@ -99,6 +109,11 @@ const char *param_subcommand(struct command *cmd UNNEEDED, const char *buffer UN
 			     const jsmntok_t tokens[] UNNEEDED,
 			     const char *name UNNEEDED, ...)
 { fprintf(stderr, "param_subcommand called!\n"); abort(); }
+/* Generated stub for param_string */
+struct command_result *param_string(struct command *cmd UNNEEDED, const char *name UNNEEDED,
+				    const char * buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
+				    const char **str UNNEEDED)
+{ fprintf(stderr, "param_string called!\n"); abort(); }
 /* Generated stub for param_tok */
 struct command_result *param_tok(struct command *cmd UNNEEDED, const char *name UNNEEDED,
 				 const char *buffer UNNEEDED, const jsmntok_t * tok UNNEEDED,
@@ -249,6 +264,186 @@ static void test_json_stream(void)
 	tal_free(talstr);
 }
 
+static struct command *later_cmd;
+
+static struct command_result *json_t_ok(struct command *cmd,
+					const char *buffer UNUSED,
+					const jsmntok_t *obj UNUSED,
+					const jsmntok_t *params UNUSED)
+{
+	struct json_stream *response = json_stream_success(cmd);
+	json_add_num(response, "x", 1);
+	return command_success(cmd, response);
+}
+
+static struct command_result *json_t_fail(struct command *cmd,
+					  const char *buffer UNUSED,
+					  const jsmntok_t *obj UNUSED,
+					  const jsmntok_t *params UNUSED)
+{
+	return command_fail(cmd, LIGHTNINGD, "Failed");
+}
+
+static struct command_result *json_t_later(struct command *cmd,
+					   const char *buffer UNUSED,
+					   const jsmntok_t *obj UNUSED,
+					   const jsmntok_t *params UNUSED)
+{
+	later_cmd = cmd;
+	return command_still_pending(cmd);
+}
+
+static struct json_command t_ok = { "t_ok", "test", json_t_ok, "" };
+static struct json_command t_fail = { "t_fail", "test", json_t_fail, "" };
+static struct json_command t_later = { "t_later", "test", json_t_later, "" };
+
+static bool tok_is(const char *buf, const jsmntok_t *tok, const char *str)
+{
+	return json_tok_full_len(tok) == strlen(str)
+		&& memeq(json_tok_full(buf, tok), json_tok_full_len(tok),
+			 str, strlen(str));
+}
+
+/* Parses the only response jcon has, and removes it. */
+static jsmntok_t *take_response(struct json_connection *jcon,
+				const char **str)
+{
+	size_t len;
+	bool valid;
+	jsmntok_t *toks;
+
+	assert(tal_count(jcon->js_arr) == 1);
+	assert(!json_stream_still_writing(jcon->js_arr[0]));
+	*str = json_out_contents(jcon->js_arr[0]->jout, &len);
+	*str = tal_strndup(jcon, *str, len);
+	tal_free(jcon->js_arr[0]);
+	tal_resize(&jcon->js_arr, 0);
+
+	toks = json_parse_input(jcon, *str, strlen(*str), &valid);
+	assert(toks);
+	return toks;
+}
+
+static void test_json_batch(void)
+{
+	struct lightningd *ld = tal(NULL, struct lightningd);
+	struct json_connection *jcon = talz(ld, struct json_connection);
+	const jsmntok_t *t;
+	jsmntok_t *toks;
+	const char *str;
+	bool valid;
+	size_t i;
+	/* Responses come in the order the commands complete. */
+	const char *ids[] = { "1", "3", "null", "5", "2" };
+	struct json_command_stats *stats;
+
+	ld->jsonrpc = tal(ld, struct jsonrpc);
+	ld->jsonrpc->commands = tal_arr(ld->jsonrpc, struct json_command *, 0);
+	tal_arr_expand(&ld->jsonrpc->commands, &t_ok);
+	tal_arr_expand(&ld->jsonrpc->commands, &t_fail);
+	tal_arr_expand(&ld->jsonrpc->commands, &t_later);
+	strmap_init(&ld->jsonrpc->statsmap);
+	ld->wallet = tal(ld, struct wallet);
+	ld->wallet->db = NULL;
+
+	jcon->ld = ld;
+	list_head_init(&jcon->commands);
+	jcon->js_arr = tal_arr(jcon, struct json_stream *, 0);
+
+	jcon->buffer = tal_strdup(jcon, "["
+	 "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"t_ok\",\"params\":{}},"
+	 "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"t_later\",\"params\":{}},"
+	 "{\"jsonrpc\":\"2.0\",\"id\":3,\"method\":\"t_fail\",\"params\":{}},"
+	 "4,"
+	 "{\"jsonrpc\":\"2.0\",\"id\":5,\"method\":\"t_none\",\"params\":{}}"
+	 "]");
+	toks = json_parse_input(jcon, jcon->buffer, strlen(jcon->buffer),
+				&valid);
+	parse_batch(jcon, toks);
+	assert(continue_batch(jcon));
+
+	/* Nothing is sent until they've all responded. */
+	assert(tal_count(jcon->js_arr) == 0);
+	assert(later_cmd);
+	stats = strmap_get(&ld->jsonrpc->statsmap, "t_later");
+	assert(stats->calls == 1 && stats->in_flight == 1);
+	was_pending(command_success(later_cmd, json_stream_success(later_cmd)));
+	assert(jcon->num_requests == 4);
+	assert(jcon->num_commands == 0);
+
+	/* Only the commands which exist are counted. */
+	assert(stats->calls == 1 && stats->in_flight == 0);
+	assert(stats->errors == 0);
+	stats = strmap_get(&ld->jsonrpc->statsmap, "t_fail");
+	assert(stats->calls == 1 && stats->in_flight == 0);
+	assert(stats->errors == 1);
+	assert(!strmap_get(&ld->jsonrpc->statsmap, "t_none"));
+
+	toks = take_response(jcon, &str);
+	assert(toks[0].type == JSMN_ARRAY);
+	assert(toks[0].size == ARRAY_SIZE(ids));
+	json_for_each_arr(i, t, toks) {
+		const jsmntok_t *result, *error;
+
+		assert(tok_is(str, json_get_member(str, t, "id"), ids[i]));
+		result = json_get_member(str, t, "result");
+		error = json_get_member(str, t, "error");
+		if (streq(ids[i], "1")) {
+			assert(tok_is(str, json_get_member(str, result, "x"),
+				      "1"));
+		} else if (streq(ids[i], "2")) {
+			assert(result && !error);
+		} else if (streq(ids[i], "3")) {
+			assert(tok_is(str, json_get_member(str, error, "code"),
+				      "-1"));
+		} else if (streq(ids[i], "null")) {
+			assert(tok_is(str, json_get_member(str, error, "code"),
+				      "-32600"));
+		} else {
+			assert(tok_is(str, json_get_member(str, error, "code"),
+				      "-32601"));
+		}
+	}
+
+	/* A batch bigger than a turn gets started a turn's worth at a time. */
+	jcon->turn_requests = 0;
+	jcon->buffer = tal_strdup(jcon, "[");
+	for (i = 0; i < 2 * JSONRPC_REQUESTS_PER_TURN + 1; i++)
+		tal_append_fmt(&jcon->buffer, "%s{\"jsonrpc\":\"2.0\","
+			       "\"id\":%zu,\"method\":\"t_ok\",\"params\":{}}",
+			       i ? "," : "", i);
+	tal_append_fmt(&jcon->buffer, "]");
+	toks = json_parse_input(jcon, jcon->buffer, strlen(jcon->buffer),
+				&valid);
+	parse_batch(jcon, toks);
+	for (i = 1; i <= 2; i++) {
+		assert(!continue_batch(jcon));
+		assert(jcon->batch->next == i * JSONRPC_REQUESTS_PER_TURN);
+		assert(jcon->turn_requests == JSONRPC_REQUESTS_PER_TURN);
+		assert(tal_count(jcon->js_arr) == 0);
+		/* The next turn. */
+		jcon->turn_requests = 0;
+	}
+	assert(continue_batch(jcon));
+	assert(!jcon->batch);
+	assert(jcon->turn_requests == 1);
+	toks = take_response(jcon, &str);
+	assert(toks[0].type == JSMN_ARRAY);
+	assert(toks[0].size == 2 * JSONRPC_REQUESTS_PER_TURN + 1);
+
+	/* An empty batch is just an error. */
+	jcon->buffer = tal_strdup(jcon, "[]");
+	toks = json_parse_input(jcon, jcon->buffer, strlen(jcon->buffer),
+				&valid);
+	parse_batch(jcon, toks);
+	toks = take_response(jcon, &str);
+	assert(toks[0].type == JSMN_OBJECT);
+	assert(json_get_member(str, toks, "error"));
+
+	strmap_clear(&ld->jsonrpc->statsmap);
+	tal_free(ld);
+}
+
 int main(void)
 {
 	setup_locale();
@@ -257,6 +452,7 @@ int main(void)
 	test_json_escape();
 	test_json_partial();
 	test_json_stream();
+	test_json_batch();
 	assert(!taken_any());
 	take_cleanup();
 }
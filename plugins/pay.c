@@ -12,6 +12,10 @@
 #include <plugins/libplugin.h>
 #include <stdio.h>
 
+/* How many routes to ask for at once: after a failure, we try the others
+ * before asking for more. */
+#define PAY_ROUTES_PER_LOOKUP 3
+
 /* Public key of this node. */
 static struct node_id my_id;
 static unsigned int maxdelay_default;
@@ -97,6 +101,10 @@ struct pay_command {
 	/* Channels which have failed us. */
 	const char **excludes;
 
+	/* Other routes from our last getroutes, to try before asking again
+	 * (for current_routehint, if any). */
+	const char **spare_routes;
+
 	/* Current routehint, if any. */
 	struct route_info *current_routehint;
 
@@ -263,6 +271,10 @@ static struct command_result *next_routehint(struct command *cmd,
 {
 	size_t num_attempts = count_sendpays(pc->ps->attempts);
 
+	/* Those were routes to the last routehint. */
+	tal_free(pc->spare_routes);
+	pc->spare_routes = tal_arr(pc, const char *, 0);
+
 	while (tal_count(pc->routehints) > 0) {
 		if (!routehint_excluded(pc->routehints[0], pc->excludes)) {
 			pc->current_routehint = pc->routehints[0];
@@ -494,22 +506,43 @@ static bool maybe_exclude(struct pay_command *pc,
 	return true;
 }
 
-static struct command_result *getroute_done(struct command *cmd,
-					    const char *buf,
-					    const jsmntok_t *result,
-					    struct pay_command *pc)
+/* Does this route use any channel we've excluded since we got it? */
+static bool route_excluded(struct pay_command *pc,
+			   const char *buf, const jsmntok_t *route)
+{
+	const jsmntok_t *t;
+	size_t i;
+
+	json_for_each_arr(i, t, route) {
+		const jsmntok_t *scid, *dir;
+
+		scid = json_get_member(buf, t, "channel");
+		dir = json_get_member(buf, t, "direction");
+		for (size_t j = 0; j < tal_count(pc->excludes); j++) {
+			const char *ex = pc->excludes[j];
+			size_t len = scid->end - scid->start;
+
+			/* Excludes are short_channel_id/direction */
+			if (strlen(ex) == len + 2
+			    && memcmp(ex, buf + scid->start, len) == 0
+			    && ex[len+1] == buf[dir->start])
+				return true;
+		}
+	}
+	return false;
+}
+
+static struct command_result *use_route(struct command *cmd,
+					const char *buf,
+					const jsmntok_t *t,
+					struct pay_command *pc)
 {
 	struct pay_attempt *attempt = current_attempt(pc);
-	const jsmntok_t *t = json_get_member(buf, result, "route");
 	struct amount_msat fee;
 	u32 delay;
 	double feepercent;
 	struct json_out *params;
 
-	if (!t)
-		plugin_err("getroute gave no 'route'? '%.*s'",
-			   result->end - result->start, buf);
-
 	if (pc->current_routehint) {
 		attempt->route = join_routehint(pc->ps->attempts, buf, t,
 						pc, pc->current_routehint);
@@ -524,16 +557,16 @@ static struct command_result *getroute_done(struct command *cmd,
 		attempt->route = json_strdup(pc->ps->attempts, buf, t);
 
 	if (!json_to_msat(buf, json_delve(buf, t, "[0].msatoshi"), &fee))
-		plugin_err("getroute with invalid msatoshi? %.*s",
-			   result->end - result->start, buf);
+		plugin_err("getroutes with invalid msatoshi? %.*s",
+			   json_tok_full_len(t), json_tok_full(buf, t));
 	if (!amount_msat_sub(&fee, fee, pc->msat))
 		plugin_err("final amount %s less than paid %s",
 			   type_to_string(tmpctx, struct amount_msat, &fee),
 			   type_to_string(tmpctx, struct amount_msat, &pc->msat));
 
 	if (!json_to_number(buf, json_delve(buf, t, "[0].delay"), &delay))
-		plugin_err("getroute with invalid delay? %.*s",
-			   result->end - result->start, buf);
+		plugin_err("getroutes with invalid delay? %.*s",
+			   json_tok_full_len(t), json_tok_full(buf, t));
 
 	/* Casting u64 to double will lose some precision. The loss of precision
 	 * in feepercent will be like 3.0000..(some dots)..1 % - 3.0 %.
@@ -618,22 +651,71 @@ static struct command_result *getroute_done(struct command *cmd,
 
 }
 
-static struct command_result *getroute_error(struct command *cmd,
+static struct command_result *getroutes_done(struct command *cmd,
 					     const char *buf,
-					     const jsmntok_t *error,
+					     const jsmntok_t *result,
 					     struct pay_command *pc)
+{
+	const jsmntok_t *routes = json_get_member(buf, result, "routes");
+	const jsmntok_t *r, *first = NULL;
+	size_t i;
+
+	if (!routes || routes->type != JSMN_ARRAY || routes->size == 0)
+		plugin_err("getroutes gave no 'routes'? '%.*s'",
+			   result->end - result->start, buf);
+
+	json_for_each_arr(i, r, routes) {
+		const jsmntok_t *t = json_get_member(buf, r, "route");
+
+		if (!t)
+			plugin_err("getroutes gave no 'route'? '%.*s'",
+				   result->end - result->start, buf);
+		if (!first)
+			first = t;
+		else
+			tal_arr_expand(&pc->spare_routes,
+				       json_strdup(pc->spare_routes, buf, t));
+	}
+
+	return use_route(cmd, buf, first, pc);
+}
+
+/* Try the next route from the last getroutes, if it's still any good. */
+static struct command_result *use_spare_route(struct command *cmd,
+					      struct pay_command *pc)
+{
+	while (tal_count(pc->spare_routes) > 0) {
+		const char *buf = tal_steal(tmpctx, pc->spare_routes[0]);
+		const jsmntok_t *toks;
+		bool valid;
+
+		tal_arr_remove(&pc->spare_routes, 0);
+		toks = json_parse_input(tmpctx, buf, strlen(buf), &valid);
+		if (!toks || !valid)
+			plugin_err("Bad spare route '%s'", buf);
+
+		if (!route_excluded(pc, buf, toks))
+			return use_route(cmd, buf, toks, pc);
+	}
+	return NULL;
+}
+
+static struct command_result *getroutes_error(struct command *cmd,
+					      const char *buf,
+					      const jsmntok_t *error,
+					      struct pay_command *pc)
 {
 	int code;
 	const jsmntok_t *codetok;
 
-	attempt_failed_tok(pc, "getroute", buf, error);
+	attempt_failed_tok(pc, "getroutes", buf, error);
 
 	codetok = json_get_member(buf, error, "code");
 	if (!json_to_int(buf, codetok, &code))
-		plugin_err("getroute error gave no 'code'? '%.*s'",
+		plugin_err("getroutes error gave no 'code'? '%.*s'",
 			   error->end - error->start, buf + error->start);
 
-	/* Strange errors from getroute should be forwarded. */
+	/* Strange errors from getroutes should be forwarded. */
 	if (code != PAY_ROUTE_NOT_FOUND)
 		return forward_error(cmd, buf, error, pc);
 
@@ -662,6 +744,7 @@ static struct command_result *start_pay_attempt(struct command *cmd,
 	va_list ap;
 	size_t n;
 	struct json_out *params;
+	struct command_result *ret;
 
 	n = tal_count(pc->ps->attempts);
 	tal_resize(&pc->ps->attempts, n+1);
@@ -709,7 +792,12 @@ static struct command_result *start_pay_attempt(struct command *cmd,
 		attempt->routehint = NULL;
 	}
 
-	/* OK, ask for route to destination */
+	/* Last time we asked, we got some alternatives: try those first. */
+	ret = use_spare_route(cmd, pc);
+	if (ret)
+		return ret;
+
+	/* OK, ask for routes to destination */
 	params = json_out_new(NULL);
 	json_out_start(params, NULL, '{');
 	json_out_addstr(params, "id", dest);
@@ -718,6 +806,7 @@ static struct command_result *start_pay_attempt(struct command *cmd,
 	json_out_add_u64(params, "cltv", cltv);
 	json_out_add_u64(params, "maxhops", max_hops);
 	json_out_add(params, "riskfactor", false, "%f", pc->riskfactor);
+	json_out_add_u64(params, "maxroutes", PAY_ROUTES_PER_LOOKUP);
 	if (tal_count(pc->excludes) != 0) {
 		json_out_start(params, "exclude", '[');
 		for (size_t i = 0; i < tal_count(pc->excludes); i++)
@@ -726,7 +815,7 @@ static struct command_result *start_pay_attempt(struct command *cmd,
 	}
 	json_out_end(params, '}');
 
-	return send_outreq(cmd, "getroute", getroute_done, getroute_error, pc,
+	return send_outreq(cmd, "getroutes", getroutes_done, getroutes_error, pc,
 			   take(params));
 }
 
@@ -1046,6 +1135,7 @@ static struct command_result *json_pay(struct command *cmd,
 					  &b11->payment_hash);
 	pc->stoptime = timeabs_add(time_now(), time_from_sec(*retryfor));
 	pc->excludes = tal_arr(cmd, const char *, 0);
+	pc->spare_routes = tal_arr(pc, const char *, 0);
 	pc->ps = add_pay_status(pc, b11str);
 	/* We try first without using routehint */
 	pc->current_routehint = NULL;
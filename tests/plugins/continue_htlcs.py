@@ -0,0 +1,16 @@
+#!/usr/bin/env python3
+"""Plugin that lets every HTLC through to whichever plugin is asked next.
+"""
+
+from lightning import Plugin
+
+plugin = Plugin()
+
+
+@plugin.hook("htlc_accepted")
+def on_htlc_accepted(htlc, plugin, **kwargs):
+    plugin.log("Letting htlc through")
+    return {'result': 'continue'}
+
+
+plugin.run()
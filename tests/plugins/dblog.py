@@ -3,6 +3,7 @@
 """
 from lightning import Plugin, RpcError
 import sqlite3
+import time
 
 plugin = Plugin()
 plugin.sqlite_pre_init_cmds = []
@@ -29,6 +30,8 @@ def db_write(plugin, writes, **kwargs):
         plugin.log("deferring {} commands".format(len(writes)))
         plugin.sqlite_pre_init_cmds += writes
     else:
+        # Pretend to be a slow (e.g. remote) backup.
+        time.sleep(float(plugin.get_option('dblog-delay')))
         for c in writes:
             plugin.conn.execute(c)
             plugin.log("{}".format(c))
@@ -36,4 +39,5 @@ def db_write(plugin, writes, **kwargs):
 
 
 plugin.add_option('dblog-file', None, 'The db file to create.')
+plugin.add_option('dblog-delay', '0', 'Seconds to wait before each write.')
 plugin.run()
@@ -0,0 +1,16 @@
+#!/usr/bin/env python3
+"""Plugin that watches HTLCs go by, without deciding what happens to them.
+"""
+
+from lightning import Plugin
+
+plugin = Plugin()
+
+
+@plugin.hook("htlc_accepted", observer=True)
+def on_htlc_accepted(htlc, plugin, **kwargs):
+    plugin.log("Observed htlc {}".format(htlc['payment_hash']))
+    return {'result': 'continue'}
+
+
+plugin.run()
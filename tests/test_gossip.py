@@ -1130,7 +1130,173 @@ def test_getroute_exclude(node_factory, bitcoind):
         l1.rpc.getroute(l4.info['id'], 1, 1, exclude=[chan_l2l3, chan_l2l4])
 
 
+@unittest.skipIf(not DEVELOPER, "gossip propagation is slow without DEVELOPER=1")
+def test_getroutes(node_factory, bitcoind):
+    """Test getroutes finds disjoint alternatives"""
+    l1, l2, l3, l4 = node_factory.line_graph(4, wait_for_announce=True)
+
+    # Only one way there.
+    route = l1.rpc.getroute(l4.info['id'], 1, 1)['route']
+    routes = l1.rpc.getroutes(l4.info['id'], 1, 1)['routes']
+    assert routes == [{'route': route}]
+
+    # Add another way from l2 to l4.
+    l2.rpc.connect(l4.info['id'], 'localhost', l4.port)
+    scid = l2.fund_channel(l4, 1000000, wait_for_active=False)
+    bitcoind.generate_block(5)
+    l1.daemon.wait_for_logs([r'update for channel {}/0 now ACTIVE'
+                             .format(scid),
+                             r'update for channel {}/1 now ACTIVE'
+                             .format(scid)])
+
+    # The direct route is best; but l1->l2 is in both, so only one.
+    routes = l1.rpc.getroutes(l4.info['id'], 1, 1)['routes']
+    assert len(routes) == 1
+    assert [h['id'] for h in routes[0]['route']] == [l2.info['id'], l4.info['id']]
+
+    # From l2, there are two.
+    routes = l1.rpc.getroutes(l4.info['id'], 1, 1, fromid=l2.info['id'])['routes']
+    assert len(routes) == 2
+    assert [h['id'] for h in routes[0]['route']] == [l4.info['id']]
+    assert [h['id'] for h in routes[1]['route']] == [l3.info['id'], l4.info['id']]
+
+    # We can ask for fewer.
+    assert len(l1.rpc.getroutes(l4.info['id'], 1, 1, fromid=l2.info['id'], maxroutes=1)['routes']) == 1
+    with pytest.raises(RpcError, match=r'maxroutes must be between'):
+        l1.rpc.getroutes(l4.info['id'], 1, 1, maxroutes=0)
+
+
+def test_getroutestats(node_factory):
+    """Test getroute with and without route threads"""
+    l1, l2 = node_factory.line_graph(2, wait_for_announce=True)
+    l3 = node_factory.get_node(options={'getroute-threads': 0})
+    l3.rpc.connect(l1.info['id'], 'localhost', l1.port)
+    wait_for(lambda: len(l3.rpc.listchannels()['channels']) == 2)
+
+    stats = l1.rpc.getroutestats()
+    assert stats['threads'] == 2
+    assert stats['answered'] == 0
+
+    # Replies come back in the order we asked.
+    route = l1.rpc.getroute(l2.info['id'], 1, 1)['route']
+    assert route[0]['id'] == l2.info['id']
+    with pytest.raises(RpcError):
+        l1.rpc.getroute(l1.info['id'], 1, 1)
+    assert l1.rpc.getroute(l2.info['id'], 1, 1)['route'] == route
+
+    stats = l1.rpc.getroutestats()
+    assert stats['answered'] == 3
+    assert stats['queued'] == 0
+    assert stats['running'] == 0
+    assert stats['max_queued'] >= 1
+
+    # Without threads, we answer immediately.
+    assert l3.rpc.getroute(l2.info['id'], 1, 1, fromid=l1.info['id'])['route'] == route
+    stats = l3.rpc.getroutestats()
+    assert stats['nodes_settled'] >= 2
+    del stats['nodes_settled']
+    assert stats == {'threads': 0, 'queued': 0,
+                     'running': 0, 'max_queued': 0,
+                     'answered': 1, 'landmarks': 0}
+
+
+def test_getroute_landmarks(node_factory):
+    """Landmarks are computed in the background, and give the same routes"""
+    l1, l2, l3, l4 = node_factory.line_graph(4, wait_for_announce=True,
+                                             opts={'getroute-landmarks': 2})
+
+    # The first query starts them off.
+    route = l1.rpc.getroute(l4.info['id'], 1000, 1, fuzzpercent=0)['route']
+    assert [h['id'] for h in route] == [l2.info['id'], l3.info['id'], l4.info['id']]
+    l1.daemon.wait_for_log('Using 2 routing landmarks')
+    assert l1.rpc.getroutestats()['landmarks'] == 2
+
+    before = l1.rpc.getroutestats()['nodes_settled']
+    assert l1.rpc.getroute(l4.info['id'], 1000, 1, fuzzpercent=0)['route'] == route
+    assert l1.rpc.getroutestats()['nodes_settled'] > before
+
+
+def test_getroute_cache(node_factory):
+    """Routes are cached until a channel on them changes"""
+    l1, l2, l3 = node_factory.line_graph(3, wait_for_announce=True,
+                                         opts={'getroute-cache-secs': 600})
+
+    route = l1.rpc.getroute(l3.info['id'], 1000, 1, fuzzpercent=0)['route']
+    assert l1.rpc.getroutestats()['cache'] == {'hits': 0, 'misses': 1,
+                                                'invalidated': 0, 'entries': 1}
+
+    # Same question, same answer (and a similar amount uses it too).
+    assert l1.rpc.getroute(l3.info['id'], 1000, 1, fuzzpercent=0)['route'] == route
+    route2 = l1.rpc.getroute(l3.info['id'], 1010, 1, fuzzpercent=0)['route']
+    assert route2[-1]['msatoshi'] == 1010
+    assert l1.rpc.getroutestats()['cache']['hits'] == 2
+
+    # A fee change on the route means we look again.
+    scid = route[1]['channel']
+    l2.rpc.setchannelfee(scid, 100, 1000)
+    wait_for(lambda: [c['base_fee_millisatoshi']
+                      for c in l1.rpc.listchannels(scid)['channels']
+                      if c['source'] == l2.info['id']] == [100])
+    route3 = l1.rpc.getroute(l3.info['id'], 1000, 1, fuzzpercent=0)['route']
+    assert route3[0]['msatoshi'] > route[0]['msatoshi']
+    assert l1.rpc.getroutestats()['cache'] == {'hits': 2, 'misses': 2,
+                                                'invalidated': 1, 'entries': 1}
+
+
 @unittest.skipIf(not DEVELOPER, "need dev-compact-gossip-store")
+def test_getroutetree(node_factory):
+    """One search prices what getroute would find to each node"""
+    l1, l2, l3, l4 = node_factory.line_graph(4, wait_for_announce=True)
+
+    dests = l1.rpc.getroutetree(100000, 1)['destinations']
+    assert set(d['id'] for d in dests) == set([l2.info['id'], l3.info['id'], l4.info['id']])
+    for d in dests:
+        route = l1.rpc.getroute(d['id'], 100000, 1, fuzzpercent=0)['route']
+        assert d['hops'] == len(route)
+        assert d['fee_msat'] == route[0]['amount_msat'] - 100000
+        assert d['delay'] == route[0]['delay']
+
+    # Just the ones we ask about, within maxhops.
+    dests = l1.rpc.getroutetree(100000, 1, ids=[l4.info['id'], l2.info['id']], maxhops=2)['destinations']
+    assert [d['id'] for d in dests] == [l2.info['id']]
+
+    with pytest.raises(RpcError, match=r'ids must not be empty'):
+        l1.rpc.getroutetree(100000, 1, ids=[])
+
+
+def test_listchannels_since(node_factory, bitcoind):
+    """listchannels and listnodes can return only what changed"""
+    l1, l2, l3 = node_factory.line_graph(3, wait_for_announce=True)
+    wait_for(lambda: len(l1.rpc.listchannels()['channels']) == 4)
+    wait_for(lambda: len(l1.rpc.listnodes()['nodes']) == 3)
+
+    res = l1.rpc.listchannels()
+    assert 'full' not in res
+    since = res['next_since']
+    nsince = l1.rpc.listnodes()['next_since']
+
+    res = l1.rpc.listchannels(since=since)
+    assert res['channels'] == []
+    assert res['removed_channels'] == []
+    assert res['full'] is False
+    assert res['next_since'] == since
+
+    # Something too old to remember gets everything.
+    res = l1.rpc.listchannels(since=0)
+    assert res['full'] is True
+    assert len(res['channels']) == 4
+
+    scid23 = l2.get_channel_scid(l3)
+    txid = l2.rpc.close(l3.info['id'])['txid']
+    wait_for(lambda: only_one(l2.rpc.listpeers(l3.info['id'])['peers'])['channels'][0]['state'] == 'CLOSINGD_COMPLETE')
+    bitcoind.generate_block(1, txid)
+
+    wait_for(lambda: l1.rpc.listchannels(since=since)['removed_channels'] == [scid23])
+    res = l1.rpc.listnodes(since=nsince)
+    assert res['full'] is False
+    assert res['removed_nodes'] == [l3.info['id']]
+
+
 def test_gossip_store_local_channels(node_factory, bitcoind):
     l1, l2 = node_factory.line_graph(2, wait_for_announce=False)
 
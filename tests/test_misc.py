@@ -618,6 +618,85 @@ def test_multiplexed_rpc(node_factory):
     sock.close()
 
 
+def test_batch_rpc(node_factory):
+    """Test that a JSON-RPC batch gets one array of responses"""
+    l1 = node_factory.get_node()
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(l1.rpc.socket_path)
+
+    sock.sendall(b'['
+                 b'{"id":1,"jsonrpc":"2.0","method":"invoice","params":[100, "batch", "batch"]},'
+                 b'{"id":2,"jsonrpc":"2.0","method":"listinvoices","params":["batch"]},'
+                 b'{"id":3,"jsonrpc":"2.0","method":"unknown","params":[]},'
+                 b'4'
+                 b']')
+    obj, _ = l1.rpc._readobj(sock, b'')
+    sock.close()
+
+    # They can come back in any order.
+    assert len(obj) == 4
+    replies = {r['id']: r for r in obj}
+    assert replies[1]['result']['bolt11'].startswith('lnbcrt')
+    assert replies[2]['result']['invoices'][0]['label'] == 'batch'
+    assert replies[3]['error']['code'] == -32601
+    assert replies[None]['error']['code'] == -32600
+
+    # lightning-cli prints them in order, and fails if any did.
+    cli = subprocess.run(['cli/lightning-cli',
+                          '--lightning-dir={}'.format(l1.daemon.lightning_dir),
+                          '--batch'],
+                         input=b'getinfo\n'
+                               b'listinvoices batch\n'
+                               b'delinvoice label=batch status=unpaid\n'
+                               b'listinvoices batch\n',
+                         stdout=subprocess.PIPE)
+    assert cli.returncode == 0
+    out = cli.stdout.decode('utf-8')
+    objs = []
+    while out.strip():
+        j, end = json.JSONDecoder().raw_decode(out.strip())
+        objs.append(j)
+        out = out.strip()[end:]
+    assert objs[0]['id'] == l1.info['id']
+    assert objs[1]['invoices'][0]['label'] == 'batch'
+    assert objs[2]['label'] == 'batch'
+    assert objs[3]['invoices'] == []
+
+    cli = subprocess.run(['cli/lightning-cli',
+                          '--lightning-dir={}'.format(l1.daemon.lightning_dir),
+                          '--batch'],
+                         input=b'getinfo\nunknown\n',
+                         stdout=subprocess.PIPE)
+    assert cli.returncode == 1
+
+
+def test_getrpcstats(node_factory):
+    """Test that JSON-RPC commands are counted, with their errors"""
+    l1 = node_factory.get_node()
+
+    l1.rpc.getinfo()
+    l1.rpc.getinfo()
+    with pytest.raises(RpcError):
+        l1.rpc.listinvoices(label=[])
+
+    stats = l1.rpc.getrpcstats('getinfo')['commands']
+    assert len(stats) == 1
+    assert stats[0]['command'] == 'getinfo'
+    assert stats[0]['category'] == 'utility'
+    assert stats[0]['calls'] == 2
+    assert stats[0]['in_flight'] == 0
+    assert stats[0]['errors'] == 0
+    assert sum(b['count'] for b in stats[0]['latency']) == 2
+
+    stats = {c['command']: c for c in l1.rpc.getrpcstats()['commands']}
+    assert stats['listinvoices']['errors'] == 1
+    # We're answering it now.
+    assert stats['getrpcstats']['in_flight'] == 1
+    assert 'unknown' not in stats
+    assert l1.rpc.getrpcstats('unknown')['commands'] == []
+
+
 def test_malformed_rpc(node_factory):
     """Test that we get a correct response to malformed RPC commands"""
     l1 = node_factory.get_node()
@@ -206,6 +206,17 @@ def test_plugin_connect_notifications(node_factory):
     l1.daemon.wait_for_log(r'Received disconnect event')
     l2.daemon.wait_for_log(r'Received disconnect event')
 
+    # They're counted.
+    plugins = l1.rpc.plugin_list()['plugins']
+    p = [p for p in plugins if p['name'].endswith('helloworld.py')][0]
+    assert p['notifications_sent'] == 2
+    assert p['queued'] == 0
+
+    # And so is how long it took to start.
+    assert p['startup']['spawn_usec'] > 0
+    assert p['startup']['manifest_usec'] > 0
+    assert p['startup']['init_usec'] > 0
+
 
 def test_failing_plugins(directory):
     fail_plugins = [
@@ -315,6 +326,48 @@ def test_db_hook(node_factory, executor):
     assert [x for x in db1.iterdump()] == [x for x in db2.iterdump()]
 
 
+def test_db_hook_pipelined(node_factory):
+    """The db hook, when we don't wait for each write to be acknowledged."""
+    dbfile = os.path.join(node_factory.directory, "dblog.sqlite3")
+    l1, l2 = node_factory.line_graph(2, opts=[
+        {'plugin': os.path.join(os.getcwd(), 'tests/plugins/dblog.py'),
+         'dblog-file': dbfile,
+         'db-write-pipeline': 4},
+        {}])
+
+    # Plenty of commits, each of which the plugin must have before l2
+    # hears about it.
+    l1.pay(l2, 100000)
+    l1.stop()
+
+    # All the writes got there, in order.
+    db1 = sqlite3.connect(os.path.join(l1.daemon.lightning_dir, 'lightningd.sqlite3'))
+    db2 = sqlite3.connect(dbfile)
+
+    assert [x for x in db1.iterdump()] == [x for x in db2.iterdump()]
+
+
+def test_db_hook_pipelined_withdraw(node_factory, bitcoind):
+    """withdraw's transaction is only broadcast once a slow db_write
+    plugin has caught up, long after the command's tmpctx is gone."""
+    dbfile = os.path.join(node_factory.directory, "dblog.sqlite3")
+    l1 = node_factory.get_node(options={
+        'plugin': os.path.join(os.getcwd(), 'tests/plugins/dblog.py'),
+        'dblog-file': dbfile,
+        'dblog-delay': 0.5,
+        'db-write-pipeline': 4})
+
+    addr = l1.rpc.newaddr()['bech32']
+    bitcoind.rpc.sendtoaddress(addr, 0.1)
+    bitcoind.generate_block(1)
+    wait_for(lambda: len(l1.rpc.listfunds()['outputs']) == 1)
+
+    waddr = bitcoind.rpc.getnewaddress()
+    out = l1.rpc.withdraw(waddr, 1000000)
+    assert out['txid'] in bitcoind.rpc.getrawmempool()
+    assert bitcoind.rpc.getrawtransaction(out['txid']) == out['tx']
+
+
 def test_utf8_passthrough(node_factory, executor):
     l1 = node_factory.get_node(options={'plugin': os.path.join(os.getcwd(), 'tests/plugins/utf8.py'),
                                         'log-level': 'io'})
@@ -448,6 +501,40 @@ def test_htlc_accepted_hook_fail(node_factory):
     assert len(inv) == 1 and inv[0]['status'] == 'unpaid'
 
 
+def test_htlc_accepted_hook_chain(node_factory):
+    """l2 has two deciders and an observer on the htlc_accepted hook.
+
+    The first decider lets the HTLC through, so the second one fails it,
+    while the observer just sees it.
+    """
+    plugins = [os.path.join(os.getcwd(), 'tests/plugins', p)
+               for p in ['continue_htlcs.py', 'fail_htlcs.py', 'observe_htlcs.py']]
+    l1, l2 = node_factory.line_graph(2, opts=[{}, {'plugin': plugins}])
+
+    inv = l2.rpc.invoice(1000, "lbl", "desc")
+    with pytest.raises(RpcError) as excinfo:
+        l1.rpc.pay(inv['bolt11'])
+    assert excinfo.value.error['data']['failcode'] == 16399
+
+    l2.daemon.wait_for_logs([r'Letting htlc through',
+                             r'Failing htlc on purpose',
+                             r'Observed htlc {}'.format(inv['payment_hash'])])
+    l2.daemon.wait_for_log(r'htlc_accepted hook took [0-9]* usec')
+
+    def hook_latency(name):
+        return only_one([p for p in l2.rpc.plugin_list()['plugins']
+                         if p['name'].endswith(name)])['hook_latency']
+
+    # Each of them answered once, and we know how long it took.  The
+    # observer may only answer after the HTLC has failed.
+    for name in ['continue_htlcs.py', 'fail_htlcs.py', 'observe_htlcs.py']:
+        wait_for(lambda: hook_latency(name) != [])
+        lat = only_one(hook_latency(name))
+        assert lat['hook'] == 'htlc_accepted'
+        assert lat['calls'] == 1
+        assert lat['max_usec'] == lat['total_usec']
+
+
 @unittest.skipIf(not DEVELOPER, "without DEVELOPER=1, gossip v slow")
 def test_htlc_accepted_hook_resolve(node_factory):
     """l3 creates an invoice, l2 knows the preimage and will shortcircuit.
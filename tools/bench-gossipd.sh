@@ -1,13 +1,17 @@
 #! /bin/sh
-# Needs bitcoind -regtest running.
+# Needs bitcoind -regtest running.  For a quicker in-process benchmark
+# which doesn't, see `make bench-gossip`.
 
 set -e
 
 DIR=""
 TARGETS=""
-DEFAULT_TARGETS=" store_load_msec vsz_kb store_rewrite_sec listnodes_sec listchannels_sec routing_sec peer_write_all_sec peer_read_all_sec "
+DEFAULT_TARGETS=" store_load_msec vsz_kb store_rewrite_sec listnodes_sec listchannels_sec routing_sec routing_settled peer_write_all_sec peer_read_all_sec "
 MCP_DIR=../million-channels-project/data/1M/gossip/
 CSV=false
+LANDMARKS=0
+# Random routes to average routing_settled over.
+ROUTES=100
 
 wait_for_start()
 {
@@ -50,8 +54,11 @@ for arg; do
 	--csv)
 	    CSV=true
 	    ;;
+	--landmarks=*)
+	    LANDMARKS="${arg#*=}"
+	    ;;
 	--help)
-	    echo "Usage: tools/bench-gossipd.sh [--dir=<directory>] [--mcp-dir=<directory>] [--csv] [TARGETS]"
+	    echo "Usage: tools/bench-gossipd.sh [--dir=<directory>] [--mcp-dir=<directory>] [--csv] [--landmarks=<num>] [TARGETS]"
 	    echo "Default targets:$DEFAULT_TARGETS"
 	    exit 0
 	    ;;
@@ -81,10 +88,10 @@ fi
 DEVELOPER=$(grep '^DEVELOPER=' config.vars | cut -d= -f2-)
 
 if [ "$DEVELOPER" = 1 ]; then
-    LIGHTNINGD="./lightningd/lightningd --network=regtest --dev-gossip-time=1550513768"
+    LIGHTNINGD="./lightningd/lightningd --network=regtest --dev-gossip-time=1550513768 --getroute-landmarks=$LANDMARKS"
 else
     # Means we can't do the peer_read_all test properly, since it will time out.
-    LIGHTNINGD="./lightningd/lightningd --network=regtest"
+    LIGHTNINGD="./lightningd/lightningd --network=regtest --getroute-landmarks=$LANDMARKS"
 fi
 LCLI1="./cli/lightning-cli --lightning-dir=$DIR -R"
 
@@ -148,6 +155,25 @@ if [ -z "${TARGETS##* routing_sec *}" ]; then
     done
 fi
 
+# How many nodes does each route search look at?
+if [ -z "${TARGETS##* routing_settled *}" ]; then
+    [ -f "$DIR"/listnodes.json ] || $LCLI1 listnodes > "$DIR"/listnodes.json
+    tr '{}' '\n' < "$DIR"/listnodes.json | grep nodeid | cut -d'"' -f4 > "$DIR"/nodeids
+    if [ "$LANDMARKS" != 0 ]; then
+	# The first query starts them computing in the background.
+	$LCLI1 getroute "$(head -n1 "$DIR"/nodeids)" 10000 1 > /dev/null 2>&1 || true
+	while [ "$($LCLI1 -H getroutestats | grep '^landmarks=' | cut -d= -f2)" = 0 ]; do sleep 1; done
+    fi
+    BEFORE=$($LCLI1 -H getroutestats | grep '^nodes_settled=' | cut -d= -f2)
+    # Same "random" pairs every time, so runs are comparable.
+    shuf -n $((ROUTES * 2)) --random-source="$DIR"/nodeids "$DIR"/nodeids | paste - - | while read -r from to; do
+	# shellcheck disable=SC2086
+	$LCLI1 getroute $from 10000 1 6 $to > /dev/null 2>&1 || true
+    done
+    AFTER=$($LCLI1 -H getroutestats | grep '^nodes_settled=' | cut -d= -f2)
+    echo $(( (AFTER - BEFORE) / ROUTES )) | print_stat routing_settled
+fi
+
 # Try getting all from the peer.
 if [ -z "${TARGETS##* peer_write_all_sec *}" ]; then
     ENTRIES=$(grep 'Read .* cannounce/cupdate/nannounce/cdelete' "$DIR"/log | cut -d\  -f5 | tr / + | bc)